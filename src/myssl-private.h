@@ -38,17 +38,242 @@
  *      0.1.0 (August 2019)
  */
 
+#include <stdint.h>
+#include <poll.h>
+
 // nomi file certificati
 #define RSA_SERVER_CERT     "client.pem"
 #define RSA_SERVER_KEY      "key.pem"
 #define RSA_CLIENT_CA_CERT  "ca.pem"
 
-// timeout e iterazioni per funzioni interne OpenSSL: sslRead()/sslwrite()/sslFunc
-#define SSL_RWTOUT  100000  // timeout per funzioni interne (e.g.: 100000 us = 100 ms)
-#define SSL_RWITER  20      // numero di iterazioni in RWSSL_TOUT
-                            // (e.g.: tot.timeout = 100 ms * 20 = 2 sec
+// session ID context del server e dimensioni dello store delle sessioni client
+#define SSL_SESS_ID_CTX     "MySSL"
+#define SSL_SESS_BUCKETS    256     // numero di bucket della tabella hash dello store
+#define SSL_SESS_MAX        4096    // numero max di chiavi (contesto/host:porta) nello store (poi evizione LRU)
+#define SSL_SESS_TICKETS    4       // max ticket TLS 1.3 (monouso) tenuti per chiave
+
+// finestra anti-replay di default per gli early data (0-RTT): età max del ticket in secondi
+#define SSL_EARLY_WINDOW    10
+
+// chiavi dei ticket condivise: chiavi precedenti accettate (default) e intervallo di controllo del file in secondi
+#define SSL_TICKET_KEEP     2
+#define SSL_TICKET_KEYS_MAX 16      // numero max di chiavi nel file
+#define SSL_TICKET_CHECK    1
+
+// profili di handshake per sslCreateCtxEx()
+#define SSL_PROFILE_DEFAULT "default"           // versioni, gruppi e cifrari di default di OpenSSL
+#define SSL_PROFILE_FAST    "fast-handshake"    // solo TLS 1.3, X25519 per primo, firme ECDSA/Ed25519 preferite
+#define SSL_PROFILE_COMPAT  "compat"            // TLS 1.2 e 1.3, solo ECDHE (X25519 per primo), AEAD
+
+// attesa (in ms) dopo una modifica dei file certificati prima del reload (e.g.: certificato e chiave copiati insieme)
+#define SSL_RELOAD_DELAY    200
+
+// compatibilità OpenSSL 1.0.2 (SSL_CTX_up_ref()/SSL_SESSION_up_ref() disponibili solo da OpenSSL 1.1.0)
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+#define SSL_CTX_up_ref(ctx)      CRYPTO_add(&(ctx)->references, 1, CRYPTO_LOCK_SSL_CTX)
+#define SSL_SESSION_up_ref(sess) CRYPTO_add(&(sess)->references, 1, CRYPTO_LOCK_SSL_SESSION)
+#endif
+
+// backend io_uring del reactor: dimensione dei buffer di ricezione/trasmissione di una connessione (un record TLS
+// completo), connessioni di default e tipi di operazione (nei 3 bit bassi dello user_data, con la connessione)
+#define SSL_URING_BUFSIZE   16384
+#define SSL_URING_CONNS     1024
+#define SSL_URING_RX        1       // ricezione (buffer rx)
+#define SSL_URING_TX        2       // trasmissione (buffer tx)
+#define SSL_URING_POLL      3       // poll di un fd (socket di ascolto, async fd)
+#define SSL_URING_OPMASK    7
+
+// buffer di I/O di una connessione del backend io_uring (il BIO della connessione legge/scrive qui, il reactor
+// accoda le operazioni sul socket)
+typedef struct SslUringIo {
+    unsigned char *rx;      // buffer di ricezione (area registrata)
+    unsigned char *tx;      // buffer di trasmissione (area registrata)
+    int  slot;              // slot dei buffer (-1 = nessuno)
+    int  rx_len;            // byte ricevuti
+    int  rx_off;            // byte già letti dal BIO
+    int  tx_len;            // byte da trasmettere
+    int  tx_sent;           // byte della trasmissione in corso
+    int  tx_error;          // errno dell'ultima trasmissione fallita (0 = nessuno)
+    bool rx_busy;           // ricezione in corso
+    bool tx_busy;           // trasmissione in corso
+    bool rx_eof;            // EOF o errore in ricezione
+    bool tx_full;           // il BIO ha rifiutato una scrittura (buffer pieno)
+    void (*notify)(void *owner);    // avviso al reactor: buffer rx consumato o nuovi dati in tx
+    void *owner;            // argomento di notify (connessione del reactor)
+} SslUringIo;
+
+// anello io_uring (tipo opaco)
+typedef struct SslUring SslUring;
+
+// scritture scatter/gather (sslWritev()): max byte di un record TLS e byte in chiaro cifrati prima di un send()
+#define SSL_RECORD_MAX      16384
+#define SSL_WRITE_BATCH     262144
+
+// dimensionamento dei record (sslRecordSize()): byte in chiaro di un record piccolo (record cifrato in un segmento
+// TCP di MTU 1500 con le opzioni IP/TCP)
+#define SSL_RECORD_SMALL    1400
+
+// framing dei messaggi (sslFrameNew()): max byte di default di un payload, buffer di lettura iniziale (un record
+// e l'header di un frame), max byte di un frame scritto in un solo record (header compreso)
+#define SSL_FRAME_MAX       (1 << 20)
+#define SSL_FRAME_BUFSIZE   (SSL_RECORD_MAX + SSL_FRAME_HEADER)
+#define SSL_FRAME_STAGE     4096
+
+// invio di file (sslSendFile()): byte di un sendfile() con kTLS
+#define SSL_SENDFILE_CHUNK  1048576
+
+// forwarder: max connessioni di default e stack dei thread delle connessioni
+#define SSL_FORWARD_CONNS   256
+#define SSL_FORWARD_STACK   262144
+
+// pool dei buffer di OpenSSL (sslPoolInit()): blocchi di SSL_POOL_MIN..SSL_POOL_MAX byte in classi di SSL_POOL_CLASS
+// byte, max byte dei blocchi liberi tenuti nel pool
+#define SSL_POOL_MIN        2048
+#define SSL_POOL_MAX        32768
+#define SSL_POOL_CLASS      1024
+#define SSL_POOL_BYTES      (16 << 20)
+
+// arene di OpenSSL (sslArenaInit()): max byte di un blocco delle arene (oltre: malloc()), memoria allocata per
+// volta, differenza dei byte in uso di un'arena riportata nel totale
+#define SSL_ARENA_MAX       32768
+#define SSL_ARENA_CHUNK     (2 << 20)
+#define SSL_ARENA_FLUSH     65536
+
+// buffer grandi (SSL_WRITE_BATCH byte) liberi tenuti nel pool di sslBufferGet()
+#define SSL_BUFFER_POOL     16
+
+// server engine: intervallo di controllo della richiesta di stop dei worker (in ms) e buffer di lettura dei dati
+#define SSL_SERVER_TICK     100
+#define SSL_SERVER_BUFSIZE  16384
+
+// pool di connessioni client (sslClientPoolNew()): bucket della tabella delle destinazioni, max connessioni inattive
+// e totali di default per destinazione, intervallo del thread di manutenzione e timeout di default di connect +
+// handshake (in ms)
+#define SSL_CPOOL_BUCKETS   64
+#define SSL_CPOOL_IDLE      8
+#define SSL_CPOOL_TOTAL     64
+#define SSL_CPOOL_TICK      100
+#define SSL_CPOOL_TIMEOUT   2000
+
+// coda di scrittura delle connessioni del reactor (sslConnSend()): soglie alta/bassa e limite di default in byte,
+// max byte in chiaro di una scrittura diretta da un buffer della coda
+#define SSL_QUEUE_HIGH      262144
+#define SSL_QUEUE_LOW       65536
+#define SSL_QUEUE_LIMIT     1048576
+#define SSL_QUEUE_CHUNK     SSL_WRITE_BATCH
+
+// elemento della coda di scrittura: buffer condiviso e byte già scritti
+typedef struct SslQueueItem {
+    struct SslBuf       *buf;       // buffer (la coda tiene un riferimento)
+    size_t              off;        // byte già scritti o copiati nel buffer di staging
+    struct SslQueueItem *next;      // elemento successivo
+} SslQueueItem;
+
+// coda di scrittura di una connessione del reactor
+typedef struct {
+    SslQueueItem  *head;            // primo buffer da scrivere
+    SslQueueItem  *tail;            // ultimo buffer da scrivere
+    size_t        bytes;            // byte in coda (staging compreso)
+    SslQueueOpts  opts;             // soglie, limite e politica (sslConnQueueSet())
+    bool          above;            // sopra la soglia alta (SSL_EV_QUEUE_HIGH notificato)
+    int64_t       above_since;      // istante del passaggio sopra la soglia alta in ns
+    bool          failed;           // scrittura fallita: la coda non accetta più buffer
+    int           step;             // risultato dell'ultimo svuotamento (SSL_STEP_WANT_READ: riprende in lettura)
+    const void    *wptr;            // scrittura in corso (ripetuta con gli stessi argomenti)
+    int           wlen;             // byte della scrittura in corso (0 = nessuna)
+    bool          wdirect;          // scrittura in corso dal primo buffer (altrimenti dal buffer di staging)
+    unsigned char *stage;           // staging dei buffer piccoli impacchettati in un record
+} SslQueue;
+
+// socket TCP (sslListen()): secondi di attesa del ClientHello con TCP_DEFER_ACCEPT, coda delle connessioni TCP Fast
+// Open in attesa di accept()
+#define SSL_SOCK_DEFER_SECS 5
+#define SSL_SOCK_TFO_QLEN   256
+
+// chiusura asincrona (sslCloseEx() con SSL_CLOSE_ASYNC): max connessioni in chiusura nel thread reaper
+#define SSL_REAPER_MAX      4096
+
+// dati privati di connessione (associati alla struttura SSL con SSL_set_ex_data())
+typedef struct {
+    char    *sess_key;      // chiave della sessione client (contesto/host:port)
+    int     timeout;        // timeout delle operazioni in ms (sslSetTimeout())
+    bool    timeout_set;    // timeout impostato (altrimenti il timeout del contesto, SslCtxData.io_timeout)
+    int     status;         // stato dell'ultima operazione (sslStatus())
+    bool    nonblock;       // socket già in modo non bloccante (sslDeadline())
+    size_t  rec_sent;       // byte scritti dall'inizio o dalla ripresa dopo un'inattività (sslRecordSent())
+    int64_t rec_last;       // istante della fine dell'ultima scrittura in ns (0 = nessuna)
+    struct SslPoolDest *pool_dest;  // destinazione del pool di connessioni client (sslClientPoolGet())
+} SslConnData;
+
+// dati privati di contesto (associati alla struttura SSL_CTX con SSL_CTX_set_ex_data())
+typedef struct {
+    struct SslTicketKeys *tkeys;    // chiavi dei ticket condivise
+    int                  rec_boost; // byte iniziali scritti in record piccoli (0 = record sempre pieni)
+    int                  rec_idle;  // inattività in ms dopo la quale si torna ai record piccoli (0 = mai)
+    unsigned long        sess_ctx;  // identità del contesto client nello store delle sessioni (0 = nessuna)
+    int                  io_timeout;    // timeout delle operazioni delle connessioni in ms (0 = SSL_TIMEOUT_DEFAULT)
+} SslCtxData;
 
 // prototipi globali
-bool sslRecovery(SSL *ssl, int sslresult);
+bool         sslRecovery(SSL *ssl, int sslresult, int64_t deadline);
+bool         sslStepWait(SSL *ssl, int step, int64_t deadline);
+int          sslStepResult(SSL *ssl, int sslresult);
+size_t       sslRecordSize(SSL *ssl, size_t num);
+void         sslRecordSent(SSL *ssl, size_t sent);
+bool         sslLibInit(void);
+int          sslLibInitEx(const SslInitOpts *opts);
+void         sslLibCleanup(void);
+void         sslLockInit(void);
+void         sslLockCleanup(void);
+void         sslQueueInit(SslQueue *queue, const SslQueueOpts *opts);
+bool         sslQueuePush(SslQueue *queue, SslBuf *buf);
+int          sslQueueFlush(SslQueue *queue, SSL *ssl);
+void         sslQueueClear(SslQueue *queue);
+void         sslPoolInit(void);
+bool         sslArenaInit(bool huge_pages);
+void         sslArenaConn(int delta);
+SslConnData* sslConnData(SSL *ssl);
+SslCtxData*  sslCtxData(SSL_CTX *ctx);
+SslCtxData*  sslCtxDataFind(SSL_CTX *ctx);
+bool         sslAsyncKeysInit(SSL_CTX *ctx, const SslCtxOpts *opts);
+int          sslAsyncWait(SSL *ssl, int64_t deadline);
+void         sslAsyncCleanup(void);
+void         sslReaperCleanup(void);
+void         sslStatusSet(SSL *ssl, int status);
+int64_t      sslDeadline(SSL *ssl, int timeout);
+int          sslPoll(struct pollfd *fds, int nfds, int64_t deadline);
+int64_t      sslClockNs(void);
+void*        sslBufferGet(void);
+void         sslBufferPut(void *buffer);
+bool         sslTicketKeysInit(SSL_CTX *ctx, const SslCtxOpts *opts);
+void         sslTicketKeysFree(struct SslTicketKeys *tkeys);
+void         sslTicketCleanup(void);
+int          sslSessionNew(SSL *ssl, SSL_SESSION *sess);
+bool         sslSessionCtxInit(SSL_CTX *ctx);
+bool         sslSessionAttach(SSL *ssl, const char *host, int port);
+void         sslSessionCtxFree(unsigned long sess_ctx);
+int          sslEarlyDataAllow(SSL *ssl, void *arg);
+SSL_CTX*     sslCtxLookup(int type, const SslCtxOpts *opts);
+SSL_CTX*     sslCtxRegister(int type, const SslCtxOpts *opts, SSL_CTX *ctx);
+void         sslCtxReplace(int type, const SslCtxOpts *opts, SSL_CTX *ctx);
+void         sslWatchCleanup(void);
+void         sslCtxOptsDefaults(SslCtxOpts *dst, const SslCtxOpts *src);
+bool         sslCtxOptsCopy(SslCtxOpts *dst, const SslCtxOpts *src);
+void         sslCtxOptsFree(SslCtxOpts *opts);
+bool         sslCtxOptsEqual(const SslCtxOpts *opts1, const SslCtxOpts *opts2);
+SSL_CTX*     sslCtxBuild(int type, const SslCtxOpts *opts, int *error);
+SslUring*    sslUringNew(int nslots);
+void         sslUringFree(SslUring *ring);
+bool         sslUringSlotGet(SslUring *ring, SslUringIo *io);
+void         sslUringSlotPut(SslUring *ring, SslUringIo *io);
+BIO*         sslUringBio(SslUringIo *io);
+bool         sslUringRecv(SslUring *ring, int fd, SslUringIo *io, void *owner);
+bool         sslUringSend(SslUring *ring, int fd, SslUringIo *io, void *owner);
+bool         sslUringPoll(SslUring *ring, int fd, void *owner);
+bool         sslUringCancel(SslUring *ring, void *owner, int op);
+int          sslUringWait(SslUring *ring, int64_t deadline);
+bool         sslUringReap(SslUring *ring, void **owner, int *op, int *res);
+void         sslUringDone(SslUringIo *io, int op, int res);
+unsigned long sslUringSyscalls(SslUring *ring);
 
 #endif /* MYSSL_PRIVATE_H */
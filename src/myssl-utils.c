@@ -19,10 +19,22 @@
  *      MySSL library
  *  FUNCTIONS
  *      global:
- *          bool sslRecovery(SSL *ssl, int sslresult);
+ *          bool sslRecovery(SSL *ssl, int sslresult, int64_t deadline);
+ *          bool sslStepWait(SSL *ssl, int step, int64_t deadline);
+ *          void sslLibInit(void);
+ *          int  sslLibInitEx(const SslInitOpts *opts);
+ *          void sslLibCleanup(void);
+ *          SslConnData* sslConnData(SSL *ssl);
+ *          SslCtxData*  sslCtxData(SSL_CTX *ctx);
+ *          SslCtxData*  sslCtxDataFind(SSL_CTX *ctx);
+ *          void* sslBufferGet(void);
+ *          void sslBufferPut(void *buffer);
  *      local:
- *          int sslSelectRd(SSL *ssl);
- *          int sslSelectWr(SSL *ssl);
+ *          int sslWaitFd(int fd, short events, int64_t deadline);
+ *          void libInitOnce(void);
+ *          void connDataNew(void *parent, void *ptr, CRYPTO_EX_DATA *ad, int idx, long argl, void *argp);
+ *          void connDataFree(void *parent, void *ptr, CRYPTO_EX_DATA *ad, int idx, long argl, void *argp);
+ *          void ctxDataFree(void *parent, void *ptr, CRYPTO_EX_DATA *ad, int idx, long argl, void *argp);
  *  DESCRIPTION
  *      The MySSL library is a simple interface to OpenSSL library to permits user-friendly writing of Servers and
  *      Clients using OpenSSL.
@@ -43,10 +55,32 @@
 
 #include "myssl.h"
 #include "myssl-private.h"
+#include <stdlib.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
 
 // local prototypes
-static int sslSelectRd(SSL *ssl);
-static int sslSelectWr(SSL *ssl);
+static int  sslWaitFd(int fd, short events, int64_t deadline);
+static void libInitOnce(void);
+static void connDataNew(void *parent, void *ptr, CRYPTO_EX_DATA *ad, int idx, long argl, void *argp);
+static void connDataFree(void *parent, void *ptr, CRYPTO_EX_DATA *ad, int idx, long argl, void *argp);
+static void ctxDataFree(void *parent, void *ptr, CRYPTO_EX_DATA *ad, int idx, long argl, void *argp);
+
+// local data
+static pthread_once_t lib_init_once = PTHREAD_ONCE_INIT;    // one-time initialization control
+static pthread_mutex_t lib_init_mutex = PTHREAD_MUTEX_INITIALIZER;  // initialization options lock
+static SslInitOpts    lib_init_opts;        // initialization options (sslLibInitEx(), default: all zero)
+static bool           lib_init_done;        // initialization started (options no more changeable)
+static bool           lib_init_alloc;       // allocator of the options installed
+static atomic_bool    lib_cleanup_done;     // teardown executed (sslLibCleanup())
+static int            conn_index    = -1;                   // ex_data index of the connection private data
+static int            ctx_index     = -1;                   // ex_data index of the context private data
+
+// local data: pool of the free large buffers (sslBufferGet())
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static void            *pool_buffers[SSL_BUFFER_POOL];
+static int             pool_count = 0;     // number of free buffers
 
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -59,47 +93,348 @@ static int sslSelectWr(SSL *ssl);
  *      sslRecovery - execute recovery on a failed ssl operation
  *  SYNOPSIS
  *      bool sslRecovery(
- *          SSL *ssl,               // OpenSSL SSL structure
- *          int sslresult);         // ssl result to recover
+ *          SSL     *ssl,           // OpenSSL SSL structure
+ *          int     sslresult,      // ssl result to recover
+ *          int64_t deadline);      // deadline of the operation in ns (see sslDeadline(), -1 = no deadline)
  *  DESCRIPTION
- *      sslRecovery() execute a recovery action on a failed ssl operation.
+ *      sslRecovery() execute a recovery action on a failed ssl operation: if the operation must be repeated when the
+ *      socket is readable/writable (or when an async operation is done) it waits the event until the deadline. When
+ *      the operation can't be repeated the connection status (see sslStatus()) is set to the failure reason.
  *  RETURN VALUE
- *      Upon successful completion, sslRecovery() shall return true.
+ *      sslRecovery() shall return true if the operation must be repeated.
  *      Otherwise, false shall be returned.
  */
 
 bool sslRecovery(
-    SSL *ssl,                       // OpenSSL SSL structure
-    int sslresult)                  // ssl result to recover
+    SSL     *ssl,                   // OpenSSL SSL structure
+    int     sslresult,              // ssl result to recover
+    int64_t deadline)               // deadline of the operation in ns (see sslDeadline(), -1 = no deadline)
 {
-    bool result = false;    // default result
+    // get the event to wait (or the failure) and wait it
+    return sslStepWait(ssl, sslStepResult(ssl, sslresult), deadline);
+}
 
-    // test ssl error
-    switch (SSL_get_error(ssl, sslresult)) {
-    case SSL_ERROR_WANT_READ:
-        // no data available right now: wait (using select()) a few seconds in case new data arrives
-        if (sslSelectRd(ssl) > 0)
-            result = true;  // more data to read
 
-        break;
+/*!
+ *  NAME
+ *      sslStepWait - wait the event required by a step
+ *  SYNOPSIS
+ *      bool sslStepWait(
+ *          SSL     *ssl,           // OpenSSL SSL structure
+ *          int     step,           // step result (see sslReadStep())
+ *          int64_t deadline);      // deadline of the operation in ns (see sslDeadline(), -1 = no deadline)
+ *  DESCRIPTION
+ *      sslStepWait() waits (until the deadline) the event required by a step: the socket readable/writable or an async
+ *      operation done. If the deadline elapses the connection status (see sslStatus()) is set to SSL_STATUS_TIMEOUT.
+ *  RETURN VALUE
+ *      sslStepWait() shall return true if the step must be repeated (the event arrived).
+ *      Otherwise (the step is not a wait, deadline elapsed or error), false shall be returned.
+ */
 
-    case SSL_ERROR_WANT_WRITE:
-        // socket not writable right now: wait (using select()) a few seconds and try again
-        if (sslSelectWr(ssl) > 0)
-            result = true;  // can write more data now
+bool sslStepWait(
+    SSL     *ssl,                   // OpenSSL SSL structure
+    int     step,                   // step result (see sslReadStep())
+    int64_t deadline)               // deadline of the operation in ns (see sslDeadline(), -1 = no deadline)
+{
+    int wait;   // result of the wait (> 0 = event, 0 = deadline elapsed, -1 = error)
 
+    // wait the event
+    switch (step) {
+    case SSL_STEP_WANT_READ:
+        // no data available right now: wait (using poll()) until new data arrives or the deadline
+        wait = sslWaitFd(SSL_get_rfd(ssl), POLLIN, deadline);
         break;
 
-    case SSL_ERROR_ZERO_RETURN:
-        // error: peer disconnected
+    case SSL_STEP_WANT_WRITE:
+        // socket not writable right now: wait (using poll()) until it's writable or the deadline
+        wait = sslWaitFd(SSL_get_wfd(ssl), POLLOUT, deadline);
         break;
 
-    default:
+    case SSL_STEP_WANT_ASYNC:
+        // private-key operation in progress in the crypto thread pool: wait until it's done and resume the job
+        wait = sslAsyncWait(ssl, deadline);
         break;
+
+    default:
+        // no event to wait: the status is already set
+        return false;
+    }
+
+    // event arrived: repeat the step, else set the connection status
+    if (wait > 0)
+        return true;
+
+    sslStatusSet(ssl, wait == 0 ? SSL_STATUS_TIMEOUT : SSL_STATUS_FATAL);
+    return false;
+}
+
+
+/*!
+ *  NAME
+ *      sslLibInit - one-time initialization of the OpenSSL library
+ *  SYNOPSIS
+ *      bool sslLibInit(void);
+ *  DESCRIPTION
+ *      sslLibInit() loads the OpenSSL algorithms and error strings. The initialization is executed only on the first call
+ *      (also when called concurrently by many threads): the following calls return immediately. After the teardown
+ *      (see sslLibCleanup()) the initialization is not executed again and sslLibInit() fails: the library can't be
+ *      used anymore.
+ *  RETURN VALUE
+ *      sslLibInit() shall return true if the library is initialized. Otherwise (after the teardown), false shall be
+ *      returned and errno set to ECANCELED.
+ */
+
+bool sslLibInit(void)
+{
+    // the library can't be used after the teardown
+    if (atomic_load_explicit(&lib_cleanup_done, memory_order_relaxed)) {
+        errno = ECANCELED;
+        return false;
+    }
+
+    // execute the initialization only once
+    pthread_once(&lib_init_once, libInitOnce);
+    return true;
+}
+
+
+/*!
+ *  NAME
+ *      sslLibInitEx - one-time initialization of the OpenSSL library with options
+ *  SYNOPSIS
+ *      int sslLibInitEx(
+ *          const SslInitOpts *opts);   // initialization options
+ *  DESCRIPTION
+ *      sslLibInitEx() is sslLibInit() with the initialization options (see sslInit()): the options are used only if
+ *      the initialization is not yet executed.
+ *  RETURN VALUE
+ *      Upon successful completion, sslLibInitEx() shall return 0.
+ *      Otherwise, -1 shall be returned: library already initialized, allocator not installed or teardown executed
+ *      (errno set to ECANCELED).
+ */
+
+int sslLibInitEx(
+    const SslInitOpts *opts)        // initialization options
+{
+    // the library can't be used after the teardown
+    if (atomic_load(&lib_cleanup_done)) {
+        errno = ECANCELED;
+        return -1;
+    }
+
+    // set the options (only before the initialization)
+    pthread_mutex_lock(&lib_init_mutex);
+    bool first = ! lib_init_done;
+    if (first)
+        lib_init_opts = *opts;
+
+    pthread_mutex_unlock(&lib_init_mutex);
+    if (! first)
+        return -1;
+
+    // execute the initialization
+    pthread_once(&lib_init_once, libInitOnce);
+    return lib_init_alloc ? 0 : -1;
+}
+
+
+/*!
+ *  NAME
+ *      sslLibCleanup - teardown of the OpenSSL library
+ *  SYNOPSIS
+ *      void sslLibCleanup(void);
+ *  DESCRIPTION
+ *      sslLibCleanup() frees the global resources of the library initialization: the locking callbacks of OpenSSL
+ *      1.0.2 (see sslLockInit()) with the global tables of OpenSSL 1.0.2, and the pool of the large buffers (see
+ *      sslBufferGet()). The teardown is executed only on the first call (also when called concurrently by many
+ *      threads), and never if the library was not initialized. After it the library can't be initialized again (see
+ *      sslLibInit()). OpenSSL 1.1.0 and above frees its global tables by
+ *      itself at the exit of the process (OPENSSL_cleanup() is not called: OpenSSL could not be initialized again).
+ *  RETURN VALUE
+ *      None.
+ */
+
+void sslLibCleanup(void)
+{
+    // execute the teardown only once (and only after the initialization): the library can't be initialized again
+    pthread_mutex_lock(&lib_init_mutex);
+    bool first = lib_init_done && ! atomic_load(&lib_cleanup_done);
+    atomic_store(&lib_cleanup_done, true);
+    pthread_mutex_unlock(&lib_init_mutex);
+    if (! first)
+        return;
+
+    // wait for an initialization in progress
+    pthread_once(&lib_init_once, libInitOnce);
+
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+    // free the global tables of OpenSSL 1.0.2 (error strings, algorithms, ex_data, error queue of this thread)
+    ERR_remove_thread_state(NULL);
+    ERR_free_strings();
+    EVP_cleanup();
+    CRYPTO_cleanup_all_ex_data();
+#endif
+
+    // remove the locking callbacks
+    sslLockCleanup();
+
+    // free the pool of the large buffers
+    pthread_mutex_lock(&pool_mutex);
+    while (pool_count > 0)
+        free(pool_buffers[--pool_count]);
+
+    pthread_mutex_unlock(&pool_mutex);
+}
+
+
+/*!
+ *  NAME
+ *      sslConnData - get the private data of a connection
+ *  SYNOPSIS
+ *      SslConnData* sslConnData(
+ *          SSL *ssl);              // OpenSSL SSL structure
+ *  DESCRIPTION
+ *      sslConnData() get the MySSL private data associated to a SSL structure. The data are allocated (zeroed) on the
+ *      first call and are automatically freed by SSL_free().
+ *  RETURN VALUE
+ *      Upon successful completion, sslConnData() shall return the private data of the connection.
+ *      Otherwise (allocation error), NULL shall be returned.
+ */
+
+SslConnData* sslConnData(
+    SSL *ssl)                       // OpenSSL SSL structure
+{
+    // get the private data
+    SslConnData *conn;
+    if ((conn = SSL_get_ex_data(ssl, conn_index)) != NULL)
+        return conn;
+
+    // first call: allocate and associate the private data
+    if ((conn = calloc(1, sizeof(SslConnData))) == NULL)
+        return NULL;
+
+    if (SSL_set_ex_data(ssl, conn_index, conn) != 1) {
+        // error: free the private data
+        free(conn);
+        return NULL;
+    }
+
+    // return the new private data
+    return conn;
+}
+
+
+/*!
+ *  NAME
+ *      sslCtxData - get the private data of a context
+ *  SYNOPSIS
+ *      SslCtxData* sslCtxData(
+ *          SSL_CTX *ctx);          // OpenSSL context
+ *  DESCRIPTION
+ *      sslCtxData() get the MySSL private data associated to a SSL_CTX structure. The data are allocated (zeroed) on the
+ *      first call and are automatically freed by SSL_CTX_free().
+ *  RETURN VALUE
+ *      Upon successful completion, sslCtxData() shall return the private data of the context.
+ *      Otherwise (allocation error), NULL shall be returned.
+ */
+
+SslCtxData* sslCtxData(
+    SSL_CTX *ctx)                   // OpenSSL context
+{
+    // get the private data
+    SslCtxData *ctxdata;
+    if ((ctxdata = SSL_CTX_get_ex_data(ctx, ctx_index)) != NULL)
+        return ctxdata;
+
+    // first call: allocate and associate the private data
+    if ((ctxdata = calloc(1, sizeof(SslCtxData))) == NULL)
+        return NULL;
+
+    if (SSL_CTX_set_ex_data(ctx, ctx_index, ctxdata) != 1) {
+        // error: free the private data
+        free(ctxdata);
+        return NULL;
     }
 
-    // return result of the recovery action
-    return result;
+    // return the new private data
+    return ctxdata;
+}
+
+
+/*!
+ *  NAME
+ *      sslCtxDataFind - find the private data of a context
+ *  SYNOPSIS
+ *      SslCtxData* sslCtxDataFind(
+ *          SSL_CTX *ctx);          // OpenSSL context
+ *  DESCRIPTION
+ *      sslCtxDataFind() get the MySSL private data of the context without allocating it (e.g.: in the data path of
+ *      the connections, where the contexts without private data must not be modified).
+ *  RETURN VALUE
+ *      sslCtxDataFind() shall return the private data, NULL if not allocated.
+ */
+
+SslCtxData* sslCtxDataFind(
+    SSL_CTX *ctx)                   // OpenSSL context
+{
+    return ctx_index < 0 ? NULL : SSL_CTX_get_ex_data(ctx, ctx_index);
+}
+
+
+/*!
+ *  NAME
+ *      sslBufferGet - get a large buffer
+ *  SYNOPSIS
+ *      void* sslBufferGet(void);
+ *  DESCRIPTION
+ *      sslBufferGet() gets a free buffer of SSL_WRITE_BATCH bytes from the pool shared by the threads, or allocates
+ *      a new buffer if the pool is empty (the bulk transfers don't allocate a large buffer for each operation).
+ *  RETURN VALUE
+ *      sslBufferGet() shall return the buffer (to release with sslBufferPut()), NULL on allocation error.
+ */
+
+void* sslBufferGet(void)
+{
+    void *buffer = NULL;
+
+    pthread_mutex_lock(&pool_mutex);
+    if (pool_count > 0)
+        buffer = pool_buffers[--pool_count];
+
+    pthread_mutex_unlock(&pool_mutex);
+
+    return buffer != NULL ? buffer : malloc(SSL_WRITE_BATCH);
+}
+
+
+/*!
+ *  NAME
+ *      sslBufferPut - release a large buffer
+ *  SYNOPSIS
+ *      void sslBufferPut(
+ *          void *buffer);          // buffer from sslBufferGet() (NULL = none)
+ *  DESCRIPTION
+ *      sslBufferPut() puts the buffer back in the pool, or frees it if the pool is full (at most SSL_BUFFER_POOL
+ *      free buffers).
+ *  RETURN VALUE
+ *      None.
+ */
+
+void sslBufferPut(
+    void *buffer)                   // buffer from sslBufferGet() (NULL = none)
+{
+    if (buffer == NULL)
+        return;
+
+    pthread_mutex_lock(&pool_mutex);
+    if (pool_count < SSL_BUFFER_POOL) {
+        pool_buffers[pool_count++] = buffer;
+        buffer = NULL;
+    }
+
+    pthread_mutex_unlock(&pool_mutex);
+
+    free(buffer);
 }
 
 
@@ -110,65 +445,189 @@ bool sslRecovery(
 
 /*!
  *  NAME
- *      sslSelectRd - execute a select() on a ssl file descriptor
+ *      sslWaitFd - wait for an event on a ssl file descriptor
  *  SYNOPSIS
- *      int sslSelectRd(
- *          SSL *ssl);              // OpenSSL SSL structure
+ *      int sslWaitFd(
+ *          int     fd,             // file descriptor
+ *          short   events,         // events to wait: POLLIN/POLLOUT
+ *          int64_t deadline);      // deadline in ns (see sslDeadline(), -1 = no deadline)
  *  DESCRIPTION
- *      sslSelectRd() execute a select() on a ssl file descriptor corresponding to the read stream.
+ *      sslWaitFd() execute a poll() on a ssl file descriptor until the deadline (any fd value is allowed, select() is
+ *      limited to FD_SETSIZE).
  *  RETURN VALUE
- *      sslSelectRd return the result of a select() operation on the ssl file descriptor.
+ *      sslWaitFd return 1 if the event arrived, 0 if the deadline is elapsed, -1 on error.
  */
 
-static int sslSelectRd(
-    SSL *ssl)                       // OpenSSL SSL structure
+static int sslWaitFd(
+    int     fd,                     // file descriptor
+    short   events,                 // events to wait: POLLIN/POLLOUT
+    int64_t deadline)               // deadline in ns (see sslDeadline(), -1 = no deadline)
 {
-    // get file descriptor associated to ssl socket
-    int sock = SSL_get_rfd(ssl);
+    // a closed/reset socket is reported as an event: the repeated operation gets the error
+    struct pollfd pfd = { fd, events, 0 };
+    return fd < 0 ? -1 : sslPoll(&pfd, 1, deadline);
+}
 
-    // set file descriptor set associated to socket fd <sock>
-    fd_set fds;
-    FD_ZERO(&fds);
-    FD_SET(sock, &fds);
 
-    // set timeout
-    struct timeval timeout;
-    timeout.tv_sec  = 0;
-    timeout.tv_usec = SSL_RWTOUT;   // timeout
+/*!
+ *  NAME
+ *      libInitOnce - initialize the OpenSSL library
+ *  SYNOPSIS
+ *      void libInitOnce(void);
+ *  DESCRIPTION
+ *      libInitOnce() execute the necessary initial actions to use the OpenSSL library (the first one is the allocator
+ *      of OpenSSL chosen by the options of sslLibInitEx(), default the libc one, that is not replaced, the second one
+ *      the locking callbacks, see sslLockInit()). It's called only once through pthread_once() by sslLibInit() or sslLibInitEx().
+ *  RETURN VALUE
+ *      None.
+ */
+
+static void libInitOnce(void)
+{
+    // get the options (no more changeable)
+    pthread_mutex_lock(&lib_init_mutex);
+    lib_init_done = true;
+    SslInitOpts opts = lib_init_opts;
+    pthread_mutex_unlock(&lib_init_mutex);
+
+    // replace the allocation functions of OpenSSL (before any allocation)
+    switch (opts.allocator) {
+    case SSL_ALLOC_POOL:
+        sslPoolInit();
+        lib_init_alloc = true;
+        break;
+
+    case SSL_ALLOC_ARENA:
+        lib_init_alloc = sslArenaInit(opts.huge_pages);
+        break;
+
+    default:
+        // SSL_ALLOC_LIBC: the allocation functions of OpenSSL are not replaced
+        lib_init_alloc = true;
+        break;
+    }
+
+    // install the locking callbacks (OpenSSL 1.0.2: not thread-safe without them)
+    sslLockInit();
 
-    // return the result of a select() operation on the ssl file descriptor
-    return select(sock + 1, &fds, NULL, NULL, &timeout);
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+    // Load encryption & hashing algorithms and the error strings (thread-safe, only once)
+    OPENSSL_init_ssl(OPENSSL_INIT_LOAD_SSL_STRINGS | OPENSSL_INIT_LOAD_CRYPTO_STRINGS, NULL);
+#else
+    // Load encryption & hashing algorithms for the SSL program
+    SSL_library_init();
+
+    // Load the error strings for SSL & CRYPTO APIs
+    SSL_load_error_strings();
+#endif
+
+    // get the ex_data index for the connection private data
+    conn_index = SSL_get_ex_new_index(0, NULL, connDataNew, NULL, connDataFree);
+
+    // get the ex_data index for the context private data
+    ctx_index = SSL_CTX_get_ex_new_index(0, NULL, NULL, NULL, ctxDataFree);
 }
 
 
 /*!
  *  NAME
- *      sslSelectWr - execute a select() on a ssl file descriptor
+ *      connDataNew - new connection
  *  SYNOPSIS
- *      int sslSelectWr(
- *          SSL *ssl);              // OpenSSL SSL structure
+ *      void connDataNew(
+ *          void           *parent, // SSL structure
+ *          void           *ptr,    // private data (always NULL)
+ *          CRYPTO_EX_DATA *ad,     // ex_data of the SSL structure
+ *          int            idx,     // ex_data index
+ *          long           argl,    // generic long argument (unused)
+ *          void           *argp);  // generic pointer argument (unused)
  *  DESCRIPTION
- *      sslSelectWr() execute a select() on a ssl file descriptor corresponding to the write stream.
+ *      connDataNew() is the ex_data callback called when a SSL structure is created: it counts the connection for the
+ *      allocation statistics (see sslAllocStats()). The private data is allocated later, by sslConnData().
  *  RETURN VALUE
- *      sslSelectWr return the result of a select() operation on the ssl file descriptor.
+ *      None.
  */
 
-static int sslSelectWr(
-    SSL *ssl)                       // OpenSSL SSL structure
+static void connDataNew(
+    void           *parent,         // SSL structure
+    void           *ptr,            // private data (always NULL)
+    CRYPTO_EX_DATA *ad,             // ex_data of the SSL structure
+    int            idx,             // ex_data index
+    long           argl,            // generic long argument (unused)
+    void           *argp)           // generic pointer argument (unused)
 {
-    // get file descriptor associated to ssl socket
-    int sock = SSL_get_wfd(ssl);
+    // count the connection
+    sslArenaConn(1);
+}
+
+
+/*!
+ *  NAME
+ *      connDataFree - free the private data of a connection
+ *  SYNOPSIS
+ *      void connDataFree(
+ *          void           *parent, // SSL structure
+ *          void           *ptr,    // private data to free
+ *          CRYPTO_EX_DATA *ad,     // ex_data of the SSL structure
+ *          int            idx,     // ex_data index
+ *          long           argl,    // generic long argument (unused)
+ *          void           *argp);  // generic pointer argument (unused)
+ *  DESCRIPTION
+ *      connDataFree() is the ex_data callback that frees the MySSL private data when the SSL structure is freed.
+ *  RETURN VALUE
+ *      None.
+ */
+
+static void connDataFree(
+    void           *parent,         // SSL structure
+    void           *ptr,            // private data to free
+    CRYPTO_EX_DATA *ad,             // ex_data of the SSL structure
+    int            idx,             // ex_data index
+    long           argl,            // generic long argument (unused)
+    void           *argp)           // generic pointer argument (unused)
+{
+    // uncount the connection and free the private data (if allocated)
+    sslArenaConn(-1);
+    SslConnData *conn = ptr;
+    if (conn) {
+        free(conn->sess_key);
+        free(conn);
+    }
+}
 
-    // set file descriptor set associated to socket fd <sock>
-    fd_set fds;
-    FD_ZERO(&fds);
-    FD_SET(sock, &fds);
 
-    // set timeout
-    struct timeval timeout;
-    timeout.tv_sec  = 0;
-    timeout.tv_usec = SSL_RWTOUT;   // timeout
+/*!
+ *  NAME
+ *      ctxDataFree - free the private data of a context
+ *  SYNOPSIS
+ *      void ctxDataFree(
+ *          void           *parent, // SSL_CTX structure
+ *          void           *ptr,    // private data to free
+ *          CRYPTO_EX_DATA *ad,     // ex_data of the SSL_CTX structure
+ *          int            idx,     // ex_data index
+ *          long           argl,    // generic long argument (unused)
+ *          void           *argp);  // generic pointer argument (unused)
+ *  DESCRIPTION
+ *      ctxDataFree() is the ex_data callback that frees the MySSL private data when the SSL_CTX structure is freed
+ *      (and removes the sessions of a client context from the sessions store).
+ *  RETURN VALUE
+ *      None.
+ */
 
-    // return the result of a select() operation on the ssl file descriptor
-    return select(sock + 1, NULL, &fds, NULL, &timeout);
+static void ctxDataFree(
+    void           *parent,         // SSL_CTX structure
+    void           *ptr,            // private data to free
+    CRYPTO_EX_DATA *ad,             // ex_data of the SSL_CTX structure
+    int            idx,             // ex_data index
+    long           argl,            // generic long argument (unused)
+    void           *argp)           // generic pointer argument (unused)
+{
+    // free the private data (if allocated)
+    SslCtxData *ctxdata = ptr;
+    if (ctxdata) {
+        sslTicketKeysFree(ctxdata->tkeys);
+        if (ctxdata->sess_ctx)
+            sslSessionCtxFree(ctxdata->sess_ctx);   // its sessions can't be resumed by any other context
+
+        free(ctxdata);
+    }
 }
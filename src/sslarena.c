@@ -0,0 +1,613 @@
+/*
+ * Copyright © 2019 Aldo Abate <aldo.abate99@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+
+/*!
+ *  FILE
+ *      sslarena.c - thread-local arena allocator of OpenSSL and allocation statistics for MySSL library
+ *  PROJECT
+ *      MySSL library
+ *  FUNCTIONS
+ *      global:
+ *          bool sslArenaInit(bool huge_pages);
+ *          void sslArenaConn(int delta);
+ *          void sslAllocStats(SslAllocStats *stats);
+ *      local:
+ *          int    arenaClass(size_t num);
+ *          size_t arenaSize(int cls);
+ *          Arena* arenaSelf(void);
+ *          void   arenaExit(void *arg);
+ *          void*  arenaChunk(size_t num);
+ *          void   arenaLive(Arena *arena, long delta);
+ *          void*  arenaMalloc(size_t num, const char *file, int line);
+ *          void*  arenaRealloc(void *ptr, size_t num, const char *file, int line);
+ *          void   arenaFree(void *ptr, const char *file, int line);
+ *  DESCRIPTION
+ *      The MySSL library is a simple interface to OpenSSL library to permits user-friendly writing of Servers and
+ *      Clients using OpenSSL.
+ *  NOTES
+ *      - The free software library "OpenSSL" is distributed under a "dual licensed" system: under the OpenSSL License
+ *        and the SSLeay License. The OpenSSL License is Apache License 1.0 and SSLeay License bears some similarity to
+ *        a 4-clause BSD License. Both licenses apply.
+ *      - The library "OpenSSL" reference version is 1.0.2g
+ *      - With the arena allocator (SSL_ALLOC_ARENA, see sslInit()) each thread allocates the OpenSSL blocks up to
+ *        SSL_ARENA_MAX bytes from its own arena, without locks: a block is rounded up to a size class and is taken
+ *        from the free list of the class or carved from a chunk of SSL_ARENA_CHUNK bytes (optionally on huge pages).
+ *        A block freed by its own thread goes back to its free list, a block freed by another thread is pushed on a
+ *        lock-free list of the owner arena, collected by the owner when a free list is empty. The arena of an ended
+ *        thread is adopted by the next new thread. The chunks are never returned to the system.
+ *      - A thread never gets an arena again after the end of its own (the destructors of the thread-local data of
+ *        OpenSSL can still allocate and free after arenaExit()): it allocates with malloc() and frees the blocks of
+ *        the arenas through their remote lists, so an adopted arena is used only by the thread that adopted it.
+ *      - With huge pages the chunks are mapped on the reserved huge pages (MAP_HUGETLB) while available: then the
+ *        chunks are mapped on normal pages, without MADV_HUGEPAGE (the transparent huge pages are faulted whole and
+ *        would take up to a chunk of RSS per arena for a few blocks), and sslAllocStats() reports the fallback.
+ *      - The counters are per arena too: the live bytes are added to the global count (and to its peak) every
+ *        SSL_ARENA_FLUSH bytes of difference, so the peak has this precision for each thread.
+ *  AUTHOR
+ *      Aldo Abate
+ *  OPERATING SYSTEM
+ *      Linux (kernel 2.6.38 and above - glibc 2.3.2 and above)
+ *  COMPILER
+ *      GNU GCC (ver. 4.9 and above)
+ *  RELEASE
+ *      0.1.0 (August 2019)
+ */
+
+#include "myssl.h"
+#include "myssl-private.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <openssl/crypto.h>
+
+// header of an allocated block (16 bytes: the user data keeps the malloc() alignment)
+typedef union {
+    struct {
+        struct Arena *arena;        // owner arena (NULL = block allocated with malloc())
+        size_t       size;          // size of the class (arena block) or of the block (malloc() block)
+    } h;
+    max_align_t align;              // alignment of the user data
+} ArenaBlock;
+
+// a free block (the link is in the user data: the header stays valid)
+typedef struct ArenaFree {
+    struct ArenaFree *next;         // next free block
+} ArenaFree;
+
+// number of size classes: 32 bytes steps up to 512, 256 bytes steps up to 4 KB, 2 KB steps up to SSL_ARENA_MAX
+#define ARENA_CLASSES   (16 + 14 + (SSL_ARENA_MAX - 4096) / 2048)
+
+// arena of a thread
+typedef struct Arena {
+    ArenaFree            *free[ARENA_CLASSES];  // free blocks of each class
+    char                 *cur;                  // free space of the current chunk
+    char                 *end;                  // end of the current chunk
+    _Atomic(ArenaFree *) remote;                // blocks freed by the other threads
+    atomic_long          allocs;                // allocations of this thread
+    atomic_long          frees;                 // frees of this thread
+    atomic_long          live;                  // live bytes not yet added to the global count
+    struct Arena         *next;                 // next arena (list of all the arenas)
+    bool                 orphan;                // arena of an ended thread (to adopt)
+} Arena;
+
+// local prototypes
+static int    arenaClass(size_t num);
+static size_t arenaSize(int cls);
+static Arena* arenaSelf(void);
+static void   arenaExit(void *arg);
+static void*  arenaChunk(size_t num);
+static void   arenaLive(Arena *arena, long delta);
+static void*  arenaMalloc(size_t num, const char *file, int line);
+static void*  arenaRealloc(void *ptr, size_t num, const char *file, int line);
+static void   arenaFree(void *ptr, const char *file, int line);
+
+// local data: arenas and global counters
+static pthread_mutex_t       arena_mutex = PTHREAD_MUTEX_INITIALIZER;   // list of the arenas lock
+static pthread_key_t         arena_key;                 // key of the thread arena (destructor: arenaExit())
+static _Thread_local Arena   *arena_self = NULL;        // arena of this thread
+static _Thread_local bool    arena_exited = false;      // arena of this thread orphaned (end of the thread)
+static Arena                 *arena_list = NULL;        // all the arenas
+static bool                  arena_active = false;      // allocation functions of OpenSSL replaced
+static bool                  arena_huge = false;        // chunks on huge pages
+static atomic_long           arena_live = 0;            // live bytes (flushed by the arenas)
+static atomic_long           arena_peak = 0;            // max live bytes
+static atomic_long           arena_chunks = 0;          // chunks allocated
+static atomic_long           arena_huge_chunks = 0;     // chunks allocated on huge pages (MAP_HUGETLB)
+static atomic_bool           arena_huge_off = false;    // no reserved huge page: chunks on normal pages
+static atomic_long           arena_conns = 0;           // connections created (private data of the connection)
+static atomic_long           arena_conns_live = 0;      // live connections
+
+
+////////////////////////////////////////////////////////////////////////////////
+// GLOBAL functions
+////////////////////////////////////////////////////////////////////////////////
+
+
+/*!
+ *  NAME
+ *      sslArenaInit - install the arena allocator of OpenSSL
+ *  SYNOPSIS
+ *      bool sslArenaInit(
+ *          bool huge_pages);       // chunks on huge pages
+ *  DESCRIPTION
+ *      sslArenaInit() replaces the allocation functions of OpenSSL with the arena allocator (see NOTES). It's called
+ *      once by the library initialization (see sslInit()), before any other OpenSSL call of the library. With
+ *      huge_pages the chunks are allocated on the reserved huge pages (MAP_HUGETLB) or, if not available, on normal
+ *      pages (see NOTES).
+ *  RETURN VALUE
+ *      sslArenaInit() shall return true on success, false if OpenSSL already allocated memory (the allocator stays
+ *      the default one).
+ */
+
+bool sslArenaInit(
+    bool huge_pages)                // chunks on huge pages
+{
+    arena_huge = huge_pages;
+    if (pthread_key_create(&arena_key, arenaExit) != 0)
+        return false;
+
+    arena_active = CRYPTO_set_mem_functions(arenaMalloc, arenaRealloc, arenaFree) == 1;
+    return arena_active;
+}
+
+
+/*!
+ *  NAME
+ *      sslArenaConn - count a connection
+ *  SYNOPSIS
+ *      void sslArenaConn(
+ *          int delta);             // 1 = connection created, -1 = connection freed
+ *  DESCRIPTION
+ *      sslArenaConn() counts the connections (the private data of the connections, see sslConnData()) for the
+ *      statistics per connection of sslAllocStats().
+ *  RETURN VALUE
+ *      None.
+ */
+
+void sslArenaConn(
+    int delta)                      // 1 = connection created, -1 = connection freed
+{
+    if (delta > 0)
+        atomic_fetch_add_explicit(&arena_conns, 1, memory_order_relaxed);
+
+    atomic_fetch_add_explicit(&arena_conns_live, delta, memory_order_relaxed);
+}
+
+
+/*!
+ *  NAME
+ *      sslAllocStats - statistics of the arena allocator
+ *  SYNOPSIS
+ *      void sslAllocStats(
+ *          SslAllocStats *stats);  // statistics (output)
+ *  DESCRIPTION
+ *      sslAllocStats() gets the statistics of the arena allocator (see NOTES): allocations and frees of OpenSSL,
+ *      live bytes and their peak, chunks (and the fallback from the huge pages), and the averages per connection (the connections used by the library,
+ *      each one with a handshake). Without the arena allocator only the connection counters are set.
+ *  RETURN VALUE
+ *      None.
+ */
+
+void sslAllocStats(
+    SslAllocStats *stats)           // statistics (output)
+{
+    memset(stats, 0, sizeof(SslAllocStats));
+    stats->active      = arena_active;
+    stats->conns       = atomic_load_explicit(&arena_conns, memory_order_relaxed);
+    stats->conns_live  = atomic_load_explicit(&arena_conns_live, memory_order_relaxed);
+    stats->live        = atomic_load(&arena_live);
+    stats->peak        = atomic_load(&arena_peak);
+    stats->chunks      = atomic_load(&arena_chunks);
+    stats->huge_chunks = atomic_load(&arena_huge_chunks);
+    stats->huge_off    = arena_huge && atomic_load(&arena_huge_off);
+
+    // sum the counters of the arenas
+    pthread_mutex_lock(&arena_mutex);
+    for (Arena *arena = arena_list; arena != NULL; arena = arena->next) {
+        stats->arenas++;
+        stats->allocs += atomic_load_explicit(&arena->allocs, memory_order_relaxed);
+        stats->frees  += atomic_load_explicit(&arena->frees, memory_order_relaxed);
+        stats->live   += atomic_load_explicit(&arena->live, memory_order_relaxed);
+    }
+
+    pthread_mutex_unlock(&arena_mutex);
+
+    if (stats->conns > 0)
+        stats->allocs_per_conn = (double)stats->allocs / stats->conns;
+
+    if (stats->conns_live > 0)
+        stats->live_per_conn = (double)stats->live / stats->conns_live;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// LOCAL functions
+////////////////////////////////////////////////////////////////////////////////
+
+
+/*!
+ *  NAME
+ *      arenaClass - size class of a block
+ *  SYNOPSIS
+ *      int arenaClass(
+ *          size_t num);            // block size (1..SSL_ARENA_MAX)
+ *  DESCRIPTION
+ *      arenaClass() gets the smallest class that contains the block (see ARENA_CLASSES).
+ *  RETURN VALUE
+ *      arenaClass() shall return the class.
+ */
+
+static int arenaClass(
+    size_t num)                     // block size (1..SSL_ARENA_MAX)
+{
+    if (num <= 512)
+        return (num + 31) / 32 - 1;
+
+    if (num <= 4096)
+        return 16 + (num - 512 + 255) / 256 - 1;
+
+    return 30 + (num - 4096 + 2047) / 2048 - 1;
+}
+
+
+/*!
+ *  NAME
+ *      arenaSize - size of a class
+ *  SYNOPSIS
+ *      size_t arenaSize(
+ *          int cls);               // class
+ *  DESCRIPTION
+ *      arenaSize() gets the size of the blocks of the class (the inverse of arenaClass()).
+ *  RETURN VALUE
+ *      arenaSize() shall return the size.
+ */
+
+static size_t arenaSize(
+    int cls)                        // class
+{
+    if (cls < 16)
+        return (cls + 1) * 32;
+
+    if (cls < 30)
+        return 512 + (cls - 15) * 256;
+
+    return 4096 + (size_t)(cls - 29) * 2048;
+}
+
+
+/*!
+ *  NAME
+ *      arenaSelf - arena of the thread
+ *  SYNOPSIS
+ *      Arena* arenaSelf(void);
+ *  DESCRIPTION
+ *      arenaSelf() gets the arena of the calling thread: on the first call of the thread it adopts the arena of an
+ *      ended thread or creates a new arena. After the end of the thread (see arenaExit()) it doesn't adopt arenas
+ *      anymore.
+ *  RETURN VALUE
+ *      arenaSelf() shall return the arena, NULL on allocation error or after the end of the thread.
+ */
+
+static Arena* arenaSelf(void)
+{
+    if (arena_self != NULL || arena_exited)
+        return arena_self;
+
+    // adopt an orphan arena or create a new one (the arenas are never freed)
+    Arena *arena;
+    pthread_mutex_lock(&arena_mutex);
+    for (arena = arena_list; arena != NULL && ! arena->orphan; arena = arena->next)
+        ;
+
+    if (arena == NULL && (arena = calloc(1, sizeof(Arena))) != NULL) {
+        arena->next = arena_list;
+        arena_list  = arena;
+    }
+
+    if (arena != NULL)
+        arena->orphan = false;
+
+    pthread_mutex_unlock(&arena_mutex);
+
+    // the destructor of the key orphans the arena at the end of the thread
+    if (arena != NULL)
+        pthread_setspecific(arena_key, arena);
+
+    return arena_self = arena;
+}
+
+
+/*!
+ *  NAME
+ *      arenaExit - end of a thread
+ *  SYNOPSIS
+ *      void arenaExit(
+ *          void *arg);             // arena of the thread
+ *  DESCRIPTION
+ *      arenaExit() is the destructor of the arena key: the arena of the ended thread becomes an orphan, adopted by
+ *      the next new thread (with its free blocks). The later allocations of the thread don't use the arenas.
+ *  RETURN VALUE
+ *      None.
+ */
+
+static void arenaExit(
+    void *arg)                      // arena of the thread
+{
+    Arena *arena = arg;
+    pthread_mutex_lock(&arena_mutex);
+    arena->orphan = true;
+    pthread_mutex_unlock(&arena_mutex);
+    arena_self   = NULL;
+    arena_exited = true;
+}
+
+
+/*!
+ *  NAME
+ *      arenaChunk - allocate a chunk
+ *  SYNOPSIS
+ *      void* arenaChunk(
+ *          size_t num);            // chunk size
+ *  DESCRIPTION
+ *      arenaChunk() maps a chunk of memory: on the reserved huge pages if required, on normal pages if not required
+ *      or after the first failure of MAP_HUGETLB (no more reserved huge pages, see NOTES).
+ *  RETURN VALUE
+ *      arenaChunk() shall return the chunk, NULL on error.
+ */
+
+static void* arenaChunk(
+    size_t num)                     // chunk size
+{
+    void *chunk = MAP_FAILED;
+#ifdef MAP_HUGETLB
+    if (arena_huge && ! atomic_load_explicit(&arena_huge_off, memory_order_relaxed)) {
+        if ((chunk = mmap(NULL, num, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1,
+                          0)) != MAP_FAILED)
+            atomic_fetch_add(&arena_huge_chunks, 1);
+        else
+            atomic_store(&arena_huge_off, true);
+    }
+#else
+    atomic_store(&arena_huge_off, true);
+#endif
+
+    if (chunk == MAP_FAILED &&
+            (chunk = mmap(NULL, num, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED)
+        return NULL;
+
+    atomic_fetch_add(&arena_chunks, 1);
+    return chunk;
+}
+
+
+/*!
+ *  NAME
+ *      arenaLive - account the live bytes
+ *  SYNOPSIS
+ *      void arenaLive(
+ *          Arena *arena,           // arena of the thread (NULL = none)
+ *          long  delta);           // bytes allocated (> 0) or freed (< 0)
+ *  DESCRIPTION
+ *      arenaLive() accounts the live bytes in the arena and adds them to the global count (updating the peak) every
+ *      SSL_ARENA_FLUSH bytes of difference. Without arena (ended thread) the bytes are added to the global count.
+ *  RETURN VALUE
+ *      None.
+ */
+
+static void arenaLive(
+    Arena *arena,                   // arena of the thread (NULL = none)
+    long  delta)                    // bytes allocated (> 0) or freed (< 0)
+{
+    long live = delta;
+    if (arena != NULL) {
+        live += atomic_load_explicit(&arena->live, memory_order_relaxed);
+        if (live > -SSL_ARENA_FLUSH && live < SSL_ARENA_FLUSH) {
+            atomic_store_explicit(&arena->live, live, memory_order_relaxed);
+            return;
+        }
+
+        atomic_store_explicit(&arena->live, 0, memory_order_relaxed);
+    }
+
+    // flush to the global count
+    long total = atomic_fetch_add(&arena_live, live) + live, peak = atomic_load(&arena_peak);
+    while (total > peak && ! atomic_compare_exchange_weak(&arena_peak, &peak, total))
+        ;
+}
+
+
+/*!
+ *  NAME
+ *      arenaMalloc - allocation function of OpenSSL
+ *  SYNOPSIS
+ *      void* arenaMalloc(
+ *          size_t     num,         // number of bytes
+ *          const char *file,       // source file of the caller (unused)
+ *          int        line);       // source line of the caller (unused)
+ *  DESCRIPTION
+ *      arenaMalloc() allocates a block from the arena of the thread (see NOTES), or with malloc() if larger than
+ *      SSL_ARENA_MAX bytes or if the thread is ended.
+ *  RETURN VALUE
+ *      Upon successful completion, arenaMalloc() shall return the block.
+ *      Otherwise, NULL shall be returned.
+ */
+
+static void* arenaMalloc(
+    size_t     num,                 // number of bytes
+    const char *file,               // source file of the caller (unused)
+    int        line)                // source line of the caller (unused)
+{
+    ArenaBlock *block;
+    Arena      *arena;
+    (void)file, (void)line;
+    if (num == 0 || ((arena = arenaSelf()) == NULL && ! arena_exited))
+        return NULL;
+
+    if (num > SSL_ARENA_MAX || arena == NULL) {
+        // large block (or ended thread): malloc()
+        if ((block = malloc(sizeof(ArenaBlock) + num)) == NULL)
+            return NULL;
+
+        block->h.arena = NULL;
+    } else {
+        // take a free block of the class (collecting the blocks freed by the other threads if none)
+        int       cls  = arenaClass(num);
+        ArenaFree *blk = arena->free[cls];
+        num = arenaSize(cls);
+        if (blk == NULL && atomic_load_explicit(&arena->remote, memory_order_relaxed) != NULL) {
+            ArenaFree *remote = atomic_exchange(&arena->remote, NULL);
+            while (remote != NULL) {
+                ArenaFree *next = remote->next;
+                int       rcls  = arenaClass(((ArenaBlock *)remote - 1)->h.size);
+                remote->next       = arena->free[rcls];
+                arena->free[rcls]  = remote;
+                remote             = next;
+            }
+
+            blk = arena->free[cls];
+        }
+
+        if (blk != NULL) {
+            arena->free[cls] = blk->next;
+            block            = (ArenaBlock *)blk - 1;
+        } else {
+            // carve a new block from the chunk (a new chunk if full)
+            size_t need = sizeof(ArenaBlock) + num;
+            if (arena->end - arena->cur < (long)need) {
+                if ((arena->cur = arenaChunk(SSL_ARENA_CHUNK)) == NULL) {
+                    arena->end = NULL;
+                    return NULL;
+                }
+
+                arena->end = arena->cur + SSL_ARENA_CHUNK;
+            }
+
+            block       = (ArenaBlock *)arena->cur;
+            arena->cur += need;
+        }
+
+        block->h.arena = arena;
+    }
+
+    block->h.size = num;
+    if (arena != NULL)
+        atomic_store_explicit(&arena->allocs, atomic_load_explicit(&arena->allocs, memory_order_relaxed) + 1,
+                              memory_order_relaxed);
+
+    arenaLive(arena, num);
+    return block + 1;
+}
+
+
+/*!
+ *  NAME
+ *      arenaRealloc - reallocation function of OpenSSL
+ *  SYNOPSIS
+ *      void* arenaRealloc(
+ *          void       *ptr,        // block to reallocate (NULL = new block)
+ *          size_t     num,         // new number of bytes
+ *          const char *file,       // source file of the caller
+ *          int        line);       // source line of the caller
+ *  DESCRIPTION
+ *      arenaRealloc() changes the size of a block: a block of an arena big enough is kept, otherwise the data is
+ *      moved to a new block.
+ *  RETURN VALUE
+ *      Upon successful completion, arenaRealloc() shall return the block.
+ *      Otherwise, NULL shall be returned (the block is not freed).
+ */
+
+static void* arenaRealloc(
+    void       *ptr,                // block to reallocate (NULL = new block)
+    size_t     num,                 // new number of bytes
+    const char *file,               // source file of the caller
+    int        line)                // source line of the caller
+{
+    if (ptr == NULL)
+        return arenaMalloc(num, file, line);
+
+    if (num == 0) {
+        arenaFree(ptr, file, line);
+        return NULL;
+    }
+
+    // the class of the block is big enough: no data to move
+    ArenaBlock *block = (ArenaBlock *)ptr - 1;
+    if (block->h.arena != NULL && num <= block->h.size)
+        return ptr;
+
+    // move the data to a new block
+    void *newptr;
+    if ((newptr = arenaMalloc(num, file, line)) == NULL)
+        return NULL;
+
+    memcpy(newptr, ptr, block->h.size < num ? block->h.size : num);
+    arenaFree(ptr, file, line);
+    return newptr;
+}
+
+
+/*!
+ *  NAME
+ *      arenaFree - free function of OpenSSL
+ *  SYNOPSIS
+ *      void arenaFree(
+ *          void       *ptr,        // block to free (NULL = none)
+ *          const char *file,       // source file of the caller (unused)
+ *          int        line);       // source line of the caller (unused)
+ *  DESCRIPTION
+ *      arenaFree() puts a block in the free list of its class (block of the thread arena), or in the list of the
+ *      blocks freed by the other threads of its arena (also the blocks freed by a thread after its end, see NOTES),
+ *      or frees it (large block).
+ *  RETURN VALUE
+ *      None.
+ */
+
+static void arenaFree(
+    void       *ptr,                // block to free (NULL = none)
+    const char *file,               // source file of the caller (unused)
+    int        line)                // source line of the caller (unused)
+{
+    (void)file, (void)line;
+    if (ptr == NULL)
+        return;
+
+    // account the free in the arena of the thread (in the global count after the end of the thread)
+    ArenaBlock *block = (ArenaBlock *)ptr - 1;
+    Arena      *self  = arenaSelf(), *owner = block->h.arena;
+    if (self != NULL)
+        atomic_store_explicit(&self->frees, atomic_load_explicit(&self->frees, memory_order_relaxed) + 1,
+                              memory_order_relaxed);
+
+    if (self != NULL || arena_exited)
+        arenaLive(self, -(long)block->h.size);
+
+    ArenaFree *blk = ptr;
+    if (owner == NULL) {
+        // large block
+        free(block);
+    } else if (owner == self) {
+        // block of this thread: free list of its class
+        int cls = arenaClass(block->h.size);
+        blk->next        = self->free[cls];
+        self->free[cls]  = blk;
+    } else {
+        // block of another thread: list of the remote frees of its arena
+        blk->next = atomic_load_explicit(&owner->remote, memory_order_relaxed);
+        while (! atomic_compare_exchange_weak(&owner->remote, &blk->next, blk))
+            ;
+    }
+}
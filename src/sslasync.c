@@ -0,0 +1,801 @@
+/*
+ * Copyright © 2019 Aldo Abate <aldo.abate99@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+
+
+/*!
+ *  FILE
+ *      sslasync.c - private-key operations offloaded to a crypto thread pool for MySSL library
+ *  PROJECT
+ *      MySSL library
+ *  FUNCTIONS
+ *      global:
+ *          bool sslAsyncKeysInit(SSL_CTX *ctx, const SslCtxOpts *opts);
+ *          int  sslAsyncWait(SSL *ssl, int64_t deadline);
+ *          void sslAsyncCleanup(void);
+ *      local:
+ *          void       methodsInit(void);
+ *          EVP_PKEY*  keyWrap(EVP_PKEY *pkey);
+ *          int        rsaPrivEnc(int flen, const unsigned char *from, unsigned char *to, RSA *rsa, int padding);
+ *          int        rsaPrivDec(int flen, const unsigned char *from, unsigned char *to, RSA *rsa, int padding);
+ *          int        rsaPrivOp(int op, int flen, const unsigned char *from, unsigned char *to, RSA *rsa,
+ *                               int padding);
+ *          int        ecSign(int type, const unsigned char *dgst, int dlen, unsigned char *sig, unsigned int *siglen,
+ *                            const BIGNUM *kinv, const BIGNUM *r, EC_KEY *eckey);
+ *          AsyncTask* taskNew(int op, const unsigned char *from, int flen, int outlen);
+ *          bool       taskExec(AsyncTask *task);
+ *          void       taskRun(AsyncTask *task);
+ *          void       taskRelease(AsyncTask *task);
+ *          void       taskFdCleanup(ASYNC_WAIT_CTX *wctx, const void *key, OSSL_ASYNC_FD fd, void *custom);
+ *          bool       poolStart(int nthreads);
+ *          void*      poolThread(void *arg);
+ *  DESCRIPTION
+ *      The MySSL library is a simple interface to OpenSSL library to permits user-friendly writing of Servers and
+ *      Clients using OpenSSL.
+ *  NOTES
+ *      - The free software library "OpenSSL" is distributed under a "dual licensed" system: under the OpenSSL License
+ *        and the SSLeay License. The OpenSSL License is Apache License 1.0 and SSLeay License bears some similarity to
+ *        a 4-clause BSD License. Both licenses apply.
+ *      - The library "OpenSSL" reference version is 1.0.2g
+ *      - The offload uses the async jobs of OpenSSL 1.1.0 and above (SSL_MODE_ASYNC): the handshake runs in a job, the
+ *        RSA/ECDSA method of the server keys hands the operation to the crypto thread pool and pauses the job, so the
+ *        OpenSSL function returns SSL_ERROR_WANT_ASYNC and the caller resumes it when the async fd is readable. The
+ *        RSA_METHOD/EC_KEY_METHOD functions are deprecated in OpenSSL 3.0 but are the only hook available without a
+ *        provider. The other key types (e.g.: Ed25519) are signed inline.
+ *      - The pool threads are joinable: sslAsyncCleanup() (from sslCleanup()) stops them after the queued tasks and
+ *        joins them, then the operations are executed inline.
+ *  AUTHOR
+ *      Aldo Abate
+ *  OPERATING SYSTEM
+ *      Linux (kernel 2.6 and above - glibc 2.3.2 and above)
+ *  COMPILER
+ *      GNU GCC (ver. 4.4 and above)
+ *  RELEASE
+ *      0.1.0 (August 2019)
+ */
+
+// the RSA_METHOD/EC_KEY_METHOD functions are deprecated in OpenSSL 3.0 (see NOTES)
+#define OPENSSL_SUPPRESS_DEPRECATED
+
+#include "myssl.h"
+#include "myssl-private.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+#include <sys/eventfd.h>
+#include <openssl/async.h>
+#include <openssl/rsa.h>
+#include <openssl/ec.h>
+
+// max number of private-keys of a context (a key for each certificate type)
+#define ASYNC_KEYS_MAX  8
+
+// private-key operations
+#define TASK_RSA_ENC    0   // RSA private encrypt (signature)
+#define TASK_RSA_DEC    1   // RSA private decrypt (RSA key exchange)
+#define TASK_EC_SIGN    2   // ECDSA signature
+
+// operation handed to the crypto thread pool. The task is shared by the job (or its wait context, if the job is
+// abandoned) and by the pool thread: the last one that releases it frees it (and closes the event fd)
+typedef struct AsyncTask {
+    int              op;            // operation: TASK_RSA_ENC/TASK_RSA_DEC/TASK_EC_SIGN
+    unsigned char    *from;         // input data (copy)
+    int              flen;          // input data length
+    unsigned char    *to;           // output data
+    unsigned int     tlen;          // output data length (ECDSA signature)
+    int              padding;       // RSA padding
+    int              type;          // ECDSA digest type
+    RSA              *rsa;          // RSA key (referenced)
+    EC_KEY           *eckey;        // EC key (referenced)
+    int              result;        // operation result
+    int              fd;            // event fd signaled when the operation is done
+    atomic_int       refs;          // references (job and pool thread)
+    atomic_bool      done;          // operation done
+    struct AsyncTask *next;         // next task in the pool queue
+} AsyncTask;
+
+// local prototypes
+static void       methodsInit(void);
+static EVP_PKEY*  keyWrap(EVP_PKEY *pkey);
+static int        rsaPrivEnc(int flen, const unsigned char *from, unsigned char *to, RSA *rsa, int padding);
+static int        rsaPrivDec(int flen, const unsigned char *from, unsigned char *to, RSA *rsa, int padding);
+static int        rsaPrivOp(int op, int flen, const unsigned char *from, unsigned char *to, RSA *rsa, int padding);
+static int        ecSign(int type, const unsigned char *dgst, int dlen, unsigned char *sig, unsigned int *siglen,
+                         const BIGNUM *kinv, const BIGNUM *r, EC_KEY *eckey);
+static AsyncTask* taskNew(int op, const unsigned char *from, int flen, int outlen);
+static bool       taskExec(AsyncTask *task);
+static void       taskRun(AsyncTask *task);
+static void       taskRelease(AsyncTask *task);
+static void       taskFdCleanup(ASYNC_WAIT_CTX *wctx, const void *key, OSSL_ASYNC_FD fd, void *custom);
+static bool       poolStart(int nthreads);
+static void*      poolThread(void *arg);
+
+// local data: key methods (created once, never freed) and default implementations
+typedef int (*RsaPrivFunc)(int flen, const unsigned char *from, unsigned char *to, RSA *rsa, int padding);
+typedef int (*EcSignFunc)(int type, const unsigned char *dgst, int dlen, unsigned char *sig, unsigned int *siglen,
+                          const BIGNUM *kinv, const BIGNUM *r, EC_KEY *eckey);
+typedef int (*EcSetupFunc)(EC_KEY *eckey, BN_CTX *ctx, BIGNUM **kinv, BIGNUM **r);
+typedef ECDSA_SIG* (*EcSigFunc)(const unsigned char *dgst, int dlen, const BIGNUM *kinv, const BIGNUM *r,
+                                EC_KEY *eckey);
+static pthread_once_t methods_once = PTHREAD_ONCE_INIT;
+static RSA_METHOD     *rsa_meth    = NULL;      // RSA method of the offloaded keys
+static EC_KEY_METHOD  *ec_meth     = NULL;      // EC method of the offloaded keys
+static RsaPrivFunc    rsa_enc_default;          // default RSA private encrypt
+static RsaPrivFunc    rsa_dec_default;          // default RSA private decrypt
+static EcSignFunc     ec_sign_default;          // default ECDSA signature
+
+// local data: crypto thread pool (started on the first use, stopped by sslAsyncCleanup())
+static pthread_mutex_t pool_mutex    = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  pool_cond     = PTHREAD_COND_INITIALIZER;
+static AsyncTask       *pool_head    = NULL;    // tasks queue (FIFO)
+static AsyncTask       *pool_tail    = NULL;
+static pthread_t       *pool_tids    = NULL;    // pool threads
+static int             pool_threads  = 0;       // number of pool threads
+static bool            pool_stop     = false;   // stop request (sslAsyncCleanup())
+static const int       task_fd_key   = 0;       // key of the event fd in the wait context of the job
+#endif
+
+
+////////////////////////////////////////////////////////////////////////////////
+// GLOBAL functions
+////////////////////////////////////////////////////////////////////////////////
+
+
+/*!
+ *  NAME
+ *      sslAsyncKeysInit - offload the private-key operations of a server context
+ *  SYNOPSIS
+ *      bool sslAsyncKeysInit(
+ *          SSL_CTX          *ctx,  // OpenSSL context (with the certificates/private-keys loaded)
+ *          const SslCtxOpts *opts);    // context options (async_workers > 0)
+ *  DESCRIPTION
+ *      sslAsyncKeysInit() starts the crypto thread pool (at least async_workers threads, the pool is shared by all
+ *      the contexts), replaces the RSA/EC private-keys of the context with copies that hand the operations to the pool
+ *      and enables the async mode of the context (SSL_MODE_ASYNC).
+ *  RETURN VALUE
+ *      sslAsyncKeysInit() shall return true on success. Otherwise (OpenSSL error or async jobs not supported, e.g.:
+ *      OpenSSL 1.0.2), false shall be returned.
+ */
+
+bool sslAsyncKeysInit(
+    SSL_CTX          *ctx,          // OpenSSL context (with the certificates/private-keys loaded)
+    const SslCtxOpts *opts)         // context options (async_workers > 0)
+{
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+    // create the key methods and start the pool
+    pthread_once(&methods_once, methodsInit);
+    if (rsa_meth == NULL || ec_meth == NULL || ! poolStart(opts->async_workers))
+        return false;
+
+    // collect the private-keys of the context (a key for each certificate type, see SslCtxOpts.cert2)
+    EVP_PKEY *keys[ASYNC_KEYS_MAX];
+    int      nkeys = 0;
+    for (long rc = SSL_CTX_set_current_cert(ctx, SSL_CERT_SET_FIRST); rc == 1 && nkeys < ASYNC_KEYS_MAX;
+             rc = SSL_CTX_set_current_cert(ctx, SSL_CERT_SET_NEXT)) {
+        if ((keys[nkeys] = SSL_CTX_get0_privatekey(ctx)) != NULL)
+            nkeys++;
+    }
+
+    // replace the keys (the key types without an offload method are left as they are)
+    for (int i = 0; i < nkeys; i++) {
+        EVP_PKEY *wrapped = keyWrap(keys[i]);
+        if (wrapped == NULL)
+            continue;
+
+        int rc = SSL_CTX_use_PrivateKey(ctx, wrapped);
+        EVP_PKEY_free(wrapped);
+        if (rc != 1)
+            return false;
+    }
+
+    // the handshakes run in async jobs
+    SSL_CTX_set_mode(ctx, SSL_MODE_ASYNC);
+    return true;
+#else
+    // async jobs not supported
+    (void)ctx, (void)opts;
+    return false;
+#endif
+}
+
+
+/*!
+ *  NAME
+ *      sslAsyncWait - wait for the async operations of a connection
+ *  SYNOPSIS
+ *      int sslAsyncWait(
+ *          SSL     *ssl,           // OpenSSL SSL structure
+ *          int64_t deadline);      // deadline in ns (see sslDeadline(), -1 = no deadline)
+ *  DESCRIPTION
+ *      sslAsyncWait() waits (at most until the deadline) that an async operation of the connection is done (the async
+ *      fd is readable) after an OpenSSL function returned SSL_ERROR_WANT_ASYNC.
+ *  RETURN VALUE
+ *      sslAsyncWait() shall return a value > 0 if an operation is done, 0 on timeout, -1 on error.
+ */
+
+int sslAsyncWait(
+    SSL     *ssl,                   // OpenSSL SSL structure
+    int64_t deadline)               // deadline in ns (see sslDeadline(), -1 = no deadline)
+{
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+    // get the async fds of the connection
+    OSSL_ASYNC_FD fds[4];
+    size_t        nfds = 0;
+    if (SSL_get_all_async_fds(ssl, NULL, &nfds) != 1 || nfds == 0 || nfds > sizeof(fds) / sizeof(fds[0]) ||
+            SSL_get_all_async_fds(ssl, fds, &nfds) != 1) {
+        // no fd to wait: the job can be resumed at once
+        return 1;
+    }
+
+    // wait until a fd is readable
+    struct pollfd pfds[4];
+    for (size_t i = 0; i < nfds; i++) {
+        pfds[i].fd     = fds[i];
+        pfds[i].events = POLLIN;
+    }
+
+    return sslPoll(pfds, nfds, deadline);
+#else
+    (void)ssl, (void)deadline;
+    return -1;
+#endif
+}
+
+
+/*!
+ *  NAME
+ *      sslAsyncCleanup - stop the crypto thread pool
+ *  SYNOPSIS
+ *      void sslAsyncCleanup(void);
+ *  DESCRIPTION
+ *      sslAsyncCleanup() stops the threads of the crypto pool (after the execution of the queued tasks) and joins
+ *      them (called by sslCleanup()). The operations of the offloaded keys are then executed inline.
+ *  RETURN VALUE
+ *      None.
+ */
+
+void sslAsyncCleanup(void)
+{
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+    // stop request
+    pthread_mutex_lock(&pool_mutex);
+    pool_stop = true;
+    pthread_cond_broadcast(&pool_cond);
+    int       nthreads = pool_threads;
+    pthread_t *tids    = pool_tids;
+    pool_threads = 0;
+    pool_tids    = NULL;
+    pthread_mutex_unlock(&pool_mutex);
+
+    // join the threads
+    for (int i = 0; i < nthreads; i++)
+        pthread_join(tids[i], NULL);
+
+    free(tids);
+#endif
+}
+
+
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+////////////////////////////////////////////////////////////////////////////////
+// LOCAL functions
+////////////////////////////////////////////////////////////////////////////////
+
+
+/*!
+ *  NAME
+ *      methodsInit - create the key methods of the offloaded keys
+ *  SYNOPSIS
+ *      void methodsInit(void);
+ *  DESCRIPTION
+ *      methodsInit() creates the RSA and EC key methods (copies of the default OpenSSL methods with the private-key
+ *      operations replaced) and saves the default implementations used by the pool threads. Executed only once.
+ *  RETURN VALUE
+ *      None.
+ */
+
+static void methodsInit(void)
+{
+    // RSA: private encrypt/decrypt
+    RSA_METHOD *rmeth;
+    if ((rmeth = RSA_meth_dup(RSA_PKCS1_OpenSSL())) != NULL) {
+        rsa_enc_default = RSA_meth_get_priv_enc(RSA_PKCS1_OpenSSL());
+        rsa_dec_default = RSA_meth_get_priv_dec(RSA_PKCS1_OpenSSL());
+        if (RSA_meth_set1_name(rmeth, "MySSL async RSA") == 1 && RSA_meth_set_priv_enc(rmeth, rsaPrivEnc) == 1 &&
+                RSA_meth_set_priv_dec(rmeth, rsaPrivDec) == 1)
+            rsa_meth = rmeth;
+        else
+            RSA_meth_free(rmeth);
+    }
+
+    // EC: ECDSA signature (the setup and the raw signature are the default ones)
+    EC_KEY_METHOD *emeth;
+    if ((emeth = EC_KEY_METHOD_new(EC_KEY_OpenSSL())) != NULL) {
+        EcSetupFunc sign_setup;
+        EcSigFunc   sign_sig;
+        EC_KEY_METHOD_get_sign(EC_KEY_OpenSSL(), &ec_sign_default, &sign_setup, &sign_sig);
+        EC_KEY_METHOD_set_sign(emeth, ecSign, sign_setup, sign_sig);
+        ec_meth = emeth;
+    }
+}
+
+
+/*!
+ *  NAME
+ *      keyWrap - copy a private-key with the offload method
+ *  SYNOPSIS
+ *      EVP_PKEY* keyWrap(
+ *          EVP_PKEY *pkey);        // private-key
+ *  DESCRIPTION
+ *      keyWrap() creates a copy of a RSA/EC private-key that uses the offload method.
+ *  RETURN VALUE
+ *      Upon successful completion, keyWrap() shall return the new key (to free with EVP_PKEY_free()).
+ *      Otherwise (key type not supported or OpenSSL error), NULL shall be returned.
+ */
+
+static EVP_PKEY* keyWrap(
+    EVP_PKEY *pkey)                 // private-key
+{
+    EVP_PKEY *wrapped = EVP_PKEY_new();
+    if (wrapped == NULL)
+        return NULL;
+
+    // copy the key and set the method
+    if (EVP_PKEY_base_id(pkey) == EVP_PKEY_RSA) {
+        RSA *rsa = EVP_PKEY_get1_RSA(pkey), *dup = rsa ? RSAPrivateKey_dup(rsa) : NULL;
+        RSA_free(rsa);
+        if (dup && RSA_set_method(dup, rsa_meth) == 1 && EVP_PKEY_assign_RSA(wrapped, dup) == 1)
+            return wrapped;
+
+        RSA_free(dup);
+    }
+    else if (EVP_PKEY_base_id(pkey) == EVP_PKEY_EC) {
+        EC_KEY *eckey = EVP_PKEY_get1_EC_KEY(pkey), *dup = eckey ? EC_KEY_dup(eckey) : NULL;
+        EC_KEY_free(eckey);
+        if (dup && EC_KEY_set_method(dup, ec_meth) == 1 && EVP_PKEY_assign_EC_KEY(wrapped, dup) == 1)
+            return wrapped;
+
+        EC_KEY_free(dup);
+    }
+
+    // key type not supported or error
+    EVP_PKEY_free(wrapped);
+    return NULL;
+}
+
+
+/*!
+ *  NAME
+ *      rsaPrivEnc/rsaPrivDec - RSA private encrypt/decrypt of the offload method
+ *  SYNOPSIS
+ *      int rsaPrivEnc/rsaPrivDec(
+ *          int                 flen,   // input data length
+ *          const unsigned char *from,  // input data
+ *          unsigned char       *to,    // output data (RSA_size() bytes)
+ *          RSA                 *rsa,   // RSA key
+ *          int                 padding);   // RSA padding
+ *  DESCRIPTION
+ *      rsaPrivEnc() and rsaPrivDec() execute the RSA private operation in the crypto thread pool (see rsaPrivOp()).
+ *  RETURN VALUE
+ *      The result of the default OpenSSL implementation.
+ */
+
+static int rsaPrivEnc(
+    int                 flen,       // input data length
+    const unsigned char *from,      // input data
+    unsigned char       *to,        // output data (RSA_size() bytes)
+    RSA                 *rsa,       // RSA key
+    int                 padding)    // RSA padding
+{
+    return rsaPrivOp(TASK_RSA_ENC, flen, from, to, rsa, padding);
+}
+
+static int rsaPrivDec(
+    int                 flen,       // input data length
+    const unsigned char *from,      // input data
+    unsigned char       *to,        // output data (RSA_size() bytes)
+    RSA                 *rsa,       // RSA key
+    int                 padding)    // RSA padding
+{
+    return rsaPrivOp(TASK_RSA_DEC, flen, from, to, rsa, padding);
+}
+
+
+/*!
+ *  NAME
+ *      rsaPrivOp - RSA private operation in the crypto thread pool
+ *  SYNOPSIS
+ *      int rsaPrivOp(
+ *          int                 op,     // operation: TASK_RSA_ENC/TASK_RSA_DEC
+ *          int                 flen,   // input data length
+ *          const unsigned char *from,  // input data
+ *          unsigned char       *to,    // output data (RSA_size() bytes)
+ *          RSA                 *rsa,   // RSA key
+ *          int                 padding);   // RSA padding
+ *  DESCRIPTION
+ *      rsaPrivOp() hands the RSA private operation to the crypto thread pool and pauses the current async job until
+ *      the operation is done. Outside an async job (or if the task cannot be created) the operation runs inline.
+ *  RETURN VALUE
+ *      The result of the default OpenSSL implementation.
+ */
+
+static int rsaPrivOp(
+    int                 op,         // operation: TASK_RSA_ENC/TASK_RSA_DEC
+    int                 flen,       // input data length
+    const unsigned char *from,      // input data
+    unsigned char       *to,        // output data (RSA_size() bytes)
+    RSA                 *rsa,       // RSA key
+    int                 padding)    // RSA padding
+{
+    RsaPrivFunc func = op == TASK_RSA_ENC ? rsa_enc_default : rsa_dec_default;
+
+    // create the task and execute it in the pool
+    AsyncTask *task;
+    if (ASYNC_get_current_job() == NULL || (task = taskNew(op, from, flen, RSA_size(rsa))) == NULL)
+        return func(flen, from, to, rsa, padding);  // not in a job (or error): inline
+
+    RSA_up_ref(rsa);
+    task->rsa     = rsa;
+    task->padding = padding;
+    if (! taskExec(task)) {
+        // the task cannot be executed by the pool: inline
+        taskRelease(task);
+        return func(flen, from, to, rsa, padding);
+    }
+
+    // copy the result and release the task
+    int result = task->result;
+    if (result > 0)
+        memcpy(to, task->to, result);
+
+    taskRelease(task);
+    return result;
+}
+
+
+/*!
+ *  NAME
+ *      ecSign - ECDSA signature of the offload method
+ *  SYNOPSIS
+ *      int ecSign(
+ *          int                 type,   // digest type
+ *          const unsigned char *dgst,  // digest
+ *          int                 dlen,   // digest length
+ *          unsigned char       *sig,   // signature (ECDSA_size() bytes)
+ *          unsigned int        *siglen,    // signature length
+ *          const BIGNUM        *kinv,  // precomputed values (NULL = none)
+ *          const BIGNUM        *r,
+ *          EC_KEY              *eckey);    // EC key
+ *  DESCRIPTION
+ *      ecSign() hands the ECDSA signature to the crypto thread pool and pauses the current async job until the
+ *      signature is done. Outside an async job (or with precomputed values) the signature runs inline.
+ *  RETURN VALUE
+ *      The result of the default OpenSSL implementation.
+ */
+
+static int ecSign(
+    int                 type,       // digest type
+    const unsigned char *dgst,      // digest
+    int                 dlen,       // digest length
+    unsigned char       *sig,       // signature (ECDSA_size() bytes)
+    unsigned int        *siglen,    // signature length
+    const BIGNUM        *kinv,      // precomputed values (NULL = none)
+    const BIGNUM        *r,
+    EC_KEY              *eckey)     // EC key
+{
+    // create the task and execute it in the pool
+    AsyncTask *task;
+    if (ASYNC_get_current_job() == NULL || kinv || r ||
+            (task = taskNew(TASK_EC_SIGN, dgst, dlen, ECDSA_size(eckey))) == NULL)
+        return ec_sign_default(type, dgst, dlen, sig, siglen, kinv, r, eckey);
+
+    EC_KEY_up_ref(eckey);
+    task->eckey = eckey;
+    task->type  = type;
+    if (! taskExec(task)) {
+        // the task cannot be executed by the pool: inline
+        taskRelease(task);
+        return ec_sign_default(type, dgst, dlen, sig, siglen, kinv, r, eckey);
+    }
+
+    // copy the result and release the task
+    int result = task->result;
+    if (result == 1) {
+        memcpy(sig, task->to, task->tlen);
+        *siglen = task->tlen;
+    }
+
+    taskRelease(task);
+    return result;
+}
+
+
+/*!
+ *  NAME
+ *      taskNew - create a task
+ *  SYNOPSIS
+ *      AsyncTask* taskNew(
+ *          int                 op,     // operation: TASK_RSA_ENC/TASK_RSA_DEC/TASK_EC_SIGN
+ *          const unsigned char *from,  // input data
+ *          int                 flen,   // input data length
+ *          int                 outlen);    // output data max length
+ *  DESCRIPTION
+ *      taskNew() allocates a task (one reference) with a copy of the input data and the output buffer.
+ *  RETURN VALUE
+ *      Upon successful completion, taskNew() shall return the task. Otherwise, NULL shall be returned.
+ */
+
+static AsyncTask* taskNew(
+    int                 op,         // operation: TASK_RSA_ENC/TASK_RSA_DEC/TASK_EC_SIGN
+    const unsigned char *from,      // input data
+    int                 flen,       // input data length
+    int                 outlen)     // output data max length
+{
+    AsyncTask *task;
+    if (flen < 0 || outlen <= 0 || (task = calloc(1, sizeof(AsyncTask))) == NULL)
+        return NULL;
+
+    task->op   = op;
+    task->flen = flen;
+    task->fd   = -1;
+    atomic_init(&task->refs, 1);
+    atomic_init(&task->done, false);
+    if ((task->from = malloc(flen > 0 ? flen : 1)) == NULL || (task->to = malloc(outlen)) == NULL) {
+        taskRelease(task);
+        return NULL;
+    }
+
+    memcpy(task->from, from, flen);
+    return task;
+}
+
+
+/*!
+ *  NAME
+ *      taskExec - execute a task in the crypto thread pool
+ *  SYNOPSIS
+ *      bool taskExec(
+ *          AsyncTask *task);       // task
+ *  DESCRIPTION
+ *      taskExec() registers the event fd of the task in the wait context of the current async job, queues the task
+ *      and pauses the job until the task is done (the caller of the OpenSSL function gets SSL_ERROR_WANT_ASYNC). If
+ *      the job is never resumed (the connection is freed) the wait context releases the reference of the job.
+ *  RETURN VALUE
+ *      taskExec() shall return true if the task is done. Otherwise (the task could not be queued), false shall be
+ *      returned.
+ */
+
+static bool taskExec(
+    AsyncTask *task)                // task
+{
+    // register the event fd (the wait context owns a reference until the fd is cleared)
+    ASYNC_WAIT_CTX *wctx = ASYNC_get_wait_ctx(ASYNC_get_current_job());
+    if (wctx == NULL || (task->fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) < 0)
+        return false;
+
+    atomic_fetch_add(&task->refs, 1);
+    if (ASYNC_WAIT_CTX_set_wait_fd(wctx, &task_fd_key, task->fd, task, taskFdCleanup) != 1) {
+        atomic_fetch_sub(&task->refs, 1);
+        return false;
+    }
+
+    // queue the task (the pool thread owns a reference), if the pool is not stopped
+    pthread_mutex_lock(&pool_mutex);
+    if (pool_stop) {
+        pthread_mutex_unlock(&pool_mutex);
+        ASYNC_WAIT_CTX_clear_fd(wctx, &task_fd_key);
+        taskRelease(task);
+        return false;
+    }
+
+    atomic_fetch_add(&task->refs, 1);
+    if (pool_tail)
+        pool_tail->next = task;
+    else
+        pool_head = task;
+
+    pool_tail = task;
+    pthread_cond_signal(&pool_cond);
+    pthread_mutex_unlock(&pool_mutex);
+
+    // pause the job until the task is done (a job can be resumed also before)
+    while (! atomic_load(&task->done))
+        ASYNC_pause_job();
+
+    // unregister the event fd and release the reference of the wait context
+    ASYNC_WAIT_CTX_clear_fd(wctx, &task_fd_key);
+    taskRelease(task);
+    return true;
+}
+
+
+/*!
+ *  NAME
+ *      taskRun - run a task
+ *  SYNOPSIS
+ *      void taskRun(
+ *          AsyncTask *task);       // task
+ *  DESCRIPTION
+ *      taskRun() executes the operation of the task with the default OpenSSL implementation (pool thread).
+ *  RETURN VALUE
+ *      None.
+ */
+
+static void taskRun(
+    AsyncTask *task)                // task
+{
+    // execute the operation
+    switch (task->op) {
+    case TASK_RSA_ENC:
+        task->result = rsa_enc_default(task->flen, task->from, task->to, task->rsa, task->padding);
+        break;
+
+    case TASK_RSA_DEC:
+        task->result = rsa_dec_default(task->flen, task->from, task->to, task->rsa, task->padding);
+        break;
+
+    case TASK_EC_SIGN:
+        task->result = ec_sign_default(task->type, task->from, task->flen, task->to, &task->tlen, NULL, NULL,
+                                       task->eckey);
+        break;
+    }
+}
+
+
+/*!
+ *  NAME
+ *      taskRelease - release a task reference
+ *  SYNOPSIS
+ *      void taskRelease(
+ *          AsyncTask *task);       // task
+ *  DESCRIPTION
+ *      taskRelease() drops a reference of the task: the last reference frees the task, its key and its event fd.
+ *  RETURN VALUE
+ *      None.
+ */
+
+static void taskRelease(
+    AsyncTask *task)                // task
+{
+    if (atomic_fetch_sub(&task->refs, 1) != 1)
+        return;
+
+    // last reference: free the task
+    if (task->fd >= 0)
+        close(task->fd);
+
+    RSA_free(task->rsa);
+    EC_KEY_free(task->eckey);
+    free(task->from);
+    free(task->to);
+    free(task);
+}
+
+
+/*!
+ *  NAME
+ *      taskFdCleanup - cleanup of the event fd of a task
+ *  SYNOPSIS
+ *      void taskFdCleanup(
+ *          ASYNC_WAIT_CTX *wctx,   // wait context
+ *          const void     *key,    // fd key
+ *          OSSL_ASYNC_FD  fd,      // event fd
+ *          void           *custom);    // task
+ *  DESCRIPTION
+ *      taskFdCleanup() is called when a wait context is freed with the fd still registered (the job was abandoned):
+ *      it releases the reference of the wait context (the fd is closed with the task).
+ *  RETURN VALUE
+ *      None.
+ */
+
+static void taskFdCleanup(
+    ASYNC_WAIT_CTX *wctx,           // wait context
+    const void     *key,            // fd key
+    OSSL_ASYNC_FD  fd,              // event fd
+    void           *custom)         // task
+{
+    (void)wctx, (void)key, (void)fd;
+    taskRelease(custom);
+}
+
+
+/*!
+ *  NAME
+ *      poolStart - start the crypto thread pool
+ *  SYNOPSIS
+ *      bool poolStart(
+ *          int nthreads);          // min number of threads
+ *  DESCRIPTION
+ *      poolStart() starts new pool threads until the pool has at least nthreads threads.
+ *  RETURN VALUE
+ *      poolStart() shall return true on success. Otherwise, false shall be returned.
+ */
+
+static bool poolStart(
+    int nthreads)                   // min number of threads
+{
+    // pool stopped (sslAsyncCleanup())
+    pthread_mutex_lock(&pool_mutex);
+    if (pool_stop) {
+        pthread_mutex_unlock(&pool_mutex);
+        return false;
+    }
+
+    // start the missing threads (joinable, see sslAsyncCleanup())
+    pthread_t *tids;
+    if (pool_threads < nthreads && (tids = realloc(pool_tids, nthreads * sizeof(pthread_t))) != NULL) {
+        pool_tids = tids;
+        while (pool_threads < nthreads && pthread_create(&pool_tids[pool_threads], NULL, poolThread, NULL) == 0)
+            pool_threads++;
+    }
+
+    // at least a thread is needed
+    bool result = pool_threads > 0;
+    pthread_mutex_unlock(&pool_mutex);
+    return result;
+}
+
+
+/*!
+ *  NAME
+ *      poolThread - crypto pool thread
+ *  SYNOPSIS
+ *      void* poolThread(
+ *          void *arg);             // not used
+ *  DESCRIPTION
+ *      poolThread() executes the queued tasks and signals their event fds, until the stop request of
+ *      sslAsyncCleanup() (the queue is emptied before).
+ *  RETURN VALUE
+ *      poolThread() shall return NULL.
+ */
+
+static void* poolThread(
+    void *arg)                      // not used
+{
+    (void)arg;
+    for (;;) {
+        // get the next task
+        pthread_mutex_lock(&pool_mutex);
+        while (pool_head == NULL && ! pool_stop)
+            pthread_cond_wait(&pool_cond, &pool_mutex);
+
+        if (pool_head == NULL) {
+            // stop request and no more tasks
+            pthread_mutex_unlock(&pool_mutex);
+            break;
+        }
+
+        AsyncTask *task = pool_head;
+        if ((pool_head = task->next) == NULL)
+            pool_tail = NULL;
+
+        pthread_mutex_unlock(&pool_mutex);
+
+        // execute the task and wake up the job (the fd is closed only with the last reference)
+        taskRun(task);
+        atomic_store(&task->done, true);
+        uint64_t one = 1;
+        ssize_t  written = write(task->fd, &one, sizeof(one));
+        (void)written;  // a single write can't overflow the event fd
+
+        taskRelease(task);
+    }
+
+    return NULL;
+}
+#endif
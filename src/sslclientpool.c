@@ -0,0 +1,840 @@
+/*
+ * Copyright © 2019 Aldo Abate <aldo.abate99@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+/*!
+ *  FILE
+ *      sslclientpool.c - client connection pool (warm connections per destination) for MySSL library
+ *  PROJECT
+ *      MySSL library
+ *  FUNCTIONS
+ *      global:
+ *          SslClientPool* sslClientPoolNew(const SslClientPoolOpts *popts, const SslCtxOpts *opts);
+ *          int            sslClientPoolWarm(SslClientPool *pool, const char *host, int port);
+ *          SSL*           sslClientPoolGet(SslClientPool *pool, const char *host, int port, int timeout);
+ *          void           sslClientPoolPut(SslClientPool *pool, SSL *ssl, bool reusable);
+ *          void           sslClientPoolStats(SslClientPool *pool, SslClientPoolStats *stats);
+ *          void           sslClientPoolFree(SslClientPool *pool);
+ *      local:
+ *          SslPoolDest* poolDest(SslClientPool *pool, const char *host, int port);
+ *          SSL*         poolConnect(SslClientPool *pool, SslPoolDest *dest, int64_t deadline);
+ *          bool         poolCheck(SSL *ssl);
+ *          void         poolClose(SSL *ssl, bool do_shutdown);
+ *          int          poolFill(SslClientPool *pool, SslPoolDest *dest);
+ *          void         poolSweep(SslClientPool *pool, SslPoolDest *dest);
+ *          int          poolWait(SslPoolDest *dest, int64_t deadline);
+ *          void*        poolMaintain(void *arg);
+ *  DESCRIPTION
+ *      The MySSL library is a simple interface to OpenSSL library to permits user-friendly writing of Servers and
+ *      Clients using OpenSSL.
+ *  NOTES
+ *      - The free software library "OpenSSL" is distributed under a "dual licensed" system: under the OpenSSL License
+ *        and the SSLeay License. The OpenSSL License is Apache License 1.0 and SSLeay License bears some similarity to
+ *        a 4-clause BSD License. Both licenses apply.
+ *      - The library "OpenSSL" reference version is 1.0.2g
+ *      - Each destination (host:port) has its own lock and list of idle connections: the pool lock (read/write) is
+ *        taken in write mode only to add a new destination, so the threads working on different destinations don't
+ *        contend. The connect, the handshake, the health check and the close are made without any lock.
+ *      - The idle connections are reused LIFO (the most recently used first, the least likely to be closed by the
+ *        peer) and expire from the oldest.
+ *      - The new connections resume the session stored for the destination (see sslConnectSession()): the TLS 1.3
+ *        tickets sent by the server after the handshake are read (and stored) by the health check of the idle
+ *        connections.
+ *  AUTHOR
+ *      Aldo Abate
+ *  OPERATING SYSTEM
+ *      Linux (kernel 2.6.27 and above - glibc 2.9 and above)
+ *  COMPILER
+ *      GNU GCC (ver. 4.4 and above)
+ *  RELEASE
+ *      0.1.0 (August 2019)
+ */
+
+#include "myssl.h"
+#include "myssl-private.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <openssl/err.h>
+
+// idle connection of a destination
+typedef struct {
+    SSL     *ssl;                   // connection
+    int64_t since;                  // start of the idle time in ns (see sslClockNs())
+} PoolIdle;
+
+// destination of the pool (host:port)
+typedef struct SslPoolDest {
+    char                       *host;   // server host
+    int                        port;    // server port
+    struct sockaddr_in         addr;    // server address
+    pthread_mutex_t            mutex;   // destination lock
+    pthread_cond_t             cond;    // a connection is released (waits beyond max_total)
+    PoolIdle                   *idle;   // idle connections (the most recent at the end, max_idle entries)
+    int                        nidle;   // number of idle connections
+    int                        nbusy;   // connections in use or being connected
+    struct SslPoolDest         *next;   // next destination in the bucket
+    struct SslPoolDest         *all;    // next destination in the list of all the destinations
+} SslPoolDest;
+
+// client connection pool
+struct SslClientPool {
+    SSL_CTX                    *ctx;            // client context
+    SslClientPoolOpts          opts;            // options (with the defaults applied)
+    pthread_rwlock_t           lock;            // destinations table lock
+    SslPoolDest                *dests[SSL_CPOOL_BUCKETS];   // destinations table (hash table)
+    _Atomic(SslPoolDest*)      all;             // list of all the destinations (walked without lock)
+    SSL                        **scratch;       // connections to close (maintenance thread, max_idle entries)
+    pthread_t                  tid;             // maintenance thread
+    bool                       started;         // maintenance thread started
+    atomic_bool                stop;            // stop request (sslClientPoolFree())
+    atomic_long                gets;            // statistics (see SslClientPoolStats)
+    atomic_long                reused;
+    atomic_long                connects;
+    atomic_long                resumed;
+    atomic_long                failed;
+    atomic_long                waits;
+    atomic_long                expired;
+    atomic_long                broken;
+};
+
+// local prototypes
+static SslPoolDest* poolDest(SslClientPool *pool, const char *host, int port);
+static SSL*         poolConnect(SslClientPool *pool, SslPoolDest *dest, int64_t deadline);
+static bool         poolCheck(SSL *ssl);
+static void         poolClose(SSL *ssl, bool do_shutdown);
+static int          poolFill(SslClientPool *pool, SslPoolDest *dest);
+static void         poolSweep(SslClientPool *pool, SslPoolDest *dest);
+static int          poolWait(SslPoolDest *dest, int64_t deadline);
+static void*        poolMaintain(void *arg);
+
+
+////////////////////////////////////////////////////////////////////////////////
+// GLOBAL functions
+////////////////////////////////////////////////////////////////////////////////
+
+
+/*!
+ *  NAME
+ *      sslClientPoolNew - create a client connection pool
+ *  SYNOPSIS
+ *      SslClientPool* sslClientPoolNew(
+ *          const SslClientPoolOpts *popts,     // pool options (NULL = defaults)
+ *          const SslCtxOpts        *opts);     // client context options (NULL = default certificate files)
+ *  DESCRIPTION
+ *      sslClientPoolNew() creates the client context (see sslCreateCtxEx()) and an empty pool of established
+ *      connections. With an idle timeout or a pre-warm the maintenance thread is started: every SSL_CPOOL_TICK ms it
+ *      closes the expired and the broken idle connections and reconnects the pre-warm connections of the
+ *      destinations.
+ *  RETURN VALUE
+ *      Upon successful completion, sslClientPoolNew() shall return the pool (to free with sslClientPoolFree()).
+ *      Otherwise (context, allocation or thread error), NULL shall be returned.
+ */
+
+SslClientPool* sslClientPoolNew(
+    const SslClientPoolOpts *popts, // pool options (NULL = defaults)
+    const SslCtxOpts        *opts)  // client context options (NULL = default certificate files)
+{
+    // allocate the pool
+    SslClientPool *pool;
+    if ((pool = calloc(1, sizeof(SslClientPool))) == NULL)
+        return NULL;
+
+    if (popts)
+        pool->opts = *popts;
+
+    if (pool->opts.max_idle <= 0)
+        pool->opts.max_idle = SSL_CPOOL_IDLE;
+
+    if (pool->opts.max_total <= 0)
+        pool->opts.max_total = SSL_CPOOL_TOTAL;
+
+    if (pool->opts.max_idle > pool->opts.max_total)
+        pool->opts.max_idle = pool->opts.max_total;
+
+    if (pool->opts.prewarm > pool->opts.max_idle)
+        pool->opts.prewarm = pool->opts.max_idle;
+
+    if (pool->opts.timeout <= 0)
+        pool->opts.timeout = SSL_CPOOL_TIMEOUT;
+
+    pthread_rwlock_init(&pool->lock, NULL);
+    atomic_init(&pool->all, NULL);
+    atomic_init(&pool->stop, false);
+
+    // create the context and start the maintenance thread (if needed)
+    int error;
+    if ((pool->ctx = sslCreateCtxEx(SSL_CLIENT, opts, &error)) == NULL || error < 0 ||
+            (pool->scratch = calloc(pool->opts.max_idle, sizeof(SSL*))) == NULL)
+        goto error;
+
+    if (pool->opts.idle_timeout > 0 || pool->opts.prewarm > 0) {
+        if (pthread_create(&pool->tid, NULL, poolMaintain, pool) != 0)
+            goto error;
+
+        pool->started = true;
+    }
+
+    return pool;
+
+error:
+    // free the pool
+    sslClientPoolFree(pool);
+    return NULL;
+}
+
+
+/*!
+ *  NAME
+ *      sslClientPoolWarm - pre-warm the connections of a destination
+ *  SYNOPSIS
+ *      int sslClientPoolWarm(
+ *          SslClientPool *pool,    // pool
+ *          const char    *host,    // server host (IPv4 address or name)
+ *          int           port);    // server port
+ *  DESCRIPTION
+ *      sslClientPoolWarm() adds the destination host:port to the pool (if not already known) and opens the idle
+ *      connections missing to the pre-warm (SslClientPoolOpts.prewarm) before returning. Later the maintenance
+ *      thread keeps the pre-warm connections of the destination ready.
+ *  RETURN VALUE
+ *      Upon successful completion, sslClientPoolWarm() shall return the number of idle connections of the
+ *      destination. Otherwise (wrong host, allocation error), -1 shall be returned.
+ */
+
+int sslClientPoolWarm(
+    SslClientPool *pool,            // pool
+    const char    *host,            // server host (IPv4 address or name)
+    int           port)             // server port
+{
+    // get the destination and open the missing connections
+    SslPoolDest *dest;
+    if ((dest = poolDest(pool, host, port)) == NULL)
+        return -1;
+
+    return poolFill(pool, dest);
+}
+
+
+/*!
+ *  NAME
+ *      sslClientPoolGet - acquire an established connection
+ *  SYNOPSIS
+ *      SSL* sslClientPoolGet(
+ *          SslClientPool *pool,    // pool
+ *          const char    *host,    // server host (IPv4 address or name)
+ *          int           port,     // server port
+ *          int           timeout); // timeout in ms (SSL_TIMEOUT_INFINITE, SSL_TIMEOUT_CONN = default timeout)
+ *  DESCRIPTION
+ *      sslClientPoolGet() gets an idle connection to host:port that passes the health check (the peer has not
+ *      closed it, see NOTES) or, when there are no idle connections, opens a new connection (TCP connect and
+ *      handshake resuming the stored session). When the destination already has SslClientPoolOpts.max_total
+ *      connections, sslClientPoolGet() waits that a connection is released. The timeout includes the wait, the
+ *      connect and the handshake. The connection must be released with sslClientPoolPut() (also to close it).
+ *  RETURN VALUE
+ *      Upon successful completion, sslClientPoolGet() shall return the connection (its socket is SSL_get_fd()).
+ *      Otherwise (wrong host, timeout, connect or handshake failure), NULL shall be returned.
+ */
+
+SSL* sslClientPoolGet(
+    SslClientPool *pool,            // pool
+    const char    *host,            // server host (IPv4 address or name)
+    int           port,             // server port
+    int           timeout)          // timeout in ms (SSL_TIMEOUT_INFINITE, SSL_TIMEOUT_CONN = default timeout)
+{
+    // get the destination and compute the deadline
+    SslPoolDest *dest;
+    if ((dest = poolDest(pool, host, port)) == NULL)
+        return NULL;
+
+    if (timeout == SSL_TIMEOUT_CONN)
+        timeout = SSL_CPOOL_TIMEOUT;
+
+    int64_t deadline = timeout < 0 ? -1 : sslClockNs() + (int64_t)timeout * 1000000;
+    atomic_fetch_add(&pool->gets, 1);
+
+    for (;;) {
+        // wait for an idle connection or a free place (beyond max_total connections)
+        pthread_mutex_lock(&dest->mutex);
+        if (dest->nidle == 0 && dest->nbusy >= pool->opts.max_total) {
+            atomic_fetch_add(&pool->waits, 1);
+            while (dest->nidle == 0 && dest->nbusy >= pool->opts.max_total) {
+                if (poolWait(dest, deadline) == ETIMEDOUT) {
+                    pthread_mutex_unlock(&dest->mutex);
+                    return NULL;
+                }
+            }
+        }
+
+        // take the most recent idle connection (or the place of a new one)
+        SSL *ssl = dest->nidle > 0 ? dest->idle[--dest->nidle].ssl : NULL;
+        dest->nbusy++;
+        pthread_mutex_unlock(&dest->mutex);
+
+        // idle connection: reuse it if the peer has not closed it
+        if (ssl) {
+            if (poolCheck(ssl)) {
+                atomic_fetch_add(&pool->reused, 1);
+                return ssl;
+            }
+
+            atomic_fetch_add(&pool->broken, 1);
+            sslClientPoolPut(pool, ssl, false);
+            continue;
+        }
+
+        // no idle connection: open a new connection
+        if ((ssl = poolConnect(pool, dest, deadline)) == NULL) {
+            pthread_mutex_lock(&dest->mutex);
+            dest->nbusy--;
+            pthread_cond_signal(&dest->cond);
+            pthread_mutex_unlock(&dest->mutex);
+        }
+
+        return ssl;
+    }
+}
+
+
+/*!
+ *  NAME
+ *      sslClientPoolPut - release a connection to the pool
+ *  SYNOPSIS
+ *      void sslClientPoolPut(
+ *          SslClientPool *pool,    // pool
+ *          SSL           *ssl,     // connection from sslClientPoolGet()
+ *          bool          reusable);    // connection reusable (the last exchange is complete)
+ *  DESCRIPTION
+ *      sslClientPoolPut() releases a connection got with sslClientPoolGet(). A reusable connection (the last
+ *      operation succeeded, no shutdown and no unread data) is kept idle if the destination has less than
+ *      SslClientPoolOpts.max_idle idle connections; otherwise it is closed (with the close_notify if reusable).
+ *  RETURN VALUE
+ *      None.
+ */
+
+void sslClientPoolPut(
+    SslClientPool *pool,            // pool
+    SSL           *ssl,             // connection from sslClientPoolGet()
+    bool          reusable)         // connection reusable (the last exchange is complete)
+{
+    // get the destination of the connection (a connection not from the pool is just closed)
+    SslConnData *conn = sslConnData(ssl);
+    SslPoolDest *dest = conn ? conn->pool_dest : NULL;
+    if (dest == NULL) {
+        poolClose(ssl, reusable);
+        return;
+    }
+
+    // a connection is reusable only after a completed operation and with all the received data read
+    reusable = reusable && sslStatus(ssl) == SSL_STATUS_OK && SSL_get_shutdown(ssl) == 0 && SSL_pending(ssl) == 0;
+
+    // keep the connection idle (the most recent at the end) or close it
+    pthread_mutex_lock(&dest->mutex);
+    dest->nbusy--;
+    if (reusable && dest->nidle < pool->opts.max_idle) {
+        dest->idle[dest->nidle].ssl   = ssl;
+        dest->idle[dest->nidle].since = sslClockNs();
+        dest->nidle++;
+        ssl = NULL;
+    }
+
+    pthread_cond_signal(&dest->cond);
+    pthread_mutex_unlock(&dest->mutex);
+
+    if (ssl)
+        poolClose(ssl, reusable);
+}
+
+
+/*!
+ *  NAME
+ *      sslClientPoolStats - get the statistics of a client connection pool
+ *  SYNOPSIS
+ *      void sslClientPoolStats(
+ *          SslClientPool      *pool,   // pool
+ *          SslClientPoolStats *stats); // statistics
+ *  DESCRIPTION
+ *      sslClientPoolStats() get the counters of the pool (since its creation), the current number of idle and busy
+ *      connections of all the destinations and the reuse rate (percentage of the connections acquired without a new
+ *      handshake).
+ *  RETURN VALUE
+ *      None.
+ */
+
+void sslClientPoolStats(
+    SslClientPool      *pool,       // pool
+    SslClientPoolStats *stats)      // statistics
+{
+    // get the counters
+    memset(stats, 0, sizeof(SslClientPoolStats));
+    stats->gets     = atomic_load(&pool->gets);
+    stats->reused   = atomic_load(&pool->reused);
+    stats->connects = atomic_load(&pool->connects);
+    stats->resumed  = atomic_load(&pool->resumed);
+    stats->failed   = atomic_load(&pool->failed);
+    stats->waits    = atomic_load(&pool->waits);
+    stats->expired  = atomic_load(&pool->expired);
+    stats->broken   = atomic_load(&pool->broken);
+
+    // count the connections of the destinations
+    for (SslPoolDest *dest = atomic_load(&pool->all); dest; dest = dest->all) {
+        pthread_mutex_lock(&dest->mutex);
+        stats->idle += dest->nidle;
+        stats->busy += dest->nbusy;
+        pthread_mutex_unlock(&dest->mutex);
+    }
+
+    stats->reuse_rate = stats->gets > 0 ? stats->reused * 100.0 / stats->gets : 0.0;
+}
+
+
+/*!
+ *  NAME
+ *      sslClientPoolFree - free a client connection pool
+ *  SYNOPSIS
+ *      void sslClientPoolFree(
+ *          SslClientPool *pool);   // pool
+ *  DESCRIPTION
+ *      sslClientPoolFree() stops the maintenance thread (within SSL_CPOOL_TICK ms), closes the idle connections,
+ *      releases the context and frees the pool. The connections in use must be released before.
+ *  RETURN VALUE
+ *      None.
+ */
+
+void sslClientPoolFree(
+    SslClientPool *pool)            // pool
+{
+    if (pool == NULL)
+        return;
+
+    // stop the maintenance thread
+    atomic_store(&pool->stop, true);
+    if (pool->started)
+        pthread_join(pool->tid, NULL);
+
+    // close the idle connections and free the destinations
+    SslPoolDest *dest = atomic_load(&pool->all);
+    while (dest) {
+        SslPoolDest *next = dest->all;
+        for (int i = 0; i < dest->nidle; i++)
+            poolClose(dest->idle[i].ssl, true);
+
+        pthread_mutex_destroy(&dest->mutex);
+        pthread_cond_destroy(&dest->cond);
+        free(dest->idle);
+        free(dest->host);
+        free(dest);
+        dest = next;
+    }
+
+    if (pool->ctx)
+        sslReleaseCtx(pool->ctx);
+
+    pthread_rwlock_destroy(&pool->lock);
+    free(pool->scratch);
+    free(pool);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// LOCAL functions
+////////////////////////////////////////////////////////////////////////////////
+
+
+/*!
+ *  NAME
+ *      poolDest - get a destination of the pool
+ *  SYNOPSIS
+ *      SslPoolDest* poolDest(
+ *          SslClientPool *pool,    // pool
+ *          const char    *host,    // server host (IPv4 address or name)
+ *          int           port);    // server port
+ *  DESCRIPTION
+ *      poolDest() search the destination host:port in the pool (with the read lock) and adds it if not found
+ *      (resolving the host once, with the write lock). The destinations are freed only with the pool.
+ *  RETURN VALUE
+ *      poolDest() shall return the destination, NULL if the host is not resolved or on allocation error.
+ */
+
+static SslPoolDest* poolDest(
+    SslClientPool *pool,            // pool
+    const char    *host,            // server host (IPv4 address or name)
+    int           port)             // server port
+{
+    // bucket of the destination (djb2 hash function of host and port)
+    unsigned hash = 5381;
+    for (const char *p = host; *p; p++)
+        hash = hash * 33 + (unsigned char)*p;
+
+    SslPoolDest **bucket = &pool->dests[(hash * 33 + port) % SSL_CPOOL_BUCKETS];
+
+    // search the destination
+    SslPoolDest *dest;
+    pthread_rwlock_rdlock(&pool->lock);
+    for (dest = *bucket; dest && (dest->port != port || strcmp(dest->host, host) != 0); dest = dest->next)
+        ;
+
+    pthread_rwlock_unlock(&pool->lock);
+    if (dest)
+        return dest;
+
+    // not found: search it again with the write lock (added by another thread?) and add it
+    pthread_rwlock_wrlock(&pool->lock);
+    for (dest = *bucket; dest && (dest->port != port || strcmp(dest->host, host) != 0); dest = dest->next)
+        ;
+
+    if (dest == NULL && (dest = calloc(1, sizeof(SslPoolDest))) != NULL) {
+        // resolve the host (IPv4)
+        struct addrinfo hints, *res = NULL;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family   = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+        if ((dest->host = strdup(host)) == NULL ||
+                (dest->idle = calloc(pool->opts.max_idle, sizeof(PoolIdle))) == NULL ||
+                getaddrinfo(host, NULL, &hints, &res) != 0) {
+            free(dest->host);
+            free(dest->idle);
+            free(dest);
+            dest = NULL;
+        } else {
+            pthread_condattr_t attr;
+            memcpy(&dest->addr, res->ai_addr, sizeof(struct sockaddr_in));
+            dest->addr.sin_port = htons(port);
+            dest->port          = port;
+            freeaddrinfo(res);
+
+            pthread_mutex_init(&dest->mutex, NULL);
+            pthread_condattr_init(&attr);
+            pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+            pthread_cond_init(&dest->cond, &attr);
+            pthread_condattr_destroy(&attr);
+
+            // add the destination to the bucket and to the list of all the destinations
+            dest->next = *bucket;
+            dest->all  = atomic_load(&pool->all);
+            *bucket    = dest;
+            atomic_store(&pool->all, dest);
+        }
+    }
+
+    pthread_rwlock_unlock(&pool->lock);
+
+    // return the destination (or NULL)
+    return dest;
+}
+
+
+/*!
+ *  NAME
+ *      poolConnect - open a new connection to a destination
+ *  SYNOPSIS
+ *      SSL* poolConnect(
+ *          SslClientPool *pool,    // pool
+ *          SslPoolDest   *dest,    // destination
+ *          int64_t       deadline);    // deadline in ns (see sslDeadline(), -1 = no deadline)
+ *  DESCRIPTION
+ *      poolConnect() connects a non-blocking TCP socket (Nagle algorithm disabled) to the destination and executes
+ *      the handshake resuming the stored session of the destination (see sslConnectSession()), within the deadline.
+ *  RETURN VALUE
+ *      Upon successful completion, poolConnect() shall return the connection. Otherwise, NULL shall be returned.
+ */
+
+static SSL* poolConnect(
+    SslClientPool *pool,            // pool
+    SslPoolDest   *dest,            // destination
+    int64_t       deadline)         // deadline in ns (see sslDeadline(), -1 = no deadline)
+{
+    // connect the socket (non-blocking: wait the connection until the deadline)
+    int           sock, error = 0, on = 1;
+    socklen_t     len = sizeof(error);
+    struct pollfd pfd;
+    SSL           *ssl = NULL;
+    if ((sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_TCP)) < 0)
+        goto error;
+
+    if (connect(sock, (struct sockaddr *)&dest->addr, sizeof(dest->addr)) < 0) {
+        pfd.fd     = sock;
+        pfd.events = POLLOUT;
+        if (errno != EINPROGRESS || sslPoll(&pfd, 1, deadline) <= 0 ||
+                getsockopt(sock, SOL_SOCKET, SO_ERROR, &error, &len) < 0 || error != 0)
+            goto error;
+    }
+
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+    // execute the handshake resuming the stored session (the time left to the deadline)
+    int timeout = SSL_TIMEOUT_INFINITE;
+    if (deadline >= 0 && (timeout = (deadline - sslClockNs()) / 1000000) < 0)
+        timeout = 0;
+
+    SslConnData *conn;
+    if ((ssl = SSL_new(pool->ctx)) == NULL || SSL_set_fd(ssl, sock) != 1 || (conn = sslConnData(ssl)) == NULL)
+        goto error;
+
+    sslSessionAttach(ssl, dest->host, dest->port);
+    if (sslFuncEx(SSL_connect, ssl, timeout) != 1)
+        goto error;
+
+    // connection of the destination
+    conn->pool_dest = dest;
+    atomic_fetch_add(&pool->connects, 1);
+    if (SSL_session_reused(ssl))
+        atomic_fetch_add(&pool->resumed, 1);
+
+    return ssl;
+
+error:
+    // close the socket (and the connection)
+    atomic_fetch_add(&pool->failed, 1);
+    ERR_clear_error();
+    if (ssl)
+        SSL_free(ssl);
+
+    if (sock >= 0)
+        close(sock);
+
+    return NULL;
+}
+
+
+/*!
+ *  NAME
+ *      poolCheck - health check of an idle connection
+ *  SYNOPSIS
+ *      bool poolCheck(
+ *          SSL *ssl);              // idle connection
+ *  DESCRIPTION
+ *      poolCheck() tests if an idle connection is still usable without waiting: a peek of the socket finds nothing
+ *      on a healthy connection. The data received while idle are read: the post-handshake messages (e.g.: the TLS
+ *      1.3 session tickets) are processed by OpenSSL, while the disconnection, the close_notify or any application
+ *      data make the connection unusable.
+ *  RETURN VALUE
+ *      poolCheck() shall return true if the connection is usable. Otherwise, false shall be returned.
+ */
+
+static bool poolCheck(
+    SSL *ssl)                       // idle connection
+{
+    // nothing received: usable connection (the common case, a single system call)
+    char    buf[256];
+    ssize_t result = recv(SSL_get_fd(ssl), buf, 1, MSG_PEEK | MSG_DONTWAIT);
+    if (result < 0)
+        return errno == EAGAIN || errno == EWOULDBLOCK;
+
+    // disconnection or received data: read the records (the socket is non-blocking, see sslDeadline())
+    if (result == 0 || sslReadStep(ssl, buf, sizeof(buf)) != SSL_STEP_WANT_READ)
+        return false;
+
+    sslStatusSet(ssl, SSL_STATUS_OK);
+    return true;
+}
+
+
+/*!
+ *  NAME
+ *      poolClose - close a connection of the pool
+ *  SYNOPSIS
+ *      void poolClose(
+ *          SSL  *ssl,              // connection
+ *          bool do_shutdown);      // send the close_notify
+ *  DESCRIPTION
+ *      poolClose() closes a connection without waiting: the close_notify (if required) is sent with a single step
+ *      of SSL_shutdown() (the close_notify of the peer is not waited). The session of a connection closed without
+ *      a failure stays resumable.
+ *  RETURN VALUE
+ *      None.
+ */
+
+static void poolClose(
+    SSL  *ssl,                      // connection
+    bool do_shutdown)               // send the close_notify
+{
+    // without the close_notify the connection is marked as shut down (unless failed): SSL_free() would remove its
+    // session, that is the stored session of the destination
+    int sock = SSL_get_fd(ssl);
+    if (do_shutdown && ! (SSL_get_shutdown(ssl) & SSL_SENT_SHUTDOWN))
+        sslFuncStep(SSL_shutdown, ssl);
+    else if (sslStatus(ssl) != SSL_STATUS_FATAL)
+        SSL_set_shutdown(ssl, SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN);
+
+    ERR_clear_error();
+    sslClose(ssl, sock, NULL, false);
+}
+
+
+/*!
+ *  NAME
+ *      poolFill - open the pre-warm connections of a destination
+ *  SYNOPSIS
+ *      int poolFill(
+ *          SslClientPool *pool,    // pool
+ *          SslPoolDest   *dest);   // destination
+ *  DESCRIPTION
+ *      poolFill() opens the idle connections missing to the pre-warm of a destination (within the limit of
+ *      max_total connections), each with the pool connect timeout. It stops on the first failure.
+ *  RETURN VALUE
+ *      poolFill() shall return the number of idle connections of the destination.
+ */
+
+static int poolFill(
+    SslClientPool *pool,            // pool
+    SslPoolDest   *dest)            // destination
+{
+    pthread_mutex_lock(&dest->mutex);
+    while (dest->nidle < pool->opts.prewarm && dest->nidle + dest->nbusy < pool->opts.max_total) {
+        // reserve the place of the connection and connect without the lock
+        dest->nbusy++;
+        pthread_mutex_unlock(&dest->mutex);
+        SSL *ssl = poolConnect(pool, dest, sslClockNs() + (int64_t)pool->opts.timeout * 1000000);
+        pthread_mutex_lock(&dest->mutex);
+        dest->nbusy--;
+
+        // new idle connection (unless the idle list has been filled in the meantime)
+        if (ssl && dest->nidle < pool->opts.max_idle) {
+            dest->idle[dest->nidle].ssl   = ssl;
+            dest->idle[dest->nidle].since = sslClockNs();
+            dest->nidle++;
+            ssl = NULL;
+        }
+
+        pthread_cond_signal(&dest->cond);
+        if (ssl) {
+            pthread_mutex_unlock(&dest->mutex);
+            poolClose(ssl, true);
+            pthread_mutex_lock(&dest->mutex);
+            break;
+        }
+
+        if (atomic_load(&pool->stop))
+            break;
+    }
+
+    int nidle = dest->nidle;
+    pthread_mutex_unlock(&dest->mutex);
+    return nidle;
+}
+
+
+/*!
+ *  NAME
+ *      poolSweep - close the expired and the broken idle connections of a destination
+ *  SYNOPSIS
+ *      void poolSweep(
+ *          SslClientPool *pool,    // pool
+ *          SslPoolDest   *dest);   // destination
+ *  DESCRIPTION
+ *      poolSweep() removes from the idle connections of a destination the connections idle for more than
+ *      idle_timeout ms and the connections that don't pass the health check (see poolCheck()), then closes them
+ *      without the lock. It is called only by the maintenance thread (that owns pool->scratch).
+ *  RETURN VALUE
+ *      None.
+ */
+
+static void poolSweep(
+    SslClientPool *pool,            // pool
+    SslPoolDest   *dest)            // destination
+{
+    int64_t limit = pool->opts.idle_timeout > 0 ? sslClockNs() - (int64_t)pool->opts.idle_timeout * 1000000 : -1;
+    int     nexpired = 0, nbroken = 0, nkept = 0;
+
+    // split the idle connections (in order: the oldest first) in kept, expired and broken
+    pthread_mutex_lock(&dest->mutex);
+    for (int i = 0; i < dest->nidle; i++) {
+        PoolIdle *idle = &dest->idle[i];
+        if (idle->since < limit) {
+            pool->scratch[nexpired + nbroken] = idle->ssl;
+            nexpired++;
+        } else if (! poolCheck(idle->ssl)) {
+            pool->scratch[nexpired + nbroken] = idle->ssl;
+            nbroken++;
+        } else
+            dest->idle[nkept++] = *idle;
+    }
+
+    dest->nidle = nkept;
+    if (nexpired + nbroken > 0)
+        pthread_cond_broadcast(&dest->cond);
+
+    pthread_mutex_unlock(&dest->mutex);
+
+    // close the removed connections (the broken ones without the close_notify)
+    atomic_fetch_add(&pool->expired, nexpired);
+    atomic_fetch_add(&pool->broken, nbroken);
+    for (int i = 0; i < nexpired + nbroken; i++)
+        poolClose(pool->scratch[i], SSL_get_shutdown(pool->scratch[i]) == 0);
+}
+
+
+/*!
+ *  NAME
+ *      poolWait - wait for a released connection of a destination
+ *  SYNOPSIS
+ *      int poolWait(
+ *          SslPoolDest *dest,      // destination (locked)
+ *          int64_t     deadline);  // deadline in ns (see sslDeadline(), -1 = no deadline)
+ *  DESCRIPTION
+ *      poolWait() waits on the condition of the destination until a connection is released or the deadline.
+ *  RETURN VALUE
+ *      poolWait() shall return 0 when signaled, ETIMEDOUT if the deadline is elapsed.
+ */
+
+static int poolWait(
+    SslPoolDest *dest,              // destination (locked)
+    int64_t     deadline)           // deadline in ns (see sslDeadline(), -1 = no deadline)
+{
+    if (deadline < 0)
+        return pthread_cond_wait(&dest->cond, &dest->mutex);
+
+    struct timespec ts;
+    ts.tv_sec  = deadline / 1000000000;
+    ts.tv_nsec = deadline % 1000000000;
+    return pthread_cond_timedwait(&dest->cond, &dest->mutex, &ts);
+}
+
+
+/*!
+ *  NAME
+ *      poolMaintain - maintenance thread of the pool
+ *  SYNOPSIS
+ *      void* poolMaintain(
+ *          void *arg);             // pool
+ *  DESCRIPTION
+ *      poolMaintain() every SSL_CPOOL_TICK ms closes the expired and the broken idle connections of all the
+ *      destinations and reopens their pre-warm connections, until the stop request.
+ *  RETURN VALUE
+ *      poolMaintain() shall return NULL.
+ */
+
+static void* poolMaintain(
+    void *arg)                      // pool
+{
+    SslClientPool *pool = arg;
+    while (! atomic_load(&pool->stop)) {
+        usleep(SSL_CPOOL_TICK * 1000);
+        for (SslPoolDest *dest = atomic_load(&pool->all); dest && ! atomic_load(&pool->stop); dest = dest->all) {
+            poolSweep(pool, dest);
+            if (pool->opts.prewarm > 0)
+                poolFill(pool, dest);
+        }
+    }
+
+    return NULL;
+}
@@ -20,6 +20,14 @@
  *  FUNCTIONS
  *      global:
  *          void sslClose(SSL *ssl, int sock, SSL_CTX *ctx, bool do_shutdown);
+ *          void sslCloseEx(SSL *ssl, int sock, SSL_CTX *ctx, int mode, int timeout);
+ *          void sslReaperCleanup(void);
+ *      local:
+ *          int   closeStep(SSL *ssl, bool *sent);
+ *          void  closeFree(SSL *ssl, int sock, SSL_CTX *ctx, bool reset);
+ *          bool  reaperAdd(SSL *ssl, int sock, SSL_CTX *ctx, int64_t deadline, bool sent);
+ *          void  reaperInit(void);
+ *          void* reaperThread(void *arg);
  *  DESCRIPTION
  *      The MySSL library is a simple interface to OpenSSL library to permits user-friendly writing of Servers and
  *      Clients using OpenSSL.
@@ -28,10 +36,19 @@
  *        and the SSLeay License. The OpenSSL License is Apache License 1.0 and SSLeay License bears some similarity to
  *        a 4-clause BSD License. Both licenses apply.
  *      - The library "OpenSSL" reference version is 1.0.2g
+ *      - No close mode waits longer than its timeout: SSL_CLOSE_QUIET never waits (a close_notify that doesn't fit
+ *        in the socket buffer of a peer that doesn't read is dropped), SSL_CLOSE_WAIT waits the close_notify of the
+ *        peer until the timeout and SSL_CLOSE_ASYNC leaves the same wait to the reaper thread, that serves all the
+ *        connections with a single poll().
+ *      - A connection that doesn't complete the shutdown within the timeout is closed with a RST (SO_LINGER with 0
+ *        seconds): the kernel doesn't keep its unsent data and the socket doesn't linger in FIN_WAIT for a peer that
+ *        vanished.
+ *      - The reaper thread is joinable: sslReaperCleanup() (from sslCleanup()) stops it, closing its connections
+ *        with a RST, and frees its tables.
  *  AUTHOR
  *      Aldo Abate
  *  OPERATING SYSTEM
- *      Linux (kernel 2.6 and above - glibc 2.3.2 and above)
+ *      Linux (kernel 2.6.22 and above - glibc 2.8 and above)
  *  COMPILER
  *      GNU GCC (ver. 4.4 and above)
  *  RELEASE
@@ -40,7 +57,41 @@
 
 #include "myssl.h"
 #include "myssl-private.h"
+#include <stdlib.h>
+#include <stdint.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <openssl/err.h>
+
+// connection of the reaper (SSL_CLOSE_ASYNC)
+typedef struct {
+    SSL     *ssl;                   // OpenSSL SSL structure
+    int     sock;                   // socket used by the session
+    SSL_CTX *ctx;                   // context reference to drop (NULL = none)
+    int64_t deadline;               // deadline of the shutdown in ns (-1 = no deadline)
+    bool    sent;                   // close_notify sent
+    short   events;                 // events to wait
+} ReapConn;
+
+// local prototypes
+static int   closeStep(SSL *ssl, bool *sent);
+static void  closeFree(SSL *ssl, int sock, SSL_CTX *ctx, bool reset);
+static bool  reaperAdd(SSL *ssl, int sock, SSL_CTX *ctx, int64_t deadline, bool sent);
+static void  reaperInit(void);
+static void* reaperThread(void *arg);
+
+// local data: connections of the reaper (appended by reaperAdd(), removed only by the reaper thread)
+static ReapConn        *reap_conns = NULL;                          // connections (SSL_REAPER_MAX)
+static struct pollfd   *reap_pfds = NULL;                           // fds of the poll (event fd + connections)
+static int             reap_count = 0;                              // number of connections
+static int             reap_fd = -1;                                // event fd to wake up the reaper thread
+static pthread_t       reap_tid;                                    // reaper thread
+static bool            reap_started = false;                        // reaper thread started (and not stopped)
+static bool            reap_stop = false;                           // stop request (sslReaperCleanup())
+static pthread_mutex_t reap_mutex = PTHREAD_MUTEX_INITIALIZER;      // connections lock
+static pthread_once_t  reap_once = PTHREAD_ONCE_INIT;               // one-time start of the reaper thread
 
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -60,6 +111,9 @@
  *  DESCRIPTION
  *      sslClose() close an active OpenSSL session. Arguments are: ssl (OpenSSL SSL structure), sock (socket used by the session),
  *      ctx (OpenSSL context used by the session), do_shutdown (flag to eventually force the execution of SSL_shutdown()).
+ *      The context is not freed: sslClose() just drops the reference borrowed with sslCreateCtx().
+ *      The shutdown is a blocking SSL_shutdown() (through sslFunc(), within the timeout of the connection) that
+ *      sends the close_notify. The other close modes are available with sslCloseEx().
  *  RETURN VALUE
  *      None.
  */
@@ -70,20 +124,386 @@ void sslClose(
     SSL_CTX *ctx,                   // OpenSSL context used by the session
     bool    do_shutdown)            // flag to eventually force the execution of SSL_shutdown()
 {
-    // frees the SSL structure (and executes shutdown) if allocated
-    if (ssl) {
-        // eventually executes shutdown
-        if (do_shutdown)
-            sslFunc(SSL_shutdown, ssl);
+    // eventually executes shutdown
+    if (ssl && do_shutdown)
+        sslFunc(SSL_shutdown, ssl);
+
+    // free the SSL structure, the socket and the context reference
+    closeFree(ssl, sock, ctx, false);
+}
+
+
+/*!
+ *  NAME
+ *      sslCloseEx - close an OpenSSL session with a close mode
+ *  SYNOPSIS
+ *      void sslCloseEx(
+ *          SSL     *ssl,           // OpenSSL SSL structure (NULL = none)
+ *          int     sock,           // socket used by the session
+ *          SSL_CTX *ctx,           // OpenSSL context used by the session (NULL = none)
+ *          int     mode,           // close mode: SSL_CLOSE_NONE, SSL_CLOSE_QUIET, SSL_CLOSE_WAIT, ...
+ *          int     timeout);       // SSL_CLOSE_WAIT/SSL_CLOSE_ASYNC: shutdown timeout in ms (SSL_TIMEOUT_CONN, ...)
+ *  DESCRIPTION
+ *      sslCloseEx() close an active OpenSSL session like sslClose(), executing the shutdown required by mode:
+ *          SSL_CLOSE_NONE      no close_notify (the peer sees only the FIN)
+ *          SSL_CLOSE_QUIET     the close_notify is sent without waiting (unidirectional shutdown)
+ *          SSL_CLOSE_WAIT      the close_notify is sent and the close_notify of the peer is waited until the timeout
+ *                              (bidirectional shutdown, the data received in the meantime are discarded)
+ *          SSL_CLOSE_ASYNC     as SSL_CLOSE_WAIT, but the connection is handed to the reaper thread and
+ *                              sslCloseEx() returns at once (SSL_CLOSE_QUIET if the reaper has SSL_REAPER_MAX
+ *                              connections)
+ *          SSL_CLOSE_RESET     no close_notify and a RST instead of the FIN (e.g.: abusive peers)
+ *      The shutdowns not completed within the timeout end with a RST (see NOTES). With SSL_TIMEOUT_CONN the timeout
+ *      is the one set with sslSetTimeout() or, if not set, SSL_CLOSE_TIMEOUT (a shutdown doesn't wait as long as the
+ *      data operations).
+ *  RETURN VALUE
+ *      None.
+ */
+
+void sslCloseEx(
+    SSL     *ssl,                   // OpenSSL SSL structure (NULL = none)
+    int     sock,                   // socket used by the session
+    SSL_CTX *ctx,                   // OpenSSL context used by the session (NULL = none)
+    int     mode,                   // close mode: SSL_CLOSE_NONE, SSL_CLOSE_QUIET, SSL_CLOSE_WAIT, ...
+    int     timeout)                // SSL_CLOSE_WAIT/SSL_CLOSE_ASYNC: shutdown timeout in ms (SSL_TIMEOUT_CONN, ...)
+{
+    // no session or no shutdown required
+    if (ssl == NULL || mode == SSL_CLOSE_NONE || mode == SSL_CLOSE_RESET) {
+        closeFree(ssl, sock, ctx, mode == SSL_CLOSE_RESET);
+        return;
+    }
+
+    // default timeout of the shutdown (the connection timeout only if set explicitly)
+    SslConnData *conn;
+    if (timeout == SSL_TIMEOUT_CONN && ((conn = sslConnData(ssl)) == NULL || ! conn->timeout_set))
+        timeout = SSL_CLOSE_TIMEOUT;
+
+    // all the steps are non-blocking (the deadline switches the socket to non-blocking mode)
+    int64_t deadline = sslDeadline(ssl, timeout);
+    bool    sent = false;
+    int     step;
+    switch (mode) {
+    case SSL_CLOSE_WAIT:
+        // bidirectional shutdown until the deadline (a RST if not completed)
+        while ((step = closeStep(ssl, &sent)) < SSL_STEP_ERROR && sslStepWait(ssl, step, deadline))
+            ;
+
+        closeFree(ssl, sock, ctx, step < SSL_STEP_ERROR);
+        break;
+
+    case SSL_CLOSE_ASYNC:
+        // first step here, then the reaper thread
+        if ((step = closeStep(ssl, &sent)) < SSL_STEP_ERROR && reaperAdd(ssl, sock, ctx, deadline, sent))
+            break;
+
+        closeFree(ssl, sock, ctx, false);
+        break;
+
+    default:
+        // SSL_CLOSE_QUIET: send the close_notify (a single step)
+        sslFuncStep(SSL_shutdown, ssl);
+        closeFree(ssl, sock, ctx, false);
+        break;
+    }
+}
+
+
+/*!
+ *  NAME
+ *      sslReaperCleanup - stop the reaper thread
+ *  SYNOPSIS
+ *      void sslReaperCleanup(void);
+ *  DESCRIPTION
+ *      sslReaperCleanup() stops the reaper thread of SSL_CLOSE_ASYNC (its connections are closed at once with a RST)
+ *      and joins it (called by sslCleanup()). The following SSL_CLOSE_ASYNC closes are executed as SSL_CLOSE_QUIET.
+ *  RETURN VALUE
+ *      None.
+ */
+
+void sslReaperCleanup(void)
+{
+    // stop request (the connections can't be added anymore)
+    pthread_mutex_lock(&reap_mutex);
+    bool started = reap_started;
+    reap_started = false;
+    reap_stop    = true;
+    if (started) {
+        uint64_t one = 1;
+        ssize_t  written = write(reap_fd, &one, sizeof(one));
+        (void)written;  // the event fd can't overflow
+    }
+
+    pthread_mutex_unlock(&reap_mutex);
+    if (! started)
+        return;
+
+    // join the thread and free its resources
+    pthread_join(reap_tid, NULL);
+    close(reap_fd);
+    reap_fd = -1;
+    free(reap_conns);
+    free(reap_pfds);
+    reap_conns = NULL;
+    reap_pfds  = NULL;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// LOCAL functions
+////////////////////////////////////////////////////////////////////////////////
+
+
+/*!
+ *  NAME
+ *      closeStep - execute a step of a bidirectional shutdown
+ *  SYNOPSIS
+ *      int closeStep(
+ *          SSL  *ssl,              // OpenSSL SSL structure
+ *          bool *sent);            // close_notify sent (updated)
+ *  DESCRIPTION
+ *      closeStep() sends the close_notify (if not already sent), then reads the connection until the close_notify of
+ *      the peer (or the disconnection), discarding the received data, without waiting. The shutdown is completed
+ *      also when the close_notify can't be sent.
+ *  RETURN VALUE
+ *      closeStep() shall return SSL_STEP_WANT_READ/SSL_STEP_WANT_WRITE/SSL_STEP_WANT_ASYNC if the step must be
+ *      repeated when the event arrives, SSL_STEP_CLOSED when the shutdown is completed, SSL_STEP_ERROR on error.
+ */
+
+static int closeStep(
+    SSL  *ssl,                      // OpenSSL SSL structure
+    bool *sent)                     // close_notify sent (updated)
+{
+    // send the close_notify: 1 = the close_notify of the peer is already received, 0 = sent (a failure, e.g.: a
+    // write still pending in the record layer, ends the shutdown)
+    int step;
+    if (! *sent) {
+        ERR_clear_error();
+        int result = SSL_shutdown(ssl);
+        if (result > 0)
+            return SSL_STEP_CLOSED;
+
+        if (result < 0)
+            return sslStepResult(ssl, result);
+
+        *sent = true;
+    }
+
+    // discard the data until the close_notify of the peer
+    char buf[MYBUFSIZE];
+    while ((step = sslReadStep(ssl, buf, sizeof(buf))) > 0)
+        ;
+
+    return step;
+}
+
+
+/*!
+ *  NAME
+ *      closeFree - free a session and close its socket
+ *  SYNOPSIS
+ *      void closeFree(
+ *          SSL     *ssl,           // OpenSSL SSL structure (NULL = none)
+ *          int     sock,           // socket used by the session
+ *          SSL_CTX *ctx,           // context reference to drop (NULL = none)
+ *          bool    reset);         // close with a RST
+ *  DESCRIPTION
+ *      closeFree() frees the SSL structure, closes the socket (with a RST if required: SO_LINGER with 0 seconds)
+ *      and drops the context reference.
+ *  RETURN VALUE
+ *      None.
+ */
 
-        // free the allocated SSL structure
+static void closeFree(
+    SSL     *ssl,                   // OpenSSL SSL structure (NULL = none)
+    int     sock,                   // socket used by the session
+    SSL_CTX *ctx,                   // context reference to drop (NULL = none)
+    bool    reset)                  // close with a RST
+{
+    // free the allocated SSL structure
+    if (ssl) {
         SSL_free(ssl);
+        ERR_clear_error();
+    }
+
+    // close the socket (a RST discards the unsent data)
+    if (reset) {
+        struct linger lng = { 1, 0 };
+        setsockopt(sock, SOL_SOCKET, SO_LINGER, &lng, sizeof(lng));
     }
 
-    // frees the socket in use
     close(sock);
 
-    // frees context if allocated
+    // drops the context reference if allocated (a registered context stays available for the next connections)
     if (ctx)
-        SSL_CTX_free(ctx);
+        sslReleaseCtx(ctx);
+}
+
+
+/*!
+ *  NAME
+ *      reaperAdd - hand a connection to the reaper thread
+ *  SYNOPSIS
+ *      bool reaperAdd(
+ *          SSL     *ssl,           // OpenSSL SSL structure (close_notify step done)
+ *          int     sock,           // socket used by the session
+ *          SSL_CTX *ctx,           // context reference to drop (NULL = none)
+ *          int64_t deadline,       // deadline of the shutdown in ns (-1 = no deadline)
+ *          bool    sent);          // close_notify sent
+ *  DESCRIPTION
+ *      reaperAdd() starts the reaper thread (on the first call) and adds the connection to the connections of the
+ *      reaper, that completes its shutdown and closes it.
+ *  RETURN VALUE
+ *      reaperAdd() shall return true if the connection is added. Otherwise (SSL_REAPER_MAX connections or reaper
+ *      thread not started), false shall be returned.
+ */
+
+static bool reaperAdd(
+    SSL     *ssl,                   // OpenSSL SSL structure (close_notify step done)
+    int     sock,                   // socket used by the session
+    SSL_CTX *ctx,                   // context reference to drop (NULL = none)
+    int64_t deadline,               // deadline of the shutdown in ns (-1 = no deadline)
+    bool    sent)                   // close_notify sent
+{
+    pthread_once(&reap_once, reaperInit);
+
+    // add the connection (the reaper thread repeats its first step)
+    pthread_mutex_lock(&reap_mutex);
+    bool result = reap_started && reap_count < SSL_REAPER_MAX;
+    if (result) {
+        ReapConn *rc = &reap_conns[reap_count++];
+        rc->ssl      = ssl;
+        rc->sock     = sock;
+        rc->ctx      = ctx;
+        rc->deadline = deadline;
+        rc->sent     = sent;
+        rc->events   = 0;
+
+        // wake up the reaper thread (under the lock: the event fd is closed by sslReaperCleanup())
+        uint64_t one = 1;
+        ssize_t  written = write(reap_fd, &one, sizeof(one));
+        (void)written;  // the event fd can't overflow
+    }
+
+    pthread_mutex_unlock(&reap_mutex);
+    return result;
+}
+
+
+/*!
+ *  NAME
+ *      reaperInit - start the reaper thread
+ *  SYNOPSIS
+ *      void reaperInit(void);
+ *  DESCRIPTION
+ *      reaperInit() creates the event fd and the tables and starts the reaper thread (joinable, it's stopped by
+ *      sslReaperCleanup()). It's called only once through pthread_once().
+ *  RETURN VALUE
+ *      None.
+ */
+
+static void reaperInit(void)
+{
+    pthread_mutex_lock(&reap_mutex);
+    if (! reap_stop && (reap_conns = calloc(SSL_REAPER_MAX, sizeof(ReapConn))) != NULL &&
+            (reap_pfds = calloc(SSL_REAPER_MAX + 1, sizeof(struct pollfd))) != NULL &&
+            (reap_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) >= 0 &&
+            pthread_create(&reap_tid, NULL, reaperThread, NULL) == 0)
+        reap_started = true;
+
+    if (! reap_started) {
+        // error (or library already cleaned up): SSL_CLOSE_ASYNC is executed as SSL_CLOSE_QUIET
+        if (reap_fd >= 0)
+            close(reap_fd);
+
+        free(reap_conns);
+        free(reap_pfds);
+        reap_fd    = -1;
+        reap_conns = NULL;
+        reap_pfds  = NULL;
+    }
+
+    pthread_mutex_unlock(&reap_mutex);
+}
+
+
+/*!
+ *  NAME
+ *      reaperThread - reaper thread
+ *  SYNOPSIS
+ *      void* reaperThread(
+ *          void *arg);             // not used
+ *  DESCRIPTION
+ *      reaperThread() repeats the shutdown steps of its connections when their sockets are ready, until the shutdown
+ *      is completed or the deadline, then closes them (see closeFree()). On the stop request of sslReaperCleanup()
+ *      the remaining connections are closed with a RST.
+ *  RETURN VALUE
+ *      reaperThread() shall return NULL.
+ */
+
+static void* reaperThread(
+    void *arg)                      // not used
+{
+    struct pollfd *pfds = reap_pfds;
+    (void)arg;
+    pfds[0].fd     = reap_fd;
+    pfds[0].events = POLLIN;
+    for (;;) {
+        // the sockets to wait and the nearest deadline (the new connections are stepped at once)
+        int64_t deadline = -1;
+        pthread_mutex_lock(&reap_mutex);
+        if (reap_stop)
+            break;
+
+        int nconn = reap_count;
+        for (int i = 0; i < nconn; i++) {
+            ReapConn *rc = &reap_conns[i];
+            pfds[i + 1].fd      = rc->sock;
+            pfds[i + 1].events  = rc->events;
+            pfds[i + 1].revents = 0;
+            if (rc->events == 0 || (rc->deadline >= 0 && (deadline < 0 || rc->deadline < deadline)))
+                deadline = rc->events == 0 ? 0 : rc->deadline;
+        }
+
+        pthread_mutex_unlock(&reap_mutex);
+
+        // wait the events (the connections added in the meantime wake up the thread)
+        sslPoll(pfds, nconn + 1, deadline);
+        if (pfds[0].revents & POLLIN) {
+            uint64_t count;
+            ssize_t  rcvd = read(reap_fd, &count, sizeof(count));
+            (void)rcvd;
+        }
+
+        // step the ready connections and close the done or expired ones (the added ones stay after nconn)
+        int64_t now = sslClockNs();
+        pthread_mutex_lock(&reap_mutex);
+        int nkept = 0;
+        for (int i = 0; i < reap_count; i++) {
+            ReapConn rc = reap_conns[i];
+            int      step = SSL_STEP_WANT_READ;
+            if (i >= nconn || rc.events == 0 || pfds[i + 1].revents != 0)
+                step = closeStep(rc.ssl, &rc.sent);
+
+            if (step >= SSL_STEP_ERROR || (rc.deadline >= 0 && now >= rc.deadline)) {
+                pthread_mutex_unlock(&reap_mutex);
+                closeFree(rc.ssl, rc.sock, rc.ctx, step < SSL_STEP_ERROR);
+                pthread_mutex_lock(&reap_mutex);
+                continue;
+            }
+
+            rc.events = step == SSL_STEP_WANT_WRITE ? POLLOUT : POLLIN;
+            reap_conns[nkept++] = rc;
+        }
+
+        reap_count = nkept;
+        pthread_mutex_unlock(&reap_mutex);
+    }
+
+    // stop request: close the connections with a RST (the shutdowns are not completed)
+    for (int i = 0; i < reap_count; i++)
+        closeFree(reap_conns[i].ssl, reap_conns[i].sock, reap_conns[i].ctx, true);
+
+    reap_count = 0;
+    pthread_mutex_unlock(&reap_mutex);
+    return NULL;
 }
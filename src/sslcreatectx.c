@@ -20,6 +20,16 @@
  *  FUNCTIONS
  *      global:
  *          SSL_CTX* sslCreateCtx(int type, int *error);
+ *          SSL_CTX* sslCreateCtxEx(int type, const SslCtxOpts *opts, int *error);
+ *          void     sslCtxOptsDefaults(SslCtxOpts *dst, const SslCtxOpts *src);
+ *          bool     sslCtxOptsCopy(SslCtxOpts *dst, const SslCtxOpts *src);
+ *          void     sslCtxOptsFree(SslCtxOpts *opts);
+ *          bool     sslCtxOptsEqual(const SslCtxOpts *opts1, const SslCtxOpts *opts2);
+ *          SSL_CTX* sslCtxBuild(int type, const SslCtxOpts *opts, int *error);
+ *      local:
+ *          int      optsStrings(SslCtxOpts *opts, const char ***strings);
+ *          bool     strEqual(const char *str1, const char *str2);
+ *          bool     profileApply(SSL_CTX *ctx, const char *profile);
  *  DESCRIPTION
  *      The MySSL library is a simple interface to OpenSSL library to permits user-friendly writing of Servers and
  *      Clients using OpenSSL.
@@ -40,6 +50,34 @@
 
 #include "myssl.h"
 #include "myssl-private.h"
+#include <stdlib.h>
+#include <string.h>
+
+// handshake profile: minimum protocol version, key exchange groups, signature algorithms and ciphers (up to TLS 1.2)
+typedef struct {
+    const char *name;       // profile name
+    int        min_version; // minimum protocol version (0 = OpenSSL default)
+    const char *groups;     // groups (curves) in preference order (NULL = OpenSSL default)
+    const char *sigalgs;    // signature algorithms in preference order (NULL = OpenSSL default)
+    const char *ciphers;    // ciphers up to TLS 1.2 (NULL = OpenSSL default)
+} CtxProfile;
+
+// local prototypes
+static int  optsStrings(SslCtxOpts *opts, const char ***strings);
+static bool strEqual(const char *str1, const char *str2);
+static bool profileApply(SSL_CTX *ctx, const char *profile);
+
+// local data: profiles table. X25519 first avoids the HelloRetryRequest (1 more RTT) with the clients that offer it, the
+// ECDSA/Ed25519 signatures cost much less than RSA on the server
+static const CtxProfile profiles[] = {
+    { SSL_PROFILE_DEFAULT, 0, NULL, NULL, NULL },
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+    { SSL_PROFILE_FAST,    TLS1_3_VERSION, "X25519:P-256",
+      "ed25519:ecdsa_secp256r1_sha256:rsa_pss_rsae_sha256:rsa_pkcs1_sha256", NULL },
+    { SSL_PROFILE_COMPAT,  TLS1_2_VERSION, "X25519:P-256:P-384", NULL,
+      "ECDHE+AESGCM:ECDHE+CHACHA20:ECDHE+AES" },
+#endif
+};
 
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -55,8 +93,8 @@
  *          int type,               // context type: SSL_SERVER/SSL_CLIENT
  *          int *error);            // error flag
  *  DESCRIPTION
- *      sslCreateCtx() create a new OpenSSL context. createSSLContex() execute the necessary initial actions to use the OpenSSL library and open/verify the
- *      certificate files.
+ *      sslCreateCtx() create a new OpenSSL context using the default certificate files. It's equivalent to a call of
+ *      sslCreateCtxEx() with opts=NULL.
  *  RETURN VALUE
  *      Upon successful completion, sslCreateCtx() shall return a valid OpenSSL context-descriptor.
  *      Otherwise, NULL shall be returned and an error flag is set to indicate the error.
@@ -66,12 +104,209 @@ SSL_CTX* sslCreateCtx(
     int type,                       // context type: SSL_SERVER/SSL_CLIENT
     int *error)                     // error flag
 {
-    // Load encryption & hashing algorithms for the SSL program
-    SSL_library_init();
+    // create (or borrow) a context with the default options
+    return sslCreateCtxEx(type, NULL, error);
+}
+
+
+/*!
+ *  NAME
+ *      sslCreateCtxEx - create an OpenSSL context with options
+ *  SYNOPSIS
+ *      SSL_CTX* sslCreateCtxEx(
+ *          int              type,  // context type: SSL_SERVER/SSL_CLIENT
+ *          const SslCtxOpts *opts, // context options (NULL = default options)
+ *          int              *error);   // error flag
+ *  DESCRIPTION
+ *      sslCreateCtxEx() return an OpenSSL context for the required type and credential set. The contexts are kept in a
+ *      thread-safe registry: the first call for a type/credential set initializes the OpenSSL library (only once),
+ *      opens/verifies the certificate files and registers the new context, the following calls just borrow a reference
+ *      to the registered context. The borrowed reference must be dropped with sslReleaseCtx() (or sslClose()).
+ *  RETURN VALUE
+ *      Upon successful completion, sslCreateCtxEx() shall return a valid OpenSSL context-descriptor.
+ *      Otherwise, NULL shall be returned and an error flag is set to indicate the error.
+ */
+
+SSL_CTX* sslCreateCtxEx(
+    int              type,          // context type: SSL_SERVER/SSL_CLIENT
+    const SslCtxOpts *opts,         // context options (NULL = default options)
+    int              *error)        // error flag
+{
+    // one-time initialization of the OpenSSL library (fails after sslCleanup())
+    if (! sslLibInit()) {
+        *error = -1;
+        return NULL;
+    }
+
+    // set the options (the fields not set assume the default values)
+    SslCtxOpts my_opts;
+    sslCtxOptsDefaults(&my_opts, opts);
+
+    // search the context in the registry: if found borrow it
+    *error = 0;     // default: no error
+    SSL_CTX *my_ctx;
+    if ((my_ctx = sslCtxLookup(type, &my_opts)) != NULL)
+        return my_ctx;
+
+    // context not found: build a new context
+    if ((my_ctx = sslCtxBuild(type, &my_opts, error)) == NULL || *error < 0) {
+        // error: return context (the caller frees it with sslClose())
+        return my_ctx;
+    }
+
+    // register the new context (if another thread registered the same context in the meantime, the new one is freed
+    // and the registered one is returned)
+    return sslCtxRegister(type, &my_opts, my_ctx);
+}
+
+
+/*!
+ *  NAME
+ *      sslCtxOptsDefaults - set the default context options
+ *  SYNOPSIS
+ *      void sslCtxOptsDefaults(
+ *          SslCtxOpts       *dst,  // options with the defaults
+ *          const SslCtxOpts *src); // options (NULL = default options)
+ *  DESCRIPTION
+ *      sslCtxOptsDefaults() copies the options src in dst setting the default values of the fields not set.
+ *  RETURN VALUE
+ *      None.
+ */
+
+void sslCtxOptsDefaults(
+    SslCtxOpts       *dst,          // options with the defaults
+    const SslCtxOpts *src)          // options (NULL = default options)
+{
+    // copy the options
+    SslCtxOpts defaults = { NULL };
+    *dst = src ? *src : defaults;
+
+    // set the default certificate files
+    if (dst->cert == NULL)
+        dst->cert = RSA_SERVER_CERT;
+
+    if (dst->key == NULL)
+        dst->key = RSA_SERVER_KEY;
+
+    if (dst->cacert == NULL)
+        dst->cacert = RSA_CLIENT_CA_CERT;
+}
+
+
+/*!
+ *  NAME
+ *      sslCtxOptsCopy - copy the context options
+ *  SYNOPSIS
+ *      bool sslCtxOptsCopy(
+ *          SslCtxOpts       *dst,  // copy of the options
+ *          const SslCtxOpts *src); // options
+ *  DESCRIPTION
+ *      sslCtxOptsCopy() copies the options src in dst duplicating the strings: the copy must be freed with
+ *      sslCtxOptsFree().
+ *  RETURN VALUE
+ *      sslCtxOptsCopy() shall return true on success. Otherwise (allocation error), false shall be returned.
+ */
+
+bool sslCtxOptsCopy(
+    SslCtxOpts       *dst,          // copy of the options
+    const SslCtxOpts *src)          // options
+{
+    // copy the options and duplicate the strings
+    *dst = *src;
+    const char **strings[8];
+    int n = optsStrings(dst, strings);
+    for (int i = 0; i < n; i++) {
+        if (*strings[i] && (*strings[i] = strdup(*strings[i])) == NULL) {
+            // allocation error: free the strings already duplicated
+            while (--i >= 0)
+                free((char *)*strings[i]);
+
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+/*!
+ *  NAME
+ *      sslCtxOptsFree - free a copy of the context options
+ *  SYNOPSIS
+ *      void sslCtxOptsFree(
+ *          SslCtxOpts *opts);      // options copied by sslCtxOptsCopy()
+ *  DESCRIPTION
+ *      sslCtxOptsFree() frees the strings of a copy of the options made by sslCtxOptsCopy().
+ *  RETURN VALUE
+ *      None.
+ */
+
+void sslCtxOptsFree(
+    SslCtxOpts *opts)               // options copied by sslCtxOptsCopy()
+{
+    // free the strings
+    const char **strings[8];
+    int n = optsStrings(opts, strings);
+    for (int i = 0; i < n; i++) {
+        free((char *)*strings[i]);
+        *strings[i] = NULL;
+    }
+}
+
+
+/*!
+ *  NAME
+ *      sslCtxOptsEqual - compare two context options
+ *  SYNOPSIS
+ *      bool sslCtxOptsEqual(
+ *          const SslCtxOpts *opts1,    // first options
+ *          const SslCtxOpts *opts2);   // second options
+ *  DESCRIPTION
+ *      sslCtxOptsEqual() compare two context options (the strings are compared by value).
+ *  RETURN VALUE
+ *      sslCtxOptsEqual() shall return true if the options are equal. Otherwise, false shall be returned.
+ */
+
+bool sslCtxOptsEqual(
+    const SslCtxOpts *opts1,        // first options
+    const SslCtxOpts *opts2)        // second options
+{
+    // compare the credential set and the other options
+    return strEqual(opts1->cert, opts2->cert) && strEqual(opts1->key, opts2->key) &&
+           strEqual(opts1->cacert, opts2->cacert) && opts1->sess_cache_size == opts2->sess_cache_size &&
+           opts1->sess_timeout == opts2->sess_timeout && opts1->no_tickets == opts2->no_tickets &&
+           opts1->max_early_data == opts2->max_early_data && opts1->early_data_window == opts2->early_data_window &&
+           strEqual(opts1->ticket_keys, opts2->ticket_keys) && opts1->ticket_rotate == opts2->ticket_rotate &&
+           opts1->ticket_keep == opts2->ticket_keep && strEqual(opts1->profile, opts2->profile) &&
+           strEqual(opts1->cert2, opts2->cert2) && strEqual(opts1->key2, opts2->key2) &&
+           opts1->async_workers == opts2->async_workers && opts1->ktls == opts2->ktls &&
+           opts1->record_boost == opts2->record_boost && opts1->record_idle == opts2->record_idle &&
+           opts1->release_buffers == opts2->release_buffers && opts1->io_timeout == opts2->io_timeout;
+}
 
-    // Load the error strings for SSL & CRYPTO APIs
-    SSL_load_error_strings();
 
+/*!
+ *  NAME
+ *      sslCtxBuild - build a new OpenSSL context
+ *  SYNOPSIS
+ *      SSL_CTX* sslCtxBuild(
+ *          int              type,  // context type: SSL_SERVER/SSL_CLIENT
+ *          const SslCtxOpts *opts, // context options
+ *          int              *error);   // error flag
+ *  DESCRIPTION
+ *      sslCtxBuild() create a new OpenSSL context (not registered), open/verify the certificate files and configure the session resumption:
+ *      the server context gets a session cache (with the required size and timeout) and a session ID context, the client
+ *      context stores the new sessions in the MySSL client sessions store under its own identity (see sslConnectSession()).
+ *  RETURN VALUE
+ *      Upon successful completion, sslCtxBuild() shall return a valid OpenSSL context-descriptor.
+ *      Otherwise, NULL shall be returned and an error flag is set to indicate the error.
+ */
+
+SSL_CTX* sslCtxBuild(
+    int              type,          // context type: SSL_SERVER/SSL_CLIENT
+    const SslCtxOpts *opts,         // context options
+    int              *error)        // error flag
+{
     // Create a SSL_METHOD structure (choose a SSL/TLS protocol version)
     const SSL_METHOD *meth = SSLv23_method();
 
@@ -87,14 +322,14 @@ SSL_CTX* sslCreateCtx(
     // test mode (server/client)
     if (type == SSL_SERVER) {
         // SERVER: load the server certificate into the SSL_CTX structure
-        if (SSL_CTX_use_certificate_file(my_ctx, RSA_SERVER_CERT, SSL_FILETYPE_PEM) != 1) {
+        if (SSL_CTX_use_certificate_file(my_ctx, opts->cert, SSL_FILETYPE_PEM) != 1) {
             // error: set error flag and return context
             *error = -1;
             return my_ctx;
         }
 
         // load the private-key corresponding to the server certificate
-        if (SSL_CTX_use_PrivateKey_file(my_ctx, RSA_SERVER_KEY, SSL_FILETYPE_PEM) != 1) {
+        if (SSL_CTX_use_PrivateKey_file(my_ctx, opts->key, SSL_FILETYPE_PEM) != 1) {
             // error: set error flag and return context
             *error = -1;
             return my_ctx;
@@ -106,10 +341,61 @@ SSL_CTX* sslCreateCtx(
             *error = -1;
             return my_ctx;
         }
+
+        // load the second certificate/private-key (of another key type, e.g.: ECDSA with RSA): OpenSSL keeps a
+        // certificate for each key type and chooses it in the handshake according to the client signature algorithms
+        if (opts->cert2 && (SSL_CTX_use_certificate_file(my_ctx, opts->cert2, SSL_FILETYPE_PEM) != 1 ||
+                            opts->key2 == NULL ||
+                            SSL_CTX_use_PrivateKey_file(my_ctx, opts->key2, SSL_FILETYPE_PEM) != 1 ||
+                            SSL_CTX_check_private_key(my_ctx) != 1)) {
+            // error: set error flag and return context
+            *error = -1;
+            return my_ctx;
+        }
+
+        // hand the private-key operations to the crypto thread pool (the handshake is resumed when they are done)
+        if (opts->async_workers > 0 && ! sslAsyncKeysInit(my_ctx, opts)) {
+            // error: set error flag and return context
+            *error = -1;
+            return my_ctx;
+        }
+
+        // set the session cache and the session ID context (required to resume the sessions)
+        SSL_CTX_set_session_cache_mode(my_ctx, SSL_SESS_CACHE_SERVER);
+        if (SSL_CTX_set_session_id_context(my_ctx, (const unsigned char *)SSL_SESS_ID_CTX,
+                                           sizeof(SSL_SESS_ID_CTX) - 1) != 1) {
+            // error: set error flag and return context
+            *error = -1;
+            return my_ctx;
+        }
+
+        if (opts->sess_cache_size > 0)
+            SSL_CTX_sess_set_cache_size(my_ctx, opts->sess_cache_size);
+
+        if (opts->no_tickets)
+            SSL_CTX_set_options(my_ctx, SSL_OP_NO_TICKET);
+
+        // use the ticket keys shared with the other processes (instead of the internal keys of the context)
+        if (opts->ticket_keys && ! sslTicketKeysInit(my_ctx, opts)) {
+            // error: set error flag and return context
+            *error = -1;
+            return my_ctx;
+        }
+
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+        // enable the early data (0-RTT): the session cache (set above) activates the OpenSSL replay protection (a
+        // ticket is accepted only once) and the callback rejects the tickets older than the anti-replay window
+        if (opts->max_early_data > 0) {
+            long window = opts->early_data_window > 0 ? opts->early_data_window : SSL_EARLY_WINDOW;
+            SSL_CTX_set_max_early_data(my_ctx, opts->max_early_data);
+            SSL_CTX_set_recv_max_early_data(my_ctx, opts->max_early_data);
+            SSL_CTX_set_allow_early_data_cb(my_ctx, sslEarlyDataAllow, (void *)window);
+        }
+#endif
     }
     else {
         // CLIENT: load the RSA CA certificate into the SSL_CTX structure. This will allow this client to verify the server's certificate
-        if (SSL_CTX_load_verify_locations(my_ctx, RSA_CLIENT_CA_CERT, NULL) != 1) {
+        if (SSL_CTX_load_verify_locations(my_ctx, opts->cacert, NULL) != 1) {
             // error: set error flag and return context
             *error = -1;
             return my_ctx;
@@ -118,9 +404,182 @@ SSL_CTX* sslCreateCtx(
         // set flag in context to require peer (server) certificate verification
         SSL_CTX_set_verify(my_ctx, SSL_VERIFY_PEER, NULL);
         SSL_CTX_set_verify_depth(my_ctx, 1);
+
+        // the new sessions are saved in the client sessions store (not in the internal cache of the context), under
+        // the identity of the context: a session is resumed only by the context that verified it
+        SSL_CTX_set_session_cache_mode(my_ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+        SSL_CTX_sess_set_new_cb(my_ctx, sslSessionNew);
+        if (! sslSessionCtxInit(my_ctx)) {
+            // error (allocation): set error flag and return context
+            *error = -1;
+            return my_ctx;
+        }
+    }
+
+    // set the sessions timeout
+    if (opts->sess_timeout > 0)
+        SSL_CTX_set_timeout(my_ctx, opts->sess_timeout);
+
+    // apply the handshake profile (protocol versions, key exchange groups, signature algorithms and ciphers)
+    if (! profileApply(my_ctx, opts->profile)) {
+        // error (unknown profile): set error flag and return context
+        *error = -1;
+        return my_ctx;
+    }
+
+    // enable the kernel TLS offload: after the handshake the kernel encrypts/decrypts the records, if it supports the
+    // negotiated cipher (otherwise OpenSSL does it as usual, see sslKtls())
+    if (opts->ktls) {
+        if (sslKtlsAvail() == 0) {
+            // error (OpenSSL without KTLS or kernel without the tls module): set error flag and return context
+            *error = -1;
+            return my_ctx;
+        }
+
+#ifdef SSL_OP_ENABLE_KTLS
+        SSL_CTX_set_options(my_ctx, SSL_OP_ENABLE_KTLS);
+#endif
+    }
+
+    // release the record buffers of the idle connections (allocated again, from the pool with SSL_ALLOC_POOL)
+    if (opts->release_buffers)
+        SSL_CTX_set_mode(my_ctx, SSL_MODE_RELEASE_BUFFERS);
+
+    // dynamic record sizing of the writes (see sslRecordSize())
+    if (opts->record_boost > 0) {
+        SslCtxData *ctxdata;
+        if ((ctxdata = sslCtxData(my_ctx)) == NULL) {
+            // error (allocation): set error flag and return context
+            *error = -1;
+            return my_ctx;
+        }
+
+        ctxdata->rec_boost = opts->record_boost;
+        ctxdata->rec_idle  = opts->record_idle;
+    }
+
+    // default timeout of the connection operations (see sslDeadline())
+    if (opts->io_timeout != 0) {
+        SslCtxData *ctxdata;
+        if (opts->io_timeout < SSL_TIMEOUT_INFINITE || (ctxdata = sslCtxData(my_ctx)) == NULL) {
+            // error (invalid timeout or allocation): set error flag and return context
+            *error = -1;
+            return my_ctx;
+        }
+
+        ctxdata->io_timeout = opts->io_timeout;
     }
 
     // unset error flag and return a valid OpenSSL context-descriptor
     *error = 0;
     return my_ctx;
 }
+
+
+////////////////////////////////////////////////////////////////////////////////
+// LOCAL functions
+////////////////////////////////////////////////////////////////////////////////
+
+/*!
+ *  NAME
+ *      optsStrings - get the string fields of the context options
+ *  SYNOPSIS
+ *      int optsStrings(
+ *          SslCtxOpts *opts,           // context options
+ *          const char ***strings);     // addresses of the string fields (8 entries at least)
+ *  DESCRIPTION
+ *      optsStrings() stores in strings the addresses of the string fields of the options.
+ *  RETURN VALUE
+ *      optsStrings() shall return the number of string fields.
+ */
+
+static int optsStrings(
+    SslCtxOpts *opts,               // context options
+    const char ***strings)          // addresses of the string fields (8 entries at least)
+{
+    // list the string fields
+    int n = 0;
+    strings[n++] = &opts->cert;
+    strings[n++] = &opts->key;
+    strings[n++] = &opts->cacert;
+    strings[n++] = &opts->ticket_keys;
+    strings[n++] = &opts->profile;
+    strings[n++] = &opts->cert2;
+    strings[n++] = &opts->key2;
+    return n;
+}
+
+
+/*!
+ *  NAME
+ *      strEqual - compare two strings
+ *  SYNOPSIS
+ *      bool strEqual(
+ *          const char *str1,       // first string (may be NULL)
+ *          const char *str2);      // second string (may be NULL)
+ *  DESCRIPTION
+ *      strEqual() compare two strings that may be NULL.
+ *  RETURN VALUE
+ *      strEqual() shall return true if the strings are equal (or both NULL). Otherwise, false shall be returned.
+ */
+
+static bool strEqual(
+    const char *str1,               // first string (may be NULL)
+    const char *str2)               // second string (may be NULL)
+{
+    // compare the strings
+    if (str1 == NULL || str2 == NULL)
+        return str1 == str2;
+
+    return strcmp(str1, str2) == 0;
+}
+
+
+/*!
+ *  NAME
+ *      profileApply - apply an handshake profile to a context
+ *  SYNOPSIS
+ *      bool profileApply(
+ *          SSL_CTX    *ctx,        // OpenSSL context
+ *          const char *profile);   // profile name (NULL = SSL_PROFILE_DEFAULT)
+ *  DESCRIPTION
+ *      profileApply() searches the profile in the profiles table and sets the minimum protocol version, the key
+ *      exchange groups, the signature algorithms and the ciphers of the context.
+ *  RETURN VALUE
+ *      profileApply() shall return true on success. Otherwise (unknown profile or OpenSSL error), false shall be
+ *      returned.
+ */
+
+static bool profileApply(
+    SSL_CTX    *ctx,                // OpenSSL context
+    const char *profile)            // profile name (NULL = SSL_PROFILE_DEFAULT)
+{
+    // search the profile
+    const CtxProfile *prof = NULL;
+    for (size_t i = 0; i < sizeof(profiles) / sizeof(profiles[0]); i++) {
+        if (strcmp(profiles[i].name, profile ? profile : SSL_PROFILE_DEFAULT) == 0) {
+            prof = &profiles[i];
+            break;
+        }
+    }
+
+    if (prof == NULL)
+        return false;
+
+    // set the profile parameters (only the ones set)
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+    if (prof->min_version && SSL_CTX_set_min_proto_version(ctx, prof->min_version) != 1)
+        return false;
+
+    if (prof->groups && SSL_CTX_set1_groups_list(ctx, prof->groups) != 1)
+        return false;
+
+    if (prof->sigalgs && SSL_CTX_set1_sigalgs_list(ctx, prof->sigalgs) != 1)
+        return false;
+#endif
+
+    if (prof->ciphers && SSL_CTX_set_cipher_list(ctx, prof->ciphers) != 1)
+        return false;
+
+    return true;
+}
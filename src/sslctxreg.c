@@ -0,0 +1,388 @@
+/*
+ * Copyright © 2019 Aldo Abate <aldo.abate99@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+/*!
+ *  FILE
+ *      sslctxreg.c - OpenSSL contexts registry for MySSL library
+ *  PROJECT
+ *      MySSL library
+ *  FUNCTIONS
+ *      global:
+ *          void     sslReleaseCtx(SSL_CTX *ctx);
+ *          void     sslFlushCtx(void);
+ *          SSL_CTX* sslCtxLookup(int type, const SslCtxOpts *opts);
+ *          SSL_CTX* sslCtxRegister(int type, const SslCtxOpts *opts, SSL_CTX *ctx);
+ *          void     sslCtxReplace(int type, const SslCtxOpts *opts, SSL_CTX *ctx);
+ *      local:
+ *          CtxEntry* entryFind(int type, const SslCtxOpts *opts);
+ *          CtxEntry* entryAlloc(int type, const SslCtxOpts *opts, SSL_CTX *ctx);
+ *          void      entryFree(CtxEntry *entry);
+ *          void      ctxSync(void);
+ *  DESCRIPTION
+ *      The MySSL library is a simple interface to OpenSSL library to permits user-friendly writing of Servers and
+ *      Clients using OpenSSL.
+ *  NOTES
+ *      - The free software library "OpenSSL" is distributed under a "dual licensed" system: under the OpenSSL License
+ *        and the SSLeay License. The OpenSSL License is Apache License 1.0 and SSLeay License bears some similarity to
+ *        a 4-clause BSD License. Both licenses apply.
+ *      - The library "OpenSSL" reference version is 1.0.2g
+ *      - The lookups don't take any lock: the entries list and the context of an entry are read with atomic loads
+ *        inside a read section (a counter of the current epoch). A reload publishes the new context with an atomic
+ *        exchange and sslFlushCtx() detaches the whole list, then both wait a grace period (ctxSync(): the epoch is
+ *        flipped and the readers of the previous epoch drain) before dropping the registry reference of the old
+ *        context or freeing the entries: no lookup can still be reading them.
+ *  AUTHOR
+ *      Aldo Abate
+ *  OPERATING SYSTEM
+ *      Linux (kernel 2.6 and above - glibc 2.3.2 and above)
+ *  COMPILER
+ *      GNU GCC (ver. 4.4 and above)
+ *  RELEASE
+ *      0.1.0 (August 2019)
+ */
+
+#include "myssl.h"
+#include "myssl-private.h"
+#include <stdlib.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sched.h>
+
+// registry entry: a context and its key (type + options). The entries are removed only by sslFlushCtx() and the
+// context is replaced with an atomic exchange, both followed by a grace period (see NOTES)
+typedef struct CtxEntry {
+    int                type;        // context type: SSL_SERVER/SSL_CLIENT
+    SslCtxOpts         opts;        // context options (the strings are owned by the entry)
+    _Atomic(SSL_CTX *) ctx;         // registered context (the registry holds a reference)
+    struct CtxEntry    *next;       // next entry
+} CtxEntry;
+
+// local prototypes
+static CtxEntry* entryFind(int type, const SslCtxOpts *opts);
+static CtxEntry* entryAlloc(int type, const SslCtxOpts *opts, SSL_CTX *ctx);
+static void      entryFree(CtxEntry *entry);
+static void      ctxSync(void);
+
+// local data
+static _Atomic(CtxEntry *) ctx_list  = NULL;                        // registry entries list
+static pthread_mutex_t     ctx_mutex = PTHREAD_MUTEX_INITIALIZER;   // registry lock (insert/replace/flush only)
+static atomic_uint         ctx_epoch = 0;                           // current epoch of the lookups (see ctxSync())
+static atomic_long         ctx_readers[2];                          // lookups in progress per epoch parity
+
+
+////////////////////////////////////////////////////////////////////////////////
+// GLOBAL functions
+////////////////////////////////////////////////////////////////////////////////
+
+
+/*!
+ *  NAME
+ *      sslReleaseCtx - release an OpenSSL context
+ *  SYNOPSIS
+ *      void sslReleaseCtx(
+ *          SSL_CTX *ctx);          // OpenSSL context to release
+ *  DESCRIPTION
+ *      sslReleaseCtx() drops a reference to a context returned by sslCreateCtx()/sslCreateCtxEx(). A registered
+ *      context stays alive in the registry (ready for the next connection) until sslFlushCtx() is called.
+ *  RETURN VALUE
+ *      None.
+ */
+
+void sslReleaseCtx(
+    SSL_CTX *ctx)                   // OpenSSL context to release
+{
+    // drop the reference (the context is freed only when the last reference is dropped)
+    if (ctx)
+        SSL_CTX_free(ctx);
+}
+
+
+/*!
+ *  NAME
+ *      sslFlushCtx - flush the OpenSSL contexts registry
+ *  SYNOPSIS
+ *      void sslFlushCtx(void);
+ *  DESCRIPTION
+ *      sslFlushCtx() removes all the contexts from the registry dropping the registry references. The contexts still
+ *      borrowed by active connections are freed when the connections are closed. The entries are freed after a grace
+ *      period, so sslFlushCtx() can run concurrently with sslCreateCtx() (the contexts created after the flush are
+ *      registered again).
+ *  RETURN VALUE
+ *      None.
+ */
+
+void sslFlushCtx(void)
+{
+    // detach the entries list from the registry and wait the end of the lookups that can be walking it
+    pthread_mutex_lock(&ctx_mutex);
+    CtxEntry *entry = atomic_exchange(&ctx_list, NULL);
+    ctxSync();
+    pthread_mutex_unlock(&ctx_mutex);
+
+    // free the entries
+    while (entry) {
+        CtxEntry *next = entry->next;
+        SSL_CTX_free(atomic_load(&entry->ctx));
+        entryFree(entry);
+        entry = next;
+    }
+}
+
+
+/*!
+ *  NAME
+ *      sslCtxLookup - search a context in the registry
+ *  SYNOPSIS
+ *      SSL_CTX* sslCtxLookup(
+ *          int              type,  // context type: SSL_SERVER/SSL_CLIENT
+ *          const SslCtxOpts *opts);    // context options
+ *  DESCRIPTION
+ *      sslCtxLookup() search the context corresponding to type and options in the registry. If found, a new reference
+ *      to the context is given to the caller. The lookup doesn't take any lock: it runs in a read section of the
+ *      current epoch, so a concurrent reload or flush can't free the context or the entry before the reference is
+ *      taken (see ctxSync()).
+ *  RETURN VALUE
+ *      If found, sslCtxLookup() shall return the registered context. Otherwise, NULL shall be returned.
+ */
+
+SSL_CTX* sslCtxLookup(
+    int              type,          // context type: SSL_SERVER/SSL_CLIENT
+    const SslCtxOpts *opts)         // context options
+{
+    // enter the read section of the current epoch
+    unsigned parity = atomic_load(&ctx_epoch) & 1;
+    atomic_fetch_add(&ctx_readers[parity], 1);
+
+    // search the entry and borrow the current context
+    CtxEntry *entry;
+    SSL_CTX  *ctx = NULL;
+    if ((entry = entryFind(type, opts)) != NULL) {
+        ctx = atomic_load(&entry->ctx);
+        SSL_CTX_up_ref(ctx);
+    }
+
+    // leave the read section
+    atomic_fetch_sub(&ctx_readers[parity], 1);
+    return ctx;
+}
+
+
+/*!
+ *  NAME
+ *      sslCtxRegister - register a context
+ *  SYNOPSIS
+ *      SSL_CTX* sslCtxRegister(
+ *          int              type,  // context type: SSL_SERVER/SSL_CLIENT
+ *          const SslCtxOpts *opts, // context options
+ *          SSL_CTX          *ctx); // context to register
+ *  DESCRIPTION
+ *      sslCtxRegister() adds a new context in the registry and gives a new reference to the caller. If a context with
+ *      the same type and options is already registered (registered by another thread in the meantime) the new context
+ *      is freed and the registered context is borrowed instead.
+ *  RETURN VALUE
+ *      sslCtxRegister() shall return the registered context.
+ */
+
+SSL_CTX* sslCtxRegister(
+    int              type,          // context type: SSL_SERVER/SSL_CLIENT
+    const SslCtxOpts *opts,         // context options
+    SSL_CTX          *ctx)          // context to register
+{
+    pthread_mutex_lock(&ctx_mutex);
+
+    // test if the context is already registered
+    CtxEntry *entry;
+    if ((entry = entryFind(type, opts)) != NULL) {
+        // already registered: borrow the registered context and free the new one (ctx_mutex excludes the replaces)
+        SSL_CTX *reg_ctx = atomic_load(&entry->ctx);
+        SSL_CTX_up_ref(reg_ctx);
+        pthread_mutex_unlock(&ctx_mutex);
+        SSL_CTX_free(ctx);
+        return reg_ctx;
+    }
+
+    // allocate a new entry (on allocation error the context is not registered: the caller owns the only reference)
+    if ((entry = entryAlloc(type, opts, ctx)) != NULL) {
+        // publish the entry at the head of the list: the registry keeps a reference, the other one is given to the
+        // caller
+        SSL_CTX_up_ref(ctx);
+        entry->next = atomic_load(&ctx_list);
+        atomic_store(&ctx_list, entry);
+    }
+
+    pthread_mutex_unlock(&ctx_mutex);
+
+    // return the context
+    return ctx;
+}
+
+
+/*!
+ *  NAME
+ *      sslCtxReplace - replace a registered context
+ *  SYNOPSIS
+ *      void sslCtxReplace(
+ *          int              type,  // context type: SSL_SERVER/SSL_CLIENT
+ *          const SslCtxOpts *opts, // context options
+ *          SSL_CTX          *ctx); // new context (the registry takes the caller reference)
+ *  DESCRIPTION
+ *      sslCtxReplace() publishes atomically a new context for type and options (registering it if needed): the next
+ *      lookups borrow the new context, the connections created with the old context keep it until they are closed.
+ *      The registry drops its reference of the old context after a grace period (no lookup is still taking a
+ *      reference of it): the context is freed when no connection uses it.
+ *  RETURN VALUE
+ *      None.
+ */
+
+void sslCtxReplace(
+    int              type,          // context type: SSL_SERVER/SSL_CLIENT
+    const SslCtxOpts *opts,         // context options
+    SSL_CTX          *ctx)          // new context (the registry takes the caller reference)
+{
+    pthread_mutex_lock(&ctx_mutex);
+
+    // search the entry
+    CtxEntry *entry;
+    if ((entry = entryFind(type, opts)) == NULL) {
+        // not registered: register the new context
+        pthread_mutex_unlock(&ctx_mutex);
+        SSL_CTX_free(sslCtxRegister(type, opts, ctx));
+        return;
+    }
+
+    // publish the new context and wait the lookups that can have read the old one
+    SSL_CTX *old_ctx = atomic_exchange(&entry->ctx, ctx);
+    ctxSync();
+    pthread_mutex_unlock(&ctx_mutex);
+
+    // drop the registry reference of the old context
+    SSL_CTX_free(old_ctx);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// LOCAL functions
+////////////////////////////////////////////////////////////////////////////////
+
+
+/*!
+ *  NAME
+ *      entryFind - search a registry entry
+ *  SYNOPSIS
+ *      CtxEntry* entryFind(
+ *          int              type,  // context type: SSL_SERVER/SSL_CLIENT
+ *          const SslCtxOpts *opts);    // context options
+ *  DESCRIPTION
+ *      entryFind() search the registry entry corresponding to type and options (without lock: in a read section or
+ *      under ctx_mutex).
+ *  RETURN VALUE
+ *      If found, entryFind() shall return the entry. Otherwise, NULL shall be returned.
+ */
+
+static CtxEntry* entryFind(
+    int              type,          // context type: SSL_SERVER/SSL_CLIENT
+    const SslCtxOpts *opts)         // context options
+{
+    // search the entry with the same type and options
+    for (CtxEntry *entry = atomic_load(&ctx_list); entry; entry = entry->next) {
+        if (entry->type == type && sslCtxOptsEqual(&entry->opts, opts))
+            return entry;
+    }
+
+    // entry not found
+    return NULL;
+}
+
+
+/*!
+ *  NAME
+ *      entryAlloc - allocate a registry entry
+ *  SYNOPSIS
+ *      CtxEntry* entryAlloc(
+ *          int              type,  // context type: SSL_SERVER/SSL_CLIENT
+ *          const SslCtxOpts *opts, // context options
+ *          SSL_CTX          *ctx); // context to register
+ *  DESCRIPTION
+ *      entryAlloc() allocate a new registry entry with a private copy of the options.
+ *  RETURN VALUE
+ *      Upon successful completion, entryAlloc() shall return the new entry. Otherwise, NULL shall be returned.
+ */
+
+static CtxEntry* entryAlloc(
+    int              type,          // context type: SSL_SERVER/SSL_CLIENT
+    const SslCtxOpts *opts,         // context options
+    SSL_CTX          *ctx)          // context to register
+{
+    // allocate the entry
+    CtxEntry *entry;
+    if ((entry = calloc(1, sizeof(CtxEntry))) == NULL)
+        return NULL;
+
+    // copy the options (the strings are duplicated)
+    entry->type = type;
+    atomic_init(&entry->ctx, ctx);
+    if (! sslCtxOptsCopy(&entry->opts, opts)) {
+        // allocation error
+        free(entry);
+        return NULL;
+    }
+
+    // return the new entry
+    return entry;
+}
+
+
+/*!
+ *  NAME
+ *      entryFree - free a registry entry
+ *  SYNOPSIS
+ *      void entryFree(
+ *          CtxEntry *entry);       // registry entry
+ *  DESCRIPTION
+ *      entryFree() free a registry entry and its copy of the options (the context reference is not dropped).
+ *  RETURN VALUE
+ *      None.
+ */
+
+static void entryFree(
+    CtxEntry *entry)                // registry entry
+{
+    // free the options strings and the entry
+    sslCtxOptsFree(&entry->opts);
+    free(entry);
+}
+
+
+/*!
+ *  NAME
+ *      ctxSync - wait a grace period of the lookups
+ *  SYNOPSIS
+ *      void ctxSync(void);
+ *  DESCRIPTION
+ *      ctxSync() flips the epoch of the lookups and waits until the lookups of the previous epoch are ended: the new
+ *      lookups count themselves in the new epoch, so the wait ends also under a continuous flow of lookups. A lookup
+ *      that has read the previous value of a pointer changed before the call is ended at the return (the lookups
+ *      that enter the previous epoch after the wait read with sequentially consistent loads the new values). Must be
+ *      called under ctx_mutex (one flip at a time).
+ *  RETURN VALUE
+ *      None.
+ */
+
+static void ctxSync(void)
+{
+    // flip the epoch and wait the readers of the previous one
+    unsigned parity = atomic_fetch_add(&ctx_epoch, 1) & 1;
+    while (atomic_load(&ctx_readers[parity]) != 0)
+        sched_yield();
+}
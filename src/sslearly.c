@@ -0,0 +1,222 @@
+/*
+ * Copyright © 2019 Aldo Abate <aldo.abate99@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+
+/*!
+ *  FILE
+ *      sslearly.c - TLS 1.3 early data (0-RTT) functions for MySSL library
+ *  PROJECT
+ *      MySSL library
+ *  FUNCTIONS
+ *      global:
+ *          int sslConnectEarly(SSL *ssl, const char *host, int port, const void *buf, int num);
+ *          int sslAcceptEarly(SSL *ssl, void *buf, int num, int *early_len);
+ *          int sslEarlyDataAllow(SSL *ssl, void *arg);
+ *  DESCRIPTION
+ *      The MySSL library is a simple interface to OpenSSL library to permits user-friendly writing of Servers and
+ *      Clients using OpenSSL.
+ *  NOTES
+ *      - The free software library "OpenSSL" is distributed under a "dual licensed" system: under the OpenSSL License
+ *        and the SSLeay License. The OpenSSL License is Apache License 1.0 and SSLeay License bears some similarity to
+ *        a 4-clause BSD License. Both licenses apply.
+ *      - The library "OpenSSL" reference version is 1.0.2g (the early data require OpenSSL 1.1.1: with the previous
+ *        versions the data are sent/received after a normal handshake)
+ *  AUTHOR
+ *      Aldo Abate
+ *  OPERATING SYSTEM
+ *      Linux (kernel 2.6 and above - glibc 2.3.2 and above)
+ *  COMPILER
+ *      GNU GCC (ver. 4.4 and above)
+ *  RELEASE
+ *      0.1.0 (August 2019)
+ */
+
+#include "myssl.h"
+#include "myssl-private.h"
+#include <time.h>
+
+
+////////////////////////////////////////////////////////////////////////////////
+// GLOBAL functions
+////////////////////////////////////////////////////////////////////////////////
+
+
+/*!
+ *  NAME
+ *      sslConnectEarly - start an OpenSSL connection sending early data (0-RTT)
+ *  SYNOPSIS
+ *      int sslConnectEarly(
+ *          SSL        *ssl,        // OpenSSL SSL structure
+ *          const char *host,       // server host
+ *          int        port,        // server port
+ *          const void *buf,        // buffer of data to write
+ *          int        num);        // number of data to write
+ *  DESCRIPTION
+ *      sslConnectEarly() resume the session stored for the server host:port (see sslConnectSession()) and, if the
+ *      session allows it, sends num bytes from the buffer buf as early data together with the handshake. If there is
+ *      not a session allowing the early data, or the server rejects them, the data are written with sslWrite() after
+ *      the handshake, so the data are always sent (use SSL_get_early_data_status() to test if they were sent as early
+ *      data). Note that the early data can be replayed by an attacker: send only idempotent requests.
+ *  RETURN VALUE
+ *      Upon successful completion, sslConnectEarly() shall return the number of bytes sent.
+ *      Otherwise, the result of the failed OpenSSL function shall be returned (<= 0) and the error can be analyzed
+ *      calling the OpenSSL library SSL_get_error() function.
+ */
+
+int sslConnectEarly(
+    SSL        *ssl,                // OpenSSL SSL structure
+    const char *host,               // server host
+    int        port,                // server port
+    const void *buf,                // buffer of data to write
+    int        num)                 // number of data to write
+{
+    // reuse the stored session (if any)
+    bool resumed = sslSessionAttach(ssl, host, port);
+
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+    // send the early data (only if the session allows them)
+    SSL_SESSION *sess = SSL_get0_session(ssl);
+    if (resumed && sess && SSL_SESSION_get_max_early_data(sess) >= (uint32_t)num) {
+        // the early data are written before SSL_connect(): set the client mode
+        SSL_set_connect_state(ssl);
+
+        // write loop (until the deadline of the operation)
+        size_t  sent     = 0;
+        int64_t deadline = sslDeadline(ssl, SSL_TIMEOUT_CONN);
+        while (sent < (size_t)num) {
+            // execute operation
+            size_t written;
+            int result;
+            if ((result = SSL_write_early_data(ssl, (const char *)buf + sent, num - sent, &written)) == 1) {
+                // operation Ok: more data to write
+                sent += written;
+                continue;
+            }
+
+            // operation NOK: start recovery procedure
+            if (! sslRecovery(ssl, result, deadline))
+                return result;
+        }
+    }
+#else
+    (void)resumed;
+#endif
+
+    // complete the handshake
+    int result;
+    if ((result = sslFunc(SSL_connect, ssl)) != 1)
+        return result;
+
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+    // early data accepted: all the data are sent
+    if (SSL_get_early_data_status(ssl) == SSL_EARLY_DATA_ACCEPTED)
+        return num;
+#endif
+
+    // early data not sent or rejected: send the data now
+    return sslWrite(ssl, buf, num);
+}
+
+
+/*!
+ *  NAME
+ *      sslAcceptEarly - accept an OpenSSL connection reading the early data (0-RTT)
+ *  SYNOPSIS
+ *      int sslAcceptEarly(
+ *          SSL  *ssl,              // OpenSSL SSL structure
+ *          void *buf,              // buffer of the early data
+ *          int  num,               // size of the buffer
+ *          int  *early_len);       // number of early data read
+ *  DESCRIPTION
+ *      sslAcceptEarly() accept an OpenSSL connection (like sslFunc(SSL_accept, ssl)) reading the early data sent by the
+ *      client before the handshake is completed. The early data are accepted only if the server context is created
+ *      with the max_early_data option and the client ticket is in the anti-replay window: to reject the early data
+ *      of a connection just call sslFunc(SSL_accept, ssl) instead (the data will be resent by sslConnectEarly() after
+ *      the handshake). The buffer must be able to contain max_early_data bytes. Note that the early data can be
+ *      replayed by an attacker: accept only idempotent requests.
+ *  RETURN VALUE
+ *      Upon successful completion, sslAcceptEarly() shall return 1 and early_len is set to the number of bytes read.
+ *      Otherwise, the result of the failed OpenSSL function shall be returned (<= 0) and the error can be analyzed
+ *      calling the OpenSSL library SSL_get_error() function.
+ */
+
+int sslAcceptEarly(
+    SSL  *ssl,                      // OpenSSL SSL structure
+    void *buf,                      // buffer of the early data
+    int  num,                       // size of the buffer
+    int  *early_len)                // number of early data read
+{
+    *early_len = 0;
+
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+    // read loop (until the deadline of the operation)
+    int64_t deadline = sslDeadline(ssl, SSL_TIMEOUT_CONN);
+    for (;;) {
+        // when the buffer is full read on a scratch byte (to detect a buffer overflow)
+        char   extra;
+        char   *pbuf = *early_len < num ? (char *)buf + *early_len : &extra;
+        size_t size  = *early_len < num ? (size_t)(num - *early_len) : 1;
+
+        // execute operation
+        size_t rcvd;
+        int result = SSL_read_early_data(ssl, pbuf, size, &rcvd);
+        if (result == SSL_READ_EARLY_DATA_SUCCESS) {
+            // operation Ok: test the buffer overflow (error) and read more data
+            if (pbuf == &extra)
+                return -1;
+
+            *early_len += rcvd;
+            continue;
+        }
+        else if (result == SSL_READ_EARLY_DATA_FINISH) {
+            // no more early data (or early data not sent/rejected): break loop
+            break;
+        }
+
+        // operation NOK: start recovery procedure
+        if (! sslRecovery(ssl, -1, deadline))
+            return -1;
+    }
+#endif
+
+    // complete the handshake
+    return sslFunc(SSL_accept, ssl);
+}
+
+
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+/*!
+ *  NAME
+ *      sslEarlyDataAllow - anti-replay window for the early data
+ *  SYNOPSIS
+ *      int sslEarlyDataAllow(
+ *          SSL  *ssl,              // OpenSSL SSL structure
+ *          void *arg);             // anti-replay window (seconds)
+ *  DESCRIPTION
+ *      sslEarlyDataAllow() is the allow early data callback of the server contexts: it rejects the early data if the
+ *      resumed session is older than the anti-replay window (a replayed ClientHello is accepted only inside the window
+ *      and only once, thanks to the OpenSSL replay protection).
+ *  RETURN VALUE
+ *      sslEarlyDataAllow() shall return 1 to accept the early data, 0 to reject them.
+ */
+
+int sslEarlyDataAllow(
+    SSL  *ssl,                      // OpenSSL SSL structure
+    void *arg)                      // anti-replay window (seconds)
+{
+    // test the session age
+    SSL_SESSION *sess = SSL_get0_session(ssl);
+    return sess && time(NULL) - SSL_SESSION_get_time(sess) <= (long)arg ? 1 : 0;
+}
+#endif
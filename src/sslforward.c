@@ -0,0 +1,753 @@
+/*
+ * Copyright © 2019 Aldo Abate <aldo.abate99@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+
+/*!
+ *  FILE
+ *      sslforward.c - TLS-terminating forwarder (TLS connections pumped to a plaintext backend) for MySSL library
+ *  PROJECT
+ *      MySSL library
+ *  FUNCTIONS
+ *      global:
+ *          int           sslForward(SSL *ssl, int backend, int timeout);
+ *          SslForwarder* sslForwarderStart(const SslForwardOpts *fopts, const SslCtxOpts *opts);
+ *          int           sslForwarderPort(SslForwarder *forwarder);
+ *          void          sslForwarderStop(SslForwarder *forwarder);
+ *      local:
+ *          int   forwardPump(SSL *ssl, int backend, int timeout, atomic_bool *stop);
+ *          int   forwardUp(SSL *ssl, int backend, ForwardDir *dir);
+ *          int   forwardDown(SSL *ssl, int backend, ForwardDir *dir);
+ *          int   forwardError(SSL *ssl);
+ *          int   forwarderBackend(SslForwarder *forwarder);
+ *          void* forwarderAccept(void *arg);
+ *          void* forwarderConn(void *arg);
+ *  DESCRIPTION
+ *      The MySSL library is a simple interface to OpenSSL library to permits user-friendly writing of Servers and
+ *      Clients using OpenSSL.
+ *  NOTES
+ *      - The free software library "OpenSSL" is distributed under a "dual licensed" system: under the OpenSSL License
+ *        and the SSLeay License. The OpenSSL License is Apache License 1.0 and SSLeay License bears some similarity to
+ *        a 4-clause BSD License. Both licenses apply.
+ *      - The library "OpenSSL" reference version is 1.0.2g
+ *      - Each direction (up: TLS -> backend, down: backend -> TLS) reads from its source only when the data already
+ *        read has been written to its destination, so a slow destination stops the reads from the source (the
+ *        backpressure is per direction: the other direction keeps flowing).
+ *      - A direction with the kernel TLS offload of its TLS side (RX for up, TX for down, see sslKtls()) moves the
+ *        data with splice() through a pipe, without copying it in user space; otherwise it uses a large pooled
+ *        buffer (see sslBufferGet()). An up direction in splice mode falls back to the buffer when the kernel stops
+ *        on a TLS control record (e.g.: the close_notify), that is handled by OpenSSL.
+ *      - The end of data is propagated in both the directions (half-close): the close_notify (or the disconnection)
+ *        of the TLS peer becomes a shutdown(SHUT_WR) of the backend and the EOF of the backend becomes a
+ *        close_notify, while the other direction goes on until its own end.
+ *  AUTHOR
+ *      Aldo Abate
+ *  OPERATING SYSTEM
+ *      Linux (kernel 2.6.17 and above - glibc 2.5 and above)
+ *  COMPILER
+ *      GNU GCC (ver. 4.4 and above)
+ *  RELEASE
+ *      0.1.0 (August 2019)
+ */
+
+#define _GNU_SOURCE     // splice()
+#include "myssl.h"
+#include "myssl-private.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/un.h>
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <openssl/err.h>
+
+// a direction of a forwarded connection
+typedef struct {
+    char   *buf;                    // buffer (buffer mode)
+    size_t len;                     // data in the buffer
+    size_t off;                     // data of the buffer already written
+    int    pipe[2];                 // pipe (splice mode, -1 = buffer mode)
+    size_t piped;                   // data in the pipe
+    bool   eof;                     // end of data from the source
+    bool   closed;                  // end of data propagated to the destination
+    short  tls_events;              // events to wait on the TLS socket
+    short  backend_events;          // events to wait on the backend socket
+} ForwardDir;
+
+// forwarder
+struct SslForwarder {
+    SSL_CTX                 *ctx;           // server context
+    int                     sock;           // listening socket
+    int                     port;           // listening port
+    struct sockaddr_storage addr;           // backend address
+    socklen_t               addrlen;        // backend address length
+    int                     max_conn;       // max concurrent connections
+    int                     timeout;        // idle timeout of a connection in ms (0 = none)
+    pthread_t               tid;            // accept thread
+    bool                    started;        // accept thread started
+    atomic_bool             stop;           // stop request (sslForwarderStop())
+    atomic_int              nconn;          // active connections
+};
+
+// connection of the forwarder (argument of its thread)
+typedef struct {
+    SslForwarder *forwarder;        // forwarder
+    int          sock;              // accepted socket
+} ForwardConn;
+
+// local prototypes
+static int   forwardPump(SSL *ssl, int backend, int timeout, atomic_bool *stop);
+static int   forwardUp(SSL *ssl, int backend, ForwardDir *dir);
+static int   forwardDown(SSL *ssl, int backend, ForwardDir *dir);
+static int   forwardError(SSL *ssl);
+static int   forwarderBackend(SslForwarder *forwarder);
+static void* forwarderAccept(void *arg);
+static void* forwarderConn(void *arg);
+
+
+////////////////////////////////////////////////////////////////////////////////
+// GLOBAL functions
+////////////////////////////////////////////////////////////////////////////////
+
+
+/*!
+ *  NAME
+ *      sslForward - forward a SSL/TLS connection to a plaintext backend
+ *  SYNOPSIS
+ *      int sslForward(
+ *          SSL *ssl,               // OpenSSL SSL structure (after the handshake)
+ *          int backend,            // connected socket of the backend (TCP or Unix)
+ *          int timeout);           // idle timeout in ms (<= 0 = none)
+ *  DESCRIPTION
+ *      sslForward() pumps the decrypted data of the specified ssl connection to the backend socket and the data of
+ *      the backend to the ssl connection, until the end of data in both the directions (see NOTES) or the idle
+ *      timeout. The sockets are set non-blocking and they are not closed.
+ *  RETURN VALUE
+ *      Upon successful completion (both the directions closed), sslForward() shall return 0: the close_notify has
+ *      been sent to the peer and the connection can be closed with sslClose() without shutdown.
+ *      Otherwise, -1 shall be returned and the reason can be analyzed calling sslStatus() (SSL_STATUS_TIMEOUT: no
+ *      data for timeout ms).
+ */
+
+int sslForward(
+    SSL *ssl,                       // OpenSSL SSL structure (after the handshake)
+    int backend,                    // connected socket of the backend (TCP or Unix)
+    int timeout)                    // idle timeout in ms (<= 0 = none)
+{
+    return forwardPump(ssl, backend, timeout, NULL);
+}
+
+
+/*!
+ *  NAME
+ *      sslForwarderStart - start a TLS-terminating forwarder
+ *  SYNOPSIS
+ *      SslForwarder* sslForwarderStart(
+ *          const SslForwardOpts *fopts,    // forwarder options
+ *          const SslCtxOpts     *opts);    // server context options (NULL = default certificate files)
+ *  DESCRIPTION
+ *      sslForwarderStart() creates the server context (see sslCreateCtxEx()), listens on the port and starts the
+ *      accept thread: each accepted connection is handled by its own thread, that executes the handshake, connects
+ *      to fopts->backend and forwards the data with sslForward(). Beyond fopts->max_conn concurrent connections
+ *      the new connections are closed at once.
+ *  RETURN VALUE
+ *      Upon successful completion, sslForwarderStart() shall return the forwarder (to stop with sslForwarderStop()).
+ *      Otherwise (wrong backend address, context, socket or thread error), NULL shall be returned.
+ */
+
+SslForwarder* sslForwarderStart(
+    const SslForwardOpts *fopts,    // forwarder options
+    const SslCtxOpts     *opts)     // server context options (NULL = default certificate files)
+{
+    // allocate the forwarder
+    SslForwarder *forwarder;
+    if (fopts->backend == NULL || (forwarder = calloc(1, sizeof(SslForwarder))) == NULL)
+        return NULL;
+
+    forwarder->sock     = -1;
+    forwarder->max_conn = fopts->max_conn > 0 ? fopts->max_conn : SSL_FORWARD_CONNS;
+    forwarder->timeout  = fopts->timeout;
+    atomic_init(&forwarder->stop, false);
+    atomic_init(&forwarder->nconn, 0);
+
+    // backend address: Unix socket path or IPv4 host:port
+    const char *colon = strrchr(fopts->backend, ':');
+    if (fopts->backend[0] == '/') {
+        struct sockaddr_un *sun = (struct sockaddr_un *)&forwarder->addr;
+        if (strlen(fopts->backend) >= sizeof(sun->sun_path))
+            goto error;
+
+        sun->sun_family    = AF_UNIX;
+        strcpy(sun->sun_path, fopts->backend);
+        forwarder->addrlen = sizeof(struct sockaddr_un);
+    } else {
+        struct sockaddr_in *sin = (struct sockaddr_in *)&forwarder->addr;
+        char               host[INET_ADDRSTRLEN];
+        if (colon == NULL || colon - fopts->backend >= (long)sizeof(host))
+            goto error;
+
+        memcpy(host, fopts->backend, colon - fopts->backend);
+        host[colon - fopts->backend] = '\0';
+        sin->sin_family    = AF_INET;
+        sin->sin_port      = htons(atoi(colon + 1));
+        forwarder->addrlen = sizeof(struct sockaddr_in);
+        if (inet_pton(AF_INET, host, &sin->sin_addr) != 1)
+            goto error;
+    }
+
+    // create the context and the listening socket
+    struct sockaddr_in addr;
+    socklen_t          addrlen = sizeof(addr);
+    int                error, on = 1;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_port        = htons(fopts->port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if ((forwarder->ctx = sslCreateCtxEx(SSL_SERVER, opts, &error)) == NULL || error < 0 ||
+            (fopts->host && inet_pton(AF_INET, fopts->host, &addr.sin_addr) != 1) ||
+            (forwarder->sock = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, IPPROTO_TCP)) < 0 ||
+            setsockopt(forwarder->sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) < 0 ||
+            bind(forwarder->sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+            listen(forwarder->sock, SOMAXCONN) < 0 ||
+            getsockname(forwarder->sock, (struct sockaddr *)&addr, &addrlen) < 0)
+        goto error;
+
+    // start the accept thread
+    forwarder->port = ntohs(addr.sin_port);
+    if (pthread_create(&forwarder->tid, NULL, forwarderAccept, forwarder) != 0)
+        goto error;
+
+    forwarder->started = true;
+    return forwarder;
+
+error:
+    // free the forwarder
+    sslForwarderStop(forwarder);
+    return NULL;
+}
+
+
+/*!
+ *  NAME
+ *      sslForwarderPort - get the listening port of a forwarder
+ *  SYNOPSIS
+ *      int sslForwarderPort(
+ *          SslForwarder *forwarder);   // forwarder
+ *  DESCRIPTION
+ *      sslForwarderPort() get the listening port (e.g.: the free port assigned when SslForwardOpts.port is 0).
+ *  RETURN VALUE
+ *      sslForwarderPort() shall return the listening port.
+ */
+
+int sslForwarderPort(
+    SslForwarder *forwarder)        // forwarder
+{
+    return forwarder->port;
+}
+
+
+/*!
+ *  NAME
+ *      sslForwarderStop - stop a forwarder
+ *  SYNOPSIS
+ *      void sslForwarderStop(
+ *          SslForwarder *forwarder);   // forwarder
+ *  DESCRIPTION
+ *      sslForwarderStop() stops the accept thread and the connection threads (within SSL_SERVER_TICK ms: the
+ *      connections are closed without shutdown), closes the listening socket, releases the context and frees the
+ *      forwarder.
+ *  RETURN VALUE
+ *      None.
+ */
+
+void sslForwarderStop(
+    SslForwarder *forwarder)        // forwarder
+{
+    if (forwarder == NULL)
+        return;
+
+    // stop the accept thread and wait the end of the connections
+    atomic_store(&forwarder->stop, true);
+    if (forwarder->started)
+        pthread_join(forwarder->tid, NULL);
+
+    while (atomic_load(&forwarder->nconn) > 0)
+        usleep(1000);
+
+    if (forwarder->sock >= 0)
+        close(forwarder->sock);
+
+    sslReleaseCtx(forwarder->ctx);
+    free(forwarder);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// LOCAL functions
+////////////////////////////////////////////////////////////////////////////////
+
+
+/*!
+ *  NAME
+ *      forwardPump - forward the data of a connection in both the directions
+ *  SYNOPSIS
+ *      int forwardPump(
+ *          SSL         *ssl,       // OpenSSL SSL structure (after the handshake)
+ *          int         backend,    // connected socket of the backend
+ *          int         timeout,    // idle timeout in ms (<= 0 = none)
+ *          atomic_bool *stop);     // stop request checked every SSL_SERVER_TICK ms (NULL = none)
+ *  DESCRIPTION
+ *      forwardPump() moves the data of the two directions without blocking and, when neither direction can go on,
+ *      waits with a single poll() the events required by both the directions.
+ *  RETURN VALUE
+ *      See sslForward().
+ */
+
+static int forwardPump(
+    SSL         *ssl,               // OpenSSL SSL structure (after the handshake)
+    int         backend,            // connected socket of the backend
+    int         timeout,            // idle timeout in ms (<= 0 = none)
+    atomic_bool *stop)              // stop request checked every SSL_SERVER_TICK ms (NULL = none)
+{
+    // set the sockets non-blocking (the TLS one through the connection data, see sslDeadline())
+    int flags;
+    (void)sslDeadline(ssl, SSL_TIMEOUT_INFINITE);
+    if ((flags = fcntl(backend, F_GETFL)) < 0 || fcntl(backend, F_SETFL, flags | O_NONBLOCK) < 0) {
+        sslStatusSet(ssl, SSL_STATUS_FATAL);
+        return -1;
+    }
+
+    // directions: splice mode with the kernel TLS of their TLS side, buffer mode otherwise (and as fallback)
+    ForwardDir dirs[2];
+    int        ktls = sslKtls(ssl), rc = -1;
+    memset(dirs, 0, sizeof(dirs));
+    for (int i = 0; i < 2; i++) {
+        dirs[i].pipe[0] = dirs[i].pipe[1] = -1;
+        dirs[i].buf     = sslBufferGet();
+        if ((ktls & (i == 0 ? SSL_KTLS_RX : SSL_KTLS_TX)) && pipe2(dirs[i].pipe, O_NONBLOCK | O_CLOEXEC) < 0)
+            dirs[i].pipe[0] = dirs[i].pipe[1] = -1;
+    }
+
+    if (dirs[0].buf == NULL || dirs[1].buf == NULL) {
+        sslStatusSet(ssl, SSL_STATUS_FATAL);
+        goto end;
+    }
+
+    // pump loop: the deadline restarts on each progress
+    int64_t deadline = timeout > 0 ? sslClockNs() + (int64_t)timeout * 1000000 : -1;
+    while (! dirs[0].closed || ! dirs[1].closed) {
+        int up, down;
+        if ((up = forwardUp(ssl, backend, &dirs[0])) < 0 || (down = forwardDown(ssl, backend, &dirs[1])) < 0)
+            goto end;
+
+        if (up || down) {
+            deadline = timeout > 0 ? sslClockNs() + (int64_t)timeout * 1000000 : -1;
+            continue;
+        }
+
+        // no progress: wait the events (a tick at a time with a stop request to check)
+        struct pollfd pfds[2] = {
+            { SSL_get_fd(ssl), dirs[0].tls_events | dirs[1].tls_events, 0 },
+            { backend, dirs[0].backend_events | dirs[1].backend_events, 0 }
+        };
+        int64_t tick = stop != NULL ? sslClockNs() + (int64_t)SSL_SERVER_TICK * 1000000 : -1;
+        int     ready;
+        if (stop != NULL && atomic_load(stop)) {
+            sslStatusSet(ssl, SSL_STATUS_FATAL);
+            goto end;
+        }
+
+        if ((ready = sslPoll(pfds, 2, tick >= 0 && (deadline < 0 || tick < deadline) ? tick : deadline)) < 0) {
+            sslStatusSet(ssl, SSL_STATUS_FATAL);
+            goto end;
+        }
+
+        if (ready == 0 && deadline >= 0 && sslClockNs() >= deadline) {
+            sslStatusSet(ssl, SSL_STATUS_TIMEOUT);
+            goto end;
+        }
+    }
+
+    sslStatusSet(ssl, SSL_STATUS_OK);
+    rc = 0;
+
+end:
+    // release the buffers and the pipes
+    for (int i = 0; i < 2; i++) {
+        sslBufferPut(dirs[i].buf);
+        if (dirs[i].pipe[0] >= 0) {
+            close(dirs[i].pipe[0]);
+            close(dirs[i].pipe[1]);
+        }
+    }
+
+    return rc;
+}
+
+
+/*!
+ *  NAME
+ *      forwardUp - forward the data from the TLS connection to the backend
+ *  SYNOPSIS
+ *      int forwardUp(
+ *          SSL        *ssl,        // OpenSSL SSL structure
+ *          int        backend,     // socket of the backend
+ *          ForwardDir *dir);       // direction
+ *  DESCRIPTION
+ *      forwardUp() writes to the backend the data already read and reads new data from the TLS connection until a
+ *      socket would block (the events to wait are set in dir). The end of data of the TLS connection (close_notify
+ *      or disconnection) is propagated with a shutdown(SHUT_WR) of the backend.
+ *  RETURN VALUE
+ *      forwardUp() shall return 1 if some data has been moved, 0 if nothing can be done now, -1 on error (status
+ *      set).
+ */
+
+static int forwardUp(
+    SSL        *ssl,                // OpenSSL SSL structure
+    int        backend,             // socket of the backend
+    ForwardDir *dir)                // direction
+{
+    int progress = 0;
+    dir->tls_events = dir->backend_events = 0;
+    while (! dir->closed) {
+        ssize_t num;
+
+        // write the pending data to the backend
+        if (dir->piped > 0 || dir->off < dir->len) {
+            if (dir->piped > 0)
+                num = splice(dir->pipe[0], NULL, backend, NULL, dir->piped, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            else
+                num = send(backend, dir->buf + dir->off, dir->len - dir->off, MSG_NOSIGNAL);
+
+            if (num < 0) {
+                if (errno == EINTR)
+                    continue;
+
+                if (errno != EAGAIN)
+                    return forwardError(ssl);
+
+                dir->backend_events = POLLOUT;
+                return progress;
+            }
+
+            if (dir->piped > 0) {
+                dir->piped -= num;
+            } else if ((dir->off += num) == dir->len) {
+                dir->len = dir->off = 0;
+            }
+
+            progress = 1;
+            continue;
+        }
+
+        // end of data: half-close the backend
+        if (dir->eof) {
+            (void)shutdown(backend, SHUT_WR);
+            dir->closed = true;
+            return 1;
+        }
+
+        // splice mode (kernel TLS RX): the socket gives the decrypted data
+        if (dir->pipe[0] >= 0) {
+            if ((num = splice(SSL_get_rfd(ssl), NULL, dir->pipe[1], NULL, SSL_WRITE_BATCH,
+                              SPLICE_F_MOVE | SPLICE_F_NONBLOCK)) > 0) {
+                dir->piped = num;
+                progress   = 1;
+                continue;
+            }
+
+            if (num < 0 && errno == EINTR)
+                continue;
+
+            if (num < 0 && errno == EAGAIN) {
+                dir->tls_events = POLLIN;
+                return progress;
+            }
+
+            // control record (e.g.: close_notify) or EOF: OpenSSL handles it (buffer mode from now on)
+            close(dir->pipe[0]);
+            close(dir->pipe[1]);
+            dir->pipe[0] = dir->pipe[1] = -1;
+            continue;
+        }
+
+        // buffer mode: read a record
+        int rcvd = sslReadStep(ssl, dir->buf, SSL_WRITE_BATCH);
+        if (rcvd > 0) {
+            dir->len = rcvd;
+            progress = 1;
+        } else if (rcvd == SSL_STEP_CLOSED) {
+            dir->eof = true;
+        } else if (rcvd == SSL_STEP_WANT_READ || rcvd == SSL_STEP_WANT_WRITE) {
+            dir->tls_events = rcvd == SSL_STEP_WANT_READ ? POLLIN : POLLOUT;
+            return progress;
+        } else {
+            return -1;
+        }
+    }
+
+    return progress;
+}
+
+
+/*!
+ *  NAME
+ *      forwardDown - forward the data from the backend to the TLS connection
+ *  SYNOPSIS
+ *      int forwardDown(
+ *          SSL        *ssl,        // OpenSSL SSL structure
+ *          int        backend,     // socket of the backend
+ *          ForwardDir *dir);       // direction
+ *  DESCRIPTION
+ *      forwardDown() writes to the TLS connection the data already read and reads new data from the backend until a
+ *      socket would block (the events to wait are set in dir). The EOF of the backend is propagated with a
+ *      close_notify.
+ *  RETURN VALUE
+ *      forwardDown() shall return 1 if some data has been moved, 0 if nothing can be done now, -1 on error (status
+ *      set).
+ */
+
+static int forwardDown(
+    SSL        *ssl,                // OpenSSL SSL structure
+    int        backend,             // socket of the backend
+    ForwardDir *dir)                // direction
+{
+    int progress = 0;
+    dir->tls_events = dir->backend_events = 0;
+    while (! dir->closed) {
+        ssize_t num;
+        int     step;
+
+        // splice mode (kernel TLS TX): the socket encrypts the data of the pipe
+        if (dir->piped > 0) {
+            if ((num = splice(dir->pipe[0], NULL, SSL_get_wfd(ssl), NULL, dir->piped,
+                              SPLICE_F_MOVE | SPLICE_F_NONBLOCK)) > 0) {
+                dir->piped -= num;
+                progress    = 1;
+                continue;
+            }
+
+            if (num < 0 && errno == EINTR)
+                continue;
+
+            if (num < 0 && errno == EAGAIN) {
+                dir->tls_events = POLLOUT;
+                return progress;
+            }
+
+            return forwardError(ssl);
+        }
+
+        // buffer mode: write the pending data (a write to repeat is repeated with the same arguments)
+        if (dir->off < dir->len) {
+            if ((step = sslWriteStep(ssl, dir->buf + dir->off, dir->len - dir->off)) > 0) {
+                if ((dir->off += step) == dir->len)
+                    dir->len = dir->off = 0;
+
+                progress = 1;
+                continue;
+            }
+
+            if (step == SSL_STEP_WANT_READ || step == SSL_STEP_WANT_WRITE) {
+                dir->tls_events = step == SSL_STEP_WANT_READ ? POLLIN : POLLOUT;
+                return progress;
+            }
+
+            return -1;
+        }
+
+        // end of data: send the close_notify
+        if (dir->eof) {
+            if ((step = SSL_shutdown(ssl)) >= 0 ||
+                    ((step = sslStepResult(ssl, step)) != SSL_STEP_WANT_READ && step != SSL_STEP_WANT_WRITE)) {
+                dir->closed = true;
+                return step >= 0 ? 1 : -1;
+            }
+
+            dir->tls_events = step == SSL_STEP_WANT_READ ? POLLIN : POLLOUT;
+            return progress;
+        }
+
+        // read from the backend (in the pipe or in the buffer)
+        if (dir->pipe[0] >= 0)
+            num = splice(backend, NULL, dir->pipe[1], NULL, SSL_WRITE_BATCH, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        else
+            num = recv(backend, dir->buf, SSL_WRITE_BATCH, 0);
+
+        if (num > 0) {
+            if (dir->pipe[0] >= 0)
+                dir->piped = num;
+            else
+                dir->len = num;
+
+            progress = 1;
+        } else if (num == 0) {
+            dir->eof = true;
+        } else if (errno == EAGAIN) {
+            dir->backend_events = POLLIN;
+            return progress;
+        } else if (errno != EINTR) {
+            return forwardError(ssl);
+        }
+    }
+
+    return progress;
+}
+
+
+/*!
+ *  NAME
+ *      forwardError - set the status of a socket error
+ *  SYNOPSIS
+ *      int forwardError(
+ *          SSL *ssl);              // OpenSSL SSL structure
+ *  DESCRIPTION
+ *      forwardError() sets the connection status after a failed syscall of the pump (errno): a reset or a closed
+ *      peer is a disconnection, otherwise a fatal error.
+ *  RETURN VALUE
+ *      forwardError() shall return -1.
+ */
+
+static int forwardError(
+    SSL *ssl)                       // OpenSSL SSL structure
+{
+    sslStatusSet(ssl, errno == EPIPE || errno == ECONNRESET ? SSL_STATUS_CLOSED : SSL_STATUS_FATAL);
+    return -1;
+}
+
+
+/*!
+ *  NAME
+ *      forwarderBackend - connect to the backend
+ *  SYNOPSIS
+ *      int forwarderBackend(
+ *          SslForwarder *forwarder);   // forwarder
+ *  DESCRIPTION
+ *      forwarderBackend() connects a socket to the backend address of the forwarder (TCP with TCP_NODELAY, or
+ *      Unix).
+ *  RETURN VALUE
+ *      Upon successful completion, forwarderBackend() shall return the connected socket.
+ *      Otherwise, -1 shall be returned.
+ */
+
+static int forwarderBackend(
+    SslForwarder *forwarder)        // forwarder
+{
+    int family = forwarder->addr.ss_family, sock, on = 1;
+    if ((sock = socket(family, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0)
+        return -1;
+
+    if (connect(sock, (struct sockaddr *)&forwarder->addr, forwarder->addrlen) < 0 ||
+            (family == AF_INET && setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on)) < 0)) {
+        close(sock);
+        return -1;
+    }
+
+    return sock;
+}
+
+
+/*!
+ *  NAME
+ *      forwarderAccept - accept thread of the forwarder
+ *  SYNOPSIS
+ *      void* forwarderAccept(
+ *          void *arg);             // forwarder
+ *  DESCRIPTION
+ *      forwarderAccept() accepts the connections and starts a detached thread for each one (closing the connections
+ *      beyond the max), until the forwarder is stopped (the stop request is checked every SSL_SERVER_TICK ms).
+ *  RETURN VALUE
+ *      forwarderAccept() shall return NULL.
+ */
+
+static void* forwarderAccept(
+    void *arg)                      // forwarder
+{
+    SslForwarder   *forwarder = arg;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_attr_setstacksize(&attr, SSL_FORWARD_STACK);
+    while (! atomic_load(&forwarder->stop)) {
+        // wait a connection
+        struct pollfd pfd = { forwarder->sock, POLLIN, 0 };
+        ForwardConn   *conn;
+        pthread_t     tid;
+        int           sock;
+        if (poll(&pfd, 1, SSL_SERVER_TICK) <= 0 ||
+                (sock = accept4(forwarder->sock, NULL, NULL, SOCK_CLOEXEC)) < 0)
+            continue;
+
+        // start the connection thread (the connection is closed if over the max or on error)
+        if (atomic_fetch_add(&forwarder->nconn, 1) >= forwarder->max_conn ||
+                (conn = malloc(sizeof(ForwardConn))) == NULL) {
+            atomic_fetch_sub(&forwarder->nconn, 1);
+            close(sock);
+            continue;
+        }
+
+        conn->forwarder = forwarder;
+        conn->sock      = sock;
+        if (pthread_create(&tid, &attr, forwarderConn, conn) != 0) {
+            atomic_fetch_sub(&forwarder->nconn, 1);
+            free(conn);
+            close(sock);
+        }
+    }
+
+    pthread_attr_destroy(&attr);
+    return NULL;
+}
+
+
+/*!
+ *  NAME
+ *      forwarderConn - connection thread of the forwarder
+ *  SYNOPSIS
+ *      void* forwarderConn(
+ *          void *arg);             // connection
+ *  DESCRIPTION
+ *      forwarderConn() executes the handshake (with the connection timeout), connects to the backend and forwards
+ *      the data until the end of the connection (or the stop of the forwarder), then closes both the sockets.
+ *  RETURN VALUE
+ *      forwarderConn() shall return NULL.
+ */
+
+static void* forwarderConn(
+    void *arg)                      // connection
+{
+    ForwardConn  *conn      = arg;
+    SslForwarder *forwarder = conn->forwarder;
+    int          sock       = conn->sock, backend = -1, on = 1;
+    SSL          *ssl;
+    free(conn);
+
+    // handshake, backend connection and forwarding
+    (void)setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    if ((ssl = SSL_new(forwarder->ctx)) != NULL && SSL_set_fd(ssl, sock) == 1 && sslFunc(SSL_accept, ssl) == 1 &&
+            (backend = forwarderBackend(forwarder)) >= 0)
+        (void)forwardPump(ssl, backend, forwarder->timeout, &forwarder->stop);
+
+    // close the connections (the shutdown is already done by the pump)
+    ERR_clear_error();
+    if (backend >= 0)
+        close(backend);
+
+    sslClose(ssl, sock, NULL, false);
+    atomic_fetch_sub(&forwarder->nconn, 1);
+    return NULL;
+}
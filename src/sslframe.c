@@ -0,0 +1,467 @@
+/*
+ * Copyright © 2019 Aldo Abate <aldo.abate99@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+/*!
+ *  FILE
+ *      sslframe.c - length-prefixed message framing for MySSL library
+ *  PROJECT
+ *      MySSL library
+ *  FUNCTIONS
+ *      global:
+ *          SslFrame* sslFrameNew(SSL *ssl, size_t max_frame);
+ *          void      sslFrameFree(SslFrame *frame);
+ *          int       sslFrameRead(SslFrame *frame, const void **payload, size_t *len, int timeout);
+ *          int       sslFrameStep(SslFrame *frame, const void **payload, size_t *len);
+ *          ssize_t   sslFrameWrite(SSL *ssl, const void *buf, size_t num);
+ *          ssize_t   sslFrameWritev(SSL *ssl, const struct iovec *iov, int iovcnt);
+ *          int       sslFrameWriteStep(SslFrame *frame, const void *buf, size_t num);
+ *      local:
+ *          bool frameRoom(SslFrame *frame, size_t need);
+ *  DESCRIPTION
+ *      The MySSL library is a simple interface to OpenSSL library to permits user-friendly writing of Servers and
+ *      Clients using OpenSSL.
+ *  NOTES
+ *      - The free software library "OpenSSL" is distributed under a "dual licensed" system: under the OpenSSL License
+ *        and the SSLeay License. The OpenSSL License is Apache License 1.0 and SSLeay License bears some similarity to
+ *        a 4-clause BSD License. Both licenses apply.
+ *      - The library "OpenSSL" reference version is 1.0.2g
+ *      - A frame is a header of SSL_FRAME_HEADER bytes (length of the payload, 32 bit in network byte order) followed
+ *        by the payload: the message boundaries don't depend on how TLS and TCP split or coalesce the data.
+ *      - The received data are read (with the read-ahead of OpenSSL enabled) into a buffer of the connection, reused
+ *        for all the frames: a read gets all the frames already arrived, and the complete frames are returned as
+ *        pointers into the buffer, without copies. Only the start of an incomplete frame is moved to the begin of the
+ *        buffer, and the buffer grows (up to a frame of max_frame bytes) only for a frame larger than the buffer.
+ *      - A frame of up to SSL_FRAME_STAGE bytes is written with its header in a single record (and a single
+ *        SSL_write()); a larger frame is written by sslWritev() in full records, the header in the first one.
+ *  AUTHOR
+ *      Aldo Abate
+ *  OPERATING SYSTEM
+ *      Linux (kernel 2.6 and above - glibc 2.3.2 and above)
+ *  COMPILER
+ *      GNU GCC (ver. 4.4 and above)
+ *  RELEASE
+ *      0.1.0 (August 2019)
+ */
+
+#include "myssl.h"
+#include "myssl-private.h"
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <arpa/inet.h>
+
+// framer of a connection
+struct SslFrame {
+    SSL           *ssl;             // OpenSSL SSL structure
+    size_t        max_frame;        // max bytes of a payload
+    unsigned char *buf;             // read buffer
+    size_t        size;             // size of the read buffer
+    size_t        start;            // start of the data not yet returned
+    size_t        end;              // end of the received data
+    size_t        consumed;         // bytes of the frame returned by the last read (released by the next one)
+    bool          failed;           // frame over max_frame received: the stream is not usable anymore
+    unsigned char *wbuf;            // frame in writing (sslFrameWriteStep())
+    size_t        wsize;            // size of the write buffer
+    size_t        wlen;             // bytes of the frame in writing (0 = none)
+};
+
+// local prototypes
+static bool frameRoom(SslFrame *frame, size_t need);
+
+
+////////////////////////////////////////////////////////////////////////////////
+// GLOBAL functions
+////////////////////////////////////////////////////////////////////////////////
+
+
+/*!
+ *  NAME
+ *      sslFrameNew - create the framer of a connection
+ *  SYNOPSIS
+ *      SslFrame* sslFrameNew(
+ *          SSL    *ssl,            // OpenSSL SSL structure
+ *          size_t max_frame);      // max bytes of a received payload (0 = SSL_FRAME_MAX)
+ *  DESCRIPTION
+ *      sslFrameNew() creates the framer of the length-prefixed messages (see NOTES) received on a ssl connection, with
+ *      its read buffer, and enables the read-ahead of the connection. A frame with a payload larger than max_frame is
+ *      a protocol error.
+ *  RETURN VALUE
+ *      Upon successful completion, sslFrameNew() shall return the framer (to free with sslFrameFree()).
+ *      Otherwise (allocation error), NULL shall be returned.
+ */
+
+SslFrame* sslFrameNew(
+    SSL    *ssl,                    // OpenSSL SSL structure
+    size_t max_frame)               // max bytes of a received payload (0 = SSL_FRAME_MAX)
+{
+    SslFrame *frame;
+    if ((frame = calloc(1, sizeof(SslFrame))) == NULL)
+        return NULL;
+
+    // the initial buffer holds a full record (and many small frames)
+    frame->ssl       = ssl;
+    frame->max_frame = max_frame == 0 ? SSL_FRAME_MAX : max_frame > UINT32_MAX ? UINT32_MAX : max_frame;
+    frame->size      = SSL_FRAME_BUFSIZE;
+    if ((frame->buf = malloc(frame->size)) == NULL) {
+        free(frame);
+        return NULL;
+    }
+
+    // read all the records already arrived with a single system call, and allow the write buffer to grow between
+    // the repetitions of a write (sslFrameWriteStep())
+    SSL_set_read_ahead(ssl, 1);
+    SSL_set_mode(ssl, SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+    return frame;
+}
+
+
+/*!
+ *  NAME
+ *      sslFrameFree - free the framer of a connection
+ *  SYNOPSIS
+ *      void sslFrameFree(
+ *          SslFrame *frame);       // framer (NULL = none)
+ *  DESCRIPTION
+ *      sslFrameFree() frees the framer and its buffers (the connection is not closed).
+ *  RETURN VALUE
+ *      None.
+ */
+
+void sslFrameFree(
+    SslFrame *frame)                // framer (NULL = none)
+{
+    if (frame) {
+        free(frame->buf);
+        free(frame->wbuf);
+        free(frame);
+    }
+}
+
+
+/*!
+ *  NAME
+ *      sslFrameRead - read a frame from a SSL/TLS connection
+ *  SYNOPSIS
+ *      int sslFrameRead(
+ *          SslFrame   *frame,      // framer of the connection
+ *          const void **payload,   // payload of the frame (output)
+ *          size_t     *len,        // bytes of the payload (output)
+ *          int        timeout);    // timeout in ms (SSL_TIMEOUT_INFINITE, SSL_TIMEOUT_CONN = connection timeout)
+ *  DESCRIPTION
+ *      sslFrameRead() reads the next frame of the connection, waiting for its data until the timeout (see
+ *      sslFrameStep()). The payload points into the buffer of the framer and is valid until the next read.
+ *  RETURN VALUE
+ *      Upon successful completion, sslFrameRead() shall return 1.
+ *      Otherwise, 0 shall be returned if the peer closed the connection, -1 on error or timeout (see sslStatus()).
+ */
+
+int sslFrameRead(
+    SslFrame   *frame,              // framer of the connection
+    const void **payload,           // payload of the frame (output)
+    size_t     *len,                // bytes of the payload (output)
+    int        timeout)             // timeout in ms (SSL_TIMEOUT_INFINITE, SSL_TIMEOUT_CONN = connection timeout)
+{
+    int rc;
+
+    // read loop: repeat the step waiting the required event (until the deadline of the operation)
+    int64_t deadline = sslDeadline(frame->ssl, timeout);
+    while ((rc = sslFrameStep(frame, payload, len)) < SSL_STEP_ERROR && sslStepWait(frame->ssl, rc, deadline))
+        ;
+
+    // return the frame or error (0 = peer disconnected)
+    return rc > 0 ? 1 : rc == SSL_STEP_CLOSED ? 0 : -1;
+}
+
+
+/*!
+ *  NAME
+ *      sslFrameStep - execute a non-blocking read of a frame
+ *  SYNOPSIS
+ *      int sslFrameStep(
+ *          SslFrame   *frame,      // framer of the connection
+ *          const void **payload,   // payload of the frame (output)
+ *          size_t     *len);       // bytes of the payload (output)
+ *  DESCRIPTION
+ *      sslFrameStep() returns the next complete frame of the buffer of the framer, reading the data of the connection
+ *      (without waiting) only when the buffer doesn't hold a complete frame. The payload points into the buffer of
+ *      the framer and is valid until the next read. It's the read of the event-driven connections: e.g. on a
+ *      SSL_EV_READ event of the reactor the frames are read until SSL_STEP_WANT_READ. A frame with a payload larger
+ *      than the max_frame of the framer is a protocol error (errno is set to EMSGSIZE), and the bytes of a frame
+ *      interrupted by the close of the peer are discarded.
+ *  RETURN VALUE
+ *      Upon successful completion, sslFrameStep() shall return 1.
+ *      Otherwise, the result of the read step (see sslReadStep()) shall be returned: SSL_STEP_CLOSED,
+ *      SSL_STEP_ERROR, SSL_STEP_WANT_READ, SSL_STEP_WANT_WRITE or SSL_STEP_WANT_ASYNC.
+ */
+
+int sslFrameStep(
+    SslFrame   *frame,              // framer of the connection
+    const void **payload,           // payload of the frame (output)
+    size_t     *len)                // bytes of the payload (output)
+{
+    if (frame->failed) {
+        sslStatusSet(frame->ssl, SSL_STATUS_FATAL);
+        return SSL_STEP_ERROR;
+    }
+
+    // release the frame returned by the previous read
+    frame->start   += frame->consumed;
+    frame->consumed = 0;
+    if (frame->start == frame->end)
+        frame->start = frame->end = 0;
+
+    for (;;) {
+        // complete frame in the buffer: return it
+        size_t avail = frame->end - frame->start;
+        size_t need  = SSL_FRAME_HEADER;
+        if (avail >= SSL_FRAME_HEADER) {
+            uint32_t hdr;
+            memcpy(&hdr, frame->buf + frame->start, sizeof(hdr));
+            if ((size_t)ntohl(hdr) > frame->max_frame) {
+                // frame too large: protocol error
+                frame->failed = true;
+                errno = EMSGSIZE;
+                sslStatusSet(frame->ssl, SSL_STATUS_FATAL);
+                return SSL_STEP_ERROR;
+            }
+
+            need += ntohl(hdr);
+            if (avail >= need) {
+                *payload        = frame->buf + frame->start + SSL_FRAME_HEADER;
+                *len            = need - SSL_FRAME_HEADER;
+                frame->consumed = need;
+                sslStatusSet(frame->ssl, SSL_STATUS_OK);
+                return 1;
+            }
+        }
+
+        // read the data of the connection (the buffer must hold the whole frame)
+        if (! frameRoom(frame, need)) {
+            sslStatusSet(frame->ssl, SSL_STATUS_FATAL);
+            return SSL_STEP_ERROR;
+        }
+
+        size_t room = frame->size - frame->end;
+        int    rcvd = sslReadStep(frame->ssl, frame->buf + frame->end, room > INT_MAX ? INT_MAX : (int)room);
+        if (rcvd <= 0)
+            return rcvd;
+
+        frame->end += rcvd;
+    }
+}
+
+
+/*!
+ *  NAME
+ *      sslFrameWrite - write a frame to a SSL/TLS connection
+ *  SYNOPSIS
+ *      ssize_t sslFrameWrite(
+ *          SSL        *ssl,        // OpenSSL SSL structure
+ *          const void *buf,        // payload of the frame
+ *          size_t     num);        // bytes of the payload
+ *  DESCRIPTION
+ *      sslFrameWrite() writes a frame with the payload of num bytes of buf (see sslFrameWritev()).
+ *  RETURN VALUE
+ *      Upon successful completion, sslFrameWrite() shall return num.
+ *      Otherwise, -1 shall be returned (see sslFrameWritev()).
+ */
+
+ssize_t sslFrameWrite(
+    SSL        *ssl,                // OpenSSL SSL structure
+    const void *buf,                // payload of the frame
+    size_t     num)                 // bytes of the payload
+{
+    struct iovec iov;
+    iov.iov_base = (void *)buf;
+    iov.iov_len  = num;
+    return sslFrameWritev(ssl, &iov, 1);
+}
+
+
+/*!
+ *  NAME
+ *      sslFrameWritev - write a frame from more buffers to a SSL/TLS connection
+ *  SYNOPSIS
+ *      ssize_t sslFrameWritev(
+ *          SSL                *ssl,    // OpenSSL SSL structure
+ *          const struct iovec *iov,    // buffers of the payload
+ *          int                iovcnt); // number of buffers
+ *  DESCRIPTION
+ *      sslFrameWritev() writes a frame with the payload made by the iovcnt buffers of iov (e.g.: a fixed prefix and
+ *      a received payload, without joining them first). A payload of up to SSL_FRAME_STAGE bytes (header included)
+ *      is written in a single record with sslWrite(), a larger payload with sslWritev().
+ *  RETURN VALUE
+ *      Upon successful completion, sslFrameWritev() shall return the bytes of the payload.
+ *      Otherwise, -1 shall be returned and the reason can be analyzed calling sslStatus() (a payload over 4 GB sets
+ *      errno to EMSGSIZE).
+ */
+
+ssize_t sslFrameWritev(
+    SSL                *ssl,        // OpenSSL SSL structure
+    const struct iovec *iov,        // buffers of the payload
+    int                iovcnt)      // number of buffers
+{
+    // length of the payload
+    size_t len = 0;
+    for (int i = 0; i < iovcnt; i++)
+        len += iov[i].iov_len;
+
+    if (iovcnt < 0 || len > UINT32_MAX) {
+        errno = EMSGSIZE;
+        sslStatusSet(ssl, SSL_STATUS_FATAL);
+        return -1;
+    }
+
+    uint32_t hdr = htonl((uint32_t)len);
+    if (SSL_FRAME_HEADER + len <= SSL_FRAME_STAGE) {
+        // small frame: header and payload in a single record
+        unsigned char stage[SSL_FRAME_STAGE];
+        size_t        pos = SSL_FRAME_HEADER;
+        memcpy(stage, &hdr, SSL_FRAME_HEADER);
+        for (int i = 0; i < iovcnt; i++) {
+            memcpy(stage + pos, iov[i].iov_base, iov[i].iov_len);
+            pos += iov[i].iov_len;
+        }
+
+        return sslWrite(ssl, stage, (int)pos) == (int)pos ? (ssize_t)len : -1;
+    }
+
+    // large frame: the header is packed with the payload in full records
+    struct iovec *frame_iov;
+    if ((frame_iov = malloc((iovcnt + 1) * sizeof(struct iovec))) == NULL) {
+        sslStatusSet(ssl, SSL_STATUS_FATAL);
+        return -1;
+    }
+
+    frame_iov[0].iov_base = &hdr;
+    frame_iov[0].iov_len  = SSL_FRAME_HEADER;
+    memcpy(frame_iov + 1, iov, iovcnt * sizeof(struct iovec));
+    ssize_t sent = sslWritev(ssl, frame_iov, iovcnt + 1);
+    free(frame_iov);
+    return sent < 0 ? -1 : sent - SSL_FRAME_HEADER;
+}
+
+
+/*!
+ *  NAME
+ *      sslFrameWriteStep - execute a non-blocking write of a frame
+ *  SYNOPSIS
+ *      int sslFrameWriteStep(
+ *          SslFrame   *frame,      // framer of the connection
+ *          const void *buf,        // payload of the frame (NULL = only continue the frames in writing)
+ *          size_t     num);        // bytes of the payload
+ *  DESCRIPTION
+ *      sslFrameWriteStep() writes a frame without waiting: it's the write of the event-driven connections. The header
+ *      and the payload are appended to the write buffer of the framer and the buffer is written with a single
+ *      SSL_write() (the header in the same record of the payload). If the write must be repeated the frames stay in
+ *      the buffer: they are continued by the next call, with a new frame or with buf NULL (e.g. on the SSL_EV_WRITE
+ *      event of the reactor).
+ *  RETURN VALUE
+ *      Upon successful completion (all the frames written), sslFrameWriteStep() shall return 1.
+ *      Otherwise, the result of the write step (see sslWriteStep()) shall be returned: SSL_STEP_CLOSED,
+ *      SSL_STEP_ERROR, SSL_STEP_WANT_READ, SSL_STEP_WANT_WRITE or SSL_STEP_WANT_ASYNC (the frame is accepted anyway).
+ */
+
+int sslFrameWriteStep(
+    SslFrame   *frame,              // framer of the connection
+    const void *buf,                // payload of the frame (NULL = only continue the frames in writing)
+    size_t     num)                 // bytes of the payload
+{
+    // new frame: append it to the write buffer
+    if (buf != NULL) {
+        size_t len = frame->wlen + SSL_FRAME_HEADER + num;
+        if (num > UINT32_MAX || len > INT_MAX) {
+            errno = EMSGSIZE;
+            sslStatusSet(frame->ssl, SSL_STATUS_FATAL);
+            return SSL_STEP_ERROR;
+        }
+
+        if (len > frame->wsize) {
+            // the buffer can move between the repetitions (SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER)
+            unsigned char *wbuf;
+            if ((wbuf = realloc(frame->wbuf, len)) == NULL) {
+                sslStatusSet(frame->ssl, SSL_STATUS_FATAL);
+                return SSL_STEP_ERROR;
+            }
+
+            frame->wbuf  = wbuf;
+            frame->wsize = len;
+        }
+
+        uint32_t hdr = htonl((uint32_t)num);
+        memcpy(frame->wbuf + frame->wlen, &hdr, SSL_FRAME_HEADER);
+        memcpy(frame->wbuf + frame->wlen + SSL_FRAME_HEADER, buf, num);
+        frame->wlen = len;
+    }
+
+    // write the frames (repeated from the same data until they are written)
+    if (frame->wlen == 0)
+        return 1;
+
+    int sent = sslWriteStep(frame->ssl, frame->wbuf, (int)frame->wlen);
+    if (sent <= 0)
+        return sent;
+
+    frame->wlen = 0;
+    return 1;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// LOCAL functions
+////////////////////////////////////////////////////////////////////////////////
+
+
+/*!
+ *  NAME
+ *      frameRoom - make room for a frame in the read buffer
+ *  SYNOPSIS
+ *      bool frameRoom(
+ *          SslFrame *frame,        // framer of the connection
+ *          size_t   need);         // bytes of the frame (header included)
+ *  DESCRIPTION
+ *      frameRoom() makes room in the read buffer for the frame starting at the first byte not yet returned: the
+ *      buffer grows if the frame is larger than the buffer, and the start of the frame is moved to the begin of the
+ *      buffer.
+ *  RETURN VALUE
+ *      frameRoom() shall return true if there is room for the frame, false on allocation error.
+ */
+
+static bool frameRoom(
+    SslFrame *frame,                // framer of the connection
+    size_t   need)                  // bytes of the frame (header included)
+{
+    // grow the buffer (doubling it, up to the largest frame)
+    if (need > frame->size) {
+        size_t        size = frame->size * 2 > need ? frame->size * 2 : need;
+        size_t        max  = SSL_FRAME_HEADER + frame->max_frame;
+        unsigned char *buf;
+        if ((buf = realloc(frame->buf, size < max ? size : max)) == NULL)
+            return false;
+
+        frame->buf  = buf;
+        frame->size = size < max ? size : max;
+    }
+
+    // move the start of the frame to the begin of the buffer (only the bytes of an incomplete frame are moved: the
+    // read gets all the room of the buffer)
+    if (frame->start > 0) {
+        memmove(frame->buf, frame->buf + frame->start, frame->end - frame->start);
+        frame->end  -= frame->start;
+        frame->start = 0;
+    }
+
+    return true;
+}
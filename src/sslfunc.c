@@ -20,6 +20,7 @@
  *  FUNCTIONS
  *      global:
  *          int sslFunc(int (*pfunc)(SSL*), SSL *ssl);
+ *          int sslFuncEx(int (*pfunc)(SSL*), SSL *ssl, int timeout);
  *  DESCRIPTION
  *      The MySSL library is a simple interface to OpenSSL library to permits user-friendly writing of Servers and
  *      Clients using OpenSSL.
@@ -55,47 +56,54 @@
  *          int (*pfunc)(SSL*),     // pointer to the OpenSSL function to execute
  *          SSL *ssl)               // OpenSSL SSL structure
  *  DESCRIPTION
- *      sslFunc() is a smart wrapper for the sslConnect(), sslAccept() and sslShutdown() function of the OpenSSL library. This is a smart method to call the
- *      required OpenSSL function bypassing the architectural features of OpenSSL that includes read/write actions in every read/write/accept/connect/shutdown
- *      action. This function analize the required OpenSSL function result to repeat the action (after a timeout of SSL_RWTOUT ms) until the activity is
- *      terminated. if the number of repeated iterations is too high (>SSL_RWITER), the activity is terminated with an error (total timeout is SSL_RWTOUT * SSL_RWITER seconds).
+ *      sslFunc() execute the required OpenSSL function with the timeout of the connection (see sslSetTimeout() and
+ *      sslFuncEx()).
  *  RETURN VALUE
- *      Upon successful completion, sslWrite() shall return the number of characters sent.
- *      Otherwise, -1 shall be returned and the error can be analyzed calling the OpenSSL library SSL_get_error() function with the return value to find out the
- *      reason.
+ *      Upon successful completion, sslFunc() shall return the result of the required function (> 0).
+ *      Otherwise, a value <= 0 shall be returned and the reason can be analyzed calling sslStatus() (or the OpenSSL
+ *      library SSL_get_error() function with the return value).
  */
 
 int sslFunc(
     int (*pfunc)(SSL*),             // pointer to the OpenSSL function to execute
     SSL *ssl)                       // OpenSSL SSL structure
 {
-    int result;
+    return sslFuncEx(pfunc, ssl, SSL_TIMEOUT_CONN);
+}
 
-    // loop di esecuzione della funzione
-    int count = 0;
-    for (;;) {
-        // test loop counter (tot.timeout = SSL_RWTOUT * SSL_RWITER)
-        if (++count > SSL_RWITER) {
-            // the total timeout is elapsed: break loop (e.g.: tot.timeout = 100 ms * 20 = 2 sec)
-            break;
-        }
 
-        // executes the required function
-        result = pfunc(ssl);
-        if (result > 0) {
-            // operation Ok: break loop
-            break;
-        }
-        else {
-            // operation NOK (result <= 0): start recovery procedure
-            if (sslRecovery(ssl, result))
-                continue; // more data to treat: continue in the loop
+/*!
+ *  NAME
+ *      sslFuncEx - smart wrapper for sslConnect()/sslAccept()/sslShutdown() with a timeout
+ *  SYNOPSIS
+ *      int sslFuncEx(
+ *          int (*pfunc)(SSL*),     // pointer to the OpenSSL function to execute
+ *          SSL *ssl,               // OpenSSL SSL structure
+ *          int timeout)            // timeout in ms (SSL_TIMEOUT_INFINITE, SSL_TIMEOUT_CONN = connection timeout)
+ *  DESCRIPTION
+ *      sslFuncEx() is a smart wrapper for the sslConnect(), sslAccept() and sslShutdown() function of the OpenSSL
+ *      library. This is a smart method to call the required OpenSSL function bypassing the architectural features of
+ *      OpenSSL that includes read/write actions in every read/write/accept/connect/shutdown action. This function
+ *      repeats the function step (see sslFuncStep()) when the socket is ready until the activity is terminated or the
+ *      timeout is elapsed (the timeout is the max duration of the whole operation).
+ *  RETURN VALUE
+ *      Upon successful completion, sslFuncEx() shall return the result of the required function (> 0).
+ *      Otherwise, a value <= 0 shall be returned and the reason can be analyzed calling sslStatus() (or the OpenSSL
+ *      library SSL_get_error() function with the return value).
+ */
+
+int sslFuncEx(
+    int (*pfunc)(SSL*),             // pointer to the OpenSSL function to execute
+    SSL *ssl,                       // OpenSSL SSL structure
+    int timeout)                    // timeout in ms (SSL_TIMEOUT_INFINITE, SSL_TIMEOUT_CONN = connection timeout)
+{
+    int result;
 
-            // break loop
-            break;
-        }
-    }
+    // loop di esecuzione della funzione: ripete lo step attendendo l'evento richiesto (fino alla scadenza)
+    int64_t deadline = sslDeadline(ssl, timeout);
+    while ((result = sslFuncStep(pfunc, ssl)) < SSL_STEP_ERROR && sslStepWait(ssl, result, deadline))
+        ;
 
-    // return the result of the required function or error
-    return result;
+    // return the result of the required function or error (0 = peer disconnected)
+    return result > 0 ? result : result == SSL_STEP_CLOSED ? 0 : -1;
 }
@@ -0,0 +1,122 @@
+/*
+ * Copyright © 2019 Aldo Abate <aldo.abate99@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+
+/*!
+ *  FILE
+ *      sslinit.c - initialization of MySSL library
+ *  PROJECT
+ *      MySSL library
+ *  FUNCTIONS
+ *      global:
+ *          int  sslInit(const SslInitOpts *opts);
+ *          void sslCleanup(void);
+ *  DESCRIPTION
+ *      The MySSL library is a simple interface to OpenSSL library to permits user-friendly writing of Servers and
+ *      Clients using OpenSSL.
+ *  NOTES
+ *      - The free software library "OpenSSL" is distributed under a "dual licensed" system: under the OpenSSL License
+ *        and the SSLeay License. The OpenSSL License is Apache License 1.0 and SSLeay License bears some similarity to
+ *        a 4-clause BSD License. Both licenses apply.
+ *      - The library "OpenSSL" reference version is 1.0.2g
+ *      - The library initializes itself on the first use: sslInit() is needed only to change the default options.
+ *      - The initialization is thread-safe: it's executed once (pthread_once()) also if many threads use the library
+ *        at the same time. On OpenSSL 1.0.2 it installs the locking callbacks (a mutex for each lock of OpenSSL), on
+ *        OpenSSL 1.1.0 and above it calls OPENSSL_init_ssl() (OpenSSL has its own locks).
+ *      - The initialization can't be executed again after the teardown (sslCleanup()): the library fails explicitly
+ *        instead of running on a torn-down OpenSSL (see sslCleanup()).
+ *  AUTHOR
+ *      Aldo Abate
+ *  OPERATING SYSTEM
+ *      Linux (kernel 2.6 and above - glibc 2.3.2 and above)
+ *  COMPILER
+ *      GNU GCC (ver. 4.4 and above)
+ *  RELEASE
+ *      0.1.0 (August 2019)
+ */
+
+#include "myssl.h"
+#include "myssl-private.h"
+
+
+////////////////////////////////////////////////////////////////////////////////
+// GLOBAL functions
+////////////////////////////////////////////////////////////////////////////////
+
+
+/*!
+ *  NAME
+ *      sslInit - initialize the library
+ *  SYNOPSIS
+ *      int sslInit(
+ *          const SslInitOpts *opts);   // initialization options (NULL = default)
+ *  DESCRIPTION
+ *      sslInit() initializes the library and OpenSSL with the options, and must be called before any other function
+ *      of the library (and before any direct use of OpenSSL by the program). The options are:
+ *          - allocator: the allocation functions used by OpenSSL, one of
+ *              SSL_ALLOC_LIBC (default): malloc() of the libc, the OpenSSL allocation functions are not replaced
+ *              SSL_ALLOC_POOL: size-classed pool of the record buffers, shared by the threads under a global lock
+ *                (see sslPoolStats())
+ *              SSL_ALLOC_ARENA: thread-local arenas without locks, with allocation statistics (see sslAllocStats())
+ *          - huge_pages: the memory of the arenas is allocated on the reserved huge pages while available,
+ *            then on normal pages (reported by sslAllocStats())
+ *  RETURN VALUE
+ *      Upon successful completion, sslInit() shall return 0.
+ *      Otherwise, -1 shall be returned: the library is already initialized (the options are ignored), OpenSSL has
+ *      already allocated memory (the allocator is not installed) or sslCleanup() was called (errno set to ECANCELED).
+ */
+
+int sslInit(
+    const SslInitOpts *opts)        // initialization options (NULL = default)
+{
+    // default options
+    SslInitOpts defopts = { 0 };
+    return sslLibInitEx(opts != NULL ? opts : &defopts);
+}
+
+
+/*!
+ *  NAME
+ *      sslCleanup - teardown of the library
+ *  SYNOPSIS
+ *      void sslCleanup(void);
+ *  DESCRIPTION
+ *      sslCleanup() frees the global resources of the library and of OpenSSL: the watchers of the certificate files
+ *      (see sslWatchCtx()), the contexts of the registry (see sslFlushCtx()), the client sessions (see
+ *      sslFlushSessions()), the locking callbacks and the global tables of OpenSSL 1.0.2 and the pool of the large
+ *      buffers. Before the teardown of OpenSSL it stops and joins the threads of the library: the watchers of the
+ *      ticket keys files of the live contexts, the reaper of sslCloseEx() (its connections are closed with a RST)
+ *      and the crypto thread pool (after its queued operations). It must be called at the end of the program, when
+ *      the other threads don't use the library anymore.
+ *      sslCleanup() is idempotent: the following calls (and the calls before any initialization) do nothing. After
+ *      sslCleanup() the library can't be used anymore: the initialization is not executed again, and the functions
+ *      that initialize the library (sslInit(), sslCreateCtx(), sslCreateCtxEx(), sslReloadCtx(), sslWatchCtx(),
+ *      sslReactorNew(), sslReactorNewEx(), sslTicketKeysRotate()) fail with errno set to ECANCELED.
+ *  RETURN VALUE
+ *      None.
+ */
+
+void sslCleanup(void)
+{
+    // stop and join the threads of the library (the watchers of the certificate files and of the ticket keys, the
+    // reaper of the asynchronous closes and the crypto pool), free the contexts and the sessions, then the global
+    // resources (only the first time)
+    sslWatchCleanup();
+    sslTicketCleanup();
+    sslReaperCleanup();
+    sslAsyncCleanup();
+    sslFlushSessions();
+    sslFlushCtx();
+    sslLibCleanup();
+}
@@ -0,0 +1,299 @@
+/*
+ * Copyright © 2019 Aldo Abate <aldo.abate99@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+/*!
+ *  FILE
+ *      ssllock.c - locking callbacks of OpenSSL 1.0.2 for MySSL library
+ *  PROJECT
+ *      MySSL library
+ *  FUNCTIONS
+ *      global:
+ *          void sslLockInit(void);
+ *          void sslLockCleanup(void);
+ *      local:
+ *          void                        lockCallback(int mode, int n, const char *file, int line);
+ *          void                        lockThreadId(CRYPTO_THREADID *id);
+ *          struct CRYPTO_dynlock_value* lockDynCreate(const char *file, int line);
+ *          void                        lockDynLock(int mode, struct CRYPTO_dynlock_value *lock, const char *file,
+ *                                                  int line);
+ *          void                        lockDynDestroy(struct CRYPTO_dynlock_value *lock, const char *file, int line);
+ *  DESCRIPTION
+ *      The MySSL library is a simple interface to OpenSSL library to permits user-friendly writing of Servers and
+ *      Clients using OpenSSL.
+ *  NOTES
+ *      - The free software library "OpenSSL" is distributed under a "dual licensed" system: under the OpenSSL License
+ *        and the SSLeay License. The OpenSSL License is Apache License 1.0 and SSLeay License bears some similarity to
+ *        a 4-clause BSD License. Both licenses apply.
+ *      - The library "OpenSSL" reference version is 1.0.2g
+ *      - OpenSSL 1.0.2 is thread-safe only if the application installs the locking callbacks: the shared structures
+ *        (session cache, error queues, random generator, reference counters, ...) are protected by CRYPTO_num_locks()
+ *        static locks and by the dynamic locks of the engines. Here each lock has its own mutex (no striping: the
+ *        locks are few, and two hot locks never share a mutex) and the thread id is the pthread_self() of the thread.
+ *      - OpenSSL 1.1.0 and above has its own threading support (the callbacks are no-op macros): sslLockInit() and
+ *        sslLockCleanup() do nothing.
+ *      - The callbacks already installed by the application are kept.
+ *  AUTHOR
+ *      Aldo Abate
+ *  OPERATING SYSTEM
+ *      Linux (kernel 2.6 and above - glibc 2.3.2 and above)
+ *  COMPILER
+ *      GNU GCC (ver. 4.4 and above)
+ *  RELEASE
+ *      0.1.0 (August 2019)
+ */
+
+#include "myssl.h"
+#include "myssl-private.h"
+#include <stdlib.h>
+#include <pthread.h>
+#include <openssl/crypto.h>
+
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+// dynamic lock of OpenSSL (CRYPTO_set_dynlock_create_callback())
+struct CRYPTO_dynlock_value {
+    pthread_mutex_t mutex;
+};
+
+// local prototypes
+static void                        lockCallback(int mode, int n, const char *file, int line);
+static void                        lockThreadId(CRYPTO_THREADID *id);
+static struct CRYPTO_dynlock_value* lockDynCreate(const char *file, int line);
+static void                        lockDynLock(int mode, struct CRYPTO_dynlock_value *lock, const char *file,
+                                               int line);
+static void                        lockDynDestroy(struct CRYPTO_dynlock_value *lock, const char *file, int line);
+
+// local data: static locks of OpenSSL
+static pthread_mutex_t *lock_mutexes = NULL;    // mutexes of the static locks (one per lock)
+static int             lock_count = 0;          // number of static locks (CRYPTO_num_locks())
+#endif
+
+
+////////////////////////////////////////////////////////////////////////////////
+// GLOBAL functions
+////////////////////////////////////////////////////////////////////////////////
+
+
+/*!
+ *  NAME
+ *      sslLockInit - install the locking callbacks of OpenSSL
+ *  SYNOPSIS
+ *      void sslLockInit(void);
+ *  DESCRIPTION
+ *      sslLockInit() installs the locking callbacks of OpenSSL 1.0.2 (static locks, dynamic locks and thread id) if
+ *      the application didn't install its own ones. It's called once by the library initialization (see
+ *      sslLibInit()), before any other thread can use OpenSSL through the library.
+ *  RETURN VALUE
+ *      None.
+ */
+
+void sslLockInit(void)
+{
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+    // keep the callbacks of the application
+    if (CRYPTO_get_locking_callback() != NULL)
+        return;
+
+    // allocate the mutexes of the static locks
+    int count = CRYPTO_num_locks();
+    if ((lock_mutexes = OPENSSL_malloc(count * sizeof(pthread_mutex_t))) == NULL)
+        return;
+
+    for (int i = 0; i < count; i++)
+        pthread_mutex_init(&lock_mutexes[i], NULL);
+
+    lock_count = count;
+
+    // install the callbacks (the thread id callback can be set only once)
+    CRYPTO_THREADID_set_callback(lockThreadId);
+    CRYPTO_set_locking_callback(lockCallback);
+    if (CRYPTO_get_dynlock_create_callback() == NULL) {
+        CRYPTO_set_dynlock_create_callback(lockDynCreate);
+        CRYPTO_set_dynlock_lock_callback(lockDynLock);
+        CRYPTO_set_dynlock_destroy_callback(lockDynDestroy);
+    }
+#endif
+}
+
+
+/*!
+ *  NAME
+ *      sslLockCleanup - remove the locking callbacks of OpenSSL
+ *  SYNOPSIS
+ *      void sslLockCleanup(void);
+ *  DESCRIPTION
+ *      sslLockCleanup() removes the locking callbacks installed by sslLockInit() and frees the mutexes of the static
+ *      locks. It's called by sslCleanup(), when no other thread uses OpenSSL.
+ *  RETURN VALUE
+ *      None.
+ */
+
+void sslLockCleanup(void)
+{
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+    // callbacks not installed (or of the application)
+    if (lock_mutexes == NULL || CRYPTO_get_locking_callback() != lockCallback)
+        return;
+
+    // remove the callbacks and free the mutexes
+    CRYPTO_set_locking_callback(NULL);
+    if (CRYPTO_get_dynlock_create_callback() == lockDynCreate) {
+        CRYPTO_set_dynlock_create_callback(NULL);
+        CRYPTO_set_dynlock_lock_callback(NULL);
+        CRYPTO_set_dynlock_destroy_callback(NULL);
+    }
+
+    for (int i = 0; i < lock_count; i++)
+        pthread_mutex_destroy(&lock_mutexes[i]);
+
+    OPENSSL_free(lock_mutexes);
+    lock_mutexes = NULL;
+    lock_count   = 0;
+#endif
+}
+
+
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+////////////////////////////////////////////////////////////////////////////////
+// LOCAL functions
+////////////////////////////////////////////////////////////////////////////////
+
+
+/*!
+ *  NAME
+ *      lockCallback - lock/unlock a static lock of OpenSSL
+ *  SYNOPSIS
+ *      void lockCallback(
+ *          int        mode,        // CRYPTO_LOCK/CRYPTO_UNLOCK (| CRYPTO_READ/CRYPTO_WRITE)
+ *          int        n,           // index of the static lock
+ *          const char *file,       // source file of the caller (unused)
+ *          int        line);       // source line of the caller (unused)
+ *  DESCRIPTION
+ *      lockCallback() is the locking callback of OpenSSL: it locks or unlocks the mutex of the static lock n (the
+ *      read locks are exclusive too: OpenSSL takes a read lock also where it then takes the write lock).
+ *  RETURN VALUE
+ *      None.
+ */
+
+static void lockCallback(
+    int        mode,                // CRYPTO_LOCK/CRYPTO_UNLOCK (| CRYPTO_READ/CRYPTO_WRITE)
+    int        n,                   // index of the static lock
+    const char *file,               // source file of the caller (unused)
+    int        line)                // source line of the caller (unused)
+{
+    if (n < 0 || n >= lock_count)
+        return;
+
+    if (mode & CRYPTO_LOCK)
+        pthread_mutex_lock(&lock_mutexes[n]);
+    else
+        pthread_mutex_unlock(&lock_mutexes[n]);
+}
+
+
+/*!
+ *  NAME
+ *      lockThreadId - id of the current thread
+ *  SYNOPSIS
+ *      void lockThreadId(
+ *          CRYPTO_THREADID *id);   // thread id (output)
+ *  DESCRIPTION
+ *      lockThreadId() is the thread id callback of OpenSSL: the id is the pthread_self() of the thread (it keys the
+ *      per-thread error queues).
+ *  RETURN VALUE
+ *      None.
+ */
+
+static void lockThreadId(
+    CRYPTO_THREADID *id)            // thread id (output)
+{
+    CRYPTO_THREADID_set_numeric(id, (unsigned long)pthread_self());
+}
+
+
+/*!
+ *  NAME
+ *      lockDynCreate - create a dynamic lock of OpenSSL
+ *  SYNOPSIS
+ *      struct CRYPTO_dynlock_value* lockDynCreate(
+ *          const char *file,       // source file of the caller (unused)
+ *          int        line);       // source line of the caller (unused)
+ *  DESCRIPTION
+ *      lockDynCreate() is the dynamic lock create callback of OpenSSL: it allocates a new mutex.
+ *  RETURN VALUE
+ *      lockDynCreate() shall return the new lock, NULL on allocation error.
+ */
+
+static struct CRYPTO_dynlock_value* lockDynCreate(
+    const char *file,               // source file of the caller (unused)
+    int        line)                // source line of the caller (unused)
+{
+    struct CRYPTO_dynlock_value *lock;
+    if ((lock = OPENSSL_malloc(sizeof(struct CRYPTO_dynlock_value))) != NULL)
+        pthread_mutex_init(&lock->mutex, NULL);
+
+    return lock;
+}
+
+
+/*!
+ *  NAME
+ *      lockDynLock - lock/unlock a dynamic lock of OpenSSL
+ *  SYNOPSIS
+ *      void lockDynLock(
+ *          int                         mode,   // CRYPTO_LOCK/CRYPTO_UNLOCK (| CRYPTO_READ/CRYPTO_WRITE)
+ *          struct CRYPTO_dynlock_value *lock,  // dynamic lock
+ *          const char                  *file,  // source file of the caller (unused)
+ *          int                         line);  // source line of the caller (unused)
+ *  DESCRIPTION
+ *      lockDynLock() is the dynamic lock callback of OpenSSL: it locks or unlocks the mutex of the lock.
+ *  RETURN VALUE
+ *      None.
+ */
+
+static void lockDynLock(
+    int                         mode,   // CRYPTO_LOCK/CRYPTO_UNLOCK (| CRYPTO_READ/CRYPTO_WRITE)
+    struct CRYPTO_dynlock_value *lock,  // dynamic lock
+    const char                  *file,  // source file of the caller (unused)
+    int                         line)   // source line of the caller (unused)
+{
+    if (mode & CRYPTO_LOCK)
+        pthread_mutex_lock(&lock->mutex);
+    else
+        pthread_mutex_unlock(&lock->mutex);
+}
+
+
+/*!
+ *  NAME
+ *      lockDynDestroy - destroy a dynamic lock of OpenSSL
+ *  SYNOPSIS
+ *      void lockDynDestroy(
+ *          struct CRYPTO_dynlock_value *lock,  // dynamic lock
+ *          const char                  *file,  // source file of the caller (unused)
+ *          int                         line);  // source line of the caller (unused)
+ *  DESCRIPTION
+ *      lockDynDestroy() is the dynamic lock destroy callback of OpenSSL: it frees the mutex.
+ *  RETURN VALUE
+ *      None.
+ */
+
+static void lockDynDestroy(
+    struct CRYPTO_dynlock_value *lock,  // dynamic lock
+    const char                  *file,  // source file of the caller (unused)
+    int                         line)   // source line of the caller (unused)
+{
+    pthread_mutex_destroy(&lock->mutex);
+    OPENSSL_free(lock);
+}
+#endif
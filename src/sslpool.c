@@ -0,0 +1,311 @@
+/*
+ * Copyright © 2019 Aldo Abate <aldo.abate99@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+
+/*!
+ *  FILE
+ *      sslpool.c - size-classed pool of the OpenSSL buffers for MySSL library
+ *  PROJECT
+ *      MySSL library
+ *  FUNCTIONS
+ *      global:
+ *          void sslPoolInit(void);
+ *          void sslPoolStats(SslPoolStats *stats);
+ *      local:
+ *          void* poolMalloc(size_t num, const char *file, int line);
+ *          void* poolRealloc(void *ptr, size_t num, const char *file, int line);
+ *          void  poolFree(void *ptr, const char *file, int line);
+ *  DESCRIPTION
+ *      The MySSL library is a simple interface to OpenSSL library to permits user-friendly writing of Servers and
+ *      Clients using OpenSSL.
+ *  NOTES
+ *      - The free software library "OpenSSL" is distributed under a "dual licensed" system: under the OpenSSL License
+ *        and the SSLeay License. The OpenSSL License is Apache License 1.0 and SSLeay License bears some similarity to
+ *        a 4-clause BSD License. Both licenses apply.
+ *      - The library "OpenSSL" reference version is 1.0.2g
+ *      - The pool is opt-in (SSL_ALLOC_POOL, see sslInit()): the allocation functions of OpenSSL are replaced at the
+ *        library initialization, for the whole process (CRYPTO_set_mem_functions() works only before the first
+ *        allocation of OpenSSL: if the application already used OpenSSL the pool stays disabled). The blocks of
+ *        SSL_POOL_MIN..SSL_POOL_MAX bytes (the record buffers, the handshake buffers and the SSL structures) are
+ *        rounded up to a class of SSL_POOL_CLASS bytes and, when freed, are kept in the free list of their class (up
+ *        to SSL_POOL_BYTES free bytes in all) for the next allocation of the same class.
+ *      - With the release of the idle buffers (release_buffers of SslCtxOpts, SSL_MODE_RELEASE_BUFFERS) OpenSSL frees
+ *        the record buffers of a connection as soon as they are empty and allocates them again on the next record:
+ *        the pool makes this cheap, and an idle connection keeps only its SSL structures.
+ *  AUTHOR
+ *      Aldo Abate
+ *  OPERATING SYSTEM
+ *      Linux (kernel 2.6 and above - glibc 2.3.2 and above)
+ *  COMPILER
+ *      GNU GCC (ver. 4.4 and above)
+ *  RELEASE
+ *      0.1.0 (August 2019)
+ */
+
+#include "myssl.h"
+#include "myssl-private.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <openssl/crypto.h>
+
+// header of an allocated block (16 bytes: the user data keeps the malloc() alignment)
+typedef union PoolBlock {
+    struct {
+        size_t size;                // size of the block (class size for a pooled block)
+        int    pooled;              // the block belongs to a class of the pool
+    } h;
+    union PoolBlock *next;          // next free block of the class (free list)
+    max_align_t     align;          // alignment of the user data
+} PoolBlock;
+
+// number of size classes
+#define POOL_CLASSES    ((SSL_POOL_MAX - SSL_POOL_MIN) / SSL_POOL_CLASS + 1)
+
+// local prototypes
+static void* poolMalloc(size_t num, const char *file, int line);
+static void* poolRealloc(void *ptr, size_t num, const char *file, int line);
+static void  poolFree(void *ptr, const char *file, int line);
+
+// local data: free lists of the classes and statistics
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static PoolBlock       *pool_free[POOL_CLASSES];    // free blocks of each class
+static bool            pool_active = false;         // allocation functions of OpenSSL replaced
+static long            pool_requests = 0;           // allocations of pooled sizes
+static long            pool_hits = 0;               // allocations served by a free list
+static long            pool_in_use = 0;             // bytes of the pooled blocks in use
+static long            pool_high_water = 0;         // max bytes of the pooled blocks in use
+static long            pool_bytes = 0;              // bytes of the free blocks
+
+
+////////////////////////////////////////////////////////////////////////////////
+// GLOBAL functions
+////////////////////////////////////////////////////////////////////////////////
+
+
+/*!
+ *  NAME
+ *      sslPoolInit - install the pool of the OpenSSL buffers
+ *  SYNOPSIS
+ *      void sslPoolInit(void);
+ *  DESCRIPTION
+ *      sslPoolInit() replaces the allocation functions of OpenSSL with the functions of the pool. It's called once by
+ *      the library initialization with the SSL_ALLOC_POOL allocator (see sslInit()), before any other OpenSSL call
+ *      of the library.
+ *  RETURN VALUE
+ *      None.
+ */
+
+void sslPoolInit(void)
+{
+    // fails if OpenSSL already allocated memory: the pool stays disabled
+    pool_active = CRYPTO_set_mem_functions(poolMalloc, poolRealloc, poolFree) == 1;
+}
+
+
+/*!
+ *  NAME
+ *      sslPoolStats - statistics of the pool of the OpenSSL buffers
+ *  SYNOPSIS
+ *      void sslPoolStats(
+ *          SslPoolStats *stats);   // statistics (output)
+ *  DESCRIPTION
+ *      sslPoolStats() gets the statistics of the pool of the OpenSSL buffers (see NOTES): the allocations of the
+ *      pooled sizes and the ones served by the pool, the bytes in use (and their high-water mark) and the bytes kept
+ *      in the free lists.
+ *  RETURN VALUE
+ *      None.
+ */
+
+void sslPoolStats(
+    SslPoolStats *stats)            // statistics (output)
+{
+    pthread_mutex_lock(&pool_mutex);
+    stats->active     = pool_active;
+    stats->requests   = pool_requests;
+    stats->hits       = pool_hits;
+    stats->hit_rate   = pool_requests > 0 ? 100.0 * pool_hits / pool_requests : 0;
+    stats->in_use     = pool_in_use;
+    stats->high_water = pool_high_water;
+    stats->pooled     = pool_bytes;
+    pthread_mutex_unlock(&pool_mutex);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// LOCAL functions
+////////////////////////////////////////////////////////////////////////////////
+
+
+/*!
+ *  NAME
+ *      poolMalloc - allocation function of OpenSSL
+ *  SYNOPSIS
+ *      void* poolMalloc(
+ *          size_t     num,         // number of bytes
+ *          const char *file,       // source file of the caller (unused)
+ *          int        line);       // source line of the caller (unused)
+ *  DESCRIPTION
+ *      poolMalloc() allocates a block with its header: a block of a pooled size is taken from the free list of its
+ *      class, if not empty.
+ *  RETURN VALUE
+ *      Upon successful completion, poolMalloc() shall return the block.
+ *      Otherwise, NULL shall be returned.
+ */
+
+static void* poolMalloc(
+    size_t     num,                 // number of bytes
+    const char *file,               // source file of the caller (unused)
+    int        line)                // source line of the caller (unused)
+{
+    PoolBlock *block = NULL;
+    bool      pooled = num >= SSL_POOL_MIN && num <= SSL_POOL_MAX;
+    (void)file, (void)line;
+    if (num == 0)
+        return NULL;
+
+    // pooled size: round up to the class and take a free block
+    if (pooled) {
+        int cls = (num - SSL_POOL_MIN + SSL_POOL_CLASS - 1) / SSL_POOL_CLASS;
+        num     = SSL_POOL_MIN + (size_t)cls * SSL_POOL_CLASS;
+        pthread_mutex_lock(&pool_mutex);
+        pool_requests++;
+        if ((block = pool_free[cls]) != NULL) {
+            pool_free[cls] = block->next;
+            pool_bytes    -= num;
+            pool_hits++;
+        }
+
+        if ((pool_in_use += num) > pool_high_water)
+            pool_high_water = pool_in_use;
+
+        pthread_mutex_unlock(&pool_mutex);
+    }
+
+    // allocate a new block
+    if (block == NULL && (block = malloc(sizeof(PoolBlock) + num)) == NULL) {
+        if (pooled) {
+            pthread_mutex_lock(&pool_mutex);
+            pool_in_use -= num;
+            pthread_mutex_unlock(&pool_mutex);
+        }
+
+        return NULL;
+    }
+
+    block->h.size   = num;
+    block->h.pooled = pooled;
+    return block + 1;
+}
+
+
+/*!
+ *  NAME
+ *      poolRealloc - reallocation function of OpenSSL
+ *  SYNOPSIS
+ *      void* poolRealloc(
+ *          void       *ptr,        // block to reallocate (NULL = new block)
+ *          size_t     num,         // new number of bytes
+ *          const char *file,       // source file of the caller
+ *          int        line);       // source line of the caller
+ *  DESCRIPTION
+ *      poolRealloc() changes the size of a block: a block that stays in the same class (or out of the pool sizes)
+ *      is kept (or reallocated with realloc()), otherwise the data is moved to a new block.
+ *  RETURN VALUE
+ *      Upon successful completion, poolRealloc() shall return the block.
+ *      Otherwise, NULL shall be returned (the block is not freed).
+ */
+
+static void* poolRealloc(
+    void       *ptr,                // block to reallocate (NULL = new block)
+    size_t     num,                 // new number of bytes
+    const char *file,               // source file of the caller
+    int        line)                // source line of the caller
+{
+    if (ptr == NULL)
+        return poolMalloc(num, file, line);
+
+    if (num == 0) {
+        poolFree(ptr, file, line);
+        return NULL;
+    }
+
+    // the block is big enough, or both the sizes are out of the pool: no data to move
+    PoolBlock *block = (PoolBlock *)ptr - 1;
+    bool      pooled = num >= SSL_POOL_MIN && num <= SSL_POOL_MAX;
+    if (block->h.pooled && num <= block->h.size)
+        return ptr;
+
+    if (! block->h.pooled && ! pooled) {
+        if ((block = realloc(block, sizeof(PoolBlock) + num)) == NULL)
+            return NULL;
+
+        block->h.size = num;
+        return block + 1;
+    }
+
+    // move the data to a new block
+    void *newptr;
+    if ((newptr = poolMalloc(num, file, line)) == NULL)
+        return NULL;
+
+    memcpy(newptr, ptr, block->h.size < num ? block->h.size : num);
+    poolFree(ptr, file, line);
+    return newptr;
+}
+
+
+/*!
+ *  NAME
+ *      poolFree - free function of OpenSSL
+ *  SYNOPSIS
+ *      void poolFree(
+ *          void       *ptr,        // block to free (NULL = none)
+ *          const char *file,       // source file of the caller (unused)
+ *          int        line);       // source line of the caller (unused)
+ *  DESCRIPTION
+ *      poolFree() puts a pooled block in the free list of its class (if the free lists don't exceed
+ *      SSL_POOL_BYTES), otherwise it frees the block.
+ *  RETURN VALUE
+ *      None.
+ */
+
+static void poolFree(
+    void       *ptr,                // block to free (NULL = none)
+    const char *file,               // source file of the caller (unused)
+    int        line)                // source line of the caller (unused)
+{
+    (void)file, (void)line;
+    if (ptr == NULL)
+        return;
+
+    PoolBlock *block = (PoolBlock *)ptr - 1;
+    if (block->h.pooled) {
+        // keep the block in the free list of its class
+        size_t size = block->h.size;
+        int    cls  = (size - SSL_POOL_MIN) / SSL_POOL_CLASS;
+        pthread_mutex_lock(&pool_mutex);
+        pool_in_use -= size;
+        if (pool_bytes + (long)size <= SSL_POOL_BYTES) {
+            block->next    = pool_free[cls];
+            pool_free[cls] = block;
+            pool_bytes    += size;
+            block          = NULL;
+        }
+
+        pthread_mutex_unlock(&pool_mutex);
+    }
+
+    free(block);
+}
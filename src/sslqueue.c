@@ -0,0 +1,419 @@
+/*
+ * Copyright © 2019 Aldo Abate <aldo.abate99@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+/*!
+ *  FILE
+ *      sslqueue.c - shared buffers and write queues of the reactor connections for MySSL library
+ *  PROJECT
+ *      MySSL library
+ *  FUNCTIONS
+ *      global:
+ *          SslBuf* sslBufNew(const void *data, size_t len);
+ *          SslBuf* sslBufRef(SslBuf *buf);
+ *          void    sslBufUnref(SslBuf *buf);
+ *          void*   sslBufData(SslBuf *buf);
+ *          size_t  sslBufLen(SslBuf *buf);
+ *          void    sslQueueInit(SslQueue *queue, const SslQueueOpts *opts);
+ *          bool    sslQueuePush(SslQueue *queue, SslBuf *buf);
+ *          int     sslQueueFlush(SslQueue *queue, SSL *ssl);
+ *          void    sslQueueClear(SslQueue *queue);
+ *      local:
+ *          void queuePop(SslQueue *queue);
+ *          int  queueNext(SslQueue *queue);
+ *  DESCRIPTION
+ *      The MySSL library is a simple interface to OpenSSL library to permits user-friendly writing of Servers and
+ *      Clients using OpenSSL.
+ *  NOTES
+ *      - The free software library "OpenSSL" is distributed under a "dual licensed" system: under the OpenSSL License
+ *        and the SSLeay License. The OpenSSL License is Apache License 1.0 and SSLeay License bears some similarity to
+ *        a 4-clause BSD License. Both licenses apply.
+ *      - The library "OpenSSL" reference version is 1.0.2g
+ *      - A buffer (SslBuf) is allocated once and shared by the write queues of many connections (e.g.: a message
+ *        sent to all the subscribers): the reference counter is atomic, so the connections can belong to reactors of
+ *        different threads. The data must not be modified after the buffer is queued.
+ *      - The write queue of a connection (see sslConnSend() in sslreactor.c) holds references to the buffers, not
+ *        copies: the memory of a slow consumer is bounded by the limit of its queue. A queue is written without
+ *        waiting: the write stops at the first SSL_STEP_WANT_WRITE and continues when the socket is writable, with
+ *        the same arguments (as required by SSL_write()). The small buffers are packed in a staging record instead
+ *        of a record each, a buffer of a record or more (or the last one) is written from the buffer itself.
+ *  AUTHOR
+ *      Aldo Abate
+ *  OPERATING SYSTEM
+ *      Linux (kernel 2.6 and above - glibc 2.3.2 and above)
+ *  COMPILER
+ *      GNU GCC (ver. 4.4 and above)
+ *  RELEASE
+ *      0.1.0 (August 2019)
+ */
+
+#include "myssl.h"
+#include "myssl-private.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+
+// shared buffer (header and data in a single allocation)
+struct SslBuf {
+    atomic_long   refs;             // references (the creator and the queues)
+    size_t        len;              // bytes of data
+    unsigned char data[];           // data
+};
+
+// local prototypes
+static void queuePop(SslQueue *queue);
+static int  queueNext(SslQueue *queue);
+
+
+////////////////////////////////////////////////////////////////////////////////
+// GLOBAL functions
+////////////////////////////////////////////////////////////////////////////////
+
+
+/*!
+ *  NAME
+ *      sslBufNew - create a shared buffer
+ *  SYNOPSIS
+ *      SslBuf* sslBufNew(
+ *          const void *data,       // data to copy in the buffer (NULL = to fill with sslBufData())
+ *          size_t     len);        // bytes of data
+ *  DESCRIPTION
+ *      sslBufNew() creates a buffer of len bytes with a reference (of the caller), to queue in the write queues of the
+ *      reactor connections (see sslConnSend()): each queue takes its own reference and releases it when the buffer is
+ *      written, so the caller releases its reference with sslBufUnref() just after queuing the buffer.
+ *  RETURN VALUE
+ *      Upon successful completion, sslBufNew() shall return the buffer.
+ *      Otherwise (allocation error), NULL shall be returned.
+ */
+
+SslBuf* sslBufNew(
+    const void *data,               // data to copy in the buffer (NULL = to fill with sslBufData())
+    size_t     len)                 // bytes of data
+{
+    SslBuf *buf;
+    if ((buf = malloc(sizeof(SslBuf) + len)) == NULL)
+        return NULL;
+
+    atomic_init(&buf->refs, 1);
+    buf->len = len;
+    if (data != NULL)
+        memcpy(buf->data, data, len);
+
+    return buf;
+}
+
+
+/*!
+ *  NAME
+ *      sslBufRef - take a reference of a shared buffer
+ *  SYNOPSIS
+ *      SslBuf* sslBufRef(
+ *          SslBuf *buf);           // buffer
+ *  DESCRIPTION
+ *      sslBufRef() takes a new reference of the buffer (to release with sslBufUnref()).
+ *  RETURN VALUE
+ *      sslBufRef() shall return the buffer.
+ */
+
+SslBuf* sslBufRef(
+    SslBuf *buf)                    // buffer
+{
+    atomic_fetch_add_explicit(&buf->refs, 1, memory_order_relaxed);
+    return buf;
+}
+
+
+/*!
+ *  NAME
+ *      sslBufUnref - release a reference of a shared buffer
+ *  SYNOPSIS
+ *      void sslBufUnref(
+ *          SslBuf *buf);           // buffer (NULL = none)
+ *  DESCRIPTION
+ *      sslBufUnref() releases a reference of the buffer: the buffer is freed with the last reference.
+ *  RETURN VALUE
+ *      None.
+ */
+
+void sslBufUnref(
+    SslBuf *buf)                    // buffer (NULL = none)
+{
+    if (buf != NULL && atomic_fetch_sub_explicit(&buf->refs, 1, memory_order_acq_rel) == 1)
+        free(buf);
+}
+
+
+/*!
+ *  NAME
+ *      sslBufData - get the data of a shared buffer
+ *  SYNOPSIS
+ *      void* sslBufData(
+ *          SslBuf *buf);           // buffer
+ *  DESCRIPTION
+ *      sslBufData() get the data of the buffer (to fill before queuing the buffer).
+ *  RETURN VALUE
+ *      sslBufData() shall return the data of the buffer.
+ */
+
+void* sslBufData(
+    SslBuf *buf)                    // buffer
+{
+    return buf->data;
+}
+
+
+/*!
+ *  NAME
+ *      sslBufLen - get the length of a shared buffer
+ *  SYNOPSIS
+ *      size_t sslBufLen(
+ *          SslBuf *buf);           // buffer
+ *  DESCRIPTION
+ *      sslBufLen() get the bytes of data of the buffer.
+ *  RETURN VALUE
+ *      sslBufLen() shall return the bytes of data.
+ */
+
+size_t sslBufLen(
+    SslBuf *buf)                    // buffer
+{
+    return buf->len;
+}
+
+
+/*!
+ *  NAME
+ *      sslQueueInit - set the options of a write queue
+ *  SYNOPSIS
+ *      void sslQueueInit(
+ *          SslQueue           *queue,  // write queue
+ *          const SslQueueOpts *opts);  // options (NULL = default)
+ *  DESCRIPTION
+ *      sslQueueInit() sets the watermarks, the limit and the policy of the queue (the fields at 0 get the default
+ *      values, and the watermarks are adjusted to low <= high <= limit). The buffers in the queue are kept.
+ *  RETURN VALUE
+ *      None.
+ */
+
+void sslQueueInit(
+    SslQueue           *queue,      // write queue
+    const SslQueueOpts *opts)       // options (NULL = default)
+{
+    SslQueueOpts defopts = { 0 };
+    queue->opts = opts != NULL ? *opts : defopts;
+    if (queue->opts.limit == 0)
+        queue->opts.limit = SSL_QUEUE_LIMIT;
+
+    if (queue->opts.high == 0)
+        queue->opts.high = SSL_QUEUE_HIGH < queue->opts.limit ? SSL_QUEUE_HIGH : queue->opts.limit;
+
+    if (queue->opts.high > queue->opts.limit)
+        queue->opts.high = queue->opts.limit;
+
+    if (queue->opts.low == 0)
+        queue->opts.low = SSL_QUEUE_LOW < queue->opts.high / 2 ? SSL_QUEUE_LOW : queue->opts.high / 2;
+
+    if (queue->opts.low > queue->opts.high)
+        queue->opts.low = queue->opts.high;
+}
+
+
+/*!
+ *  NAME
+ *      sslQueuePush - append a buffer to a write queue
+ *  SYNOPSIS
+ *      bool sslQueuePush(
+ *          SslQueue *queue,        // write queue
+ *          SslBuf   *buf);         // buffer (the queue takes a reference)
+ *  DESCRIPTION
+ *      sslQueuePush() appends the buffer to the queue (without checking the limit: see sslConnSend()).
+ *  RETURN VALUE
+ *      sslQueuePush() shall return true if the buffer is queued, false on allocation error.
+ */
+
+bool sslQueuePush(
+    SslQueue *queue,                // write queue
+    SslBuf   *buf)                  // buffer (the queue takes a reference)
+{
+    SslQueueItem *item;
+    if ((item = malloc(sizeof(SslQueueItem))) == NULL)
+        return false;
+
+    item->buf  = sslBufRef(buf);
+    item->off  = 0;
+    item->next = NULL;
+    if (queue->tail)
+        queue->tail->next = item;
+    else
+        queue->head = item;
+
+    queue->tail   = item;
+    queue->bytes += buf->len;
+    return true;
+}
+
+
+/*!
+ *  NAME
+ *      sslQueueFlush - write a write queue
+ *  SYNOPSIS
+ *      int sslQueueFlush(
+ *          SslQueue *queue,        // write queue
+ *          SSL      *ssl);         // OpenSSL SSL structure of the connection
+ *  DESCRIPTION
+ *      sslQueueFlush() writes the buffers of the queue without waiting (see NOTES), until the queue is empty or the
+ *      write must be repeated: a write stopped by SSL_STEP_WANT_WRITE (or SSL_STEP_WANT_READ) stays in the queue and
+ *      is repeated with the same arguments by the next call. The staging record is freed when the queue is empty.
+ *  RETURN VALUE
+ *      sslQueueFlush() shall return 1 if the queue is empty.
+ *      Otherwise, the result of the write step (see sslWriteStep()) shall be returned: SSL_STEP_CLOSED,
+ *      SSL_STEP_ERROR, SSL_STEP_WANT_READ, SSL_STEP_WANT_WRITE or SSL_STEP_WANT_ASYNC.
+ */
+
+int sslQueueFlush(
+    SslQueue *queue,                // write queue
+    SSL      *ssl)                  // OpenSSL SSL structure of the connection
+{
+    while (queue->wlen > 0 || queue->head) {
+        // next write (a write to repeat keeps its arguments)
+        if (queue->wlen == 0 && queueNext(queue) == 0)
+            break;
+
+        int sent = sslWriteStep(ssl, queue->wptr, queue->wlen);
+        if (sent <= 0)
+            return queue->step = sent;
+
+        // written: release the buffers done
+        queue->bytes -= sent;
+        queue->wlen   = 0;
+        if (queue->wdirect && (queue->head->off += sent) == queue->head->buf->len)
+            queuePop(queue);
+    }
+
+    // queue empty: free the staging record
+    free(queue->stage);
+    queue->stage = NULL;
+    return queue->step = 1;
+}
+
+
+/*!
+ *  NAME
+ *      sslQueueClear - empty a write queue
+ *  SYNOPSIS
+ *      void sslQueueClear(
+ *          SslQueue *queue);       // write queue
+ *  DESCRIPTION
+ *      sslQueueClear() releases the buffers of the queue and frees the staging record (e.g.: when the connection is
+ *      closed). The options are kept.
+ *  RETURN VALUE
+ *      None.
+ */
+
+void sslQueueClear(
+    SslQueue *queue)                // write queue
+{
+    while (queue->head)
+        queuePop(queue);
+
+    free(queue->stage);
+    queue->stage = NULL;
+    queue->bytes = 0;
+    queue->wlen  = 0;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// LOCAL functions
+////////////////////////////////////////////////////////////////////////////////
+
+
+/*!
+ *  NAME
+ *      queuePop - remove the first buffer of a write queue
+ *  SYNOPSIS
+ *      void queuePop(
+ *          SslQueue *queue);       // write queue
+ *  DESCRIPTION
+ *      queuePop() removes the first buffer of the queue and releases its reference.
+ *  RETURN VALUE
+ *      None.
+ */
+
+static void queuePop(
+    SslQueue *queue)                // write queue
+{
+    SslQueueItem *item = queue->head;
+    if ((queue->head = item->next) == NULL)
+        queue->tail = NULL;
+
+    sslBufUnref(item->buf);
+    free(item);
+}
+
+
+/*!
+ *  NAME
+ *      queueNext - prepare the next write of a write queue
+ *  SYNOPSIS
+ *      int queueNext(
+ *          SslQueue *queue);       // write queue (not empty)
+ *  DESCRIPTION
+ *      queueNext() prepares the next write: from the first buffer if it holds a record or more, or if it's the last
+ *      one (up to SSL_QUEUE_CHUNK bytes), otherwise from the staging record filled with the small buffers (the
+ *      buffers copied in the staging record are released).
+ *  RETURN VALUE
+ *      queueNext() shall return the bytes of the write, 0 if the queue holds only empty buffers (a staging record not
+ *      allocated is not an error: the buffer is written directly).
+ */
+
+static int queueNext(
+    SslQueue *queue)                // write queue (not empty)
+{
+    // the empty buffers are not written (a write of 0 bytes is not a valid SSL_write())
+    while (queue->head && queue->head->off == queue->head->buf->len)
+        queuePop(queue);
+
+    if (queue->head == NULL)
+        return 0;
+
+    SslQueueItem *item = queue->head;
+    size_t       left  = item->buf->len - item->off;
+    if (left >= SSL_RECORD_MAX || item->next == NULL ||
+            (queue->stage == NULL && (queue->stage = malloc(SSL_RECORD_MAX)) == NULL)) {
+        // write from the buffer (no copy)
+        queue->wptr    = item->buf->data + item->off;
+        queue->wlen    = left < SSL_QUEUE_CHUNK ? (int)left : SSL_QUEUE_CHUNK;
+        queue->wdirect = true;
+        return queue->wlen;
+    }
+
+    // pack the small buffers in the staging record
+    int len = 0;
+    while ((item = queue->head) != NULL && len < SSL_RECORD_MAX) {
+        size_t num = item->buf->len - item->off;
+        if (num > (size_t)(SSL_RECORD_MAX - len))
+            num = SSL_RECORD_MAX - len;
+
+        memcpy(queue->stage + len, item->buf->data + item->off, num);
+        len       += num;
+        item->off += num;
+        if (item->off == item->buf->len)
+            queuePop(queue);
+    }
+
+    queue->wptr    = queue->stage;
+    queue->wlen    = len;
+    queue->wdirect = false;
+    return len;
+}
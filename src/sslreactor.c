@@ -0,0 +1,1348 @@
+/*
+ * Copyright © 2019 Aldo Abate <aldo.abate99@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+
+
+/*!
+ *  FILE
+ *      sslreactor.c - epoll reactor for non-blocking SSL/TLS connections for MySSL library
+ *  PROJECT
+ *      MySSL library
+ *  FUNCTIONS
+ *      global:
+ *          SslReactor*   sslReactorNew(void);
+ *          SslReactor*   sslReactorNewEx(int backend, int max_conn);
+ *          void          sslReactorFree(SslReactor *reactor);
+ *          int           sslReactorListen(SslReactor *reactor, int sock, SSL_CTX *ctx, SslConnCb cb, void *arg);
+ *          SslConn*      sslReactorAdd(SslReactor *reactor, int sock, SSL_CTX *ctx, int type, SslConnCb cb,
+ *                                      void *arg);
+ *          int           sslReactorRun(SslReactor *reactor, int timeout);
+ *          void          sslReactorStop(SslReactor *reactor);
+ *          int           sslReactorCount(SslReactor *reactor);
+ *          int           sslReactorBackend(SslReactor *reactor);
+ *          unsigned long sslReactorSyscalls(SslReactor *reactor);
+ *          SSL*          sslConnSsl(SslConn *conn);
+ *          void          sslConnSetCb(SslConn *conn, SslConnCb cb, void *arg);
+ *          void          sslConnClose(SslConn *conn, bool do_shutdown);
+ *          void          sslConnQueueSet(SslConn *conn, const SslQueueOpts *opts);
+ *          int           sslConnSend(SslConn *conn, SslBuf *buf);
+ *          size_t        sslConnQueued(SslConn *conn);
+ *      local:
+ *          SslConn* connNew(SslReactor *reactor, int sock, SSL_CTX *ctx, int type, SslConnCb cb, void *arg);
+ *          void     connEvent(SslConn *conn, uint32_t events);
+ *          void     connAccept(SslConn *listener);
+ *          void     connAsyncWatch(SslConn *conn);
+ *          void     connAsyncUnwatch(SslConn *conn);
+ *          void     connNotify(void *owner);
+ *          void     connQueueFlush(SslConn *conn);
+ *          void     connQueueDrop(SslConn *conn);
+ *          int      reactorEpoll(SslReactor *reactor, int64_t deadline);
+ *          int      reactorUring(SslReactor *reactor, int64_t deadline);
+ *          void     reactorFlush(SslReactor *reactor);
+ *          void     reactorComplete(SslConn *conn, int op, int res);
+ *          void     reactorRelease(SslReactor *reactor);
+ *  DESCRIPTION
+ *      The MySSL library is a simple interface to OpenSSL library to permits user-friendly writing of Servers and
+ *      Clients using OpenSSL.
+ *  NOTES
+ *      - The free software library "OpenSSL" is distributed under a "dual licensed" system: under the OpenSSL License
+ *        and the SSLeay License. The OpenSSL License is Apache License 1.0 and SSLeay License bears some similarity to
+ *        a 4-clause BSD License. Both licenses apply.
+ *      - The library "OpenSSL" reference version is 1.0.2g
+ *      - A reactor drives many non-blocking connections in a single thread (a reactor must be used only by the thread
+ *        that runs it): the sockets are registered once in edge-triggered mode (EPOLLIN|EPOLLOUT|EPOLLET), the
+ *        handshakes are executed by the reactor and the application gets the connection events in a callback.
+ *      - With the io_uring backend (SSL_REACTOR_URING, see ssluring.c) the connections use a BIO on two buffers
+ *        instead of the socket BIO: the receives and the sends of all the connections are queued during an events
+ *        batch and submitted with the single io_uring_enter() that waits the next completions, instead of a
+ *        recv()/send() for each record. The callbacks get the same events of the epoll backend.
+ *      - Each connection has a write queue (see sslqueue.c): sslConnSend() queues a shared buffer and the reactor
+ *        writes the queue when the socket is writable, so a producer can send to many connections without handling
+ *        SSL_STEP_WANT_WRITE. The queue reports the watermarks (SSL_EV_QUEUE_HIGH/SSL_EV_QUEUE_LOW) for the
+ *        backpressure, and a slow consumer can't hold more than the limit of its queue: over the limit the new buffer
+ *        is dropped or the connection is closed (policy of sslConnQueueSet()). The application must not mix
+ *        sslConnSend() and sslWriteStep() on the same connection.
+ *  AUTHOR
+ *      Aldo Abate
+ *  OPERATING SYSTEM
+ *      Linux (kernel 2.6 and above - glibc 2.3.2 and above)
+ *  COMPILER
+ *      GNU GCC (ver. 4.4 and above)
+ *  RELEASE
+ *      0.1.0 (August 2019)
+ */
+
+#define _GNU_SOURCE     // accept4()
+#include "myssl.h"
+#include "myssl-private.h"
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+// max number of events read by a epoll_wait()
+#define REACTOR_EVENTS  256
+
+// connection type of a listening socket
+#define CONN_LISTENER   -1
+
+// max async fds of a connection (see SSL_get_changed_async_fds())
+#define CONN_ASYNC_FDS  4
+
+// reactor connection (or listening socket). The struct is aligned to 8 bytes (calloc()): the io_uring operations
+// carry the connection with the operation type in the low bits
+struct SslConn {
+    SslReactor     *reactor;        // reactor of the connection
+    int            sock;            // socket
+    int            type;            // type: SSL_SERVER/SSL_CLIENT/CONN_LISTENER
+    SSL            *ssl;            // OpenSSL SSL structure (NULL for a listening socket)
+    SSL_CTX        *ctx;            // context of the accepted connections (listening socket)
+    SslConnCb      cb;              // events callback
+    void           *arg;            // callback argument
+    bool           connected;       // handshake done
+    bool           closed;          // closed (freed at the end of the events batch)
+    struct SslConn *prev;           // previous connection of the reactor
+    struct SslConn *next;           // next connection of the reactor (or of the closed list)
+    SslUringIo     io;              // io_uring backend: I/O buffers
+    int            inflight;        // io_uring backend: operations in progress (the connection can't be freed)
+    int            npoll;           // io_uring backend: polls in progress (listening socket or async fds)
+    bool           kick;            // io_uring backend: first handshake step to execute
+    bool           dirty;           // io_uring backend: in the list of the connections to flush
+    struct SslConn *dirty_next;     // io_uring backend: next connection to flush
+    SslQueue       queue;           // write queue (sslConnSend())
+    int            async_fd[CONN_ASYNC_FDS];    // epoll backend: async fds registered in the epoll fd
+    int            nasync;          // epoll backend: number of async fds registered
+};
+
+// reactor
+struct SslReactor {
+    int           epfd;             // epoll fd (epoll backend)
+    SslUring      *ring;            // io_uring ring (io_uring backend)
+    bool          stop;             // stop request (sslReactorStop())
+    int           nconn;            // number of connections (the listening sockets are not counted)
+    SslConn       *conns;           // connections list
+    SslConn       *closed;          // connections closed during the events batch
+    SslConn       *dirty;           // connections with I/O operations to queue (io_uring backend)
+    unsigned long syscalls;         // syscalls of the reactor (epoll_wait(), epoll_ctl(), accept4())
+};
+
+// local prototypes
+static SslConn* connNew(SslReactor *reactor, int sock, SSL_CTX *ctx, int type, SslConnCb cb, void *arg);
+static void     connEvent(SslConn *conn, uint32_t events);
+static void     connAccept(SslConn *listener);
+static void     connAsyncWatch(SslConn *conn);
+static void     connAsyncUnwatch(SslConn *conn);
+static void     connNotify(void *owner);
+static void     connQueueFlush(SslConn *conn);
+static void     connQueueDrop(SslConn *conn);
+static int      reactorEpoll(SslReactor *reactor, int64_t deadline);
+static int      reactorUring(SslReactor *reactor, int64_t deadline);
+static void     reactorFlush(SslReactor *reactor);
+static void     reactorComplete(SslConn *conn, int op, int res);
+static void     reactorRelease(SslReactor *reactor);
+
+
+////////////////////////////////////////////////////////////////////////////////
+// GLOBAL functions
+////////////////////////////////////////////////////////////////////////////////
+
+
+/*!
+ *  NAME
+ *      sslReactorNew - create a reactor
+ *  SYNOPSIS
+ *      SslReactor* sslReactorNew(void);
+ *  DESCRIPTION
+ *      sslReactorNew() create a reactor without connections (epoll backend, see sslReactorNewEx()).
+ *  RETURN VALUE
+ *      Upon successful completion, sslReactorNew() shall return the reactor (to free with sslReactorFree()).
+ *      Otherwise, NULL shall be returned.
+ */
+
+SslReactor* sslReactorNew(void)
+{
+    // epoll backend
+    return sslReactorNewEx(SSL_REACTOR_EPOLL, 0);
+}
+
+
+/*!
+ *  NAME
+ *      sslReactorNewEx - create a reactor with an I/O backend
+ *  SYNOPSIS
+ *      SslReactor* sslReactorNewEx(
+ *          int backend,            // I/O backend: SSL_REACTOR_EPOLL/SSL_REACTOR_URING
+ *          int max_conn);          // io_uring backend: max number of connections (0 = default)
+ *  DESCRIPTION
+ *      sslReactorNewEx() create a reactor without connections that does the socket I/O with the backend:
+ *          SSL_REACTOR_EPOLL   epoll in edge-triggered mode and the socket BIO of OpenSSL
+ *          SSL_REACTOR_URING   io_uring with the receives/sends of a events batch submitted together (max_conn
+ *                              connections, each with 32 KB of registered buffers)
+ *      If io_uring is not available (old kernel, disabled by the system or OpenSSL 1.0.2) the epoll backend is used:
+ *      sslReactorBackend() gets the backend in use.
+ *  RETURN VALUE
+ *      Upon successful completion, sslReactorNewEx() shall return the reactor (to free with sslReactorFree()).
+ *      Otherwise, NULL shall be returned.
+ */
+
+SslReactor* sslReactorNewEx(
+    int backend,                    // I/O backend: SSL_REACTOR_EPOLL/SSL_REACTOR_URING
+    int max_conn)                   // io_uring backend: max number of connections (0 = default)
+{
+    // one-time initialization of the OpenSSL library (fails after sslCleanup())
+    if (! sslLibInit())
+        return NULL;
+
+    // allocate the reactor
+    SslReactor *reactor;
+    if ((reactor = calloc(1, sizeof(SslReactor))) == NULL)
+        return NULL;
+
+    // create the io_uring ring (if required and available) or the epoll fd
+    reactor->epfd = -1;
+    if (backend == SSL_REACTOR_URING)
+        reactor->ring = sslUringNew(max_conn > 0 ? max_conn : SSL_URING_CONNS);
+
+    if (reactor->ring == NULL && (reactor->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        free(reactor);
+        return NULL;
+    }
+
+    return reactor;
+}
+
+
+/*!
+ *  NAME
+ *      sslReactorFree - free a reactor
+ *  SYNOPSIS
+ *      void sslReactorFree(
+ *          SslReactor *reactor);   // reactor
+ *  DESCRIPTION
+ *      sslReactorFree() closes all the connections of the reactor (without shutdown and without callback) and the
+ *      listening sockets, and frees the reactor.
+ *  RETURN VALUE
+ *      None.
+ */
+
+void sslReactorFree(
+    SslReactor *reactor)            // reactor
+{
+    if (reactor == NULL)
+        return;
+
+    // close all the connections
+    while (reactor->conns)
+        sslConnClose(reactor->conns, false);
+
+    // io_uring backend: wait the end of the operations of the closed connections (the sockets are shut down and the
+    // polls cancelled, the kernel must not write the buffers after they are freed)
+    if (reactor->ring) {
+        while (reactor->dirty) {
+            SslConn *conn  = reactor->dirty;
+            reactor->dirty = conn->dirty_next;
+            conn->dirty    = false;
+        }
+
+        int64_t deadline = sslClockNs() + 1000000000;
+        for (;;) {
+            reactorRelease(reactor);
+            if (reactor->closed == NULL || sslClockNs() >= deadline ||
+                    sslUringWait(reactor->ring, deadline) < 0)
+                break;
+
+            void *owner;
+            int  op, res;
+            while (sslUringReap(reactor->ring, &owner, &op, &res)) {
+                if (owner)
+                    reactorComplete(owner, op, res);
+            }
+        }
+    }
+
+    // free the closed connections
+    while (reactor->closed) {
+        SslConn *conn   = reactor->closed;
+        reactor->closed = conn->next;
+        free(conn);
+    }
+
+    if (reactor->epfd >= 0)
+        close(reactor->epfd);
+
+    sslUringFree(reactor->ring);
+    free(reactor);
+}
+
+
+/*!
+ *  NAME
+ *      sslReactorListen - accept the connections of a listening socket
+ *  SYNOPSIS
+ *      int sslReactorListen(
+ *          SslReactor *reactor,    // reactor
+ *          int        sock,        // listening socket
+ *          SSL_CTX    *ctx,        // server context of the accepted connections
+ *          SslConnCb  cb,          // events callback of the accepted connections
+ *          void       *arg);       // callback argument
+ *  DESCRIPTION
+ *      sslReactorListen() adds a listening socket to the reactor: the reactor accepts the connections, executes the
+ *      handshakes and calls cb with the events of each connection (see sslReactorAdd()). The socket (set non-blocking)
+ *      is closed by sslReactorFree(), the context must be valid until then.
+ *  RETURN VALUE
+ *      Upon successful completion, sslReactorListen() shall return 0.
+ *      Otherwise, -1 shall be returned.
+ */
+
+int sslReactorListen(
+    SslReactor *reactor,            // reactor
+    int        sock,                // listening socket
+    SSL_CTX    *ctx,                // server context of the accepted connections
+    SslConnCb  cb,                  // events callback of the accepted connections
+    void       *arg)                // callback argument
+{
+    // add the listening socket
+    return connNew(reactor, sock, ctx, CONN_LISTENER, cb, arg) ? 0 : -1;
+}
+
+
+/*!
+ *  NAME
+ *      sslReactorAdd - add a connection to a reactor
+ *  SYNOPSIS
+ *      SslConn* sslReactorAdd(
+ *          SslReactor *reactor,    // reactor
+ *          int        sock,        // connected socket
+ *          SSL_CTX    *ctx,        // context of the connection
+ *          int        type,        // connection type: SSL_SERVER/SSL_CLIENT
+ *          SslConnCb  cb,          // events callback
+ *          void       *arg);       // callback argument
+ *  DESCRIPTION
+ *      sslReactorAdd() adds a connected socket (set non-blocking, or blocking with the io_uring backend that waits in
+ *      the ring) to the reactor: the reactor executes the handshake
+ *      (as server or client) and calls cb with the events of the connection:
+ *          SSL_EV_CONNECTED    handshake done (followed by a SSL_EV_READ)
+ *          SSL_EV_READ         data to read: read with sslReadStep() until SSL_STEP_WANT_READ (edge-triggered);
+ *                              a peer disconnection is reported here (sslReadStep() returns SSL_STEP_CLOSED)
+ *          SSL_EV_WRITE        socket writable again (after a SSL_STEP_WANT_WRITE of sslWriteStep())
+ *          SSL_EV_CLOSED       handshake failed, or slow consumer dropped by the write queue (SSL_QUEUE_CLOSE
+ *                              policy or max_time, see sslConnQueueSet()): the connection is closed after the callback
+ *          SSL_EV_QUEUE_HIGH   write queue above the high watermark (sslConnSend())
+ *          SSL_EV_QUEUE_LOW    write queue back to the low watermark (after a SSL_EV_QUEUE_HIGH)
+ *      The application closes the connection with sslConnClose() (also inside the callback).
+ *  RETURN VALUE
+ *      Upon successful completion, sslReactorAdd() shall return the connection.
+ *      Otherwise (also with the io_uring backend if there are already max_conn connections), NULL shall be returned
+ *      (the socket is not closed).
+ */
+
+SslConn* sslReactorAdd(
+    SslReactor *reactor,            // reactor
+    int        sock,                // connected socket
+    SSL_CTX    *ctx,                // context of the connection
+    int        type,                // connection type: SSL_SERVER/SSL_CLIENT
+    SslConnCb  cb,                  // events callback
+    void       *arg)                // callback argument
+{
+    // add the connection
+    return connNew(reactor, sock, ctx, type == SSL_SERVER ? SSL_SERVER : SSL_CLIENT, cb, arg);
+}
+
+
+/*!
+ *  NAME
+ *      sslReactorRun - run a reactor
+ *  SYNOPSIS
+ *      int sslReactorRun(
+ *          SslReactor *reactor,    // reactor
+ *          int        timeout);    // max duration in ms (SSL_TIMEOUT_INFINITE = until sslReactorStop())
+ *  DESCRIPTION
+ *      sslReactorRun() waits the events of the connections and dispatches them until the timeout is elapsed or
+ *      sslReactorStop() is called (also by a callback).
+ *  RETURN VALUE
+ *      Upon successful completion, sslReactorRun() shall return 0.
+ *      Otherwise (epoll error), -1 shall be returned.
+ */
+
+int sslReactorRun(
+    SslReactor *reactor,            // reactor
+    int        timeout)             // max duration in ms (SSL_TIMEOUT_INFINITE = until sslReactorStop())
+{
+    int64_t deadline = timeout < 0 ? -1 : sslClockNs() + (int64_t)timeout * 1000000;
+    reactor->stop = false;
+    while (! reactor->stop) {
+        // deadline elapsed
+        if (deadline >= 0 && deadline <= sslClockNs())
+            break;
+
+        // wait and dispatch a events batch, then free the connections closed during the batch
+        if ((reactor->ring ? reactorUring(reactor, deadline) : reactorEpoll(reactor, deadline)) < 0)
+            return -1;
+
+        reactorRelease(reactor);
+    }
+
+    return 0;
+}
+
+
+/*!
+ *  NAME
+ *      sslReactorStop - stop a reactor
+ *  SYNOPSIS
+ *      void sslReactorStop(
+ *          SslReactor *reactor);   // reactor
+ *  DESCRIPTION
+ *      sslReactorStop() makes sslReactorRun() return after the current events batch (to call in a callback).
+ *  RETURN VALUE
+ *      None.
+ */
+
+void sslReactorStop(
+    SslReactor *reactor)            // reactor
+{
+    reactor->stop = true;
+}
+
+
+/*!
+ *  NAME
+ *      sslReactorCount - get the number of connections of a reactor
+ *  SYNOPSIS
+ *      int sslReactorCount(
+ *          SslReactor *reactor);   // reactor
+ *  DESCRIPTION
+ *      sslReactorCount() get the number of open connections of the reactor (the listening sockets are not counted).
+ *  RETURN VALUE
+ *      sslReactorCount() shall return the number of connections.
+ */
+
+int sslReactorCount(
+    SslReactor *reactor)            // reactor
+{
+    return reactor->nconn;
+}
+
+
+/*!
+ *  NAME
+ *      sslReactorBackend - get the I/O backend of a reactor
+ *  SYNOPSIS
+ *      int sslReactorBackend(
+ *          SslReactor *reactor);   // reactor
+ *  DESCRIPTION
+ *      sslReactorBackend() get the I/O backend in use (SSL_REACTOR_EPOLL if io_uring was required but not available).
+ *  RETURN VALUE
+ *      sslReactorBackend() shall return SSL_REACTOR_EPOLL or SSL_REACTOR_URING.
+ */
+
+int sslReactorBackend(
+    SslReactor *reactor)            // reactor
+{
+    return reactor->ring ? SSL_REACTOR_URING : SSL_REACTOR_EPOLL;
+}
+
+
+/*!
+ *  NAME
+ *      sslReactorSyscalls - get the number of syscalls of a reactor
+ *  SYNOPSIS
+ *      unsigned long sslReactorSyscalls(
+ *          SslReactor *reactor);   // reactor
+ *  DESCRIPTION
+ *      sslReactorSyscalls() get the number of syscalls executed by the reactor: epoll_wait(), epoll_ctl() and
+ *      accept4() with the epoll backend (the socket reads and writes are done by the socket BIO of OpenSSL),
+ *      io_uring_enter() and accept4() with the io_uring backend (all the socket I/O).
+ *  RETURN VALUE
+ *      sslReactorSyscalls() shall return the number of syscalls.
+ */
+
+unsigned long sslReactorSyscalls(
+    SslReactor *reactor)            // reactor
+{
+    return reactor->syscalls + (reactor->ring ? sslUringSyscalls(reactor->ring) : 0);
+}
+
+
+/*!
+ *  NAME
+ *      sslConnSsl - get the OpenSSL SSL structure of a reactor connection
+ *  SYNOPSIS
+ *      SSL* sslConnSsl(
+ *          SslConn *conn);         // reactor connection
+ *  DESCRIPTION
+ *      sslConnSsl() get the OpenSSL SSL structure of a connection, to use with the step functions (sslReadStep(),
+ *      sslWriteStep()) and the OpenSSL functions that don't do I/O.
+ *  RETURN VALUE
+ *      sslConnSsl() shall return the OpenSSL SSL structure.
+ */
+
+SSL* sslConnSsl(
+    SslConn *conn)                  // reactor connection
+{
+    return conn->ssl;
+}
+
+
+/*!
+ *  NAME
+ *      sslConnSetCb - change the events callback of a reactor connection
+ *  SYNOPSIS
+ *      void sslConnSetCb(
+ *          SslConn   *conn,        // reactor connection
+ *          SslConnCb cb,           // events callback
+ *          void      *arg);        // callback argument
+ *  DESCRIPTION
+ *      sslConnSetCb() changes the events callback of a connection (also inside the callback, effective from the next
+ *      event), e.g. to give its own argument to a connection accepted by a listening socket (see sslReactorListen()).
+ *  RETURN VALUE
+ *      None.
+ */
+
+void sslConnSetCb(
+    SslConn   *conn,                // reactor connection
+    SslConnCb cb,                   // events callback
+    void      *arg)                 // callback argument
+{
+    conn->cb  = cb;
+    conn->arg = arg;
+}
+
+
+/*!
+ *  NAME
+ *      sslConnClose - close a reactor connection
+ *  SYNOPSIS
+ *      void sslConnClose(
+ *          SslConn *conn,          // reactor connection
+ *          bool    do_shutdown);   // send the close_notify before closing (without waiting the peer)
+ *  DESCRIPTION
+ *      sslConnClose() removes the connection from the reactor, frees the OpenSSL SSL structure and closes the socket.
+ *      The connection memory is freed at the end of the current events batch (so it can be closed in a callback), or
+ *      with the io_uring backend when its operations in progress are completed.
+ *  RETURN VALUE
+ *      None.
+ */
+
+void sslConnClose(
+    SslConn *conn,                  // reactor connection
+    bool    do_shutdown)            // send the close_notify before closing (without waiting the peer)
+{
+    if (conn->closed)
+        return;
+
+    // remove the connection from the reactor and close it
+    SslReactor *reactor = conn->reactor;
+    if (reactor->epfd >= 0) {
+        reactor->syscalls++;
+        epoll_ctl(reactor->epfd, EPOLL_CTL_DEL, conn->sock, NULL);
+
+        // the async fds of a handshake in progress stay open until the private-key operation is done: remove them,
+        // their events must not reach the freed connection
+        connAsyncUnwatch(conn);
+    }
+
+    if (conn->ssl) {
+        if (do_shutdown && conn->connected) {
+            SSL_shutdown(conn->ssl);
+
+            // io_uring backend: send the close_notify at once (best effort, the connection won't be flushed)
+            if (reactor->ring && conn->io.tx_len > 0 && ! conn->io.tx_busy)
+                send(conn->sock, conn->io.tx, conn->io.tx_len, MSG_DONTWAIT | MSG_NOSIGNAL);
+        }
+
+        SSL_free(conn->ssl);
+        conn->ssl = NULL;
+        reactor->nconn--;
+    }
+
+    // io_uring backend: the operations in progress hold the socket, end them (the connection is freed after their
+    // completions)
+    if (reactor->ring) {
+        if (conn->inflight > conn->npoll)
+            shutdown(conn->sock, SHUT_RDWR);
+
+        for (int i = 0; i < conn->npoll; i++)
+            sslUringCancel(reactor->ring, conn, SSL_URING_POLL);
+    }
+
+    close(conn->sock);
+    sslQueueClear(&conn->queue);
+
+    // move the connection to the closed list
+    if (conn->prev)
+        conn->prev->next = conn->next;
+    else
+        reactor->conns = conn->next;
+
+    if (conn->next)
+        conn->next->prev = conn->prev;
+
+    conn->closed    = true;
+    conn->next      = reactor->closed;
+    reactor->closed = conn;
+}
+
+
+/*!
+ *  NAME
+ *      sslConnQueueSet - set the options of the write queue of a reactor connection
+ *  SYNOPSIS
+ *      void sslConnQueueSet(
+ *          SslConn            *conn,   // reactor connection
+ *          const SslQueueOpts *opts);  // options (NULL = default)
+ *  DESCRIPTION
+ *      sslConnQueueSet() sets the options of the write queue of a connection (see sslConnSend()):
+ *          high        bytes in queue for the SSL_EV_QUEUE_HIGH event (default 256 KB)
+ *          low         bytes in queue for the SSL_EV_QUEUE_LOW event after a SSL_EV_QUEUE_HIGH (default 64 KB)
+ *          limit       max bytes in queue (default 1 MB)
+ *          policy      over the limit: SSL_QUEUE_DROP (the new buffer is dropped) or SSL_QUEUE_CLOSE (the connection
+ *                      is closed after a SSL_EV_CLOSED event)
+ *          max_time    ms above the high watermark after which the connection is closed (0 = no limit), checked by
+ *                      sslConnSend()
+ *      The fields at 0 get the default values. The buffers already queued are kept.
+ *  RETURN VALUE
+ *      None.
+ */
+
+void sslConnQueueSet(
+    SslConn            *conn,       // reactor connection
+    const SslQueueOpts *opts)       // options (NULL = default)
+{
+    sslQueueInit(&conn->queue, opts);
+}
+
+
+/*!
+ *  NAME
+ *      sslConnSend - queue a buffer to write on a reactor connection
+ *  SYNOPSIS
+ *      int sslConnSend(
+ *          SslConn *conn,          // reactor connection
+ *          SslBuf  *buf);          // shared buffer (the queue takes a reference)
+ *  DESCRIPTION
+ *      sslConnSend() appends the buffer to the write queue of the connection (also during the handshake) and writes
+ *      the queue at once if it was empty: the rest is written by the reactor when the socket is writable. The caller
+ *      keeps its reference of the buffer (the same buffer can be sent to many connections). When the queue goes
+ *      above the high watermark the callback gets a SSL_EV_QUEUE_HIGH event (the producer can stop), and a
+ *      SSL_EV_QUEUE_LOW event when it's written down to the low watermark. A buffer that would exceed the limit is
+ *      dropped (SSL_QUEUE_DROP) or the connection is closed (SSL_QUEUE_CLOSE), as a connection above the high
+ *      watermark since more than max_time ms: see sslConnQueueSet().
+ *  RETURN VALUE
+ *      Upon successful completion, sslConnSend() shall return 0.
+ *      Otherwise, -1 shall be returned and errno set: EPIPE (connection closed or write failed), ENOBUFS (limit
+ *      exceeded), ETIMEDOUT (above the high watermark since more than max_time ms) or ENOMEM. With the SSL_QUEUE_CLOSE
+ *      policy or max_time the connection is closed (and freed at the end of the events batch).
+ */
+
+int sslConnSend(
+    SslConn *conn,                  // reactor connection
+    SslBuf  *buf)                   // shared buffer (the queue takes a reference)
+{
+    SslQueue *queue = &conn->queue;
+    if (conn->closed || queue->failed) {
+        errno = EPIPE;
+        return -1;
+    }
+
+    // slow consumer: above the high watermark for too long or over the limit
+    if (queue->above && queue->opts.max_time > 0 &&
+            sslClockNs() - queue->above_since >= (int64_t)queue->opts.max_time * 1000000) {
+        connQueueDrop(conn);
+        errno = ETIMEDOUT;
+        return -1;
+    }
+
+    if (queue->bytes + sslBufLen(buf) > queue->opts.limit) {
+        if (queue->opts.policy == SSL_QUEUE_CLOSE)
+            connQueueDrop(conn);
+
+        errno = ENOBUFS;
+        return -1;
+    }
+
+    // queue the buffer and write at once if the queue was empty
+    bool idle = queue->head == NULL && queue->wlen == 0;
+    if (! sslQueuePush(queue, buf)) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    if (idle && conn->connected) {
+        connQueueFlush(conn);
+        if (conn->closed || queue->failed) {
+            errno = EPIPE;
+            return -1;
+        }
+    }
+
+    // high watermark crossed
+    if (! queue->above && queue->bytes > queue->opts.high) {
+        queue->above       = true;
+        queue->above_since = sslClockNs();
+        conn->cb(conn, SSL_EV_QUEUE_HIGH, conn->arg);
+    }
+
+    return 0;
+}
+
+
+/*!
+ *  NAME
+ *      sslConnQueued - get the bytes in the write queue of a reactor connection
+ *  SYNOPSIS
+ *      size_t sslConnQueued(
+ *          SslConn *conn);         // reactor connection
+ *  DESCRIPTION
+ *      sslConnQueued() get the bytes queued by sslConnSend() and not yet written.
+ *  RETURN VALUE
+ *      sslConnQueued() shall return the bytes in queue.
+ */
+
+size_t sslConnQueued(
+    SslConn *conn)                  // reactor connection
+{
+    return conn->queue.bytes;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// LOCAL functions
+////////////////////////////////////////////////////////////////////////////////
+
+
+/*!
+ *  NAME
+ *      connNew - create a reactor connection
+ *  SYNOPSIS
+ *      SslConn* connNew(
+ *          SslReactor *reactor,    // reactor
+ *          int        sock,        // socket
+ *          SSL_CTX    *ctx,        // context
+ *          int        type,        // type: SSL_SERVER/SSL_CLIENT/CONN_LISTENER
+ *          SslConnCb  cb,          // events callback
+ *          void       *arg);       // callback argument
+ *  DESCRIPTION
+ *      connNew() set the socket non-blocking, creates the OpenSSL SSL structure (not for a listening socket) and
+ *      registers the socket in the epoll fd in edge-triggered mode (io_uring backend: assigns the I/O buffers and the
+ *      BIO, and queues the connection to flush).
+ *  RETURN VALUE
+ *      Upon successful completion, connNew() shall return the connection.
+ *      Otherwise, NULL shall be returned (the socket is not closed).
+ */
+
+static SslConn* connNew(
+    SslReactor *reactor,            // reactor
+    int        sock,                // socket
+    SSL_CTX    *ctx,                // context
+    int        type,                // type: SSL_SERVER/SSL_CLIENT/CONN_LISTENER
+    SslConnCb  cb,                  // events callback
+    void       *arg)                // callback argument
+{
+    // set the socket non-blocking (the io_uring operations on a non-blocking socket fail with EAGAIN instead of
+    // waiting in the ring: the connections of the io_uring backend are blocking)
+    int  flags;
+    bool nonblock = reactor->ring == NULL || type == CONN_LISTENER;
+    if ((flags = fcntl(sock, F_GETFL)) < 0 ||
+            fcntl(sock, F_SETFL, nonblock ? flags | O_NONBLOCK : flags & ~O_NONBLOCK) < 0)
+        return NULL;
+
+    // allocate the connection and the SSL structure
+    SslConn *conn;
+    if ((conn = calloc(1, sizeof(SslConn))) == NULL)
+        return NULL;
+
+    conn->reactor = reactor;
+    conn->sock    = sock;
+    conn->type    = type;
+    conn->ctx     = ctx;
+    conn->cb      = cb;
+    conn->arg     = arg;
+    conn->io.slot = -1;
+    sslQueueInit(&conn->queue, NULL);
+    if (type != CONN_LISTENER) {
+        if (reactor->ring) {
+            // io_uring backend: BIO on the buffers of a slot
+            BIO *bio = NULL;
+            if (! sslUringSlotGet(reactor->ring, &conn->io) || (conn->ssl = SSL_new(ctx)) == NULL ||
+                    (bio = sslUringBio(&conn->io)) == NULL) {
+                sslUringSlotPut(reactor->ring, &conn->io);
+                SSL_free(conn->ssl);
+                free(conn);
+                return NULL;
+            }
+
+            conn->io.notify = connNotify;
+            conn->io.owner  = conn;
+            SSL_set_bio(conn->ssl, bio, bio);
+        } else if ((conn->ssl = SSL_new(ctx)) == NULL || SSL_set_fd(conn->ssl, sock) != 1) {
+            SSL_free(conn->ssl);
+            free(conn);
+            return NULL;
+        }
+
+        if (type == SSL_SERVER)
+            SSL_set_accept_state(conn->ssl);
+        else
+            SSL_set_connect_state(conn->ssl);
+    }
+
+    if (reactor->ring) {
+        // io_uring backend: the first handshake step (or the poll of the listening socket) is queued by the reactor
+        conn->kick = conn->ssl != NULL;
+        connNotify(conn);
+    } else {
+        // register the socket (edge-triggered: the events are reported once per readiness change)
+        struct epoll_event ev;
+        ev.events   = type == CONN_LISTENER ? EPOLLIN | EPOLLET : EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.ptr = conn;
+        reactor->syscalls++;
+        if (epoll_ctl(reactor->epfd, EPOLL_CTL_ADD, sock, &ev) < 0) {
+            SSL_free(conn->ssl);
+            free(conn);
+            return NULL;
+        }
+    }
+
+    // add the connection to the reactor list
+    if ((conn->next = reactor->conns) != NULL)
+        conn->next->prev = conn;
+
+    reactor->conns = conn;
+    if (conn->ssl)
+        reactor->nconn++;
+
+    return conn;
+}
+
+
+/*!
+ *  NAME
+ *      connEvent - dispatch the events of a connection
+ *  SYNOPSIS
+ *      void connEvent(
+ *          SslConn  *conn,         // reactor connection
+ *          uint32_t events);       // epoll events
+ *  DESCRIPTION
+ *      connEvent() accepts the new connections (listening socket), executes a handshake step (connection not yet
+ *      connected) or calls the callback with the read/write events.
+ *  RETURN VALUE
+ *      None.
+ */
+
+static void connEvent(
+    SslConn  *conn,                 // reactor connection
+    uint32_t events)                // epoll events
+{
+    // listening socket: accept the new connections
+    if (conn->type == CONN_LISTENER) {
+        connAccept(conn);
+        return;
+    }
+
+    // handshake in progress: execute a step (any event can unblock it)
+    if (! conn->connected) {
+        int result = sslFuncStep(SSL_do_handshake, conn->ssl);
+        if (result == SSL_STEP_WANT_ASYNC) {
+            // private-key operation in the crypto thread pool: watch its fd
+            connAsyncWatch(conn);
+            return;
+        }
+
+        // no operation in progress: forget the async fds now (see connAsyncUnwatch())
+        connAsyncUnwatch(conn);
+
+        if (result == SSL_STEP_WANT_READ || result == SSL_STEP_WANT_WRITE)
+            return;
+
+        if (result <= SSL_STEP_CLOSED) {
+            // handshake failed: close the connection
+            conn->cb(conn, SSL_EV_CLOSED, conn->arg);
+            sslConnClose(conn, false);
+            return;
+        }
+
+        // handshake done: write the buffers queued during the handshake, the application data may be already
+        // buffered (no other edge will be reported)
+        conn->connected = true;
+        if (conn->queue.head || conn->queue.wlen > 0) {
+            connQueueFlush(conn);
+            if (conn->closed)
+                return;
+        }
+
+        conn->cb(conn, SSL_EV_CONNECTED, conn->arg);
+        if (! conn->closed)
+            conn->cb(conn, SSL_EV_READ, conn->arg);
+
+        return;
+    }
+
+    // connected: write the queue (a write stopped by SSL_STEP_WANT_READ is repeated when readable)
+    SslQueue *queue = &conn->queue;
+    if ((queue->head || queue->wlen > 0) &&
+            ((events & EPOLLOUT) || ((events & EPOLLIN) && queue->step == SSL_STEP_WANT_READ))) {
+        connQueueFlush(conn);
+        if (conn->closed)
+            return;
+    }
+
+    // read/write events (a disconnection is reported as readable, the read gets the error)
+    if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+        conn->cb(conn, SSL_EV_READ, conn->arg);
+
+    if (! conn->closed && (events & EPOLLOUT))
+        conn->cb(conn, SSL_EV_WRITE, conn->arg);
+}
+
+
+/*!
+ *  NAME
+ *      connAccept - accept the new connections of a listening socket
+ *  SYNOPSIS
+ *      void connAccept(
+ *          SslConn *listener);     // listening socket
+ *  DESCRIPTION
+ *      connAccept() accepts all the pending connections (edge-triggered) and adds them to the reactor.
+ *  RETURN VALUE
+ *      None.
+ */
+
+static void connAccept(
+    SslConn *listener)              // listening socket
+{
+    for (;;) {
+        // accept a connection (until EAGAIN)
+        int sock;
+        listener->reactor->syscalls++;
+        if ((sock = accept4(listener->sock, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+
+            break;
+        }
+
+        // add the connection (on error just close it)
+        if (connNew(listener->reactor, sock, listener->ctx, SSL_SERVER, listener->cb, listener->arg) == NULL)
+            close(sock);
+    }
+}
+
+
+/*!
+ *  NAME
+ *      connAsyncWatch - watch the async fds of a connection
+ *  SYNOPSIS
+ *      void connAsyncWatch(
+ *          SslConn *conn);         // reactor connection
+ *  DESCRIPTION
+ *      connAsyncWatch() registers the new async fds of the connection (see sslAsyncKeysInit()) in the epoll fd: the
+ *      handshake step is repeated when the private-key operation is done. The fds no longer used are removed, the fds
+ *      still registered are tracked in the connection and removed by sslConnClose() (io_uring backend: a one-shot
+ *      poll for each fd, cancelled by sslConnClose()).
+ *  RETURN VALUE
+ *      None.
+ */
+
+static void connAsyncWatch(
+    SslConn *conn)                  // reactor connection
+{
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+    // get the new async fds
+    OSSL_ASYNC_FD add[4], del[4];
+    size_t        nadd = 0, ndel = 0;
+    if (SSL_get_changed_async_fds(conn->ssl, NULL, &nadd, NULL, &ndel) != 1 || nadd > CONN_ASYNC_FDS ||
+            ndel > CONN_ASYNC_FDS || SSL_get_changed_async_fds(conn->ssl, add, &nadd, del, &ndel) != 1)
+        return;
+
+    // remove the fds no longer used (epoll backend)
+    SslReactor *reactor = conn->reactor;
+    for (size_t i = 0; reactor->ring == NULL && i < ndel; i++) {
+        for (int j = 0; j < conn->nasync; j++) {
+            if (conn->async_fd[j] == del[i]) {
+                conn->async_fd[j] = conn->async_fd[--conn->nasync];
+                reactor->syscalls++;
+                epoll_ctl(reactor->epfd, EPOLL_CTL_DEL, del[i], NULL);
+                break;
+            }
+        }
+    }
+
+    // register the new fds (io_uring backend: one-shot polls)
+    for (size_t i = 0; i < nadd; i++) {
+        if (reactor->ring) {
+            if (sslUringPoll(reactor->ring, add[i], conn)) {
+                conn->npoll++;
+                conn->inflight++;
+            }
+
+            continue;
+        }
+
+        struct epoll_event ev;
+        ev.events   = EPOLLIN | EPOLLET;
+        ev.data.ptr = conn;
+        reactor->syscalls++;
+        if (conn->nasync < CONN_ASYNC_FDS && epoll_ctl(reactor->epfd, EPOLL_CTL_ADD, add[i], &ev) == 0)
+            conn->async_fd[conn->nasync++] = add[i];
+    }
+#else
+    (void)conn;
+#endif
+}
+
+
+/*!
+ *  NAME
+ *      connAsyncUnwatch - stop watching the async fds of a connection
+ *  SYNOPSIS
+ *      void connAsyncUnwatch(
+ *          SslConn *conn);         // reactor connection
+ *  DESCRIPTION
+ *      connAsyncUnwatch() removes the async fds of the connection from the epoll fd (epoll backend). It's called when
+ *      the connection is closed and as soon as a handshake step doesn't wait a private-key operation: the fd of a
+ *      completed operation is closed with its task and its number can be reused by the async fd of another
+ *      connection, that a later removal would unregister.
+ *  RETURN VALUE
+ *      None.
+ */
+
+static void connAsyncUnwatch(
+    SslConn *conn)                  // reactor connection
+{
+    SslReactor *reactor = conn->reactor;
+    for (int i = 0; reactor->epfd >= 0 && i < conn->nasync; i++) {
+        reactor->syscalls++;
+        epoll_ctl(reactor->epfd, EPOLL_CTL_DEL, conn->async_fd[i], NULL);
+    }
+
+    conn->nasync = 0;
+}
+
+
+/*!
+ *  NAME
+ *      connNotify - queue a connection to flush
+ *  SYNOPSIS
+ *      void connNotify(
+ *          void *owner);           // reactor connection
+ *  DESCRIPTION
+ *      connNotify() adds the connection to the list of the connections to flush (io_uring backend: called by the BIO
+ *      when rx is consumed or tx has new data): the reactor queues its operations before waiting the completions.
+ *  RETURN VALUE
+ *      None.
+ */
+
+static void connNotify(
+    void *owner)                    // reactor connection
+{
+    SslConn *conn = owner;
+    if (conn->dirty || conn->closed)
+        return;
+
+    conn->dirty          = true;
+    conn->dirty_next     = conn->reactor->dirty;
+    conn->reactor->dirty = conn;
+}
+
+
+/*!
+ *  NAME
+ *      connQueueFlush - write the write queue of a connection
+ *  SYNOPSIS
+ *      void connQueueFlush(
+ *          SslConn *conn);         // reactor connection (connected)
+ *  DESCRIPTION
+ *      connQueueFlush() writes the write queue until it's empty or the socket is full, and calls the callback with
+ *      SSL_EV_QUEUE_LOW when the queue is written down to the low watermark. A failed write empties the queue and
+ *      refuses the next buffers (the application gets the error reading the connection).
+ *  RETURN VALUE
+ *      None.
+ */
+
+static void connQueueFlush(
+    SslConn *conn)                  // reactor connection (connected)
+{
+    SslQueue *queue = &conn->queue;
+    int      result = sslQueueFlush(queue, conn->ssl);
+    if (result == SSL_STEP_CLOSED || result == SSL_STEP_ERROR) {
+        sslQueueClear(queue);
+        queue->failed = true;
+        queue->above  = false;
+        return;
+    }
+
+    // low watermark reached
+    if (queue->above && queue->bytes <= queue->opts.low) {
+        queue->above = false;
+        conn->cb(conn, SSL_EV_QUEUE_LOW, conn->arg);
+    }
+}
+
+
+/*!
+ *  NAME
+ *      connQueueDrop - close a slow consumer
+ *  SYNOPSIS
+ *      void connQueueDrop(
+ *          SslConn *conn);         // reactor connection
+ *  DESCRIPTION
+ *      connQueueDrop() calls the callback with SSL_EV_CLOSED and closes the connection (without close_notify: the
+ *      peer doesn't read), releasing its write queue.
+ *  RETURN VALUE
+ *      None.
+ */
+
+static void connQueueDrop(
+    SslConn *conn)                  // reactor connection
+{
+    conn->cb(conn, SSL_EV_CLOSED, conn->arg);
+    sslConnClose(conn, false);
+}
+
+
+/*!
+ *  NAME
+ *      reactorEpoll - wait and dispatch a events batch (epoll backend)
+ *  SYNOPSIS
+ *      int reactorEpoll(
+ *          SslReactor *reactor,    // reactor
+ *          int64_t    deadline);   // deadline in ns (see sslClockNs(), -1 = no deadline)
+ *  DESCRIPTION
+ *      reactorEpoll() waits the epoll events (at most until the deadline) and dispatches them.
+ *  RETURN VALUE
+ *      reactorEpoll() shall return 0 on success (also on timeout or signal), -1 on error.
+ */
+
+static int reactorEpoll(
+    SslReactor *reactor,            // reactor
+    int64_t    deadline)            // deadline in ns (see sslClockNs(), -1 = no deadline)
+{
+    // wait the events (until the deadline)
+    int wait_ms = -1;
+    if (deadline >= 0) {
+        int64_t left = deadline - sslClockNs();
+        wait_ms = left > 0 ? (int)((left + 999999) / 1000000) : 0;
+    }
+
+    struct epoll_event events[REACTOR_EVENTS];
+    int                nevents;
+    reactor->syscalls++;
+    if ((nevents = epoll_wait(reactor->epfd, events, REACTOR_EVENTS, wait_ms)) < 0)
+        return errno == EINTR ? 0 : -1;
+
+    // dispatch the events
+    for (int i = 0; i < nevents; i++) {
+        SslConn *conn = events[i].data.ptr;
+        if (! conn->closed)
+            connEvent(conn, events[i].events);
+    }
+
+    return 0;
+}
+
+
+/*!
+ *  NAME
+ *      reactorUring - wait and dispatch a events batch (io_uring backend)
+ *  SYNOPSIS
+ *      int reactorUring(
+ *          SslReactor *reactor,    // reactor
+ *          int64_t    deadline);   // deadline in ns (see sslClockNs(), -1 = no deadline)
+ *  DESCRIPTION
+ *      reactorUring() queues the operations of the connections to flush, submits them and waits the completions (at
+ *      most until the deadline) with a single io_uring_enter(), and dispatches the completions.
+ *  RETURN VALUE
+ *      reactorUring() shall return 0 on success (also on timeout or signal), -1 on error.
+ */
+
+static int reactorUring(
+    SslReactor *reactor,            // reactor
+    int64_t    deadline)            // deadline in ns (see sslClockNs(), -1 = no deadline)
+{
+    // queue the operations and wait
+    reactorFlush(reactor);
+    if (sslUringWait(reactor->ring, deadline) < 0)
+        return -1;
+
+    // dispatch the completions (the cancellations have no connection)
+    void *owner;
+    int  op, res;
+    while (sslUringReap(reactor->ring, &owner, &op, &res)) {
+        if (owner)
+            reactorComplete(owner, op, res);
+    }
+
+    return 0;
+}
+
+
+/*!
+ *  NAME
+ *      reactorFlush - queue the operations of the connections to flush
+ *  SYNOPSIS
+ *      void reactorFlush(
+ *          SslReactor *reactor);   // reactor
+ *  DESCRIPTION
+ *      reactorFlush() executes the first handshake step of the new connections and queues a receive for each
+ *      connection with rx consumed, a send for each connection with data in tx and the poll of the listening sockets
+ *      (io_uring backend).
+ *  RETURN VALUE
+ *      None.
+ */
+
+static void reactorFlush(
+    SslReactor *reactor)            // reactor
+{
+    // the handshake steps can add connections to the list: repeat until it's empty
+    while (reactor->dirty) {
+        SslConn *conn    = reactor->dirty;
+        reactor->dirty   = conn->dirty_next;
+        conn->dirty      = false;
+        if (conn->closed)
+            continue;
+
+        // listening socket: poll it
+        if (conn->type == CONN_LISTENER) {
+            if (conn->npoll == 0 && sslUringPoll(reactor->ring, conn->sock, conn)) {
+                conn->npoll++;
+                conn->inflight++;
+            }
+
+            continue;
+        }
+
+        // new connection: first handshake step (e.g.: the client hello is written in tx)
+        if (conn->kick) {
+            conn->kick = false;
+            connEvent(conn, 0);
+            if (conn->closed)
+                continue;
+        }
+
+        // queue the receive and the send
+        SslUringIo *io = &conn->io;
+        if (! io->rx_busy && ! io->rx_eof && io->rx_off == io->rx_len &&
+                sslUringRecv(reactor->ring, conn->sock, io, conn))
+            conn->inflight++;
+
+        if (! io->tx_busy && io->tx_len > 0 && io->tx_error == 0 &&
+                sslUringSend(reactor->ring, conn->sock, io, conn))
+            conn->inflight++;
+    }
+}
+
+
+/*!
+ *  NAME
+ *      reactorComplete - dispatch a completion
+ *  SYNOPSIS
+ *      void reactorComplete(
+ *          SslConn *conn,          // reactor connection
+ *          int     op,             // operation type: SSL_URING_RX/SSL_URING_TX/SSL_URING_POLL
+ *          int     res);           // result (bytes or -errno)
+ *  DESCRIPTION
+ *      reactorComplete() updates the I/O buffers of the connection and dispatches the completion as the epoll
+ *      events: a receive is a readable event, a send that freed a full tx is a writable event, a poll accepts the new
+ *      connections (listening socket) or resumes the handshake (async fd). The completions of a closed connection are
+ *      only counted (io_uring backend).
+ *  RETURN VALUE
+ *      None.
+ */
+
+static void reactorComplete(
+    SslConn *conn,                  // reactor connection
+    int     op,                     // operation type: SSL_URING_RX/SSL_URING_TX/SSL_URING_POLL
+    int     res)                    // result (bytes or -errno)
+{
+    conn->inflight--;
+    if (op == SSL_URING_POLL)
+        conn->npoll--;
+    else
+        sslUringDone(&conn->io, op, res);
+
+    if (conn->closed)
+        return;
+
+    switch (op) {
+    case SSL_URING_RX:
+        // data received (or EOF): nothing received on a signal, just repeat the receive
+        if (res == -EAGAIN || res == -EINTR)
+            connNotify(conn);
+        else
+            connEvent(conn, EPOLLIN);
+
+        break;
+
+    case SSL_URING_TX:
+        // data sent: send the data appended during the send, resume the writer blocked on a full tx
+        connNotify(conn);
+        if (conn->io.tx_full) {
+            conn->io.tx_full = false;
+            connEvent(conn, EPOLLOUT);
+        }
+
+        break;
+
+    case SSL_URING_POLL:
+        // listening socket readable (poll it again) or async operation done
+        if (res == -ECANCELED)
+            break;
+
+        if (conn->type == CONN_LISTENER) {
+            connAccept(conn);
+            connNotify(conn);
+        } else {
+            connEvent(conn, EPOLLIN);
+        }
+
+        break;
+    }
+}
+
+
+/*!
+ *  NAME
+ *      reactorRelease - free the closed connections
+ *  SYNOPSIS
+ *      void reactorRelease(
+ *          SslReactor *reactor);   // reactor
+ *  DESCRIPTION
+ *      reactorRelease() frees the connections closed during the events batch, except (io_uring backend) the ones
+ *      with operations in progress or still in the list of the connections to flush.
+ *  RETURN VALUE
+ *      None.
+ */
+
+static void reactorRelease(
+    SslReactor *reactor)            // reactor
+{
+    SslConn **pconn = &reactor->closed;
+    while (*pconn) {
+        SslConn *conn = *pconn;
+        if (conn->inflight > 0 || conn->dirty) {
+            // still referenced by the ring or by the flush list
+            pconn = &conn->next;
+            continue;
+        }
+
+        *pconn = conn->next;
+        if (reactor->ring)
+            sslUringSlotPut(reactor->ring, &conn->io);
+
+        free(conn);
+    }
+}
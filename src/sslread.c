@@ -20,6 +20,10 @@
  *  FUNCTIONS
  *      global:
  *          int sslRead(SSL *ssl, void *buf, int num);
+ *          int sslReadEx(SSL *ssl, void *buf, int num, int timeout);
+ *          ssize_t sslReadBatch(SSL *ssl, void *buf, size_t min, size_t max, int timeout);
+ *      local:
+ *          bool readPending(SSL *ssl);
  *  DESCRIPTION
  *      The MySSL library is a simple interface to OpenSSL library to permits user-friendly writing of Servers and
  *      Clients using OpenSSL.
@@ -40,6 +44,10 @@
 
 #include "myssl.h"
 #include "myssl-private.h"
+#include <limits.h>
+
+// local prototypes
+static bool readPending(SSL *ssl);
 
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -56,48 +64,145 @@
  *          void *buf,              // buffer of data to read
  *          int  num);              // number of data to read
  *  DESCRIPTION
- *      SSL_read() writes num bytes from the buffer buf into the specified ssl connection. This is a smart method to call the OpenSSL library SSL_read()
- *      bypassing the architectural features of OpenSSL that includes read/write actions in every read/write/accept/connect/shutdown action. This function
- *      analize the SSL_read() result to repeat the action (after a timeout of SSL_RWTOUT ms) until the activity is terminated. if the number of repeated
- *      iterations is too high (>SSL_RWITER), the activity is terminated with an error (total timeout is SSL_RWTOUT * SSL_RWITER seconds).
+ *      sslRead() reads up to num bytes from the specified ssl connection into the buffer buf, with the timeout of the
+ *      connection (see sslSetTimeout() and sslReadEx()).
  *  RETURN VALUE
  *      Upon successful completion, sslRead() shall return the number of bytes received.
- *      Otherwise, -1 shall be returned and the error can be analyzed calling the OpenSSL library SSL_get_error() function with the return value to find out the
- *      reason.
+ *      Otherwise, a value <= 0 shall be returned and the reason can be analyzed calling sslStatus() (or the OpenSSL
+ *      library SSL_get_error() function with the return value).
  */
 
 int sslRead(
     SSL  *ssl,                      // OpenSSL SSL structure
     void *buf,                      // buffer of data to read
     int  num)                       // number of data to read
+{
+    return sslReadEx(ssl, buf, num, SSL_TIMEOUT_CONN);
+}
+
+
+/*!
+ *  NAME
+ *      sslReadEx - read data from a SSL/TLS connection with a timeout
+ *  SYNOPSIS
+ *      int sslReadEx(
+ *          SSL  *ssl,              // OpenSSL SSL structure
+ *          void *buf,              // buffer of data to read
+ *          int  num,               // number of data to read
+ *          int  timeout);          // timeout in ms (SSL_TIMEOUT_INFINITE, SSL_TIMEOUT_CONN = connection timeout)
+ *  DESCRIPTION
+ *      sslReadEx() reads up to num bytes from the specified ssl connection into the buffer buf. This is a smart method
+ *      to call the OpenSSL library SSL_read() bypassing the architectural features of OpenSSL that includes read/write
+ *      actions in every read/write/accept/connect/shutdown action. This function repeats the read step (see
+ *      sslReadStep()) when the socket is ready until the activity is terminated or the timeout is elapsed (the timeout
+ *      is the max duration of the whole operation).
+ *  RETURN VALUE
+ *      Upon successful completion, sslReadEx() shall return the number of bytes received.
+ *      Otherwise, a value <= 0 shall be returned and the reason can be analyzed calling sslStatus() (or the OpenSSL
+ *      library SSL_get_error() function with the return value).
+ */
+
+int sslReadEx(
+    SSL  *ssl,                      // OpenSSL SSL structure
+    void *buf,                      // buffer of data to read
+    int  num,                       // number of data to read
+    int  timeout)                   // timeout in ms (SSL_TIMEOUT_INFINITE, SSL_TIMEOUT_CONN = connection timeout)
 {
     int rcvd;
 
-    // read loop
-    int count = 0;
-    for (;;) {
-        // test loop counter (tot.timeout = SSL_RWTOUT * SSL_RWITER)
-        if (++count > SSL_RWITER) {
-            // the total timeout is elapsed: break loop (e.g.: tot.timeout = 100 ms * 20 = 2 sec)
-            break;
-        }
+    // read loop: repeat the step waiting the required event (until the deadline of the operation)
+    int64_t deadline = sslDeadline(ssl, timeout);
+    while ((rcvd = sslReadStep(ssl, buf, num)) < SSL_STEP_ERROR && sslStepWait(ssl, rcvd, deadline))
+        ;
 
-        // execute operation
-        rcvd = SSL_read(ssl, buf, num);
-        if (rcvd > 0) {
-            // operation Ok: break loop
-            break;
-        }
-        else {
-            // operation NOK (result <= 0): start recovery procedure
-            if (sslRecovery(ssl, rcvd))
-                continue; // more data to treat: continue in the loop
+    // return the number of received bytes or error (0 = peer disconnected)
+    return rcvd > 0 ? rcvd : rcvd == SSL_STEP_CLOSED ? 0 : -1;
+}
+
+
+/*!
+ *  NAME
+ *      sslReadBatch - read all the available data from a SSL/TLS connection
+ *  SYNOPSIS
+ *      ssize_t sslReadBatch(
+ *          SSL    *ssl,            // OpenSSL SSL structure
+ *          void   *buf,            // buffer of data to read
+ *          size_t min,             // min number of data to read (waiting for them, 0 = 1)
+ *          size_t max,             // max number of data to read (size of the buffer)
+ *          int    timeout);        // timeout in ms (SSL_TIMEOUT_INFINITE, SSL_TIMEOUT_CONN = connection timeout)
+ *  DESCRIPTION
+ *      sslReadBatch() reads at least min bytes and up to max bytes from the specified ssl connection into the buffer
+ *      buf: it waits (until the timeout) only while fewer than min bytes are read, then it continues to read while
+ *      OpenSSL holds data already received (decrypted or not), without further system calls. The read-ahead is
+ *      enabled on the connection, so a read system call gets all the records already arrived (up to the size of the
+ *      OpenSSL read buffer) instead of one record: a burst of small messages is read with one call of the function
+ *      and few system calls, instead of a sslRead() for each record.
+ *  RETURN VALUE
+ *      Upon successful completion, sslReadBatch() shall return the number of bytes received (>= min, or < min if the
+ *      timeout is elapsed or the peer closed the connection after some data: see sslStatus()).
+ *      Otherwise, 0 shall be returned if the peer closed the connection, -1 on error or timeout without data (see
+ *      sslStatus()).
+ */
+
+ssize_t sslReadBatch(
+    SSL    *ssl,                    // OpenSSL SSL structure
+    void   *buf,                    // buffer of data to read
+    size_t min,                     // min number of data to read (waiting for them, 0 = 1)
+    size_t max,                     // max number of data to read (size of the buffer)
+    int    timeout)                 // timeout in ms (SSL_TIMEOUT_INFINITE, SSL_TIMEOUT_CONN = connection timeout)
+{
+    // read the records already arrived with a single system call
+    if (! SSL_get_read_ahead(ssl))
+        SSL_set_read_ahead(ssl, 1);
 
-            // break loop
+    if (min < 1)
+        min = 1;
+
+    if (min > max)
+        min = max;
+
+    // read loop: wait for the data until min bytes, then only the data held by OpenSSL
+    int64_t deadline = sslDeadline(ssl, timeout);
+    size_t  done = 0;
+    int     rcvd = SSL_STEP_ERROR;
+    while (done < max && (done < min || readPending(ssl))) {
+        size_t num = max - done;
+        if ((rcvd = sslReadStep(ssl, (char *)buf + done, num > INT_MAX ? INT_MAX : (int)num)) > 0)
+            done += rcvd;
+        else if (rcvd == SSL_STEP_ERROR || rcvd == SSL_STEP_CLOSED || done >= min || ! sslStepWait(ssl, rcvd, deadline))
             break;
-        }
     }
 
-    // return the number of received bytes or error
-    return rcvd;
+    // return the number of received bytes or error (0 = peer disconnected)
+    return done > 0 ? (ssize_t)done : rcvd == SSL_STEP_CLOSED ? 0 : -1;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// LOCAL functions
+////////////////////////////////////////////////////////////////////////////////
+
+
+/*!
+ *  NAME
+ *      readPending - check the data held by OpenSSL
+ *  SYNOPSIS
+ *      bool readPending(
+ *          SSL *ssl);              // OpenSSL SSL structure
+ *  DESCRIPTION
+ *      readPending() checks if OpenSSL holds data to read without a system call: decrypted data of the current
+ *      record or (OpenSSL 1.1.0 and above) received data not yet processed, e.g. records read ahead.
+ *  RETURN VALUE
+ *      readPending() shall return true if there is data held by OpenSSL.
+ *      Otherwise, false shall be returned.
+ */
+
+static bool readPending(
+    SSL *ssl)                       // OpenSSL SSL structure
+{
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+    return SSL_has_pending(ssl) == 1;
+#else
+    return SSL_pending(ssl) > 0;
+#endif
 }
@@ -0,0 +1,507 @@
+/*
+ * Copyright © 2019 Aldo Abate <aldo.abate99@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+
+/*!
+ *  FILE
+ *      sslreload.c - certificates hot-reload functions for MySSL library
+ *  PROJECT
+ *      MySSL library
+ *  FUNCTIONS
+ *      global:
+ *          int sslReloadCtx(int type, const SslCtxOpts *opts);
+ *          int  sslWatchCtx(int type, const SslCtxOpts *opts);
+ *          int  sslUnwatchCtx(int type, const SslCtxOpts *opts);
+ *          void sslWatchCleanup(void);
+ *      local:
+ *          void* watchThread(void *arg);
+ *          void  watchStop(WatchData *list);
+ *          bool  watchAdd(WatchData *watch, const char *path);
+ *          bool  watchMatch(WatchData *watch, const struct inotify_event *event);
+ *          void  watchFree(WatchData *watch);
+ *          void  ticketKeysCopy(SSL_CTX *dst, SSL_CTX *src);
+ *  DESCRIPTION
+ *      The MySSL library is a simple interface to OpenSSL library to permits user-friendly writing of Servers and
+ *      Clients using OpenSSL.
+ *  NOTES
+ *      - The free software library "OpenSSL" is distributed under a "dual licensed" system: under the OpenSSL License
+ *        and the SSLeay License. The OpenSSL License is Apache License 1.0 and SSLeay License bears some similarity to
+ *        a 4-clause BSD License. Both licenses apply.
+ *      - The library "OpenSSL" reference version is 1.0.2g
+ *      - The watcher threads are listed by type and options (as the contexts in the registry): a watcher runs until
+ *        sslUnwatchCtx() with the same type and options, or until sslCleanup().
+ *  AUTHOR
+ *      Aldo Abate
+ *  OPERATING SYSTEM
+ *      Linux (kernel 2.6 and above - glibc 2.3.2 and above)
+ *  COMPILER
+ *      GNU GCC (ver. 4.4 and above)
+ *  RELEASE
+ *      0.1.0 (August 2019)
+ */
+
+#include "myssl.h"
+#include "myssl-private.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/inotify.h>
+#include <sys/eventfd.h>
+
+// max number of watched files (certificates and private-keys, CA certificate)
+#define WATCH_FILES 5
+
+// watcher data
+typedef struct WatchData {
+    int        type;                    // context type: SSL_SERVER/SSL_CLIENT
+    SslCtxOpts opts;                    // context options (the strings are owned by the watcher)
+    int        fd;                      // inotify file descriptor
+    int        stop_fd;                 // event file descriptor of the stop request
+    pthread_t  tid;                     // watcher thread
+    int        nfiles;                  // number of watched files
+    int        wd[WATCH_FILES];         // watch descriptors of the files directories
+    char       *name[WATCH_FILES];      // watched files names (without directory)
+    struct WatchData *next;             // next watcher (list of the running watchers)
+} WatchData;
+
+// local prototypes
+static void* watchThread(void *arg);
+static void  watchStop(WatchData *list);
+static bool  watchAdd(WatchData *watch, const char *path);
+static bool  watchMatch(WatchData *watch, const struct inotify_event *event);
+static void  watchFree(WatchData *watch);
+static void  ticketKeysCopy(SSL_CTX *dst, SSL_CTX *src);
+
+// local data
+static WatchData       *watch_list = NULL;                          // running watchers
+static pthread_mutex_t watch_mutex = PTHREAD_MUTEX_INITIALIZER;     // watchers list lock
+
+
+////////////////////////////////////////////////////////////////////////////////
+// GLOBAL functions
+////////////////////////////////////////////////////////////////////////////////
+
+
+/*!
+ *  NAME
+ *      sslReloadCtx - reload the certificate files of a context
+ *  SYNOPSIS
+ *      int sslReloadCtx(
+ *          int              type,  // context type: SSL_SERVER/SSL_CLIENT
+ *          const SslCtxOpts *opts);    // context options (NULL = default options)
+ *  DESCRIPTION
+ *      sslReloadCtx() builds a new context for type and options (reading again the certificate files) and publishes it
+ *      atomically in the contexts registry: the next sslCreateCtx()/sslCreateCtxEx() calls get the new context without
+ *      locking, the existing connections keep the old context until they are closed. If the new files are not valid
+ *      the old context stays in use. The internal ticket keys are copied from the old context, so the sessions can be
+ *      resumed after the reload (with a shared keys file, see ticket_keys, the keys are reloaded from the file).
+ *  RETURN VALUE
+ *      Upon successful completion, sslReloadCtx() shall return 0.
+ *      Otherwise, -1 shall be returned (the OpenSSL errors can be printed with ERR_print_errors_fp()).
+ */
+
+int sslReloadCtx(
+    int              type,          // context type: SSL_SERVER/SSL_CLIENT
+    const SslCtxOpts *opts)         // context options (NULL = default options)
+{
+    // one-time initialization of the OpenSSL library (fails after sslCleanup())
+    if (! sslLibInit())
+        return -1;
+
+    // set the options (the fields not set assume the default values)
+    SslCtxOpts my_opts;
+    sslCtxOptsDefaults(&my_opts, opts);
+
+    // build the new context (outside the registry: the handshakes in progress are not delayed)
+    SSL_CTX *ctx;
+    int     error;
+    if ((ctx = sslCtxBuild(type, &my_opts, &error)) == NULL || error < 0) {
+        // error: the old context stays in use
+        if (ctx)
+            SSL_CTX_free(ctx);
+
+        return -1;
+    }
+
+    // keep the internal ticket keys of the old context
+    SSL_CTX *old_ctx;
+    if (type == SSL_SERVER && my_opts.ticket_keys == NULL && (old_ctx = sslCtxLookup(type, &my_opts)) != NULL) {
+        ticketKeysCopy(ctx, old_ctx);
+        sslReleaseCtx(old_ctx);
+    }
+
+    // publish the new context
+    sslCtxReplace(type, &my_opts, ctx);
+    return 0;
+}
+
+
+/*!
+ *  NAME
+ *      sslWatchCtx - watch the certificate files of a context
+ *  SYNOPSIS
+ *      int sslWatchCtx(
+ *          int              type,  // context type: SSL_SERVER/SSL_CLIENT
+ *          const SslCtxOpts *opts);    // context options (NULL = default options)
+ *  DESCRIPTION
+ *      sslWatchCtx() starts a background thread that watches (using inotify) the certificate files of a context: when
+ *      a file is written or replaced (e.g.: renamed in the directory) the context is reloaded with sslReloadCtx(), after
+ *      a pause of SSL_RELOAD_DELAY ms without other changes (so a certificate and its key can be copied together).
+ *      The thread runs until sslUnwatchCtx() is called with the same type and options, or until sslCleanup().
+ *  RETURN VALUE
+ *      Upon successful completion, sslWatchCtx() shall return 0. Otherwise, -1 shall be returned.
+ */
+
+int sslWatchCtx(
+    int              type,          // context type: SSL_SERVER/SSL_CLIENT
+    const SslCtxOpts *opts)         // context options (NULL = default options)
+{
+    // allocate the watcher data with a private copy of the options (the library must be usable: see sslCleanup())
+    WatchData *watch;
+    if (! sslLibInit() || (watch = calloc(1, sizeof(WatchData))) == NULL)
+        return -1;
+
+    watch->fd = watch->stop_fd = -1;
+    SslCtxOpts my_opts;
+    sslCtxOptsDefaults(&my_opts, opts);
+    watch->type = type;
+    if (! sslCtxOptsCopy(&watch->opts, &my_opts)) {
+        free(watch);
+        return -1;
+    }
+
+    if ((watch->fd = inotify_init1(IN_CLOEXEC)) < 0 || (watch->stop_fd = eventfd(0, EFD_CLOEXEC)) < 0) {
+        watchFree(watch);
+        return -1;
+    }
+
+    // watch the certificate files of the context type
+    bool ok = type == SSL_SERVER ? watchAdd(watch, watch->opts.cert) && watchAdd(watch, watch->opts.key) :
+                                   watchAdd(watch, watch->opts.cacert);
+    if (type == SSL_SERVER && watch->opts.cert2)
+        ok = ok && watchAdd(watch, watch->opts.cert2) && watchAdd(watch, watch->opts.key2);
+
+    // start the watcher thread and add it to the list
+    if (! ok || pthread_create(&watch->tid, NULL, watchThread, watch) != 0) {
+        // error
+        watchFree(watch);
+        return -1;
+    }
+
+    pthread_mutex_lock(&watch_mutex);
+    watch->next = watch_list;
+    watch_list  = watch;
+    pthread_mutex_unlock(&watch_mutex);
+    return 0;
+}
+
+
+/*!
+ *  NAME
+ *      sslUnwatchCtx - stop watching the certificate files of a context
+ *  SYNOPSIS
+ *      int sslUnwatchCtx(
+ *          int              type,  // context type: SSL_SERVER/SSL_CLIENT
+ *          const SslCtxOpts *opts);    // context options (NULL = default options)
+ *  DESCRIPTION
+ *      sslUnwatchCtx() stops the watcher threads started by sslWatchCtx() with the same type and options (a reload
+ *      in progress is completed first) and frees their resources.
+ *  RETURN VALUE
+ *      Upon successful completion, sslUnwatchCtx() shall return 0.
+ *      Otherwise (no watcher for type and options), -1 shall be returned.
+ */
+
+int sslUnwatchCtx(
+    int              type,          // context type: SSL_SERVER/SSL_CLIENT
+    const SslCtxOpts *opts)         // context options (NULL = default options)
+{
+    // set the options (the fields not set assume the default values)
+    SslCtxOpts my_opts;
+    sslCtxOptsDefaults(&my_opts, opts);
+
+    // remove the watchers of type and options from the list
+    WatchData *stopped = NULL;
+    pthread_mutex_lock(&watch_mutex);
+    for (WatchData **pwatch = &watch_list; *pwatch; ) {
+        WatchData *watch = *pwatch;
+        if (watch->type == type && sslCtxOptsEqual(&watch->opts, &my_opts)) {
+            *pwatch     = watch->next;
+            watch->next = stopped;
+            stopped     = watch;
+        }
+        else
+            pwatch = &watch->next;
+    }
+
+    pthread_mutex_unlock(&watch_mutex);
+
+    // stop them (outside the lock)
+    if (stopped == NULL)
+        return -1;
+
+    watchStop(stopped);
+    return 0;
+}
+
+
+/*!
+ *  NAME
+ *      sslWatchCleanup - stop all the watchers
+ *  SYNOPSIS
+ *      void sslWatchCleanup(void);
+ *  DESCRIPTION
+ *      sslWatchCleanup() stops all the watcher threads started by sslWatchCtx() and frees their resources (called by
+ *      sslCleanup(), before the contexts of the registry are freed).
+ *  RETURN VALUE
+ *      None.
+ */
+
+void sslWatchCleanup(void)
+{
+    // take the whole list and stop the watchers (outside the lock)
+    pthread_mutex_lock(&watch_mutex);
+    WatchData *stopped = watch_list;
+    watch_list = NULL;
+    pthread_mutex_unlock(&watch_mutex);
+    watchStop(stopped);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// LOCAL functions
+////////////////////////////////////////////////////////////////////////////////
+
+
+/*!
+ *  NAME
+ *      watchThread - watcher thread
+ *  SYNOPSIS
+ *      void* watchThread(
+ *          void *arg);             // watcher data
+ *  DESCRIPTION
+ *      watchThread() waits the inotify events of the watched files and reloads the context, until the stop request
+ *      (see watchStop()) or an inotify error. The watcher data is freed by watchStop().
+ *  RETURN VALUE
+ *      None.
+ */
+
+static void* watchThread(
+    void *arg)                      // watcher data
+{
+    WatchData *watch = arg;
+
+    // events loop
+    bool pending = false;   // reload pending
+    for (;;) {
+        // wait the events (with a pending reload wait only for SSL_RELOAD_DELAY ms)
+        struct pollfd pfd[2] = { { watch->fd, POLLIN, 0 }, { watch->stop_fd, POLLIN, 0 } };
+        int rc;
+        if ((rc = poll(pfd, 2, pending ? SSL_RELOAD_DELAY : -1)) < 0)
+            continue;   // interrupted
+
+        if (pfd[1].revents)
+            break;      // stop request
+
+        if (rc == 0) {
+            // no more changes: reload the context
+            sslReloadCtx(watch->type, &watch->opts);
+            pending = false;
+            continue;
+        }
+
+        // read the events
+        char    buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+        ssize_t len;
+        if ((len = read(watch->fd, buf, sizeof(buf))) <= 0)
+            break;  // error: stop the watcher
+
+        // test the events
+        for (char *ptr = buf; ptr < buf + len; ) {
+            const struct inotify_event *event = (const struct inotify_event *)ptr;
+            if (watchMatch(watch, event))
+                pending = true;
+
+            ptr += sizeof(struct inotify_event) + event->len;
+        }
+    }
+
+    return NULL;
+}
+
+
+/*!
+ *  NAME
+ *      watchStop - stop a list of watchers
+ *  SYNOPSIS
+ *      void watchStop(
+ *          WatchData *list);       // watchers (removed from the list of the running watchers)
+ *  DESCRIPTION
+ *      watchStop() sends the stop request to the watcher threads, waits their end and frees the watcher data.
+ *  RETURN VALUE
+ *      None.
+ */
+
+static void watchStop(
+    WatchData *list)                // watchers (removed from the list of the running watchers)
+{
+    while (list) {
+        WatchData *watch = list;
+        list = watch->next;
+
+        // wake up the thread, wait its end and free the data
+        uint64_t one = 1;
+        if (write(watch->stop_fd, &one, sizeof(one)) != sizeof(one)) {
+            // error: the thread can't be stopped, its data is not freed
+            pthread_detach(watch->tid);
+            continue;
+        }
+
+        pthread_join(watch->tid, NULL);
+        watchFree(watch);
+    }
+}
+
+
+/*!
+ *  NAME
+ *      watchAdd - add a file to the watcher
+ *  SYNOPSIS
+ *      bool watchAdd(
+ *          WatchData  *watch,      // watcher data
+ *          const char *path);      // file to watch
+ *  DESCRIPTION
+ *      watchAdd() watches the directory of a file (the files are often replaced with a rename(), so the directory must
+ *      be watched instead of the file).
+ *  RETURN VALUE
+ *      Upon successful completion, watchAdd() shall return true. Otherwise, false shall be returned.
+ */
+
+static bool watchAdd(
+    WatchData  *watch,              // watcher data
+    const char *path)               // file to watch
+{
+    // split directory and name
+    char       dir[FILENAME_MAX];
+    const char *name = strrchr(path, '/');
+    if (name) {
+        snprintf(dir, sizeof(dir), "%.*s", (int)(name - path) > 0 ? (int)(name - path) : 1, path);
+        name++;
+    }
+    else {
+        snprintf(dir, sizeof(dir), ".");
+        name = path;
+    }
+
+    // watch the directory (the same directory of another file returns the same watch descriptor)
+    int wd;
+    if (watch->nfiles >= WATCH_FILES ||
+            (wd = inotify_add_watch(watch->fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE)) < 0)
+        return false;
+
+    watch->wd[watch->nfiles]   = wd;
+    watch->name[watch->nfiles] = strdup(name);
+    return watch->name[watch->nfiles++] != NULL;
+}
+
+
+/*!
+ *  NAME
+ *      watchMatch - test an inotify event
+ *  SYNOPSIS
+ *      bool watchMatch(
+ *          WatchData                  *watch,  // watcher data
+ *          const struct inotify_event *event); // inotify event
+ *  DESCRIPTION
+ *      watchMatch() tests if an inotify event refers to a watched file.
+ *  RETURN VALUE
+ *      watchMatch() shall return true if the event refers to a watched file. Otherwise, false shall be returned.
+ */
+
+static bool watchMatch(
+    WatchData                  *watch,  // watcher data
+    const struct inotify_event *event)  // inotify event
+{
+    // search the file
+    for (int i = 0; i < watch->nfiles; i++) {
+        if (event->wd == watch->wd[i] && event->len > 0 && strcmp(event->name, watch->name[i]) == 0)
+            return true;
+    }
+
+    return false;
+}
+
+
+/*!
+ *  NAME
+ *      watchFree - free the watcher data
+ *  SYNOPSIS
+ *      void watchFree(
+ *          WatchData *watch);      // watcher data
+ *  DESCRIPTION
+ *      watchFree() closes the inotify and the stop event file descriptors and frees the watcher data.
+ *  RETURN VALUE
+ *      None.
+ */
+
+static void watchFree(
+    WatchData *watch)               // watcher data
+{
+    // close the inotify file descriptor (the watches are removed too)
+    if (watch->fd >= 0)
+        close(watch->fd);
+
+    if (watch->stop_fd >= 0)
+        close(watch->stop_fd);
+
+    // free the strings and the data
+    for (int i = 0; i < watch->nfiles; i++)
+        free(watch->name[i]);
+
+    sslCtxOptsFree(&watch->opts);
+    free(watch);
+}
+
+
+/*!
+ *  NAME
+ *      ticketKeysCopy - copy the internal ticket keys of a context
+ *  SYNOPSIS
+ *      void ticketKeysCopy(
+ *          SSL_CTX *dst,           // destination context
+ *          SSL_CTX *src);          // source context
+ *  DESCRIPTION
+ *      ticketKeysCopy() copies the internal ticket keys of a context to another context.
+ *  RETURN VALUE
+ *      None.
+ */
+
+static void ticketKeysCopy(
+    SSL_CTX *dst,                   // destination context
+    SSL_CTX *src)                   // source context
+{
+    // get and set the keys (name + HMAC key + AES key)
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+    unsigned char keys[80];
+#else
+    unsigned char keys[48];
+#endif
+    if (SSL_CTX_get_tlsext_ticket_keys(src, keys, sizeof(keys)) == 1)
+        SSL_CTX_set_tlsext_ticket_keys(dst, keys, sizeof(keys));
+
+    OPENSSL_cleanse(keys, sizeof(keys));
+}
@@ -0,0 +1,296 @@
+/*
+ * Copyright © 2019 Aldo Abate <aldo.abate99@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+
+/*!
+ *  FILE
+ *      sslsendfile.c - sslSendFile(), sslKtls() and sslKtlsAvail() functions (file transfer and kernel TLS) for MySSL library
+ *  PROJECT
+ *      MySSL library
+ *  FUNCTIONS
+ *      global:
+ *          int sslKtls(SSL *ssl);
+ *          int sslKtlsAvail(void);
+ *          ssize_t sslSendFile(SSL *ssl, int fd, off_t offset, size_t size);
+ *      local:
+ *          ssize_t sendfileKtls(SSL *ssl, int fd, off_t offset, size_t size);
+ *          ssize_t sendfileCopy(SSL *ssl, int fd, off_t offset, size_t size);
+ *  DESCRIPTION
+ *      The MySSL library is a simple interface to OpenSSL library to permits user-friendly writing of Servers and
+ *      Clients using OpenSSL.
+ *  NOTES
+ *      - The free software library "OpenSSL" is distributed under a "dual licensed" system: under the OpenSSL License
+ *        and the SSLeay License. The OpenSSL License is Apache License 1.0 and SSLeay License bears some similarity to
+ *        a 4-clause BSD License. Both licenses apply.
+ *      - The library "OpenSSL" reference version is 1.0.2g
+ *      - The kernel TLS offload (OpenSSL 3.0 and above built with KTLS, option ktls of SslCtxOpts) is activated by
+ *        OpenSSL at the end of the handshake only if the kernel has the tls module and supports the negotiated
+ *        cipher: otherwise the connection works as usual and sslSendFile() falls back to read and write.
+ *      - sslKtlsAvail() tests the OpenSSL build and the kernel (sslCreateCtxEx() fails if the option ktls is requested
+ *        and the offload isn't available), the cipher is known only after the handshake (see sslKtls()).
+ *      - The read buffer of the fallback (SSL_WRITE_BATCH bytes) is taken from the pool of the large buffers (see
+ *        sslBufferGet()), to not allocate a large buffer for each file.
+ *  AUTHOR
+ *      Aldo Abate
+ *  OPERATING SYSTEM
+ *      Linux (kernel 2.6 and above - glibc 2.3.2 and above)
+ *  COMPILER
+ *      GNU GCC (ver. 4.4 and above)
+ *  RELEASE
+ *      0.1.0 (August 2019)
+ */
+
+#include "myssl.h"
+#include "myssl-private.h"
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <openssl/err.h>
+
+// local prototypes
+static ssize_t sendfileKtls(SSL *ssl, int fd, off_t offset, size_t size);
+static ssize_t sendfileCopy(SSL *ssl, int fd, off_t offset, size_t size);
+
+
+////////////////////////////////////////////////////////////////////////////////
+// GLOBAL functions
+////////////////////////////////////////////////////////////////////////////////
+
+
+/*!
+ *  NAME
+ *      sslKtls - kernel TLS offload state of a SSL/TLS connection
+ *  SYNOPSIS
+ *      int sslKtls(
+ *          SSL *ssl);              // OpenSSL SSL structure
+ *  DESCRIPTION
+ *      sslKtls() reports if the records of the specified ssl connection are encrypted (transmission) and decrypted
+ *      (reception) by the kernel. The state is final after the handshake.
+ *  RETURN VALUE
+ *      sslKtls() shall return a mask of SSL_KTLS_TX and SSL_KTLS_RX (0 = no offload, always with OpenSSL versions
+ *      without kernel TLS).
+ */
+
+int sslKtls(
+    SSL *ssl)                       // OpenSSL SSL structure
+{
+    int state = 0;
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L && ! defined(OPENSSL_NO_KTLS)
+    // test the socket BIOs (the offload is enabled by OpenSSL when the keys are changed)
+    BIO *wbio = SSL_get_wbio(ssl), *rbio = SSL_get_rbio(ssl);
+    if (wbio != NULL && BIO_get_ktls_send(wbio))
+        state |= SSL_KTLS_TX;
+
+    if (rbio != NULL && BIO_get_ktls_recv(rbio))
+        state |= SSL_KTLS_RX;
+#else
+    (void)ssl;
+#endif
+
+    return state;
+}
+
+
+/*!
+ *  NAME
+ *      sslKtlsAvail - kernel TLS offload availability
+ *  SYNOPSIS
+ *      int sslKtlsAvail(void);
+ *  DESCRIPTION
+ *      sslKtlsAvail() tests if the kernel TLS offload can be activated: OpenSSL 3.0 and above built with KTLS and a
+ *      kernel with the tls module (loaded on demand by the test, if permitted). The offload of a connection also
+ *      needs a cipher supported by the kernel and by OpenSSL (see sslKtls()).
+ *  RETURN VALUE
+ *      sslKtlsAvail() shall return a mask of SSL_KTLS_TX and SSL_KTLS_RX (0 = offload not available).
+ */
+
+int sslKtlsAvail(void)
+{
+    int avail = 0;
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L && ! defined(OPENSSL_NO_KTLS) && defined(SSL_OP_ENABLE_KTLS) && \
+        defined(TCP_ULP)
+    // attach the tls ULP to a not connected socket: ENOTCONN if the kernel has the tls module, ENOENT otherwise
+    int sock;
+    if ((sock = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0)) >= 0) {
+        if (setsockopt(sock, IPPROTO_TCP, TCP_ULP, "tls", sizeof("tls")) == 0 || errno == ENOTCONN)
+            avail = SSL_KTLS_TX | SSL_KTLS_RX;
+
+        close(sock);
+    }
+#endif
+
+    return avail;
+}
+
+
+/*!
+ *  NAME
+ *      sslSendFile - send a file to a SSL/TLS connection
+ *  SYNOPSIS
+ *      ssize_t sslSendFile(
+ *          SSL    *ssl,            // OpenSSL SSL structure
+ *          int    fd,              // file descriptor of the file
+ *          off_t  offset,          // offset of the data in the file
+ *          size_t size);           // number of bytes to send
+ *  DESCRIPTION
+ *      sslSendFile() sends size bytes of the file fd, starting from offset, into the specified ssl connection (after
+ *      the handshake). With the kernel TLS transmission offload (see sslKtls()) the data is sent with sendfile()
+ *      without copying it in user space, otherwise it is read in a pooled buffer and written with sslWriteAll(). The
+ *      file offset of fd is not changed. The timeout of the connection (see sslSetTimeout()) is the max duration of
+ *      the whole operation.
+ *  RETURN VALUE
+ *      Upon successful completion, sslSendFile() shall return the number of bytes sent: less than size only if the
+ *      end of the file is reached.
+ *      Otherwise, -1 shall be returned and the reason can be analyzed calling sslStatus(): after an error or a
+ *      timeout the data may be partially sent and the connection is not usable anymore (SSL_STATUS_FATAL), except
+ *      for SSL_STATUS_CLOSED.
+ */
+
+ssize_t sslSendFile(
+    SSL    *ssl,                    // OpenSSL SSL structure
+    int    fd,                      // file descriptor of the file
+    off_t  offset,                  // offset of the data in the file
+    size_t size)                    // number of bytes to send
+{
+    if (fd < 0 || offset < 0) {
+        sslStatusSet(ssl, SSL_STATUS_FATAL);
+        return -1;
+    }
+
+    // zero-copy with the kernel TLS, otherwise read and write
+    return (sslKtls(ssl) & SSL_KTLS_TX) ? sendfileKtls(ssl, fd, offset, size) : sendfileCopy(ssl, fd, offset, size);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// LOCAL functions
+////////////////////////////////////////////////////////////////////////////////
+
+
+/*!
+ *  NAME
+ *      sendfileKtls - send a file with the kernel TLS
+ *  SYNOPSIS
+ *      ssize_t sendfileKtls(
+ *          SSL    *ssl,            // OpenSSL SSL structure
+ *          int    fd,              // file descriptor of the file
+ *          off_t  offset,          // offset of the data in the file
+ *          size_t size);           // number of bytes to send
+ *  DESCRIPTION
+ *      sendfileKtls() sends the file with SSL_sendfile() (a sendfile() of the socket, the kernel encrypts the
+ *      records) in chunks of SSL_SENDFILE_CHUNK bytes, waiting when the socket buffer is full.
+ *  RETURN VALUE
+ *      See sslSendFile().
+ */
+
+static ssize_t sendfileKtls(
+    SSL    *ssl,                    // OpenSSL SSL structure
+    int    fd,                      // file descriptor of the file
+    off_t  offset,                  // offset of the data in the file
+    size_t size)                    // number of bytes to send
+{
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L && ! defined(OPENSSL_NO_KTLS)
+    int64_t deadline = sslDeadline(ssl, SSL_TIMEOUT_CONN);
+    ssize_t total    = 0;
+    while ((size_t)total < size) {
+        size_t      chunk = size - total < SSL_SENDFILE_CHUNK ? size - total : SSL_SENDFILE_CHUNK;
+        ossl_ssize_t sent = SSL_sendfile(ssl, fd, offset + total, chunk, 0);
+        if (sent > 0) {
+            total += sent;
+            continue;
+        }
+
+        // end of the file
+        if (sent == 0)
+            break;
+
+        // socket buffer full (SSL_sendfile() doesn't set the want-write state): wait until the socket is writable
+        struct pollfd pfd = { SSL_get_wfd(ssl), POLLOUT, 0 };
+        if (errno == EINTR || ((errno == EAGAIN || errno == EBUSY) && sslPoll(&pfd, 1, deadline) > 0))
+            continue;
+
+        // error, timeout or peer disconnected: the records already sent break the connection
+        ERR_clear_error();
+        sslStatusSet(ssl, errno == EPIPE || errno == ECONNRESET ? SSL_STATUS_CLOSED : SSL_STATUS_FATAL);
+        return -1;
+    }
+
+    sslStatusSet(ssl, SSL_STATUS_OK);
+    return total;
+#else
+    return sendfileCopy(ssl, fd, offset, size);
+#endif
+}
+
+
+/*!
+ *  NAME
+ *      sendfileCopy - send a file with read and write
+ *  SYNOPSIS
+ *      ssize_t sendfileCopy(
+ *          SSL    *ssl,            // OpenSSL SSL structure
+ *          int    fd,              // file descriptor of the file
+ *          off_t  offset,          // offset of the data in the file
+ *          size_t size);           // number of bytes to send
+ *  DESCRIPTION
+ *      sendfileCopy() reads the file with pread() in a pooled buffer of SSL_WRITE_BATCH bytes and writes each
+ *      block with sslWriteAll() (full records and a single send() for each block).
+ *  RETURN VALUE
+ *      See sslSendFile().
+ */
+
+static ssize_t sendfileCopy(
+    SSL    *ssl,                    // OpenSSL SSL structure
+    int    fd,                      // file descriptor of the file
+    off_t  offset,                  // offset of the data in the file
+    size_t size)                    // number of bytes to send
+{
+    void *buffer;
+    if ((buffer = sslBufferGet()) == NULL) {
+        sslStatusSet(ssl, SSL_STATUS_FATAL);
+        return -1;
+    }
+
+    ssize_t total = 0;
+    while ((size_t)total < size) {
+        size_t  chunk = size - total < SSL_WRITE_BATCH ? size - total : SSL_WRITE_BATCH;
+        ssize_t len   = pread(fd, buffer, chunk, offset + total);
+        if (len < 0 && errno == EINTR)
+            continue;
+
+        // end of the file
+        if (len == 0)
+            break;
+
+        // read error (the rest of the file can't be sent) or write error (status set)
+        if (len < 0 || sslWriteAll(ssl, buffer, len) < 0) {
+            if (len < 0)
+                sslStatusSet(ssl, SSL_STATUS_FATAL);
+
+            sslBufferPut(buffer);
+            return -1;
+        }
+
+        total += len;
+    }
+
+    sslBufferPut(buffer);
+    sslStatusSet(ssl, SSL_STATUS_OK);
+    return total;
+}
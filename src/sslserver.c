@@ -0,0 +1,341 @@
+/*
+ * Copyright © 2019 Aldo Abate <aldo.abate99@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+
+
+/*!
+ *  FILE
+ *      sslserver.c - multi-threaded server engine (a SO_REUSEPORT listener and a reactor per worker) for MySSL library
+ *  PROJECT
+ *      MySSL library
+ *  FUNCTIONS
+ *      global:
+ *          SslServer* sslServerStart(const SslServerOpts *sopts, const SslCtxOpts *opts);
+ *          int        sslServerPort(SslServer *server);
+ *          void       sslServerStop(SslServer *server);
+ *      local:
+ *          int   serverListen(const char *host, int port, int *bound_port);
+ *          void* serverWorker(void *arg);
+ *          void  serverConnEvent(SslConn *conn, int event, void *arg);
+ *  DESCRIPTION
+ *      The MySSL library is a simple interface to OpenSSL library to permits user-friendly writing of Servers and
+ *      Clients using OpenSSL.
+ *  NOTES
+ *      - The free software library "OpenSSL" is distributed under a "dual licensed" system: under the OpenSSL License
+ *        and the SSLeay License. The OpenSSL License is Apache License 1.0 and SSLeay License bears some similarity to
+ *        a 4-clause BSD License. Both licenses apply.
+ *      - The library "OpenSSL" reference version is 1.0.2g
+ *      - Each worker thread has its own listening socket on the same port (SO_REUSEPORT: the kernel distributes the
+ *        new connections among the sockets) and its own reactor, so the workers share nothing but the server context
+ *        (and its session cache): the accepted handshakes and the throughput scale with the cores.
+ *  AUTHOR
+ *      Aldo Abate
+ *  OPERATING SYSTEM
+ *      Linux (kernel 3.9 and above - glibc 2.3.2 and above)
+ *  COMPILER
+ *      GNU GCC (ver. 4.4 and above)
+ *  RELEASE
+ *      0.1.0 (August 2019)
+ */
+
+#include "myssl.h"
+#include "myssl-private.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <arpa/inet.h>
+
+// worker of the server engine
+typedef struct {
+    struct SslServer *server;       // server engine
+    SslReactor       *reactor;      // reactor of the worker
+    pthread_t        tid;           // worker thread
+    bool             started;       // thread started
+} ServerWorker;
+
+// server engine
+struct SslServer {
+    SSL_CTX       *ctx;             // server context (shared by the workers)
+    SslServerCb   cb;               // application data callback
+    void          *arg;             // callback argument
+    int           port;             // listening port
+    int           nworkers;         // number of workers
+    ServerWorker  *workers;         // workers
+    atomic_bool   stop;             // stop request (sslServerStop())
+};
+
+// local prototypes
+static int   serverListen(const char *host, int port, int *bound_port);
+static void* serverWorker(void *arg);
+static void  serverConnEvent(SslConn *conn, int event, void *arg);
+
+
+////////////////////////////////////////////////////////////////////////////////
+// GLOBAL functions
+////////////////////////////////////////////////////////////////////////////////
+
+
+/*!
+ *  NAME
+ *      sslServerStart - start a multi-threaded server engine
+ *  SYNOPSIS
+ *      SslServer* sslServerStart(
+ *          const SslServerOpts *sopts,     // server engine options
+ *          const SslCtxOpts    *opts);     // server context options (NULL = default certificate files)
+ *  DESCRIPTION
+ *      sslServerStart() creates the server context (see sslCreateCtxEx()) and starts the workers (default: a worker
+ *      per core): each worker listens on the port with its own SO_REUSEPORT socket, accepts the connections and runs
+ *      the handshakes in its own reactor, and calls sopts->cb (in the worker thread) with the decrypted application
+ *      data of each connection:
+ *          cb(conn, buf, num, arg)     num bytes received: the callback replies with sslWriteStep(sslConnSsl(conn))
+ *                                      and can close the connection with sslConnClose()
+ *          cb(conn, NULL, 0, arg)      connection closed by the peer (or error): it is closed after the callback
+ *      A connection is always handled by the same worker (the callback needs locks only for the data shared among the
+ *      connections).
+ *  RETURN VALUE
+ *      Upon successful completion, sslServerStart() shall return the server engine (to stop with sslServerStop()).
+ *      Otherwise (context, socket or thread error), NULL shall be returned.
+ */
+
+SslServer* sslServerStart(
+    const SslServerOpts *sopts,     // server engine options
+    const SslCtxOpts    *opts)      // server context options (NULL = default certificate files)
+{
+    // allocate the server engine
+    SslServer *server;
+    int       nworkers = sopts->workers > 0 ? sopts->workers : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (sopts->cb == NULL || (server = calloc(1, sizeof(SslServer))) == NULL)
+        return NULL;
+
+    server->cb       = sopts->cb;
+    server->arg      = sopts->arg;
+    server->nworkers = nworkers > 0 ? nworkers : 1;
+    atomic_init(&server->stop, false);
+
+    // create the shared context and the workers
+    int error;
+    if ((server->ctx = sslCreateCtxEx(SSL_SERVER, opts, &error)) == NULL || error < 0 ||
+            (server->workers = calloc(server->nworkers, sizeof(ServerWorker))) == NULL)
+        goto error;
+
+    server->port = sopts->port;
+    for (int i = 0; i < server->nworkers; i++) {
+        // listening socket on the same port (the first one gets the free port if port is 0) and reactor
+        ServerWorker *worker = &server->workers[i];
+        int          sock;
+        worker->server = server;
+        if ((sock = serverListen(sopts->host, server->port, &server->port)) < 0)
+            goto error;
+
+        if ((worker->reactor = sslReactorNewEx(sopts->backend, sopts->max_conn)) == NULL ||
+                sslReactorListen(worker->reactor, sock, server->ctx, serverConnEvent, server) < 0) {
+            close(sock);
+            goto error;
+        }
+    }
+
+    // start the workers
+    for (int i = 0; i < server->nworkers; i++) {
+        ServerWorker *worker = &server->workers[i];
+        if (pthread_create(&worker->tid, NULL, serverWorker, worker) != 0)
+            goto error;
+
+        worker->started = true;
+    }
+
+    return server;
+
+error:
+    // stop the started workers and free the engine
+    sslServerStop(server);
+    return NULL;
+}
+
+
+/*!
+ *  NAME
+ *      sslServerPort - get the listening port of a server engine
+ *  SYNOPSIS
+ *      int sslServerPort(
+ *          SslServer *server);     // server engine
+ *  DESCRIPTION
+ *      sslServerPort() get the listening port (e.g.: the free port assigned when SslServerOpts.port is 0).
+ *  RETURN VALUE
+ *      sslServerPort() shall return the listening port.
+ */
+
+int sslServerPort(
+    SslServer *server)              // server engine
+{
+    return server->port;
+}
+
+
+/*!
+ *  NAME
+ *      sslServerStop - stop a server engine
+ *  SYNOPSIS
+ *      void sslServerStop(
+ *          SslServer *server);     // server engine
+ *  DESCRIPTION
+ *      sslServerStop() stops the workers (within SSL_SERVER_TICK ms), closes the listening sockets and the
+ *      connections (without shutdown and without callback), releases the context and frees the engine.
+ *  RETURN VALUE
+ *      None.
+ */
+
+void sslServerStop(
+    SslServer *server)              // server engine
+{
+    if (server == NULL)
+        return;
+
+    // stop the workers and free their reactors
+    atomic_store(&server->stop, true);
+    for (int i = 0; server->workers && i < server->nworkers; i++) {
+        ServerWorker *worker = &server->workers[i];
+        if (worker->started)
+            pthread_join(worker->tid, NULL);
+
+        sslReactorFree(worker->reactor);
+    }
+
+    free(server->workers);
+    sslReleaseCtx(server->ctx);
+    free(server);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// LOCAL functions
+////////////////////////////////////////////////////////////////////////////////
+
+
+/*!
+ *  NAME
+ *      serverListen - create a SO_REUSEPORT listening socket
+ *  SYNOPSIS
+ *      int serverListen(
+ *          const char *host,       // IPv4 address (NULL = all the interfaces)
+ *          int        port,        // port (0 = free port)
+ *          int        *bound_port);    // port assigned
+ *  DESCRIPTION
+ *      serverListen() creates a listening socket with SO_REUSEADDR and SO_REUSEPORT (other sockets can listen on the
+ *      same port) and a SOMAXCONN queue.
+ *  RETURN VALUE
+ *      Upon successful completion, serverListen() shall return the socket.
+ *      Otherwise, -1 shall be returned (errno set).
+ */
+
+static int serverListen(
+    const char *host,               // IPv4 address (NULL = all the interfaces)
+    int        port,                // port (0 = free port)
+    int        *bound_port)         // port assigned
+{
+    // listening address
+    struct sockaddr_in addr;
+    socklen_t          addrlen = sizeof(addr);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_port        = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (host && inet_pton(AF_INET, host, &addr.sin_addr) != 1) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    // create the socket, bind the address and start listening
+    int sock, on = 1;
+    if ((sock = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, IPPROTO_TCP)) < 0)
+        return -1;
+
+    if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) < 0 ||
+            setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0 ||
+            bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(sock, SOMAXCONN) < 0 ||
+            getsockname(sock, (struct sockaddr *)&addr, &addrlen) < 0) {
+        int saved = errno;
+        close(sock);
+        errno = saved;
+        return -1;
+    }
+
+    *bound_port = ntohs(addr.sin_port);
+    return sock;
+}
+
+
+/*!
+ *  NAME
+ *      serverWorker - worker thread
+ *  SYNOPSIS
+ *      void* serverWorker(
+ *          void *arg);             // worker
+ *  DESCRIPTION
+ *      serverWorker() runs the reactor of the worker until the engine is stopped (the stop request is checked every
+ *      SSL_SERVER_TICK ms).
+ *  RETURN VALUE
+ *      serverWorker() shall return NULL.
+ */
+
+static void* serverWorker(
+    void *arg)                      // worker
+{
+    ServerWorker *worker = arg;
+    while (! atomic_load(&worker->server->stop) && sslReactorRun(worker->reactor, SSL_SERVER_TICK) == 0)
+        ;
+
+    return NULL;
+}
+
+
+/*!
+ *  NAME
+ *      serverConnEvent - events of the connections of a worker
+ *  SYNOPSIS
+ *      void serverConnEvent(
+ *          SslConn *conn,          // reactor connection
+ *          int     event,          // event: SSL_EV_CONNECTED/SSL_EV_READ/SSL_EV_WRITE/SSL_EV_CLOSED
+ *          void    *arg);          // server engine
+ *  DESCRIPTION
+ *      serverConnEvent() reads the decrypted data of the connection (until the socket is drained) and passes it to
+ *      the application callback. On disconnection or error the callback gets num = 0 and the connection is closed.
+ *  RETURN VALUE
+ *      None.
+ */
+
+static void serverConnEvent(
+    SslConn *conn,                  // reactor connection
+    int     event,                  // event: SSL_EV_CONNECTED/SSL_EV_READ/SSL_EV_WRITE/SSL_EV_CLOSED
+    void    *arg)                   // server engine
+{
+    SslServer *server = arg;
+    if (event != SSL_EV_READ)
+        return;
+
+    // pass the data to the application (the callback can close the connection)
+    char buf[SSL_SERVER_BUFSIZE];
+    int  rcvd = SSL_STEP_WANT_READ;
+    SSL  *ssl;
+    while ((ssl = sslConnSsl(conn)) != NULL && (rcvd = sslReadStep(ssl, buf, sizeof(buf))) > 0)
+        server->cb(conn, buf, rcvd, server->arg);
+
+    // disconnection or error: notify the application and close the connection
+    if (ssl != NULL && (rcvd == SSL_STEP_CLOSED || rcvd == SSL_STEP_ERROR)) {
+        server->cb(conn, NULL, 0, server->arg);
+        sslConnClose(conn, false);
+    }
+}
@@ -0,0 +1,666 @@
+/*
+ * Copyright © 2019 Aldo Abate <aldo.abate99@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+
+/*!
+ *  FILE
+ *      sslsession.c - TLS session resumption functions for MySSL library
+ *  PROJECT
+ *      MySSL library
+ *  FUNCTIONS
+ *      global:
+ *          int  sslConnectSession(SSL *ssl, const char *host, int port);
+ *          void sslSessionStats(SSL_CTX *ctx, SslSessStats *stats);
+ *          void sslFlushSessions(void);
+ *          int  sslSessionNew(SSL *ssl, SSL_SESSION *sess);
+ *          bool sslSessionCtxInit(SSL_CTX *ctx);
+ *          bool sslSessionAttach(SSL *ssl, const char *host, int port);
+ *          void sslSessionCtxFree(unsigned long sess_ctx);
+ *      local:
+ *          SSL_SESSION* storeGet(const char *key);
+ *          bool         storePut(const char *key, SSL_SESSION *sess);
+ *          SessEntry**  storeFind(const char *key);
+ *          unsigned     storeHash(const char *key);
+ *          void         storeFree(SessEntry *entry);
+ *          void         storeRemove(SessEntry **pentry);
+ *          void         lruUnlink(SessEntry *entry);
+ *          void         lruPush(SessEntry *entry);
+ *          bool         sessExpired(SSL_SESSION *sess);
+ *          bool         sessSingleUse(SSL_SESSION *sess);
+ *  DESCRIPTION
+ *      The MySSL library is a simple interface to OpenSSL library to permits user-friendly writing of Servers and
+ *      Clients using OpenSSL.
+ *  NOTES
+ *      - The free software library "OpenSSL" is distributed under a "dual licensed" system: under the OpenSSL License
+ *        and the SSLeay License. The OpenSSL License is Apache License 1.0 and SSLeay License bears some similarity to
+ *        a 4-clause BSD License. Both licenses apply.
+ *      - The library "OpenSSL" reference version is 1.0.2g
+ *      - The entries of the store are also in a LRU list (the most recently used at the head): when the store is full
+ *        (SSL_SESS_MAX keys) the least recently used entry is evicted for the new key. The entries of a client
+ *        context are removed when the context is freed (sslSessionCtxFree(), from the ex_data free callback).
+ *  AUTHOR
+ *      Aldo Abate
+ *  OPERATING SYSTEM
+ *      Linux (kernel 2.6 and above - glibc 2.3.2 and above)
+ *  COMPILER
+ *      GNU GCC (ver. 4.4 and above)
+ *  RELEASE
+ *      0.1.0 (August 2019)
+ */
+
+#include "myssl.h"
+#include "myssl-private.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+// client sessions store entry
+typedef struct SessEntry {
+    char             *key;          // session key (context/host:port)
+    SSL_SESSION      *sess[SSL_SESS_TICKETS];   // stored sessions, the newest at the end (the store holds a reference)
+    int              nsess;         // number of stored sessions
+    unsigned long    sess_ctx;      // identity of the client context (the prefix of the key)
+    struct SessEntry *next;         // next entry in the bucket
+    struct SessEntry *lru_prev;     // previous (more recently used) entry in the LRU list
+    struct SessEntry *lru_next;     // next (less recently used) entry in the LRU list
+} SessEntry;
+
+// local prototypes
+static SSL_SESSION* storeGet(const char *key);
+static bool         storePut(const char *key, SSL_SESSION *sess);
+static SessEntry**  storeFind(const char *key);
+static unsigned     storeHash(const char *key);
+static void         storeFree(SessEntry *entry);
+static void         storeRemove(SessEntry **pentry);
+static void         lruUnlink(SessEntry *entry);
+static void         lruPush(SessEntry *entry);
+static bool         sessExpired(SSL_SESSION *sess);
+static bool         sessSingleUse(SSL_SESSION *sess);
+
+// local data
+static SessEntry       *sess_store[SSL_SESS_BUCKETS];               // client sessions store (hash table)
+static int             sess_count = 0;                              // number of stored keys
+static SessEntry       *sess_lru_head = NULL;                       // LRU list: most recently used entry
+static SessEntry       *sess_lru_tail = NULL;                       // LRU list: least recently used entry
+static unsigned long   sess_ctx_last = 0;                           // last identity given to a client context
+static pthread_mutex_t sess_mutex = PTHREAD_MUTEX_INITIALIZER;      // store lock
+
+
+////////////////////////////////////////////////////////////////////////////////
+// GLOBAL functions
+////////////////////////////////////////////////////////////////////////////////
+
+
+/*!
+ *  NAME
+ *      sslConnectSession - start an OpenSSL connection resuming a stored session
+ *  SYNOPSIS
+ *      int sslConnectSession(
+ *          SSL        *ssl,        // OpenSSL SSL structure
+ *          const char *host,       // server host
+ *          int        port);       // server port
+ *  DESCRIPTION
+ *      sslConnectSession() execute a SSL_connect() (through sslFunc()) reusing the session stored for the server
+ *      host:port, so the handshake is abbreviated when the server accepts the session. The new sessions received from
+ *      the server (also the TLS 1.3 tickets received after the handshake) are stored for the next connections to the
+ *      same host:port from the same context: a session verified with the CA and options of a context is never resumed
+ *      by another one (nor by the context that replaces it, see sslReloadCtx()). The SSL structure must be created
+ *      from a client context created with sslCreateCtx().
+ *  RETURN VALUE
+ *      Upon successful completion, sslConnectSession() shall return 1 (use SSL_session_reused() to test if the session
+ *      was resumed). Otherwise, the result of SSL_connect() shall be returned and the error can be analyzed calling the
+ *      OpenSSL library SSL_get_error() function.
+ */
+
+int sslConnectSession(
+    SSL        *ssl,                // OpenSSL SSL structure
+    const char *host,               // server host
+    int        port)                // server port
+{
+    // reuse the stored session (if any) and start the OpenSSL connection
+    sslSessionAttach(ssl, host, port);
+    return sslFunc(SSL_connect, ssl);
+}
+
+
+/*!
+ *  NAME
+ *      sslSessionStats - get the session resumption statistics
+ *  SYNOPSIS
+ *      void sslSessionStats(
+ *          SSL_CTX      *ctx,      // OpenSSL context (server or client)
+ *          SslSessStats *stats);   // statistics
+ *  DESCRIPTION
+ *      sslSessionStats() get the session resumption statistics of a context: the number of completed handshakes, the
+ *      number of abbreviated handshakes (resumed sessions) and the resumption hit rate (percentage).
+ *  RETURN VALUE
+ *      None.
+ */
+
+void sslSessionStats(
+    SSL_CTX      *ctx,              // OpenSSL context (server or client)
+    SslSessStats *stats)            // statistics
+{
+    // get the context statistics (a context is used only as server or only as client)
+    stats->handshakes = SSL_CTX_sess_accept_good(ctx) + SSL_CTX_sess_connect_good(ctx);
+    stats->resumed    = SSL_CTX_sess_hits(ctx);
+    stats->hit_rate   = stats->handshakes > 0 ? stats->resumed * 100.0 / stats->handshakes : 0.0;
+}
+
+
+/*!
+ *  NAME
+ *      sslFlushSessions - flush the client sessions store
+ *  SYNOPSIS
+ *      void sslFlushSessions(void);
+ *  DESCRIPTION
+ *      sslFlushSessions() removes all the sessions from the client sessions store.
+ *  RETURN VALUE
+ *      None.
+ */
+
+void sslFlushSessions(void)
+{
+    // free all the entries of the store
+    pthread_mutex_lock(&sess_mutex);
+    for (int i = 0; i < SSL_SESS_BUCKETS; i++) {
+        while (sess_store[i]) {
+            SessEntry *entry = sess_store[i];
+            sess_store[i] = entry->next;
+            storeFree(entry);
+        }
+    }
+
+    sess_count    = 0;
+    sess_lru_head = NULL;
+    sess_lru_tail = NULL;
+    pthread_mutex_unlock(&sess_mutex);
+}
+
+
+/*!
+ *  NAME
+ *      sslSessionNew - save a new client session
+ *  SYNOPSIS
+ *      int sslSessionNew(
+ *          SSL         *ssl,       // OpenSSL SSL structure
+ *          SSL_SESSION *sess);     // new session
+ *  DESCRIPTION
+ *      sslSessionNew() is the new session callback of the client contexts: it saves the new session in the client
+ *      sessions store with the key set by sslConnectSession().
+ *  RETURN VALUE
+ *      sslSessionNew() shall return 1 if the session is stored (the store keeps the reference), 0 otherwise.
+ */
+
+int sslSessionNew(
+    SSL         *ssl,               // OpenSSL SSL structure
+    SSL_SESSION *sess)              // new session
+{
+    // get the session key (the connections not started with sslConnectSession() have no key)
+    SslConnData *conn;
+    if ((conn = sslConnData(ssl)) == NULL || conn->sess_key == NULL)
+        return 0;
+
+    // store the session
+    return storePut(conn->sess_key, sess) ? 1 : 0;
+}
+
+
+/*!
+ *  NAME
+ *      sslSessionCtxInit - give a client context its identity in the sessions store
+ *  SYNOPSIS
+ *      bool sslSessionCtxInit(
+ *          SSL_CTX *ctx);          // OpenSSL client context
+ *  DESCRIPTION
+ *      sslSessionCtxInit() assign a unique identity to a new client context: the identity is part of the keys of its
+ *      sessions, so the sessions of a context are never resumed by another context (that could verify the servers with
+ *      different CA or options). The identities are never reused, also after the context is freed.
+ *  RETURN VALUE
+ *      Upon successful completion, sslSessionCtxInit() shall return true. Otherwise (allocation error), false shall be
+ *      returned.
+ */
+
+bool sslSessionCtxInit(
+    SSL_CTX *ctx)                   // OpenSSL client context
+{
+    // get the private data of the context
+    SslCtxData *ctxdata;
+    if ((ctxdata = sslCtxData(ctx)) == NULL)
+        return false;
+
+    // assign the identity
+    pthread_mutex_lock(&sess_mutex);
+    ctxdata->sess_ctx = ++sess_ctx_last;
+    pthread_mutex_unlock(&sess_mutex);
+    return true;
+}
+
+
+/*!
+ *  NAME
+ *      sslSessionAttach - attach the stored session to a connection
+ *  SYNOPSIS
+ *      bool sslSessionAttach(
+ *          SSL        *ssl,        // OpenSSL SSL structure
+ *          const char *host,       // server host
+ *          int        port);       // server port
+ *  DESCRIPTION
+ *      sslSessionAttach() set the session key (context/host:port) of a client connection, used to save the new
+ *      sessions, and set the stored session for the key (if any) as the session to resume. The connections of contexts
+ *      not created with sslCreateCtx() (without identity) don't use the store.
+ *  RETURN VALUE
+ *      sslSessionAttach() shall return true if a stored session is attached. Otherwise, false shall be returned.
+ */
+
+bool sslSessionAttach(
+    SSL        *ssl,                // OpenSSL SSL structure
+    const char *host,               // server host
+    int        port)                // server port
+{
+    // set the session key of the connection (used to save the new sessions): the identity of the context is part of
+    // the key, the sessions are shared only by the connections of the same context
+    SslCtxData  *ctxdata;
+    SslConnData *conn;
+    if ((ctxdata = sslCtxDataFind(SSL_get_SSL_CTX(ssl))) == NULL || ctxdata->sess_ctx == 0 ||
+            (conn = sslConnData(ssl)) == NULL)
+        return false;
+
+    char key[256];
+    snprintf(key, sizeof(key), "%lu/%s:%d", ctxdata->sess_ctx, host, port);
+    free(conn->sess_key);
+    if ((conn->sess_key = strdup(key)) == NULL)
+        return false;
+
+    // reuse the stored session (if any)
+    SSL_SESSION *sess;
+    if ((sess = storeGet(conn->sess_key)) == NULL)
+        return false;
+
+    bool result = SSL_set_session(ssl, sess) == 1;
+    SSL_SESSION_free(sess);
+    return result;
+}
+
+
+/*!
+ *  NAME
+ *      sslSessionCtxFree - remove the sessions of a client context
+ *  SYNOPSIS
+ *      void sslSessionCtxFree(
+ *          unsigned long sess_ctx);    // identity of the client context (sslSessionCtxInit())
+ *  DESCRIPTION
+ *      sslSessionCtxFree() removes from the client sessions store all the entries of a context: it's called when the
+ *      context is freed, its identity is never reused so its sessions could never be resumed again.
+ *  RETURN VALUE
+ *      None.
+ */
+
+void sslSessionCtxFree(
+    unsigned long sess_ctx)         // identity of the client context (sslSessionCtxInit())
+{
+    // remove the entries of the context (walking the LRU list, that links all the entries)
+    pthread_mutex_lock(&sess_mutex);
+    for (SessEntry *entry = sess_lru_head, *next; entry; entry = next) {
+        next = entry->lru_next;
+        if (entry->sess_ctx == sess_ctx)
+            storeRemove(storeFind(entry->key));
+    }
+
+    pthread_mutex_unlock(&sess_mutex);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// LOCAL functions
+////////////////////////////////////////////////////////////////////////////////
+
+
+/*!
+ *  NAME
+ *      storeGet - get a session from the store
+ *  SYNOPSIS
+ *      SSL_SESSION* storeGet(
+ *          const char *key);       // session key (context/host:port)
+ *  DESCRIPTION
+ *      storeGet() search the newest valid session of a key in the client sessions store. The expired sessions are
+ *      removed, as the single use sessions (TLS 1.3 tickets, see sessSingleUse()) given to the caller: so the
+ *      concurrent connections to the same server resume different tickets.
+ *  RETURN VALUE
+ *      If found, storeGet() shall return the session with a new reference (to free with SSL_SESSION_free()).
+ *      Otherwise, NULL shall be returned.
+ */
+
+static SSL_SESSION* storeGet(
+    const char *key)                // session key (context/host:port)
+{
+    SSL_SESSION *sess = NULL;
+
+    pthread_mutex_lock(&sess_mutex);
+
+    // search the entry
+    SessEntry **pentry = storeFind(key);
+    if (*pentry) {
+        SessEntry *entry = *pentry;
+
+        // remove the expired sessions
+        int nsess = 0;
+        for (int i = 0; i < entry->nsess; i++) {
+            if (sessExpired(entry->sess[i]))
+                SSL_SESSION_free(entry->sess[i]);
+            else
+                entry->sess[nsess++] = entry->sess[i];
+        }
+
+        entry->nsess = nsess;
+
+        // get the newest session: a reference, or the store reference of a single use session
+        if (entry->nsess > 0) {
+            sess = entry->sess[entry->nsess - 1];
+            if (sessSingleUse(sess))
+                entry->nsess--;
+            else
+                SSL_SESSION_up_ref(sess);
+        }
+
+        // no more sessions: remove the entry, else it becomes the most recently used
+        if (entry->nsess == 0)
+            storeRemove(pentry);
+        else {
+            lruUnlink(entry);
+            lruPush(entry);
+        }
+    }
+
+    pthread_mutex_unlock(&sess_mutex);
+
+    // return the session (or NULL)
+    return sess;
+}
+
+
+/*!
+ *  NAME
+ *      storePut - put a session in the store
+ *  SYNOPSIS
+ *      bool storePut(
+ *          const char  *key,       // session key (context/host:port)
+ *          SSL_SESSION *sess);     // session to store
+ *  DESCRIPTION
+ *      storePut() save a session in the client sessions store. A single use session (TLS 1.3 ticket) is added to
+ *      the sessions of the key (up to SSL_SESS_TICKETS, replacing the oldest), any other session replaces them. If
+ *      the store is full (SSL_SESS_MAX keys) the least recently used key is evicted to make room for a new key.
+ *  RETURN VALUE
+ *      storePut() shall return true if the session is stored (the store takes the caller reference). Otherwise, false
+ *      shall be returned.
+ */
+
+static bool storePut(
+    const char  *key,               // session key (context/host:port)
+    SSL_SESSION *sess)              // session to store
+{
+    bool result = false;
+
+    pthread_mutex_lock(&sess_mutex);
+
+    // search the entry
+    SessEntry **pentry = storeFind(key);
+    if (*pentry) {
+        // entry found: add the session (the only one if reusable, else dropping the oldest if full)
+        SessEntry *entry = *pentry;
+        while (entry->nsess > 0 && (! sessSingleUse(sess) || entry->nsess == SSL_SESS_TICKETS)) {
+            SSL_SESSION_free(entry->sess[0]);
+            memmove(&entry->sess[0], &entry->sess[1], --entry->nsess * sizeof(SSL_SESSION*));
+        }
+
+        entry->sess[entry->nsess++] = sess;
+        lruUnlink(entry);
+        lruPush(entry);
+        result = true;
+    }
+    else {
+        // entry not found: add a new entry at the end of the bucket (evicting the least recently used if full)
+        SessEntry *entry;
+        if ((entry = calloc(1, sizeof(SessEntry))) != NULL) {
+            if ((entry->key = strdup(key)) != NULL) {
+                if (sess_count >= SSL_SESS_MAX && sess_lru_tail) {
+                    storeRemove(storeFind(sess_lru_tail->key));
+                    pentry = storeFind(key);    // the evicted entry can be the last one of the bucket
+                }
+
+                entry->sess[0]  = sess;
+                entry->nsess    = 1;
+                entry->sess_ctx = strtoul(key, NULL, 10);
+                *pentry         = entry;
+                lruPush(entry);
+                sess_count++;
+                result = true;
+            }
+            else
+                free(entry);
+        }
+    }
+
+    pthread_mutex_unlock(&sess_mutex);
+
+    // return the result
+    return result;
+}
+
+
+/*!
+ *  NAME
+ *      storeFind - search an entry in the store
+ *  SYNOPSIS
+ *      SessEntry** storeFind(
+ *          const char *key);       // session key (context/host:port)
+ *  DESCRIPTION
+ *      storeFind() search an entry in the client sessions store. Must be called with the store lock.
+ *  RETURN VALUE
+ *      storeFind() shall return the address of the link to the entry found (or the address of the last link of the
+ *      bucket, that contains NULL, if the entry is not found).
+ */
+
+static SessEntry** storeFind(
+    const char *key)                // session key (context/host:port)
+{
+    // search the entry in the bucket
+    SessEntry **pentry = &sess_store[storeHash(key)];
+    while (*pentry && strcmp((*pentry)->key, key) != 0)
+        pentry = &(*pentry)->next;
+
+    // return the link found
+    return pentry;
+}
+
+
+/*!
+ *  NAME
+ *      storeHash - hash function of the store
+ *  SYNOPSIS
+ *      unsigned storeHash(
+ *          const char *key);       // session key (context/host:port)
+ *  DESCRIPTION
+ *      storeHash() compute the bucket index of a key (djb2 hash function).
+ *  RETURN VALUE
+ *      storeHash() shall return the bucket index.
+ */
+
+static unsigned storeHash(
+    const char *key)                // session key (context/host:port)
+{
+    // compute the hash
+    unsigned hash = 5381;
+    while (*key)
+        hash = hash * 33 + (unsigned char)*key++;
+
+    // return the bucket index
+    return hash % SSL_SESS_BUCKETS;
+}
+
+
+/*!
+ *  NAME
+ *      storeFree - free an entry of the store
+ *  SYNOPSIS
+ *      void storeFree(
+ *          SessEntry *entry);      // entry (removed from the store)
+ *  DESCRIPTION
+ *      storeFree() drops the references of the sessions of an entry and frees it.
+ *  RETURN VALUE
+ *      None.
+ */
+
+static void storeFree(
+    SessEntry *entry)               // entry (removed from the store)
+{
+    for (int i = 0; i < entry->nsess; i++)
+        SSL_SESSION_free(entry->sess[i]);
+
+    free(entry->key);
+    free(entry);
+}
+
+
+/*!
+ *  NAME
+ *      storeRemove - remove an entry from the store
+ *  SYNOPSIS
+ *      void storeRemove(
+ *          SessEntry **pentry);    // link to the entry in its bucket (see storeFind())
+ *  DESCRIPTION
+ *      storeRemove() unlinks an entry from its bucket and from the LRU list and frees it. Must be called with the
+ *      store lock.
+ *  RETURN VALUE
+ *      None.
+ */
+
+static void storeRemove(
+    SessEntry **pentry)             // link to the entry in its bucket (see storeFind())
+{
+    SessEntry *entry = *pentry;
+    *pentry = entry->next;
+    lruUnlink(entry);
+    storeFree(entry);
+    sess_count--;
+}
+
+
+/*!
+ *  NAME
+ *      lruUnlink - remove an entry from the LRU list
+ *  SYNOPSIS
+ *      void lruUnlink(
+ *          SessEntry *entry);      // entry of the store
+ *  DESCRIPTION
+ *      lruUnlink() removes an entry from the LRU list of the store. Must be called with the store lock.
+ *  RETURN VALUE
+ *      None.
+ */
+
+static void lruUnlink(
+    SessEntry *entry)               // entry of the store
+{
+    if (entry->lru_prev)
+        entry->lru_prev->lru_next = entry->lru_next;
+    else
+        sess_lru_head = entry->lru_next;
+
+    if (entry->lru_next)
+        entry->lru_next->lru_prev = entry->lru_prev;
+    else
+        sess_lru_tail = entry->lru_prev;
+
+    entry->lru_prev = entry->lru_next = NULL;
+}
+
+
+/*!
+ *  NAME
+ *      lruPush - add an entry at the head of the LRU list
+ *  SYNOPSIS
+ *      void lruPush(
+ *          SessEntry *entry);      // entry of the store (not in the list)
+ *  DESCRIPTION
+ *      lruPush() adds an entry at the head of the LRU list of the store (the most recently used). Must be called with
+ *      the store lock.
+ *  RETURN VALUE
+ *      None.
+ */
+
+static void lruPush(
+    SessEntry *entry)               // entry of the store (not in the list)
+{
+    entry->lru_prev = NULL;
+    entry->lru_next = sess_lru_head;
+    if (sess_lru_head)
+        sess_lru_head->lru_prev = entry;
+    else
+        sess_lru_tail = entry;
+
+    sess_lru_head = entry;
+}
+
+
+/*!
+ *  NAME
+ *      sessExpired - test if a session is expired
+ *  SYNOPSIS
+ *      bool sessExpired(
+ *          SSL_SESSION *sess);     // session to test
+ *  DESCRIPTION
+ *      sessExpired() test if a session is expired (or not resumable).
+ *  RETURN VALUE
+ *      sessExpired() shall return true if the session is expired. Otherwise, false shall be returned.
+ */
+
+static bool sessExpired(
+    SSL_SESSION *sess)              // session to test
+{
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+    // test if the session is resumable
+    if (! SSL_SESSION_is_resumable(sess))
+        return true;
+#endif
+
+    // test the session timeout
+    return SSL_SESSION_get_time(sess) + SSL_SESSION_get_timeout(sess) < time(NULL);
+}
+
+
+/*!
+ *  NAME
+ *      sessSingleUse - test if a session must be resumed only once
+ *  SYNOPSIS
+ *      bool sessSingleUse(
+ *          SSL_SESSION *sess);     // session to test
+ *  DESCRIPTION
+ *      sessSingleUse() test if a session is a TLS 1.3 ticket: OpenSSL resumes a TLS 1.3 ticket only once (RFC 8446,
+ *      C.4) and the server sends new tickets for the next connections.
+ *  RETURN VALUE
+ *      sessSingleUse() shall return true for a single use session. Otherwise, false shall be returned.
+ */
+
+static bool sessSingleUse(
+    SSL_SESSION *sess)              // session to test
+{
+#ifdef TLS1_3_VERSION
+    return SSL_SESSION_get_protocol_version(sess) == TLS1_3_VERSION;
+#else
+    (void)sess;
+    return false;
+#endif
+}
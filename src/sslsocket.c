@@ -0,0 +1,311 @@
+/*
+ * Copyright © 2019 Aldo Abate <aldo.abate99@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+/*!
+ *  FILE
+ *      sslsocket.c - creation and tuning of the TCP sockets of the connections for MySSL library
+ *  PROJECT
+ *      MySSL library
+ *  FUNCTIONS
+ *      global:
+ *          int sslListen(const char *host, int port, const SslSockOpts *sopts);
+ *          int sslAccept(int lsock);
+ *          int sslConnect(const char *host, int port, const SslSockOpts *sopts);
+ *      local:
+ *          void sockOpts(SslSockOpts *opts, const SslSockOpts *sopts);
+ *          void sockTune(int sock, const SslSockOpts *opts);
+ *  DESCRIPTION
+ *      The MySSL library is a simple interface to OpenSSL library to permits user-friendly writing of Servers and
+ *      Clients using OpenSSL.
+ *  NOTES
+ *      - The free software library "OpenSSL" is distributed under a "dual licensed" system: under the OpenSSL License
+ *        and the SSLeay License. The OpenSSL License is Apache License 1.0 and SSLeay License bears some similarity to
+ *        a 4-clause BSD License. Both licenses apply.
+ *      - The library "OpenSSL" reference version is 1.0.2g
+ *      - The default profile (SSL_SOCK_LATENCY) is tuned for the latency of the TLS connections: TCP_NODELAY (the
+ *        handshake flights and the small records are not held by the Nagle algorithm waiting the delayed ACK of the
+ *        peer), TCP Fast Open (the ClientHello is sent in the SYN, saving a round trip on the connections to a server
+ *        already known) and TCP_DEFER_ACCEPT (the server accepts a connection when the ClientHello arrives, the
+ *        handshake never waits it). The multi-record writes are corked by sslWritev() (see sslwritev.c).
+ *      - The options of the listening socket (TCP_NODELAY, SO_SNDBUF, SO_RCVBUF) are inherited by the accepted
+ *        sockets: sslAccept() doesn't need a syscall for each option. The tuning options are best effort (e.g.: Fast
+ *        Open is used only if enabled by net.ipv4.tcp_fastopen, on both the client and the server).
+ *      - Fast Open needs net.ipv4.tcp_fastopen = 3 (bit 1 client, bit 2 server: with the default 1 the server ignores
+ *        the data in the SYN) and a cookie of the server, got by the first connection: the SYN of the next connections
+ *        carries the ClientHello. The client uses TCP_FASTOPEN_CONNECT (Linux 4.11 and above, the same SYN of a
+ *        sendto() with MSG_FASTOPEN but with the usual connect() and SSL_connect()).
+ *  AUTHOR
+ *      Aldo Abate
+ *  OPERATING SYSTEM
+ *      Linux (kernel 2.6 and above - glibc 2.3.2 and above)
+ *  COMPILER
+ *      GNU GCC (ver. 4.4 and above)
+ *  RELEASE
+ *      0.1.0 (August 2019)
+ */
+
+#define _GNU_SOURCE     // accept4()
+#include "myssl.h"
+#include "myssl-private.h"
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+// local prototypes
+static void sockOpts(SslSockOpts *opts, const SslSockOpts *sopts);
+static void sockTune(int sock, const SslSockOpts *opts);
+
+
+////////////////////////////////////////////////////////////////////////////////
+// GLOBAL functions
+////////////////////////////////////////////////////////////////////////////////
+
+
+/*!
+ *  NAME
+ *      sslListen - create a listening socket
+ *  SYNOPSIS
+ *      int sslListen(
+ *          const char        *host,    // IPv4 address (NULL = all the interfaces)
+ *          int               port,     // port (0 = free port, see getsockname())
+ *          const SslSockOpts *sopts);  // socket options (NULL = default profile)
+ *  DESCRIPTION
+ *      sslListen() creates a TCP socket bound to host:port with SO_REUSEADDR, applies the tuning profile of sopts
+ *      (see NOTES) and starts listening with a queue of sopts->backlog connections (SOMAXCONN by default). The
+ *      connections are accepted with sslAccept() (or by a reactor, see sslReactorListen()).
+ *  RETURN VALUE
+ *      Upon successful completion, sslListen() shall return the listening socket.
+ *      Otherwise, -1 shall be returned (errno set).
+ */
+
+int sslListen(
+    const char        *host,        // IPv4 address (NULL = all the interfaces)
+    int               port,         // port (0 = free port, see getsockname())
+    const SslSockOpts *sopts)       // socket options (NULL = default profile)
+{
+    // listening address
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_port        = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (host && inet_pton(AF_INET, host, &addr.sin_addr) != 1) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    // create the socket and apply the profile (the options are inherited by the accepted sockets)
+    SslSockOpts opts;
+    int         sock, on = 1;
+    sockOpts(&opts, sopts);
+    if ((sock = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, IPPROTO_TCP)) < 0)
+        return -1;
+
+    sockTune(sock, &opts);
+    if (opts.flags & SSL_SOCK_DEFER) {
+        int secs = SSL_SOCK_DEFER_SECS;
+        (void)setsockopt(sock, IPPROTO_TCP, TCP_DEFER_ACCEPT, &secs, sizeof(secs));
+    }
+
+    if (opts.flags & SSL_SOCK_FASTOPEN) {
+        int qlen = SSL_SOCK_TFO_QLEN;
+        (void)setsockopt(sock, IPPROTO_TCP, TCP_FASTOPEN, &qlen, sizeof(qlen));
+    }
+
+    // bind the address and start listening
+    if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) < 0 ||
+            bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(sock, opts.backlog) < 0) {
+        int saved = errno;
+        close(sock);
+        errno = saved;
+        return -1;
+    }
+
+    return sock;
+}
+
+
+/*!
+ *  NAME
+ *      sslAccept - accept a connection
+ *  SYNOPSIS
+ *      int sslAccept(
+ *          int lsock);             // listening socket (see sslListen())
+ *  DESCRIPTION
+ *      sslAccept() accepts a connection of the listening socket (waiting it if the listening socket is blocking) with
+ *      a single accept4(): the socket is created non-blocking (as set by the MySSL functions at the first operation,
+ *      see sslDeadline()) and close-on-exec, with the options of the listening socket.
+ *  RETURN VALUE
+ *      Upon successful completion, sslAccept() shall return the socket of the connection.
+ *      Otherwise, -1 shall be returned (errno set: EAGAIN if the listening socket is non-blocking and there are no
+ *      connections).
+ */
+
+int sslAccept(
+    int lsock)                      // listening socket (see sslListen())
+{
+    int sock;
+    while ((sock = accept4(lsock, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) < 0 && errno == EINTR)
+        ;
+
+    return sock;
+}
+
+
+/*!
+ *  NAME
+ *      sslConnect - connect a socket to a server
+ *  SYNOPSIS
+ *      int sslConnect(
+ *          const char        *host,    // server host name or IPv4 address
+ *          int               port,     // server port
+ *          const SslSockOpts *sopts);  // socket options (NULL = default profile)
+ *  DESCRIPTION
+ *      sslConnect() creates a non-blocking TCP socket with the tuning profile of sopts (see NOTES) and connects it
+ *      to host:port, waiting the connection up to sopts->timeout ms. With Fast Open the connection is completed by
+ *      the first write (the ClientHello of SSL_connect(), in the SYN if the server is already known): a refused
+ *      connection is then reported by the handshake.
+ *  RETURN VALUE
+ *      Upon successful completion, sslConnect() shall return the connected socket (to use with SSL_set_fd()).
+ *      Otherwise, -1 shall be returned (errno set: EHOSTUNREACH if the host is not resolved, ETIMEDOUT on timeout).
+ */
+
+int sslConnect(
+    const char        *host,        // server host name or IPv4 address
+    int               port,         // server port
+    const SslSockOpts *sopts)       // socket options (NULL = default profile)
+{
+    // resolve the host (IPv4)
+    struct addrinfo    hints, *res = NULL;
+    struct sockaddr_in addr;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family   = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (host == NULL || getaddrinfo(host, NULL, &hints, &res) != 0) {
+        errno = EHOSTUNREACH;
+        return -1;
+    }
+
+    memcpy(&addr, res->ai_addr, sizeof(addr));
+    addr.sin_port = htons(port);
+    freeaddrinfo(res);
+
+    // create the socket and apply the profile
+    SslSockOpts opts;
+    int         sock;
+    sockOpts(&opts, sopts);
+    if ((sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_TCP)) < 0)
+        return -1;
+
+    sockTune(sock, &opts);
+#ifdef TCP_FASTOPEN_CONNECT
+    if (opts.flags & SSL_SOCK_FASTOPEN) {
+        int on = 1;
+        (void)setsockopt(sock, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, &on, sizeof(on));
+    }
+#endif
+
+    // connect (Fast Open with a cookie: the SYN is deferred to the first write and connect() returns at once)
+    if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        int64_t       deadline = opts.timeout > 0 ? sslClockNs() + (int64_t)opts.timeout * 1000000 : -1;
+        struct pollfd pfd      = { sock, POLLOUT, 0 };
+        int           error    = errno, rc;
+        socklen_t     len      = sizeof(error);
+        if (error == EINPROGRESS) {
+            // wait the connection until the deadline
+            if ((rc = sslPoll(&pfd, 1, deadline)) <= 0)
+                error = rc == 0 ? ETIMEDOUT : errno;
+            else if (getsockopt(sock, SOL_SOCKET, SO_ERROR, &error, &len) < 0)
+                error = errno;
+        }
+
+        if (error != 0) {
+            close(sock);
+            errno = error;
+            return -1;
+        }
+    }
+
+    return sock;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// LOCAL functions
+////////////////////////////////////////////////////////////////////////////////
+
+
+/*!
+ *  NAME
+ *      sockOpts - get the socket options with the default values
+ *  SYNOPSIS
+ *      void sockOpts(
+ *          SslSockOpts       *opts,    // socket options with the default values (output)
+ *          const SslSockOpts *sopts);  // socket options (NULL = default profile)
+ *  DESCRIPTION
+ *      sockOpts() copies the socket options (the default profile SSL_SOCK_LATENCY if sopts is NULL) with the default
+ *      value of the backlog.
+ *  RETURN VALUE
+ *      None.
+ */
+
+static void sockOpts(
+    SslSockOpts       *opts,        // socket options with the default values (output)
+    const SslSockOpts *sopts)       // socket options (NULL = default profile)
+{
+    memset(opts, 0, sizeof(SslSockOpts));
+    if (sopts)
+        *opts = *sopts;
+    else
+        opts->flags = SSL_SOCK_LATENCY;
+
+    if (opts->backlog <= 0)
+        opts->backlog = SOMAXCONN;
+}
+
+
+/*!
+ *  NAME
+ *      sockTune - apply the common options of a socket
+ *  SYNOPSIS
+ *      void sockTune(
+ *          int               sock,     // socket
+ *          const SslSockOpts *opts);   // socket options
+ *  DESCRIPTION
+ *      sockTune() sets TCP_NODELAY and the sizes of the socket buffers (before the connection, so the TCP window
+ *      scale is negotiated for them). The options are best effort: the errors are ignored.
+ *  RETURN VALUE
+ *      None.
+ */
+
+static void sockTune(
+    int               sock,         // socket
+    const SslSockOpts *opts)        // socket options
+{
+    int on = 1;
+    if (opts->flags & SSL_SOCK_NODELAY)
+        (void)setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+    if (opts->sndbuf > 0)
+        (void)setsockopt(sock, SOL_SOCKET, SO_SNDBUF, &opts->sndbuf, sizeof(opts->sndbuf));
+
+    if (opts->rcvbuf > 0)
+        (void)setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &opts->rcvbuf, sizeof(opts->rcvbuf));
+}
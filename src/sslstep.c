@@ -0,0 +1,236 @@
+/*
+ * Copyright © 2019 Aldo Abate <aldo.abate99@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+
+
+/*!
+ *  FILE
+ *      sslstep.c - non-blocking step functions for MySSL library
+ *  PROJECT
+ *      MySSL library
+ *  FUNCTIONS
+ *      global:
+ *          int sslFuncStep(int (*pfunc)(SSL*), SSL *ssl);
+ *          int sslReadStep(SSL *ssl, void *buf, int num);
+ *          int sslWriteStep(SSL *ssl, const void *buf, int num);
+ *          int sslStepResult(SSL *ssl, int sslresult);
+ *  DESCRIPTION
+ *      The MySSL library is a simple interface to OpenSSL library to permits user-friendly writing of Servers and
+ *      Clients using OpenSSL.
+ *  NOTES
+ *      - The free software library "OpenSSL" is distributed under a "dual licensed" system: under the OpenSSL License
+ *        and the SSLeay License. The OpenSSL License is Apache License 1.0 and SSLeay License bears some similarity to
+ *        a 4-clause BSD License. Both licenses apply.
+ *      - The library "OpenSSL" reference version is 1.0.2g
+ *      - The step functions execute an OpenSSL function only once and never wait: when the function must be repeated
+ *        they return the event to wait (SSL_STEP_WANT_READ/SSL_STEP_WANT_WRITE/SSL_STEP_WANT_ASYNC). The socket must
+ *        be non-blocking. The blocking functions (sslRead(), sslWrite(), sslFunc()) repeat the steps waiting the
+ *        events until the deadline.
+ *  AUTHOR
+ *      Aldo Abate
+ *  OPERATING SYSTEM
+ *      Linux (kernel 2.6 and above - glibc 2.3.2 and above)
+ *  COMPILER
+ *      GNU GCC (ver. 4.4 and above)
+ *  RELEASE
+ *      0.1.0 (August 2019)
+ */
+
+#include "myssl.h"
+#include "myssl-private.h"
+#include <errno.h>
+#include <openssl/err.h>
+
+
+////////////////////////////////////////////////////////////////////////////////
+// GLOBAL functions
+////////////////////////////////////////////////////////////////////////////////
+
+
+/*!
+ *  NAME
+ *      sslFuncStep - execute a step of SSL_accept()/SSL_connect()/SSL_shutdown()
+ *  SYNOPSIS
+ *      int sslFuncStep(
+ *          int (*pfunc)(SSL*),     // pointer to the OpenSSL function to execute
+ *          SSL *ssl);              // OpenSSL SSL structure
+ *  DESCRIPTION
+ *      sslFuncStep() execute once the required OpenSSL function without waiting (see NOTES).
+ *  RETURN VALUE
+ *      Upon successful completion, sslFuncStep() shall return the result of the required function (> 0).
+ *      Otherwise, SSL_STEP_WANT_READ/SSL_STEP_WANT_WRITE/SSL_STEP_WANT_ASYNC shall be returned if the function must be
+ *      repeated when the event arrives, SSL_STEP_CLOSED if the peer closed the connection, SSL_STEP_ERROR on error.
+ */
+
+int sslFuncStep(
+    int (*pfunc)(SSL*),             // pointer to the OpenSSL function to execute
+    SSL *ssl)                       // OpenSSL SSL structure
+{
+    // execute the required function (with an empty error queue: a stale error of another connection of the thread
+    // would turn the SSL_get_error() of a retryable result into SSL_ERROR_SSL)
+    ERR_clear_error();
+    int result = pfunc(ssl);
+    if (result > 0) {
+        // operation Ok
+        sslStatusSet(ssl, SSL_STATUS_OK);
+        return result;
+    }
+
+    // operation NOK (result <= 0): get the event to wait or the failure
+    return sslStepResult(ssl, result);
+}
+
+
+/*!
+ *  NAME
+ *      sslReadStep - execute a step of read data from a SSL/TLS connection
+ *  SYNOPSIS
+ *      int sslReadStep(
+ *          SSL  *ssl,              // OpenSSL SSL structure
+ *          void *buf,              // buffer of data to read
+ *          int  num);              // number of data to read
+ *  DESCRIPTION
+ *      sslReadStep() reads up to num bytes from the specified ssl connection into the buffer buf without waiting (see
+ *      NOTES). With an edge-triggered readiness notification (e.g.: the MySSL reactor) the data must be read until
+ *      SSL_STEP_WANT_READ is returned.
+ *  RETURN VALUE
+ *      Upon successful completion, sslReadStep() shall return the number of bytes received.
+ *      Otherwise, SSL_STEP_WANT_READ/SSL_STEP_WANT_WRITE/SSL_STEP_WANT_ASYNC shall be returned if the read must be
+ *      repeated when the event arrives, SSL_STEP_CLOSED if the peer closed the connection, SSL_STEP_ERROR on error.
+ */
+
+int sslReadStep(
+    SSL  *ssl,                      // OpenSSL SSL structure
+    void *buf,                      // buffer of data to read
+    int  num)                       // number of data to read
+{
+    // execute operation (with an empty error queue, see sslFuncStep())
+    ERR_clear_error();
+    int rcvd = SSL_read(ssl, buf, num);
+    if (rcvd > 0) {
+        // operation Ok
+        sslStatusSet(ssl, SSL_STATUS_OK);
+        return rcvd;
+    }
+
+    // operation NOK (result <= 0): get the event to wait or the failure
+    return sslStepResult(ssl, rcvd);
+}
+
+
+/*!
+ *  NAME
+ *      sslWriteStep - execute a step of write data to a SSL/TLS connection
+ *  SYNOPSIS
+ *      int sslWriteStep(
+ *          SSL        *ssl,        // OpenSSL SSL structure
+ *          const void *buf,        // buffer of data to write
+ *          int        num);        // number of data to write
+ *  DESCRIPTION
+ *      sslWriteStep() writes num bytes from the buffer buf into the specified ssl connection without waiting (see
+ *      NOTES). A write to repeat must be repeated with the same arguments (OpenSSL requirement).
+ *  RETURN VALUE
+ *      Upon successful completion, sslWriteStep() shall return the number of characters sent.
+ *      Otherwise, SSL_STEP_WANT_READ/SSL_STEP_WANT_WRITE/SSL_STEP_WANT_ASYNC shall be returned if the write must be
+ *      repeated when the event arrives, SSL_STEP_CLOSED if the peer closed the connection, SSL_STEP_ERROR on error.
+ */
+
+int sslWriteStep(
+    SSL        *ssl,                // OpenSSL SSL structure
+    const void *buf,                // buffer of data to write
+    int        num)                 // number of data to write
+{
+    // execute operation (with an empty error queue, see sslFuncStep())
+    ERR_clear_error();
+    int sent = SSL_write(ssl, buf, num);
+    if (sent > 0) {
+        // operation Ok
+        sslStatusSet(ssl, SSL_STATUS_OK);
+        return sent;
+    }
+
+    // operation NOK (result <= 0): get the event to wait or the failure
+    return sslStepResult(ssl, sent);
+}
+
+
+/*!
+ *  NAME
+ *      sslStepResult - get the step result of a failed ssl operation
+ *  SYNOPSIS
+ *      int sslStepResult(
+ *          SSL *ssl,               // OpenSSL SSL structure
+ *          int sslresult);         // ssl result (<= 0)
+ *  DESCRIPTION
+ *      sslStepResult() analyze the result of a failed ssl operation: if the operation must be repeated it returns the
+ *      event to wait, else it sets the connection status (see sslStatus()) to the failure reason.
+ *  RETURN VALUE
+ *      sslStepResult() shall return SSL_STEP_WANT_READ/SSL_STEP_WANT_WRITE/SSL_STEP_WANT_ASYNC, SSL_STEP_CLOSED or
+ *      SSL_STEP_ERROR.
+ */
+
+int sslStepResult(
+    SSL *ssl,                       // OpenSSL SSL structure
+    int sslresult)                  // ssl result (<= 0)
+{
+    int status = SSL_STATUS_FATAL;  // default status
+
+    // test ssl error
+    switch (SSL_get_error(ssl, sslresult)) {
+    case SSL_ERROR_WANT_READ:
+        // no data available right now: repeat when the socket is readable
+        return SSL_STEP_WANT_READ;
+
+    case SSL_ERROR_WANT_WRITE:
+        // socket not writable right now: repeat when the socket is writable
+        return SSL_STEP_WANT_WRITE;
+
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+    case SSL_ERROR_WANT_ASYNC:
+        // private-key operation in progress in the crypto thread pool: repeat when it's done
+        return SSL_STEP_WANT_ASYNC;
+
+#endif
+    case SSL_ERROR_ZERO_RETURN:
+        // error: peer disconnected (close_notify received)
+        status = SSL_STATUS_CLOSED;
+        break;
+
+    case SSL_ERROR_SYSCALL:
+        // system error: EOF and reset are a disconnection of the peer, a signal just repeats the operation
+        if (sslresult < 0 && errno == EINTR)
+            return SSL_STEP_WANT_READ;
+
+        if (ERR_peek_error() == 0 && (sslresult == 0 || errno == ECONNRESET || errno == EPIPE))
+            status = SSL_STATUS_CLOSED;
+
+        break;
+
+    case SSL_ERROR_SSL:
+#ifdef SSL_R_UNEXPECTED_EOF_WHILE_READING
+        // protocol error: OpenSSL 3.0 reports the EOF without close_notify as a protocol error
+        if (ERR_GET_REASON(ERR_peek_error()) == SSL_R_UNEXPECTED_EOF_WHILE_READING)
+            status = SSL_STATUS_CLOSED;
+
+#endif
+        break;
+
+    default:
+        break;
+    }
+
+    // set the connection status
+    sslStatusSet(ssl, status);
+    return status == SSL_STATUS_CLOSED ? SSL_STEP_CLOSED : SSL_STEP_ERROR;
+}
@@ -0,0 +1,702 @@
+/*
+ * Copyright © 2019 Aldo Abate <aldo.abate99@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+
+/*!
+ *  FILE
+ *      sslticket.c - session ticket keys shared between processes for MySSL library
+ *  PROJECT
+ *      MySSL library
+ *  FUNCTIONS
+ *      global:
+ *          int  sslTicketKeysRotate(const char *path, int keep);
+ *          bool sslTicketKeysInit(SSL_CTX *ctx, const SslCtxOpts *opts);
+ *          void sslTicketKeysFree(struct SslTicketKeys *tkeys);
+ *          void sslTicketCleanup(void);
+ *      local:
+ *          int  ticketKeyCb(SSL *ssl, unsigned char *name, unsigned char *iv, EVP_CIPHER_CTX *cctx, TicketMac *hctx,
+ *                           int enc);
+ *          bool macInit(TicketMac *hctx, const unsigned char *hmac_key);
+ *          void keysWatchStart(struct SslTicketKeys *tkeys);
+ *          void keysWatchStop(struct SslTicketKeys *tkeys);
+ *          void* keysWatch(void *arg);
+ *          void keysRefresh(struct SslTicketKeys *tkeys);
+ *          int  keysRotate(const char *path, int keep, long max_age);
+ *          int  keysRead(const char *path, TicketKey *keys, int max);
+ *          int  keysWrite(const char *path, const TicketKey *keys, int nkeys);
+ *  DESCRIPTION
+ *      The MySSL library is a simple interface to OpenSSL library to permits user-friendly writing of Servers and
+ *      Clients using OpenSSL.
+ *  NOTES
+ *      - The free software library "OpenSSL" is distributed under a "dual licensed" system: under the OpenSSL License
+ *        and the SSLeay License. The OpenSSL License is Apache License 1.0 and SSLeay License bears some similarity to
+ *        a 4-clause BSD License. Both licenses apply.
+ *      - The library "OpenSSL" reference version is 1.0.2g
+ *      - The keys file contains the keys in binary format (newest first) and it's shared only between the processes of
+ *        the same host: to use a shared memory segment just use a file in /dev/shm (the POSIX shared memory of Linux).
+ *      - The keys file is checked by a thread of the context (every SSL_TICKET_CHECK seconds), that rotates the keys
+ *        and reloads them, then publishes them under the keys lock: the ticket callback never does file I/O and holds
+ *        the lock only as reader. A process forked after the creation of the context starts its own thread at the
+ *        first ticket.
+ *      - The ticket keys of the live contexts are linked in a list: sslTicketCleanup() (from sslCleanup()) stops and
+ *        joins their threads also when the contexts are still referenced by the application.
+ *  AUTHOR
+ *      Aldo Abate
+ *  OPERATING SYSTEM
+ *      Linux (kernel 2.6 and above - glibc 2.3.2 and above)
+ *  COMPILER
+ *      GNU GCC (ver. 4.4 and above)
+ *  RELEASE
+ *      0.1.0 (August 2019)
+ */
+
+#include "myssl.h"
+#include "myssl-private.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <openssl/rand.h>
+#include <openssl/evp.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/core_names.h>
+typedef EVP_MAC_CTX TicketMac;      // HMAC context of the ticket callback (OpenSSL 3.0)
+#else
+#include <openssl/hmac.h>
+typedef HMAC_CTX    TicketMac;      // HMAC context of the ticket callback (OpenSSL 1.0.2/1.1)
+#endif
+
+// ticket key (record of the keys file)
+typedef struct {
+    unsigned char name[16];         // key name (sent in the ticket)
+    unsigned char aes_key[32];      // AES-256 encryption key
+    unsigned char hmac_key[32];     // HMAC-SHA256 key
+    int64_t       created;          // creation time
+} TicketKey;
+
+// shared ticket keys of a context
+struct SslTicketKeys {
+    char             *path;                         // keys file
+    long             rotate;                        // rotation interval (seconds, 0 = no rotation)
+    int              keep;                          // number of previous keys kept at the rotation
+    pthread_rwlock_t lock;                          // keys lock
+    TicketKey        keys[SSL_TICKET_KEYS_MAX];     // loaded keys (newest first)
+    int              nkeys;                         // number of loaded keys
+    struct timespec  mtime;                         // modification time of the loaded file
+    ino_t            ino;                           // inode of the loaded file
+    pthread_mutex_t  mutex;                         // lock of the thread data
+    pthread_cond_t   cond;                          // stop request of the thread
+    pthread_t        tid;                           // thread checking the keys file
+    atomic_int       pid;                           // process of the running thread (0 = not started)
+    bool             stop;                          // stop request (sslTicketKeysFree()/sslTicketCleanup())
+    struct SslTicketKeys *prev, *next;              // list of the ticket keys of the live contexts
+};
+
+// local prototypes
+static int  ticketKeyCb(SSL *ssl, unsigned char *name, unsigned char *iv, EVP_CIPHER_CTX *cctx, TicketMac *hctx,
+                        int enc);
+static bool macInit(TicketMac *hctx, const unsigned char *hmac_key);
+static void keysWatchStart(struct SslTicketKeys *tkeys);
+static void keysWatchStop(struct SslTicketKeys *tkeys);
+static void* keysWatch(void *arg);
+static void keysRefresh(struct SslTicketKeys *tkeys);
+static int  keysRotate(const char *path, int keep, long max_age);
+static int  keysRead(const char *path, TicketKey *keys, int max);
+static int  keysWrite(const char *path, const TicketKey *keys, int nkeys);
+
+// local data
+static struct SslTicketKeys *tkeys_list  = NULL;                        // ticket keys of the live contexts
+static pthread_mutex_t      tkeys_mutex = PTHREAD_MUTEX_INITIALIZER;    // list lock
+
+
+////////////////////////////////////////////////////////////////////////////////
+// GLOBAL functions
+////////////////////////////////////////////////////////////////////////////////
+
+
+/*!
+ *  NAME
+ *      sslTicketKeysRotate - rotate the ticket keys of a keys file
+ *  SYNOPSIS
+ *      int sslTicketKeysRotate(
+ *          const char *path,       // keys file
+ *          int        keep);       // number of previous keys to keep (0 = SSL_TICKET_KEEP)
+ *  DESCRIPTION
+ *      sslTicketKeysRotate() adds a new ticket key to a keys file (created if needed) keeping the previous keep keys.
+ *      The new key is used to encrypt the new tickets, the previous keys are still accepted to decrypt the tickets. The
+ *      processes that share the keys file pick up the new key without restarting. It can be used by a deploy tool
+ *      instead of (or together with) the automatic rotation of the ticket_rotate option.
+ *  RETURN VALUE
+ *      Upon successful completion, sslTicketKeysRotate() shall return the number of keys in the file.
+ *      Otherwise, -1 shall be returned.
+ */
+
+int sslTicketKeysRotate(
+    const char *path,               // keys file
+    int        keep)                // number of previous keys to keep (0 = SSL_TICKET_KEEP)
+{
+    // one-time initialization of the OpenSSL library (fails after sslCleanup())
+    if (! sslLibInit())
+        return -1;
+
+    // force the rotation (the file holds at most SSL_TICKET_KEYS_MAX keys)
+    keep = keep > 0 ? keep : SSL_TICKET_KEEP;
+    return keysRotate(path, keep < SSL_TICKET_KEYS_MAX ? keep : SSL_TICKET_KEYS_MAX - 1, 0);
+}
+
+
+/*!
+ *  NAME
+ *      sslTicketKeysInit - set the shared ticket keys of a context
+ *  SYNOPSIS
+ *      bool sslTicketKeysInit(
+ *          SSL_CTX          *ctx,  // OpenSSL context (server)
+ *          const SslCtxOpts *opts);    // context options
+ *  DESCRIPTION
+ *      sslTicketKeysInit() loads the ticket keys of the keys file (creating the file with a new key if it doesn't
+ *      exist), sets the ticket key callback of the context and starts the thread that checks the keys file. The
+ *      previous keys kept at the rotation are at most SSL_TICKET_KEYS_MAX - 1.
+ *  RETURN VALUE
+ *      Upon successful completion, sslTicketKeysInit() shall return true. Otherwise, false shall be returned.
+ */
+
+bool sslTicketKeysInit(
+    SSL_CTX          *ctx,          // OpenSSL context (server)
+    const SslCtxOpts *opts)         // context options
+{
+    // get the context private data
+    SslCtxData *ctxdata;
+    if ((ctxdata = sslCtxData(ctx)) == NULL)
+        return false;
+
+    // allocate the keys
+    struct SslTicketKeys *tkeys;
+    if ((tkeys = calloc(1, sizeof(struct SslTicketKeys))) == NULL)
+        return false;
+
+    if ((tkeys->path = strdup(opts->ticket_keys)) == NULL) {
+        free(tkeys);
+        return false;
+    }
+
+    pthread_condattr_t attr;
+    tkeys->rotate = opts->ticket_rotate;
+    tkeys->keep   = opts->ticket_keep > 0 ? opts->ticket_keep : SSL_TICKET_KEEP;
+    if (tkeys->keep >= SSL_TICKET_KEYS_MAX)
+        tkeys->keep = SSL_TICKET_KEYS_MAX - 1;
+
+    pthread_rwlock_init(&tkeys->lock, NULL);
+    pthread_mutex_init(&tkeys->mutex, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&tkeys->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    atomic_init(&tkeys->pid, 0);
+    ctxdata->tkeys = tkeys;     // freed with the context
+
+    // link the keys in the list of the live contexts (see sslTicketCleanup())
+    pthread_mutex_lock(&tkeys_mutex);
+    if ((tkeys->next = tkeys_list) != NULL)
+        tkeys_list->prev = tkeys;
+
+    tkeys_list = tkeys;
+    pthread_mutex_unlock(&tkeys_mutex);
+
+    // create the keys file (if needed) and load the keys (the thread is not running yet)
+    if (keysRotate(tkeys->path, tkeys->keep, -1) < 0)
+        return false;
+
+    keysRefresh(tkeys);
+    if (tkeys->nkeys == 0)
+        return false;
+
+    // set the ticket key callback
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    if (SSL_CTX_set_tlsext_ticket_key_evp_cb(ctx, ticketKeyCb) != 1)
+        return false;
+#else
+    if (SSL_CTX_set_tlsext_ticket_key_cb(ctx, ticketKeyCb) != 1)
+        return false;
+#endif
+
+    // start the thread that checks the keys file
+    keysWatchStart(tkeys);
+    return true;
+}
+
+
+/*!
+ *  NAME
+ *      sslTicketKeysFree - free the shared ticket keys of a context
+ *  SYNOPSIS
+ *      void sslTicketKeysFree(
+ *          struct SslTicketKeys *tkeys);   // ticket keys (may be NULL)
+ *  DESCRIPTION
+ *      sslTicketKeysFree() stops the thread that checks the keys file and frees the ticket keys (called when the context
+ *      is freed).
+ *  RETURN VALUE
+ *      None.
+ */
+
+void sslTicketKeysFree(
+    struct SslTicketKeys *tkeys)    // ticket keys (may be NULL)
+{
+    if (tkeys == NULL)
+        return;
+
+    // unlink the keys from the list (a running sslTicketCleanup() is waited) and stop the thread
+    pthread_mutex_lock(&tkeys_mutex);
+    if (tkeys->prev)
+        tkeys->prev->next = tkeys->next;
+    else
+        tkeys_list = tkeys->next;
+
+    if (tkeys->next)
+        tkeys->next->prev = tkeys->prev;
+
+    pthread_mutex_unlock(&tkeys_mutex);
+    keysWatchStop(tkeys);
+
+    // clear the keys and free the memory
+    pthread_cond_destroy(&tkeys->cond);
+    pthread_mutex_destroy(&tkeys->mutex);
+    pthread_rwlock_destroy(&tkeys->lock);
+    OPENSSL_cleanse(tkeys->keys, sizeof(tkeys->keys));
+    free(tkeys->path);
+    free(tkeys);
+}
+
+
+/*!
+ *  NAME
+ *      sslTicketCleanup - stop the threads of the ticket keys
+ *  SYNOPSIS
+ *      void sslTicketCleanup(void);
+ *  DESCRIPTION
+ *      sslTicketCleanup() stops and joins the threads that check the keys files of all the live contexts (called by
+ *      sslCleanup(): a context can outlive the registry when the application still holds a reference). The keys
+ *      already loaded stay valid until the contexts are freed, but they are no more rotated or reloaded.
+ *  RETURN VALUE
+ *      None.
+ */
+
+void sslTicketCleanup(void)
+{
+    pthread_mutex_lock(&tkeys_mutex);
+    for (struct SslTicketKeys *tkeys = tkeys_list; tkeys; tkeys = tkeys->next)
+        keysWatchStop(tkeys);
+
+    pthread_mutex_unlock(&tkeys_mutex);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// LOCAL functions
+////////////////////////////////////////////////////////////////////////////////
+
+
+/*!
+ *  NAME
+ *      ticketKeyCb - ticket key callback
+ *  SYNOPSIS
+ *      int ticketKeyCb(
+ *          SSL            *ssl,    // OpenSSL SSL structure
+ *          unsigned char  *name,   // key name (16 bytes)
+ *          unsigned char  *iv,     // initialization vector
+ *          EVP_CIPHER_CTX *cctx,   // cipher context
+ *          TicketMac      *hctx,   // HMAC context
+ *          int            enc);    // 1 = encrypt a new ticket, 0 = decrypt a ticket
+ *  DESCRIPTION
+ *      ticketKeyCb() is the ticket key callback of the contexts with shared ticket keys: the new tickets are encrypted
+ *      with the newest key, the received tickets are decrypted with the key named in the ticket (if still accepted).
+ *      The keys are picked up and rotated by the thread of the context (see keysWatch()): the callback only reads
+ *      them, under the keys lock as reader.
+ *  RETURN VALUE
+ *      Encrypt: 1 if the ticket can be encrypted, -1 on error.
+ *      Decrypt: 1 if the key is the newest, 2 if it's an old key or the protocol is TLS 1.3 (the ticket is renewed), 0 if
+ *      the key is not found (full handshake), -1 on error.
+ */
+
+static int ticketKeyCb(
+    SSL            *ssl,            // OpenSSL SSL structure
+    unsigned char  *name,           // key name (16 bytes)
+    unsigned char  *iv,             // initialization vector
+    EVP_CIPHER_CTX *cctx,           // cipher context
+    TicketMac      *hctx,           // HMAC context
+    int            enc)             // 1 = encrypt a new ticket, 0 = decrypt a ticket
+{
+    // get the keys of the context
+    SslCtxData *ctxdata = sslCtxData(SSL_get_SSL_CTX(ssl));
+    struct SslTicketKeys *tkeys;
+    if (ctxdata == NULL || (tkeys = ctxdata->tkeys) == NULL)
+        return -1;
+
+    // a process forked after the creation of the context starts its own thread checking the keys file
+    if (atomic_load_explicit(&tkeys->pid, memory_order_relaxed) != getpid())
+        keysWatchStart(tkeys);
+
+    // the TLS 1.3 clients use a ticket only once: a new ticket is always required
+#ifdef TLS1_3_VERSION
+    bool tls13 = SSL_version(ssl) >= TLS1_3_VERSION;
+#else
+    bool tls13 = false;
+#endif
+
+    int result = -1;
+    pthread_rwlock_rdlock(&tkeys->lock);
+    if (enc) {
+        // encrypt: use the newest key with a random IV
+        const TicketKey *key = &tkeys->keys[0];
+        if (tkeys->nkeys > 0 && RAND_bytes(iv, EVP_MAX_IV_LENGTH) == 1 &&
+                EVP_EncryptInit_ex(cctx, EVP_aes_256_cbc(), NULL, key->aes_key, iv) == 1 && macInit(hctx, key->hmac_key)) {
+            memcpy(name, key->name, sizeof(key->name));
+            result = 1;
+        }
+    }
+    else {
+        // decrypt: search the key named in the ticket
+        result = 0;
+        for (int i = 0; i < tkeys->nkeys; i++) {
+            const TicketKey *key = &tkeys->keys[i];
+            if (memcmp(name, key->name, sizeof(key->name)) == 0) {
+                if (EVP_DecryptInit_ex(cctx, EVP_aes_256_cbc(), NULL, key->aes_key, iv) == 1 &&
+                        macInit(hctx, key->hmac_key))
+                    result = i == 0 && ! tls13 ? 1 : 2;     // old key (or TLS 1.3 single-use ticket): renew the ticket
+                else
+                    result = -1;
+
+                break;
+            }
+        }
+    }
+
+    pthread_rwlock_unlock(&tkeys->lock);
+    return result;
+}
+
+
+/*!
+ *  NAME
+ *      macInit - initialize the HMAC context of a ticket
+ *  SYNOPSIS
+ *      bool macInit(
+ *          TicketMac           *hctx,      // HMAC context
+ *          const unsigned char *hmac_key); // HMAC-SHA256 key (32 bytes)
+ *  DESCRIPTION
+ *      macInit() initialize the HMAC-SHA256 context used to authenticate a ticket.
+ *  RETURN VALUE
+ *      Upon successful completion, macInit() shall return true. Otherwise, false shall be returned.
+ */
+
+static bool macInit(
+    TicketMac           *hctx,      // HMAC context
+    const unsigned char *hmac_key)  // HMAC-SHA256 key (32 bytes)
+{
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    // set the key and the digest of the MAC
+    OSSL_PARAM params[3];
+    params[0] = OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY, (void *)hmac_key, 32);
+    params[1] = OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, "SHA256", 0);
+    params[2] = OSSL_PARAM_construct_end();
+    return EVP_MAC_CTX_set_params(hctx, params) == 1;
+#else
+    // set the key and the digest of the HMAC
+    return HMAC_Init_ex(hctx, hmac_key, 32, EVP_sha256(), NULL) == 1;
+#endif
+}
+
+
+/*!
+ *  NAME
+ *      keysWatchStart - start the thread that checks the keys file
+ *  SYNOPSIS
+ *      void keysWatchStart(
+ *          struct SslTicketKeys *tkeys);   // ticket keys
+ *  DESCRIPTION
+ *      keysWatchStart() starts the thread that checks the keys file (see keysWatch()), if not already running in this
+ *      process: at the creation of the context and at the first ticket of a process forked after it. If the thread
+ *      can't be created the loaded keys stay in use (the start is tried again at the next ticket).
+ *  RETURN VALUE
+ *      None.
+ */
+
+static void keysWatchStart(
+    struct SslTicketKeys *tkeys)    // ticket keys
+{
+    pthread_mutex_lock(&tkeys->mutex);
+    int pid = getpid();
+    if (atomic_load(&tkeys->pid) != pid && ! tkeys->stop && pthread_create(&tkeys->tid, NULL, keysWatch, tkeys) == 0)
+        atomic_store(&tkeys->pid, pid);
+
+    pthread_mutex_unlock(&tkeys->mutex);
+}
+
+
+/*!
+ *  NAME
+ *      keysWatchStop - stop the thread that checks the keys file
+ *  SYNOPSIS
+ *      void keysWatchStop(
+ *          struct SslTicketKeys *tkeys);   // ticket keys
+ *  DESCRIPTION
+ *      keysWatchStop() sends the stop request to the thread that checks the keys file and joins it, if started by this
+ *      process (the thread of the parent doesn't exist in a forked process). The thread is never started again.
+ *  RETURN VALUE
+ *      None.
+ */
+
+static void keysWatchStop(
+    struct SslTicketKeys *tkeys)    // ticket keys
+{
+    pthread_mutex_lock(&tkeys->mutex);
+    bool join = ! tkeys->stop && atomic_load(&tkeys->pid) == getpid();     // joined only once
+    tkeys->stop = true;
+    pthread_cond_signal(&tkeys->cond);
+    pthread_mutex_unlock(&tkeys->mutex);
+    if (join)
+        pthread_join(tkeys->tid, NULL);
+}
+
+
+/*!
+ *  NAME
+ *      keysWatch - thread that checks the keys file
+ *  SYNOPSIS
+ *      void* keysWatch(
+ *          void *arg);             // ticket keys
+ *  DESCRIPTION
+ *      keysWatch() checks the keys file every SSL_TICKET_CHECK seconds (see keysRefresh()) until the stop request of
+ *      sslTicketKeysFree().
+ *  RETURN VALUE
+ *      keysWatch() shall return NULL.
+ */
+
+static void* keysWatch(
+    void *arg)                      // ticket keys
+{
+    struct SslTicketKeys *tkeys = arg;
+    pthread_mutex_lock(&tkeys->mutex);
+    while (! tkeys->stop) {
+        // wait the check interval (or the stop request)
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        ts.tv_sec += SSL_TICKET_CHECK;
+        while (! tkeys->stop && pthread_cond_timedwait(&tkeys->cond, &tkeys->mutex, &ts) != ETIMEDOUT)
+            ;
+
+        // check the keys file (without the lock: the stop request doesn't wait the file I/O)
+        if (! tkeys->stop) {
+            pthread_mutex_unlock(&tkeys->mutex);
+            keysRefresh(tkeys);
+            pthread_mutex_lock(&tkeys->mutex);
+        }
+    }
+
+    pthread_mutex_unlock(&tkeys->mutex);
+    return NULL;
+}
+
+
+/*!
+ *  NAME
+ *      keysRefresh - pick up the new ticket keys
+ *  SYNOPSIS
+ *      void keysRefresh(
+ *          struct SslTicketKeys *tkeys);   // ticket keys
+ *  DESCRIPTION
+ *      keysRefresh() checks the keys file: if the rotation interval is elapsed the keys are rotated (only one of the
+ *      processes sharing the file does it), then if the file is changed the keys are reloaded and published under the
+ *      keys lock. It's called only by the thread of the context (and by sslTicketKeysInit() before starting it): the
+ *      keys are modified only here, so they are read without the lock.
+ *  RETURN VALUE
+ *      None.
+ */
+
+static void keysRefresh(
+    struct SslTicketKeys *tkeys)    // ticket keys
+{
+    // rotate the keys if the newest key is too old
+    time_t now = time(NULL);
+    if (tkeys->rotate > 0 && tkeys->nkeys > 0 && now - tkeys->keys[0].created >= tkeys->rotate)
+        keysRotate(tkeys->path, tkeys->keep, tkeys->rotate);
+
+    // reload the keys if the file is changed (a new file replaces the old one at every rotation)
+    struct stat st;
+    if (stat(tkeys->path, &st) == 0 && (st.st_ino != tkeys->ino || st.st_mtim.tv_sec != tkeys->mtime.tv_sec ||
+                                        st.st_mtim.tv_nsec != tkeys->mtime.tv_nsec)) {
+        TicketKey keys[SSL_TICKET_KEYS_MAX];
+        int nkeys;
+        if ((nkeys = keysRead(tkeys->path, keys, SSL_TICKET_KEYS_MAX)) > 0) {
+            // publish the new keys
+            pthread_rwlock_wrlock(&tkeys->lock);
+            memcpy(tkeys->keys, keys, nkeys * sizeof(TicketKey));
+            tkeys->nkeys = nkeys;
+            pthread_rwlock_unlock(&tkeys->lock);
+            tkeys->ino   = st.st_ino;
+            tkeys->mtime = st.st_mtim;
+        }
+
+        OPENSSL_cleanse(keys, sizeof(keys));
+    }
+}
+
+
+/*!
+ *  NAME
+ *      keysRotate - rotate the keys of a keys file
+ *  SYNOPSIS
+ *      int keysRotate(
+ *          const char *path,       // keys file
+ *          int        keep,        // number of previous keys to keep
+ *          long       max_age);    // max age of the newest key (seconds, 0 = always rotate, -1 = only if empty)
+ *  DESCRIPTION
+ *      keysRotate() adds a new random key to the keys file if the file is empty or the newest key is older than max_age
+ *      (the test is repeated with the file locked, so only one of the processes sharing the file does the rotation).
+ *      The file is replaced atomically (write of a temporary file + rename()).
+ *  RETURN VALUE
+ *      Upon successful completion, keysRotate() shall return the number of keys in the file.
+ *      Otherwise, -1 shall be returned.
+ */
+
+static int keysRotate(
+    const char *path,               // keys file
+    int        keep,                // number of previous keys to keep
+    long       max_age)             // max age of the newest key (seconds, 0 = always rotate, -1 = only if empty)
+{
+    // lock the keys file (using a lock file: the keys file is replaced at every rotation)
+    char lock_path[FILENAME_MAX + 8];
+    snprintf(lock_path, sizeof(lock_path), "%s.lock", path);
+    int lock_fd;
+    if ((lock_fd = open(lock_path, O_RDWR | O_CREAT | O_CLOEXEC, 0600)) < 0)
+        return -1;
+
+    if (flock(lock_fd, LOCK_EX) < 0) {
+        close(lock_fd);
+        return -1;
+    }
+
+    // read the current keys and test if the rotation is required
+    TicketKey keys[SSL_TICKET_KEYS_MAX];
+    int nkeys = keysRead(path, keys + 1, SSL_TICKET_KEYS_MAX - 1);
+    if (nkeys < 0)
+        nkeys = 0;
+
+    int result = nkeys;
+    time_t now = time(NULL);
+    if (nkeys == 0 || (max_age >= 0 && now - keys[1].created >= max_age)) {
+        // create a new key (the first of the file)
+        if (RAND_bytes(keys[0].name, sizeof(keys[0].name)) == 1 &&
+                RAND_bytes(keys[0].aes_key, sizeof(keys[0].aes_key)) == 1 &&
+                RAND_bytes(keys[0].hmac_key, sizeof(keys[0].hmac_key)) == 1) {
+            keys[0].created = now;
+            nkeys = nkeys + 1 < keep + 1 ? nkeys + 1 : keep + 1;
+            result = keysWrite(path, keys, nkeys) == 0 ? nkeys : -1;
+        }
+        else
+            result = -1;
+    }
+
+    // clear the keys and unlock the file
+    OPENSSL_cleanse(keys, sizeof(keys));
+    flock(lock_fd, LOCK_UN);
+    close(lock_fd);
+    return result;
+}
+
+
+/*!
+ *  NAME
+ *      keysRead - read the keys of a keys file
+ *  SYNOPSIS
+ *      int keysRead(
+ *          const char *path,       // keys file
+ *          TicketKey  *keys,       // keys read
+ *          int        max);        // max number of keys to read
+ *  DESCRIPTION
+ *      keysRead() reads the keys (newest first) of a keys file.
+ *  RETURN VALUE
+ *      Upon successful completion, keysRead() shall return the number of keys read (0 if the file doesn't exist).
+ *      Otherwise, -1 shall be returned.
+ */
+
+static int keysRead(
+    const char *path,               // keys file
+    TicketKey  *keys,               // keys read
+    int        max)                 // max number of keys to read
+{
+    // open the keys file
+    FILE *fp;
+    if ((fp = fopen(path, "rb")) == NULL)
+        return 0;
+
+    // read the keys
+    int nkeys = fread(keys, sizeof(TicketKey), max, fp);
+    int result = ferror(fp) ? -1 : nkeys;
+    fclose(fp);
+    return result;
+}
+
+
+/*!
+ *  NAME
+ *      keysWrite - write the keys of a keys file
+ *  SYNOPSIS
+ *      int keysWrite(
+ *          const char      *path,  // keys file
+ *          const TicketKey *keys,  // keys to write
+ *          int             nkeys); // number of keys to write
+ *  DESCRIPTION
+ *      keysWrite() writes the keys in a temporary file that replaces atomically the keys file (the other processes read
+ *      always a complete file).
+ *  RETURN VALUE
+ *      Upon successful completion, keysWrite() shall return 0. Otherwise, -1 shall be returned.
+ */
+
+static int keysWrite(
+    const char      *path,          // keys file
+    const TicketKey *keys,          // keys to write
+    int             nkeys)          // number of keys to write
+{
+    // create the temporary file (readable only by the owner)
+    char tmp_path[FILENAME_MAX + 32];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%d.tmp", path, (int)getpid());
+    int fd;
+    if ((fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600)) < 0)
+        return -1;
+
+    // write the keys and replace the keys file
+    ssize_t size = nkeys * sizeof(TicketKey);
+    bool    ok   = write(fd, keys, size) == size && fsync(fd) == 0;
+    if (close(fd) < 0 || ! ok) {
+        // write error
+        unlink(tmp_path);
+        return -1;
+    }
+
+    if (rename(tmp_path, path) < 0) {
+        // rename error
+        unlink(tmp_path);
+        return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,283 @@
+/*
+ * Copyright © 2019 Aldo Abate <aldo.abate99@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+
+
+/*!
+ *  FILE
+ *      ssltimeout.c - operations timeouts and connection status for MySSL library
+ *  PROJECT
+ *      MySSL library
+ *  FUNCTIONS
+ *      global:
+ *          int     sslSetTimeout(SSL *ssl, int timeout);
+ *          int     sslStatus(SSL *ssl);
+ *          void    sslStatusSet(SSL *ssl, int status);
+ *          int64_t sslDeadline(SSL *ssl, int timeout);
+ *          int     sslPoll(struct pollfd *fds, int nfds, int64_t deadline);
+ *          int64_t sslClockNs(void);
+ *      local:
+ *          void    fdNonBlock(int fd);
+ *  DESCRIPTION
+ *      The MySSL library is a simple interface to OpenSSL library to permits user-friendly writing of Servers and
+ *      Clients using OpenSSL.
+ *  NOTES
+ *      - The free software library "OpenSSL" is distributed under a "dual licensed" system: under the OpenSSL License
+ *        and the SSLeay License. The OpenSSL License is Apache License 1.0 and SSLeay License bears some similarity to
+ *        a 4-clause BSD License. Both licenses apply.
+ *      - The library "OpenSSL" reference version is 1.0.2g
+ *      - Every blocking operation computes a single deadline (CLOCK_MONOTONIC) when it starts and all its waits use
+ *        the time left, so the total timeout doesn't depend on the number of waits. The waits use ppoll(), that works
+ *        with any fd value (select() is limited to FD_SETSIZE).
+ *      - The socket of a connection is switched to non-blocking mode by the first operation: the OpenSSL functions
+ *        never sleep in the kernel and all the waits are made (with the deadline) by the MySSL functions. The flag
+ *        is not restored (sslClose() closes the socket): see the note on O_NONBLOCK in myssl.h.
+ *      - Without sslSetTimeout() the connection timeout is the one of the context (SslCtxOpts io_timeout, default
+ *        SSL_TIMEOUT_DEFAULT), so a silent peer can't block a thread forever unless SSL_TIMEOUT_INFINITE is chosen.
+ *  AUTHOR
+ *      Aldo Abate
+ *  OPERATING SYSTEM
+ *      Linux (kernel 2.6 and above - glibc 2.3.2 and above)
+ *  COMPILER
+ *      GNU GCC (ver. 4.4 and above)
+ *  RELEASE
+ *      0.1.0 (August 2019)
+ */
+
+#define _GNU_SOURCE     // ppoll()
+#include "myssl.h"
+#include "myssl-private.h"
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+
+// local prototypes
+static void fdNonBlock(int fd);
+
+
+////////////////////////////////////////////////////////////////////////////////
+// GLOBAL functions
+////////////////////////////////////////////////////////////////////////////////
+
+
+/*!
+ *  NAME
+ *      sslSetTimeout - set the operations timeout of a connection
+ *  SYNOPSIS
+ *      int sslSetTimeout(
+ *          SSL *ssl,               // OpenSSL SSL structure
+ *          int timeout);           // timeout in ms (SSL_TIMEOUT_INFINITE = no timeout)
+ *  DESCRIPTION
+ *      sslSetTimeout() set the timeout used by the blocking operations of the connection (sslRead(), sslWrite(),
+ *      sslFunc(), ... and the Ex functions called with SSL_TIMEOUT_CONN). The timeout is the max duration of a whole
+ *      operation, not of a single wait. By default a connection uses the timeout of its context (SslCtxOpts
+ *      io_timeout, SSL_TIMEOUT_DEFAULT if not set): a connection that must wait without limits (e.g.: an interactive
+ *      session) has to set SSL_TIMEOUT_INFINITE explicitly, here or in the options of the context.
+ *  RETURN VALUE
+ *      Upon successful completion, sslSetTimeout() shall return 0.
+ *      Otherwise (invalid timeout or allocation error), -1 shall be returned.
+ */
+
+int sslSetTimeout(
+    SSL *ssl,                       // OpenSSL SSL structure
+    int timeout)                    // timeout in ms (SSL_TIMEOUT_INFINITE = no timeout)
+{
+    // test the timeout and set it in the private data of the connection
+    SslConnData *conn;
+    if (timeout < SSL_TIMEOUT_INFINITE || (conn = sslConnData(ssl)) == NULL)
+        return -1;
+
+    conn->timeout     = timeout;
+    conn->timeout_set = true;
+    return 0;
+}
+
+
+/*!
+ *  NAME
+ *      sslStatus - get the status of the last operation of a connection
+ *  SYNOPSIS
+ *      int sslStatus(
+ *          SSL *ssl);              // OpenSSL SSL structure
+ *  DESCRIPTION
+ *      sslStatus() get the status of the last blocking operation of the connection: it tells apart the failures of
+ *      sslRead()/sslWrite()/sslFunc()/... (that just return a value <= 0).
+ *  RETURN VALUE
+ *      SSL_STATUS_OK       the operation completed
+ *      SSL_STATUS_TIMEOUT  the timeout elapsed (the connection can be used again)
+ *      SSL_STATUS_CLOSED   the peer closed the connection
+ *      SSL_STATUS_FATAL    protocol or system error (analyze it with SSL_get_error()/ERR_get_error()/errno)
+ */
+
+int sslStatus(
+    SSL *ssl)                       // OpenSSL SSL structure
+{
+    // get the status from the private data of the connection
+    SslConnData *conn = sslConnData(ssl);
+    return conn ? conn->status : SSL_STATUS_FATAL;
+}
+
+
+/*!
+ *  NAME
+ *      sslStatusSet - set the status of the last operation of a connection
+ *  SYNOPSIS
+ *      void sslStatusSet(
+ *          SSL *ssl,               // OpenSSL SSL structure
+ *          int status);            // status: SSL_STATUS_OK/SSL_STATUS_TIMEOUT/SSL_STATUS_CLOSED/SSL_STATUS_FATAL
+ *  DESCRIPTION
+ *      sslStatusSet() set the status returned by sslStatus().
+ *  RETURN VALUE
+ *      None.
+ */
+
+void sslStatusSet(
+    SSL *ssl,                       // OpenSSL SSL structure
+    int status)                     // status: SSL_STATUS_OK/SSL_STATUS_TIMEOUT/SSL_STATUS_CLOSED/SSL_STATUS_FATAL
+{
+    // set the status in the private data of the connection
+    SslConnData *conn;
+    if ((conn = sslConnData(ssl)) != NULL)
+        conn->status = status;
+}
+
+
+/*!
+ *  NAME
+ *      sslDeadline - compute the deadline of an operation
+ *  SYNOPSIS
+ *      int64_t sslDeadline(
+ *          SSL *ssl,               // OpenSSL SSL structure
+ *          int timeout);           // timeout in ms (SSL_TIMEOUT_INFINITE, SSL_TIMEOUT_CONN = connection timeout)
+ *  DESCRIPTION
+ *      sslDeadline() compute the absolute deadline (CLOCK_MONOTONIC) of an operation starting now. On the first call
+ *      for a connection the socket is switched to non-blocking mode (see NOTES).
+ *  RETURN VALUE
+ *      sslDeadline() shall return the deadline in ns, or -1 if the operation has no timeout.
+ */
+
+int64_t sslDeadline(
+    SSL *ssl,                       // OpenSSL SSL structure
+    int timeout)                    // timeout in ms (SSL_TIMEOUT_INFINITE, SSL_TIMEOUT_CONN = connection timeout)
+{
+    // first operation of the connection: set the socket non-blocking
+    SslConnData *conn = sslConnData(ssl);
+    if (conn && ! conn->nonblock) {
+        fdNonBlock(SSL_get_rfd(ssl));
+        if (SSL_get_wfd(ssl) != SSL_get_rfd(ssl))
+            fdNonBlock(SSL_get_wfd(ssl));
+
+        conn->nonblock = true;
+    }
+
+    // get the connection timeout
+    if (timeout == SSL_TIMEOUT_CONN) {
+        SslCtxData *ctxdata;
+        if (conn && conn->timeout_set)
+            timeout = conn->timeout;
+        else if ((ctxdata = sslCtxDataFind(SSL_get_SSL_CTX(ssl))) != NULL && ctxdata->io_timeout != 0)
+            timeout = ctxdata->io_timeout;
+        else
+            timeout = SSL_TIMEOUT_DEFAULT;
+    }
+
+    // compute the deadline
+    return timeout < 0 ? -1 : sslClockNs() + (int64_t)timeout * 1000000;
+}
+
+
+/*!
+ *  NAME
+ *      sslPoll - wait for the events of a set of fds until a deadline
+ *  SYNOPSIS
+ *      int sslPoll(
+ *          struct pollfd *fds,     // fds and events (see poll())
+ *          int           nfds,     // number of fds
+ *          int64_t       deadline);    // deadline in ns (see sslDeadline(), -1 = no deadline)
+ *  DESCRIPTION
+ *      sslPoll() execute a ppoll() with the time left to the deadline (at least a check of the fds is done also when
+ *      the deadline is elapsed) and restart it if interrupted by a signal.
+ *  RETURN VALUE
+ *      sslPoll() shall return the number of ready fds, 0 if the deadline is elapsed, -1 on error.
+ */
+
+int sslPoll(
+    struct pollfd *fds,             // fds and events (see poll())
+    int           nfds,             // number of fds
+    int64_t       deadline)         // deadline in ns (see sslDeadline(), -1 = no deadline)
+{
+    for (;;) {
+        // time left
+        struct timespec tout, *ptout = NULL;
+        if (deadline >= 0) {
+            int64_t left = deadline - sslClockNs();
+            if (left < 0)
+                left = 0;
+
+            tout.tv_sec  = left / 1000000000;
+            tout.tv_nsec = left % 1000000000;
+            ptout        = &tout;
+        }
+
+        // wait the events (restart if interrupted)
+        int result;
+        if ((result = ppoll(fds, nfds, ptout, NULL)) >= 0 || errno != EINTR)
+            return result;
+    }
+}
+
+
+/*!
+ *  NAME
+ *      sslClockNs - get the monotonic time
+ *  SYNOPSIS
+ *      int64_t sslClockNs(void);
+ *  DESCRIPTION
+ *      sslClockNs() get the time of CLOCK_MONOTONIC (not affected by the system time changes).
+ *  RETURN VALUE
+ *      sslClockNs() shall return the time in ns.
+ */
+
+int64_t sslClockNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// LOCAL functions
+////////////////////////////////////////////////////////////////////////////////
+
+
+/*!
+ *  NAME
+ *      fdNonBlock - set a file descriptor in non-blocking mode
+ *  SYNOPSIS
+ *      void fdNonBlock(
+ *          int fd);                // file descriptor (< 0 = none)
+ *  DESCRIPTION
+ *      fdNonBlock() set the O_NONBLOCK flag of a file descriptor.
+ *  RETURN VALUE
+ *      None.
+ */
+
+static void fdNonBlock(
+    int fd)                         // file descriptor (< 0 = none)
+{
+    int flags;
+    if (fd >= 0 && (flags = fcntl(fd, F_GETFL)) >= 0 && ! (flags & O_NONBLOCK))
+        fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
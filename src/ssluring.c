@@ -0,0 +1,986 @@
+/*
+ * Copyright © 2019 Aldo Abate <aldo.abate99@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+
+
+/*!
+ *  FILE
+ *      ssluring.c - io_uring ring and BIO of the reactor io_uring backend for MySSL library
+ *  PROJECT
+ *      MySSL library
+ *  FUNCTIONS
+ *      global:
+ *          SslUring*     sslUringNew(int nslots);
+ *          void          sslUringFree(SslUring *ring);
+ *          bool          sslUringSlotGet(SslUring *ring, SslUringIo *io);
+ *          void          sslUringSlotPut(SslUring *ring, SslUringIo *io);
+ *          BIO*          sslUringBio(SslUringIo *io);
+ *          bool          sslUringRecv(SslUring *ring, int fd, SslUringIo *io, void *owner);
+ *          bool          sslUringSend(SslUring *ring, int fd, SslUringIo *io, void *owner);
+ *          bool          sslUringPoll(SslUring *ring, int fd, void *owner);
+ *          bool          sslUringCancel(SslUring *ring, void *owner, int op);
+ *          int           sslUringWait(SslUring *ring, int64_t deadline);
+ *          bool          sslUringReap(SslUring *ring, void **owner, int *op, int *res);
+ *          void          sslUringDone(SslUringIo *io, int op, int res);
+ *          unsigned long sslUringSyscalls(SslUring *ring);
+ *      local:
+ *          struct io_uring_sqe* ringSqe(SslUring *ring);
+ *          int                  ringEnter(SslUring *ring, unsigned to_submit, unsigned min_complete, unsigned flags,
+ *                                         const void *arg, size_t argsz);
+ *          void                 bioMethodInit(void);
+ *          int                  bioRead(BIO *bio, char *buf, int len);
+ *          int                  bioWrite(BIO *bio, const char *buf, int len);
+ *          long                 bioCtrl(BIO *bio, int cmd, long num, void *ptr);
+ *          int                  bioCreate(BIO *bio);
+ *  DESCRIPTION
+ *      The MySSL library is a simple interface to OpenSSL library to permits user-friendly writing of Servers and
+ *      Clients using OpenSSL.
+ *  NOTES
+ *      - The free software library "OpenSSL" is distributed under a "dual licensed" system: under the OpenSSL License
+ *        and the SSLeay License. The OpenSSL License is Apache License 1.0 and SSLeay License bears some similarity to
+ *        a 4-clause BSD License. Both licenses apply.
+ *      - The library "OpenSSL" reference version is 1.0.2g
+ *      - The ring is used with the raw syscalls (io_uring_setup()/io_uring_enter()/io_uring_register(), no liburing)
+ *        and needs Linux 5.11 and above (IORING_FEAT_EXT_ARG and IORING_FEAT_NODROP) and OpenSSL 1.1.0 and above
+ *        (BIO_meth_new()): otherwise sslUringNew() fails and the reactor uses epoll.
+ *      - The ciphertext of a connection goes through two buffers (a slot of an area registered with
+ *        IORING_REGISTER_BUFFERS, so the kernel doesn't map the pages on each operation): the BIO of the connection
+ *        reads the received records from rx and appends the records to send to tx, the reactor queues a receive when
+ *        rx is consumed and a send when tx has data, and submits all the operations of an events batch with the
+ *        io_uring_enter() that waits the completions. If the area can't be registered (e.g.: RLIMIT_MEMLOCK) the plain
+ *        IORING_OP_RECV is used for the receives.
+ *      - The sends are always IORING_OP_SEND with MSG_NOSIGNAL (IORING_OP_WRITE_FIXED doesn't take the send flags and
+ *        a write on a socket reset by the peer would raise SIGPIPE).
+ *      - The entries are filled on a local tail and the tail of the submission queue is published to the kernel only
+ *        by ringEnter(), so the kernel never sees an entry before it's filled (e.g.: with IORING_SETUP_SQPOLL).
+ *      - A ring must be used only by the thread of its reactor.
+ *  AUTHOR
+ *      Aldo Abate
+ *  OPERATING SYSTEM
+ *      Linux (kernel 2.6 and above - glibc 2.3.2 and above)
+ *  COMPILER
+ *      GNU GCC (ver. 4.4 and above)
+ *  RELEASE
+ *      0.1.0 (August 2019)
+ */
+
+#include "myssl.h"
+#include "myssl-private.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+// io_uring available with OpenSSL 1.1.0 and above (BIO_meth_new()) and the kernel headers of Linux 5.11 and above
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#ifdef IORING_FEAT_EXT_ARG
+#define URING_SUPPORTED
+#endif
+#endif
+#endif
+
+#ifdef URING_SUPPORTED
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+
+// submission queue entries (the operations are submitted at the latest when the queue is full)
+#define RING_ENTRIES    512
+
+// io_uring ring
+struct SslUring {
+    int                 fd;             // ring fd
+    unsigned            *sq_head;       // submission queue (shared with the kernel)
+    unsigned            *sq_tail;
+    unsigned            *sq_mask;
+    unsigned            *sq_entries;
+    unsigned            *sq_array;
+    struct io_uring_sqe *sqes;          // submission queue entries
+    unsigned            *cq_head;       // completion queue (shared with the kernel)
+    unsigned            *cq_tail;
+    unsigned            *cq_mask;
+    struct io_uring_cqe *cqes;
+    void                *sq_ptr;        // mapped rings
+    size_t              sq_size;
+    void                *cq_ptr;
+    size_t              cq_size;
+    size_t              sqes_size;
+    unsigned            sq_local;       // local tail (entries filled, published to the kernel by ringEnter())
+    unsigned            to_submit;      // queued entries not yet submitted
+    unsigned char       *bufs;          // buffers area (a rx and a tx buffer per slot)
+    size_t              bufs_size;
+    bool                fixed;          // buffers area registered (IORING_OP_READ_FIXED)
+    int                 *free_slots;    // free slots stack
+    int                 nfree;
+    unsigned long       syscalls;       // io_uring_enter() calls
+};
+
+// local prototypes
+static struct io_uring_sqe* ringSqe(SslUring *ring);
+static int                  ringEnter(SslUring *ring, unsigned to_submit, unsigned min_complete, unsigned flags,
+                                      const void *arg, size_t argsz);
+static void                 bioMethodInit(void);
+static int                  bioRead(BIO *bio, char *buf, int len);
+static int                  bioWrite(BIO *bio, const char *buf, int len);
+static long                 bioCtrl(BIO *bio, int cmd, long num, void *ptr);
+static int                  bioCreate(BIO *bio);
+
+// local data: BIO method of the connections (created once, never freed)
+static pthread_once_t bio_once = PTHREAD_ONCE_INIT;
+static BIO_METHOD     *bio_meth = NULL;
+#endif
+
+
+////////////////////////////////////////////////////////////////////////////////
+// GLOBAL functions
+////////////////////////////////////////////////////////////////////////////////
+
+
+/*!
+ *  NAME
+ *      sslUringNew - create an io_uring ring
+ *  SYNOPSIS
+ *      SslUring* sslUringNew(
+ *          int nslots);            // number of buffer slots (max number of connections)
+ *  DESCRIPTION
+ *      sslUringNew() creates an io_uring ring (the completion queue holds an operation per buffer of each slot) and
+ *      the buffers area of nslots connections, and registers the area in the ring.
+ *  RETURN VALUE
+ *      Upon successful completion, sslUringNew() shall return the ring (to free with sslUringFree()).
+ *      Otherwise (io_uring not available or not supported), NULL shall be returned.
+ */
+
+SslUring* sslUringNew(
+    int nslots)                     // number of buffer slots (max number of connections)
+{
+#ifdef URING_SUPPORTED
+    // create the BIO method
+    pthread_once(&bio_once, bioMethodInit);
+    if (bio_meth == NULL || nslots <= 0)
+        return NULL;
+
+    SslUring *ring;
+    if ((ring = calloc(1, sizeof(SslUring))) == NULL)
+        return NULL;
+
+    ring->fd = -1;
+
+    // create the ring: a completion for each receive, send and poll of the connections (never dropped)
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags      = IORING_SETUP_CQSIZE;
+    params.cq_entries = nslots * 3 + RING_ENTRIES;
+    if ((ring->fd = (int)syscall(__NR_io_uring_setup, RING_ENTRIES, &params)) < 0 ||
+            (params.features & (IORING_FEAT_EXT_ARG | IORING_FEAT_NODROP)) !=
+            (IORING_FEAT_EXT_ARG | IORING_FEAT_NODROP))
+        goto error;
+
+    // map the submission and completion queues
+    ring->sq_size   = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_size   = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_size > ring->sq_size)
+            ring->sq_size = ring->cq_size;
+
+        ring->cq_size = 0;
+    }
+
+    if ((ring->sq_ptr = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+                             IORING_OFF_SQ_RING)) == MAP_FAILED) {
+        ring->sq_ptr = NULL;
+        goto error;
+    }
+
+    ring->cq_ptr = ring->sq_ptr;
+    if (ring->cq_size > 0 && (ring->cq_ptr = mmap(NULL, ring->cq_size, PROT_READ | PROT_WRITE,
+                                                  MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING)) == MAP_FAILED) {
+        ring->cq_ptr = NULL;
+        goto error;
+    }
+
+    if ((ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+                           IORING_OFF_SQES)) == MAP_FAILED) {
+        ring->sqes = NULL;
+        goto error;
+    }
+
+    unsigned char *sq = ring->sq_ptr, *cq = ring->cq_ptr;
+    ring->sq_head    = (unsigned *)(sq + params.sq_off.head);
+    ring->sq_tail    = (unsigned *)(sq + params.sq_off.tail);
+    ring->sq_mask    = (unsigned *)(sq + params.sq_off.ring_mask);
+    ring->sq_entries = (unsigned *)(sq + params.sq_off.ring_entries);
+    ring->sq_array   = (unsigned *)(sq + params.sq_off.array);
+    ring->sq_local   = *ring->sq_tail;
+    ring->cq_head    = (unsigned *)(cq + params.cq_off.head);
+    ring->cq_tail    = (unsigned *)(cq + params.cq_off.tail);
+    ring->cq_mask    = (unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes       = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+    // allocate the buffers area and the free slots stack
+    ring->bufs_size = (size_t)nslots * 2 * SSL_URING_BUFSIZE;
+    if ((ring->bufs = mmap(NULL, ring->bufs_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) ==
+            MAP_FAILED) {
+        ring->bufs = NULL;
+        goto error;
+    }
+
+    if ((ring->free_slots = malloc(nslots * sizeof(int))) == NULL)
+        goto error;
+
+    for (int i = 0; i < nslots; i++)
+        ring->free_slots[i] = nslots - 1 - i;
+
+    ring->nfree = nslots;
+
+    // register the area (optional: the pages are pinned once instead of on each operation)
+    struct iovec iov = { ring->bufs, ring->bufs_size };
+    ring->fixed = syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_BUFFERS, &iov, 1) == 0;
+    return ring;
+
+error:
+    // io_uring not available
+    sslUringFree(ring);
+    return NULL;
+#else
+    // io_uring not supported
+    (void)nslots;
+    return NULL;
+#endif
+}
+
+
+/*!
+ *  NAME
+ *      sslUringFree - free an io_uring ring
+ *  SYNOPSIS
+ *      void sslUringFree(
+ *          SslUring *ring);        // io_uring ring
+ *  DESCRIPTION
+ *      sslUringFree() closes the ring and frees the buffers area. The operations of the ring must be completed (the
+ *      kernel could still write the buffers).
+ *  RETURN VALUE
+ *      None.
+ */
+
+void sslUringFree(
+    SslUring *ring)                 // io_uring ring
+{
+#ifdef URING_SUPPORTED
+    if (ring == NULL)
+        return;
+
+    if (ring->sqes)
+        munmap(ring->sqes, ring->sqes_size);
+
+    if (ring->cq_ptr && ring->cq_ptr != ring->sq_ptr)
+        munmap(ring->cq_ptr, ring->cq_size);
+
+    if (ring->sq_ptr)
+        munmap(ring->sq_ptr, ring->sq_size);
+
+    if (ring->fd >= 0)
+        close(ring->fd);
+
+    if (ring->bufs)
+        munmap(ring->bufs, ring->bufs_size);
+
+    free(ring->free_slots);
+    free(ring);
+#else
+    (void)ring;
+#endif
+}
+
+
+/*!
+ *  NAME
+ *      sslUringSlotGet - assign a buffer slot to a connection
+ *  SYNOPSIS
+ *      bool sslUringSlotGet(
+ *          SslUring   *ring,       // io_uring ring
+ *          SslUringIo *io);        // I/O buffers of the connection
+ *  DESCRIPTION
+ *      sslUringSlotGet() assigns a free slot of the buffers area to the connection and resets its I/O state.
+ *  RETURN VALUE
+ *      sslUringSlotGet() shall return true on success, false if all the slots are in use.
+ */
+
+bool sslUringSlotGet(
+    SslUring   *ring,               // io_uring ring
+    SslUringIo *io)                 // I/O buffers of the connection
+{
+#ifdef URING_SUPPORTED
+    if (ring->nfree == 0)
+        return false;
+
+    memset(io, 0, sizeof(SslUringIo));
+    io->slot = ring->free_slots[--ring->nfree];
+    io->rx   = ring->bufs + (size_t)io->slot * 2 * SSL_URING_BUFSIZE;
+    io->tx   = io->rx + SSL_URING_BUFSIZE;
+    return true;
+#else
+    (void)ring, (void)io;
+    return false;
+#endif
+}
+
+
+/*!
+ *  NAME
+ *      sslUringSlotPut - release the buffer slot of a connection
+ *  SYNOPSIS
+ *      void sslUringSlotPut(
+ *          SslUring   *ring,       // io_uring ring
+ *          SslUringIo *io);        // I/O buffers of the connection
+ *  DESCRIPTION
+ *      sslUringSlotPut() releases the slot of the connection (no operation of the connection must be in progress).
+ *  RETURN VALUE
+ *      None.
+ */
+
+void sslUringSlotPut(
+    SslUring   *ring,               // io_uring ring
+    SslUringIo *io)                 // I/O buffers of the connection
+{
+#ifdef URING_SUPPORTED
+    if (io->slot < 0 || io->rx == NULL)
+        return;
+
+    ring->free_slots[ring->nfree++] = io->slot;
+    io->slot = -1;
+    io->rx   = io->tx = NULL;
+#else
+    (void)ring, (void)io;
+#endif
+}
+
+
+/*!
+ *  NAME
+ *      sslUringBio - create the BIO of a connection
+ *  SYNOPSIS
+ *      BIO* sslUringBio(
+ *          SslUringIo *io);        // I/O buffers of the connection
+ *  DESCRIPTION
+ *      sslUringBio() creates a BIO that reads the received data from the rx buffer and appends the data to send to
+ *      the tx buffer of the connection (when a buffer is empty/full the operation must be retried, as with a
+ *      non-blocking socket): the BIO calls io->notify() when the reactor has to queue a receive or a send.
+ *  RETURN VALUE
+ *      Upon successful completion, sslUringBio() shall return the BIO (to use with SSL_set_bio()).
+ *      Otherwise, NULL shall be returned.
+ */
+
+BIO* sslUringBio(
+    SslUringIo *io)                 // I/O buffers of the connection
+{
+#ifdef URING_SUPPORTED
+    BIO *bio;
+    if ((bio = BIO_new(bio_meth)) != NULL)
+        BIO_set_data(bio, io);
+
+    return bio;
+#else
+    (void)io;
+    return NULL;
+#endif
+}
+
+
+/*!
+ *  NAME
+ *      sslUringRecv - queue the receive of a connection
+ *  SYNOPSIS
+ *      bool sslUringRecv(
+ *          SslUring   *ring,       // io_uring ring
+ *          int        fd,          // socket
+ *          SslUringIo *io,         // I/O buffers of the connection
+ *          void       *owner);     // connection (completion data, aligned to 8 bytes)
+ *  DESCRIPTION
+ *      sslUringRecv() queues a receive in the rx buffer of the connection (consumed by the BIO). The operation is
+ *      submitted by the next sslUringWait().
+ *  RETURN VALUE
+ *      sslUringRecv() shall return true on success, false on error.
+ */
+
+bool sslUringRecv(
+    SslUring   *ring,               // io_uring ring
+    int        fd,                  // socket
+    SslUringIo *io,                 // I/O buffers of the connection
+    void       *owner)              // connection (completion data, aligned to 8 bytes)
+{
+#ifdef URING_SUPPORTED
+    struct io_uring_sqe *sqe;
+    if ((sqe = ringSqe(ring)) == NULL)
+        return false;
+
+    sqe->opcode    = ring->fixed ? IORING_OP_READ_FIXED : IORING_OP_RECV;
+    sqe->fd        = fd;
+    sqe->addr      = (uintptr_t)io->rx;
+    sqe->len       = SSL_URING_BUFSIZE;
+    sqe->user_data = (uintptr_t)owner | SSL_URING_RX;
+    io->rx_len     = io->rx_off = 0;
+    io->rx_busy    = true;
+    return true;
+#else
+    (void)ring, (void)fd, (void)io, (void)owner;
+    return false;
+#endif
+}
+
+
+/*!
+ *  NAME
+ *      sslUringSend - queue the send of a connection
+ *  SYNOPSIS
+ *      bool sslUringSend(
+ *          SslUring   *ring,       // io_uring ring
+ *          int        fd,          // socket
+ *          SslUringIo *io,         // I/O buffers of the connection
+ *          void       *owner);     // connection (completion data, aligned to 8 bytes)
+ *  DESCRIPTION
+ *      sslUringSend() queues the send of the data in the tx buffer of the connection (the BIO can append other data
+ *      during the send). The operation is submitted by the next sslUringWait().
+ *  RETURN VALUE
+ *      sslUringSend() shall return true on success, false on error.
+ */
+
+bool sslUringSend(
+    SslUring   *ring,               // io_uring ring
+    int        fd,                  // socket
+    SslUringIo *io,                 // I/O buffers of the connection
+    void       *owner)              // connection (completion data, aligned to 8 bytes)
+{
+#ifdef URING_SUPPORTED
+    struct io_uring_sqe *sqe;
+    if ((sqe = ringSqe(ring)) == NULL)
+        return false;
+
+    // a send (not a write) for the MSG_NOSIGNAL: a reset peer must not raise SIGPIPE
+    sqe->opcode    = IORING_OP_SEND;
+    sqe->fd        = fd;
+    sqe->addr      = (uintptr_t)io->tx;
+    sqe->len       = io->tx_len;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = (uintptr_t)owner | SSL_URING_TX;
+
+    io->tx_sent = io->tx_len;
+    io->tx_busy = true;
+    return true;
+#else
+    (void)ring, (void)fd, (void)io, (void)owner;
+    return false;
+#endif
+}
+
+
+/*!
+ *  NAME
+ *      sslUringPoll - queue the poll of a fd
+ *  SYNOPSIS
+ *      bool sslUringPoll(
+ *          SslUring *ring,         // io_uring ring
+ *          int      fd,            // fd (listening socket or async fd)
+ *          void     *owner);       // connection (completion data, aligned to 8 bytes)
+ *  DESCRIPTION
+ *      sslUringPoll() queues a one-shot poll of the fd (completed when the fd is readable).
+ *  RETURN VALUE
+ *      sslUringPoll() shall return true on success, false on error.
+ */
+
+bool sslUringPoll(
+    SslUring *ring,                 // io_uring ring
+    int      fd,                    // fd (listening socket or async fd)
+    void     *owner)                // connection (completion data, aligned to 8 bytes)
+{
+#ifdef URING_SUPPORTED
+    struct io_uring_sqe *sqe;
+    if ((sqe = ringSqe(ring)) == NULL)
+        return false;
+
+    sqe->opcode         = IORING_OP_POLL_ADD;
+    sqe->fd             = fd;
+    sqe->poll32_events  = POLLIN;
+    sqe->user_data      = (uintptr_t)owner | SSL_URING_POLL;
+    return true;
+#else
+    (void)ring, (void)fd, (void)owner;
+    return false;
+#endif
+}
+
+
+/*!
+ *  NAME
+ *      sslUringCancel - cancel the operations of a connection
+ *  SYNOPSIS
+ *      bool sslUringCancel(
+ *          SslUring *ring,         // io_uring ring
+ *          void     *owner,        // connection
+ *          int      op);           // operation type: SSL_URING_RX/SSL_URING_TX/SSL_URING_POLL
+ *  DESCRIPTION
+ *      sslUringCancel() queues the cancellation of an operation of the connection (e.g.: the poll of an async fd,
+ *      that is not completed by closing the fd). The cancelled operation is completed with -ECANCELED, the completion
+ *      of the cancellation has no owner.
+ *  RETURN VALUE
+ *      sslUringCancel() shall return true on success, false on error.
+ */
+
+bool sslUringCancel(
+    SslUring *ring,                 // io_uring ring
+    void     *owner,                // connection
+    int      op)                    // operation type: SSL_URING_RX/SSL_URING_TX/SSL_URING_POLL
+{
+#ifdef URING_SUPPORTED
+    struct io_uring_sqe *sqe;
+    if ((sqe = ringSqe(ring)) == NULL)
+        return false;
+
+    sqe->opcode    = IORING_OP_ASYNC_CANCEL;
+    sqe->fd        = -1;
+    sqe->addr      = (uintptr_t)owner | op;
+    sqe->user_data = 0;
+    return true;
+#else
+    (void)ring, (void)owner, (void)op;
+    return false;
+#endif
+}
+
+
+/*!
+ *  NAME
+ *      sslUringWait - submit the queued operations and wait the completions
+ *  SYNOPSIS
+ *      int sslUringWait(
+ *          SslUring *ring,         // io_uring ring
+ *          int64_t  deadline);     // deadline in ns (see sslClockNs(), -1 = no deadline)
+ *  DESCRIPTION
+ *      sslUringWait() submits the queued operations and waits (at most until the deadline) at least a completion,
+ *      with a single io_uring_enter() (no wait if a completion is already available).
+ *  RETURN VALUE
+ *      sslUringWait() shall return 0 on success (also on timeout or signal), -1 on error.
+ */
+
+int sslUringWait(
+    SslUring *ring,                 // io_uring ring
+    int64_t  deadline)              // deadline in ns (see sslClockNs(), -1 = no deadline)
+{
+#ifdef URING_SUPPORTED
+    // completions already available: just submit
+    unsigned min_complete = 1, flags = IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+    if (*ring->cq_head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+        if (ring->to_submit == 0)
+            return 0;
+
+        min_complete = 0;
+        flags        = 0;
+    }
+
+    // submit and wait (relative timeout)
+    struct __kernel_timespec      ts;
+    struct io_uring_getevents_arg        arg;
+    memset(&arg, 0, sizeof(arg));
+    if (deadline >= 0) {
+        int64_t left = deadline - sslClockNs();
+        if (left < 0)
+            left = 0;
+
+        ts.tv_sec  = left / 1000000000;
+        ts.tv_nsec = left % 1000000000;
+        arg.ts     = (uintptr_t)&ts;
+    }
+
+    int rc = ringEnter(ring, ring->to_submit, min_complete, flags, flags ? &arg : NULL, flags ? sizeof(arg) : 0);
+    return rc >= 0 || errno == ETIME || errno == EINTR || errno == EBUSY || errno == EAGAIN ? 0 : -1;
+#else
+    (void)ring, (void)deadline;
+    return -1;
+#endif
+}
+
+
+/*!
+ *  NAME
+ *      sslUringReap - get a completion
+ *  SYNOPSIS
+ *      bool sslUringReap(
+ *          SslUring *ring,         // io_uring ring
+ *          void     **owner,       // connection of the operation (NULL for a cancellation)
+ *          int      *op,           // operation type: SSL_URING_RX/SSL_URING_TX/SSL_URING_POLL
+ *          int      *res);         // result (bytes or -errno)
+ *  DESCRIPTION
+ *      sslUringReap() removes the next completion from the completion queue.
+ *  RETURN VALUE
+ *      sslUringReap() shall return true if a completion is returned, false if the queue is empty.
+ */
+
+bool sslUringReap(
+    SslUring *ring,                 // io_uring ring
+    void     **owner,               // connection of the operation (NULL for a cancellation)
+    int      *op,                   // operation type: SSL_URING_RX/SSL_URING_TX/SSL_URING_POLL
+    int      *res)                  // result (bytes or -errno)
+{
+#ifdef URING_SUPPORTED
+    unsigned head = *ring->cq_head;
+    if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+        return false;
+
+    struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+    *owner = (void *)(uintptr_t)(cqe->user_data & ~(uint64_t)SSL_URING_OPMASK);
+    *op    = (int)(cqe->user_data & SSL_URING_OPMASK);
+    *res   = cqe->res;
+    __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+    return true;
+#else
+    (void)ring, (void)owner, (void)op, (void)res;
+    return false;
+#endif
+}
+
+
+/*!
+ *  NAME
+ *      sslUringDone - update the I/O buffers of a connection after a completion
+ *  SYNOPSIS
+ *      void sslUringDone(
+ *          SslUringIo *io,         // I/O buffers of the connection
+ *          int        op,          // operation type: SSL_URING_RX/SSL_URING_TX
+ *          int        res);        // result (bytes or -errno)
+ *  DESCRIPTION
+ *      sslUringDone() updates the buffers of the connection: a receive fills rx (0 or an error is an EOF, -EAGAIN
+ *      and -EINTR just repeat it), a send removes the data sent from tx (an error is returned by the next BIO write).
+ *  RETURN VALUE
+ *      None.
+ */
+
+void sslUringDone(
+    SslUringIo *io,                 // I/O buffers of the connection
+    int        op,                  // operation type: SSL_URING_RX/SSL_URING_TX
+    int        res)                 // result (bytes or -errno)
+{
+    if (op == SSL_URING_RX) {
+        // receive done
+        io->rx_busy = false;
+        if (res > 0)
+            io->rx_len = res;
+        else if (res != -EAGAIN && res != -EINTR)
+            io->rx_eof = true;
+    } else if (op == SSL_URING_TX) {
+        // send done: move the data appended during the send to the start of tx
+        io->tx_busy = false;
+        if (res < 0 && res != -EAGAIN && res != -EINTR) {
+            io->tx_error = -res;
+            io->tx_len   = 0;
+        } else if (res > 0) {
+            memmove(io->tx, io->tx + res, io->tx_len - res);
+            io->tx_len -= res;
+        }
+
+        io->tx_sent = 0;
+    }
+}
+
+
+/*!
+ *  NAME
+ *      sslUringSyscalls - get the number of syscalls of a ring
+ *  SYNOPSIS
+ *      unsigned long sslUringSyscalls(
+ *          SslUring *ring);        // io_uring ring
+ *  DESCRIPTION
+ *      sslUringSyscalls() get the number of io_uring_enter() executed by the ring.
+ *  RETURN VALUE
+ *      sslUringSyscalls() shall return the number of syscalls.
+ */
+
+unsigned long sslUringSyscalls(
+    SslUring *ring)                 // io_uring ring
+{
+#ifdef URING_SUPPORTED
+    return ring->syscalls;
+#else
+    (void)ring;
+    return 0;
+#endif
+}
+
+
+#ifdef URING_SUPPORTED
+////////////////////////////////////////////////////////////////////////////////
+// LOCAL functions
+////////////////////////////////////////////////////////////////////////////////
+
+
+/*!
+ *  NAME
+ *      ringSqe - get a free submission queue entry
+ *  SYNOPSIS
+ *      struct io_uring_sqe* ringSqe(
+ *          SslUring *ring);        // io_uring ring
+ *  DESCRIPTION
+ *      ringSqe() gets the next submission queue entry (cleared) on the local tail: the entry is made visible to the
+ *      kernel by the next ringEnter(), after the caller filled it. If the queue is full the queued entries are
+ *      submitted first.
+ *  RETURN VALUE
+ *      Upon successful completion, ringSqe() shall return the entry.
+ *      Otherwise, NULL shall be returned.
+ */
+
+static struct io_uring_sqe* ringSqe(
+    SslUring *ring)                 // io_uring ring
+{
+    // queue full: submit the queued entries
+    unsigned tail = ring->sq_local;
+    if (tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= *ring->sq_entries &&
+            (ringEnter(ring, ring->to_submit, 0, 0, NULL, 0) < 0 ||
+             tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= *ring->sq_entries))
+        return NULL;
+
+    // get the entry (published by ringEnter())
+    unsigned            index = tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe  = &ring->sqes[index];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    ring->sq_array[index] = index;
+    ring->to_submit++;
+    ring->sq_local = tail + 1;
+    return sqe;
+}
+
+
+/*!
+ *  NAME
+ *      ringEnter - submit the queued entries and wait the completions
+ *  SYNOPSIS
+ *      int ringEnter(
+ *          SslUring   *ring,           // io_uring ring
+ *          unsigned   to_submit,       // entries to submit
+ *          unsigned   min_complete,    // completions to wait
+ *          unsigned   flags,           // io_uring_enter() flags
+ *          const void *arg,            // io_uring_enter() argument (IORING_ENTER_EXT_ARG)
+ *          size_t     argsz);          // argument size
+ *  DESCRIPTION
+ *      ringEnter() publishes the entries filled since the last call (tail of the submission queue), executes
+ *      io_uring_enter() and updates the number of entries not yet submitted.
+ *  RETURN VALUE
+ *      ringEnter() shall return the result of io_uring_enter().
+ */
+
+static int ringEnter(
+    SslUring   *ring,               // io_uring ring
+    unsigned   to_submit,           // entries to submit
+    unsigned   min_complete,        // completions to wait
+    unsigned   flags,               // io_uring_enter() flags
+    const void *arg,                // io_uring_enter() argument (IORING_ENTER_EXT_ARG)
+    size_t     argsz)               // argument size
+{
+    __atomic_store_n(ring->sq_tail, ring->sq_local, __ATOMIC_RELEASE);
+    ring->syscalls++;
+    int rc = (int)syscall(__NR_io_uring_enter, ring->fd, to_submit, min_complete, flags, arg, argsz);
+    if (rc > 0)
+        ring->to_submit -= (unsigned)rc < ring->to_submit ? (unsigned)rc : ring->to_submit;
+
+    return rc;
+}
+
+
+/*!
+ *  NAME
+ *      bioMethodInit - create the BIO method of the connections
+ *  SYNOPSIS
+ *      void bioMethodInit(void);
+ *  DESCRIPTION
+ *      bioMethodInit() creates the BIO method (called once by pthread_once()).
+ *  RETURN VALUE
+ *      None.
+ */
+
+static void bioMethodInit(void)
+{
+    BIO_METHOD *meth;
+    if ((meth = BIO_meth_new(BIO_get_new_index() | BIO_TYPE_SOURCE_SINK, "MySSL io_uring")) == NULL)
+        return;
+
+    if (BIO_meth_set_read(meth, bioRead) != 1 || BIO_meth_set_write(meth, bioWrite) != 1 ||
+            BIO_meth_set_ctrl(meth, bioCtrl) != 1 || BIO_meth_set_create(meth, bioCreate) != 1) {
+        BIO_meth_free(meth);
+        return;
+    }
+
+    bio_meth = meth;
+}
+
+
+/*!
+ *  NAME
+ *      bioRead - read from the rx buffer
+ *  SYNOPSIS
+ *      int bioRead(
+ *          BIO  *bio,              // BIO of the connection
+ *          char *buf,              // buffer
+ *          int  len);              // buffer size
+ *  DESCRIPTION
+ *      bioRead() copies the received data from the rx buffer. When rx is empty the reactor is notified (a receive
+ *      must be queued) and the read must be retried.
+ *  RETURN VALUE
+ *      bioRead() shall return the bytes read, 0 on EOF, -1 if the read must be retried.
+ */
+
+static int bioRead(
+    BIO  *bio,                      // BIO of the connection
+    char *buf,                      // buffer
+    int  len)                       // buffer size
+{
+    SslUringIo *io = BIO_get_data(bio);
+    BIO_clear_retry_flags(bio);
+    int avail = io->rx_len - io->rx_off;
+    if (avail <= 0) {
+        // rx consumed: EOF or retry after the next receive
+        if (io->rx_eof)
+            return 0;
+
+        if (! io->rx_busy)
+            io->notify(io->owner);
+
+        BIO_set_retry_read(bio);
+        return -1;
+    }
+
+    // copy the data
+    if (len > avail)
+        len = avail;
+
+    memcpy(buf, io->rx + io->rx_off, len);
+    io->rx_off += len;
+    if (io->rx_off == io->rx_len && ! io->rx_eof)
+        io->notify(io->owner);
+
+    return len;
+}
+
+
+/*!
+ *  NAME
+ *      bioWrite - append to the tx buffer
+ *  SYNOPSIS
+ *      int bioWrite(
+ *          BIO        *bio,        // BIO of the connection
+ *          const char *buf,        // data
+ *          int        len);        // data length
+ *  DESCRIPTION
+ *      bioWrite() appends the data to the tx buffer and notifies the reactor (a send must be queued). When tx is full
+ *      the write must be retried.
+ *  RETURN VALUE
+ *      bioWrite() shall return the bytes written, -1 on error (errno set) or if the write must be retried.
+ */
+
+static int bioWrite(
+    BIO        *bio,                // BIO of the connection
+    const char *buf,                // data
+    int        len)                 // data length
+{
+    SslUringIo *io = BIO_get_data(bio);
+    BIO_clear_retry_flags(bio);
+    if (io->tx_error) {
+        // the last send failed
+        errno = io->tx_error;
+        return -1;
+    }
+
+    int space = SSL_URING_BUFSIZE - io->tx_len;
+    if (space <= 0) {
+        // tx full: retry after the send
+        io->tx_full = true;
+        BIO_set_retry_write(bio);
+        return -1;
+    }
+
+    // append the data
+    if (len > space)
+        len = space;
+
+    memcpy(io->tx + io->tx_len, buf, len);
+    io->tx_len += len;
+    io->notify(io->owner);
+    return len;
+}
+
+
+/*!
+ *  NAME
+ *      bioCtrl - BIO control operations
+ *  SYNOPSIS
+ *      long bioCtrl(
+ *          BIO  *bio,              // BIO of the connection
+ *          int  cmd,               // operation
+ *          long num,               // numeric argument
+ *          void *ptr);             // pointer argument
+ *  DESCRIPTION
+ *      bioCtrl() executes the BIO control operations used by OpenSSL: the flush is done by the reactor (the sends
+ *      are submitted at the end of the events batch).
+ *  RETURN VALUE
+ *      bioCtrl() shall return the result of the operation (0 if not supported).
+ */
+
+static long bioCtrl(
+    BIO  *bio,                      // BIO of the connection
+    int  cmd,                       // operation
+    long num,                       // numeric argument
+    void *ptr)                      // pointer argument
+{
+    SslUringIo *io = BIO_get_data(bio);
+    (void)num, (void)ptr;
+    switch (cmd) {
+    case BIO_CTRL_FLUSH:
+        return 1;
+
+    case BIO_CTRL_PENDING:
+        return io->rx_len - io->rx_off;
+
+    case BIO_CTRL_WPENDING:
+        return io->tx_len;
+
+    case BIO_CTRL_EOF:
+        return io->rx_eof && io->rx_off == io->rx_len;
+
+    default:
+        return 0;
+    }
+}
+
+
+/*!
+ *  NAME
+ *      bioCreate - initialize a BIO
+ *  SYNOPSIS
+ *      int bioCreate(
+ *          BIO *bio);              // BIO
+ *  DESCRIPTION
+ *      bioCreate() marks the BIO as initialized (the I/O buffers are set by sslUringBio()).
+ *  RETURN VALUE
+ *      bioCreate() shall return 1.
+ */
+
+static int bioCreate(
+    BIO *bio)                       // BIO
+{
+    BIO_set_init(bio, 1);
+    return 1;
+}
+#endif
@@ -20,6 +20,9 @@
  *  FUNCTIONS
  *      global:
  *          int sslWrite(SSL *ssl, const void *buf, int num);
+ *          int sslWriteEx(SSL *ssl, const void *buf, int num, int timeout);
+ *          size_t sslRecordSize(SSL *ssl, size_t num);
+ *          void sslRecordSent(SSL *ssl, size_t sent);
  *  DESCRIPTION
  *      The MySSL library is a simple interface to OpenSSL library to permits user-friendly writing of Servers and
  *      Clients using OpenSSL.
@@ -28,6 +31,15 @@
  *        and the SSLeay License. The OpenSSL License is Apache License 1.0 and SSLeay License bears some similarity to
  *        a 4-clause BSD License. Both licenses apply.
  *      - The library "OpenSSL" reference version is 1.0.2g
+ *      - With the dynamic record sizing of the context (record_boost of SslCtxOpts) the first bytes of a connection,
+ *        and the first bytes after an idle period, are sent in small records (SSL_RECORD_SMALL bytes, a record for
+ *        each TCP segment): the peer decrypts the first record as soon as the first segment arrives, without waiting
+ *        for a full 16 KB record when the congestion window is still small. Then the records go back to the full
+ *        size (less records and less overhead for the bulk data).
+ *      - A small record is a SSL_write() of at most SSL_RECORD_SMALL bytes (the max fragment of OpenSSL is never
+ *        changed, no call to switch between small and full records). Only the bytes actually written are accounted
+ *        (sslRecordSent()), and the idle period is measured from the end of the last write: a long write blocked by
+ *        the peer is not taken for an idle period.
  *  AUTHOR
  *      Aldo Abate
  *  OPERATING SYSTEM
@@ -56,14 +68,12 @@
  *          const void *buf,        // buffer of data to write
  *          int        num);        // number of data to write
  *  DESCRIPTION
- *      sslWrite() writes num bytes from the buffer buf into the specified ssl connection. This is a smart method to call the OpenSSL library SSL_write()
- *      bypassing the architectural features of OpenSSL that includes read/write actions in every read/write/accept/connect/shutdown action. This function
- *      analize the SSL_write() result to repeat the action (after a timeout of SSL_RWTOUT ms) until the activity is terminated. if the number of repeated
- *      iterations is too high (>SSL_RWITER), the activity is terminated with an error (total timeout is SSL_RWTOUT * SSL_RWITER seconds).
+ *      sslWrite() writes num bytes from the buffer buf into the specified ssl connection, with the timeout of the
+ *      connection (see sslSetTimeout() and sslWriteEx()).
  *  RETURN VALUE
  *      Upon successful completion, sslWrite() shall return the number of characters sent.
- *      Otherwise, -1 shall be returned and the error can be analyzed calling the OpenSSL library SSL_get_error() function with the return value to find out the
- *      reason.
+ *      Otherwise, a value <= 0 shall be returned and the reason can be analyzed calling sslStatus() (or the OpenSSL
+ *      library SSL_get_error() function with the return value).
  */
 
 int sslWrite(
@@ -71,33 +81,133 @@ int sslWrite(
     const void *buf,                // buffer of data to write
     int        num)                 // number of data to write
 {
-    int sent;
-
-    // write loop
-    int count = 0;
-    for (;;) {
-        // test loop counter (tot.timeout = SSL_RWTOUT * SSL_RWITER)
-        if (++count > SSL_RWITER) {
-            // the total timeout is elapsed: break loop (e.g.: tot.timeout = 100 ms * 20 = 2 sec)
-            break;
-        }
+    return sslWriteEx(ssl, buf, num, SSL_TIMEOUT_CONN);
+}
 
-        // execute operation
-        sent = SSL_write(ssl, buf, num);
-        if (sent > 0) {
-            // operation Ok: break loop
-            break;
-        }
-        else {
-            // operation NOK (result <= 0): start recovery procedure
-            if (sslRecovery(ssl, sent))
-                continue; // more data to treat: continue in the loop
 
-            // break loop
-            break;
+/*!
+ *  NAME
+ *      sslWriteEx - write data to a SSL/TLS connection with a timeout
+ *  SYNOPSIS
+ *      int sslWriteEx(
+ *          SSL        *ssl,        // OpenSSL SSL structure
+ *          const void *buf,        // buffer of data to write
+ *          int        num,         // number of data to write
+ *          int        timeout);    // timeout in ms (SSL_TIMEOUT_INFINITE, SSL_TIMEOUT_CONN = connection timeout)
+ *  DESCRIPTION
+ *      sslWriteEx() writes num bytes from the buffer buf into the specified ssl connection. This is a smart method to
+ *      call the OpenSSL library SSL_write() bypassing the architectural features of OpenSSL that includes read/write
+ *      actions in every read/write/accept/connect/shutdown action. This function repeats the write step (see
+ *      sslWriteStep()) when the socket is ready until the activity is terminated or the timeout is elapsed (the
+ *      timeout is the max duration of the whole operation).
+ *  RETURN VALUE
+ *      Upon successful completion, sslWriteEx() shall return the number of characters sent.
+ *      Otherwise, a value <= 0 shall be returned and the reason can be analyzed calling sslStatus() (or the OpenSSL
+ *      library SSL_get_error() function with the return value).
+ */
+
+int sslWriteEx(
+    SSL        *ssl,                // OpenSSL SSL structure
+    const void *buf,                // buffer of data to write
+    int        num,                 // number of data to write
+    int        timeout)             // timeout in ms (SSL_TIMEOUT_INFINITE, SSL_TIMEOUT_CONN = connection timeout)
+{
+    int sent, total = 0;
+
+    // write loop: repeat the step waiting the required event (until the deadline of the operation), a small record
+    // at a time with the dynamic record sizing
+    int64_t deadline = sslDeadline(ssl, timeout);
+    do {
+        int part = num > 0 ? (int)sslRecordSize(ssl, num - total) : num;
+        while ((sent = sslWriteStep(ssl, (const char *)buf + total, part)) < SSL_STEP_ERROR &&
+               sslStepWait(ssl, sent, deadline))
+            ;
+
+        if (sent > 0)
+            sslRecordSent(ssl, sent);
+
+        // error after a part already sent: the connection is not usable anymore
+        if (sent <= 0 && total > 0) {
+            if (sslStatus(ssl) != SSL_STATUS_CLOSED)
+                sslStatusSet(ssl, SSL_STATUS_FATAL);
+
+            return -1;
         }
+    } while (sent > 0 && (total += sent) < num);
+
+    // return the number of sent bytes or error (0 = peer disconnected)
+    return sent > 0 ? total : sent == SSL_STEP_CLOSED ? 0 : -1;
+}
+
+
+/*!
+ *  NAME
+ *      sslRecordSize - get the size of the next write
+ *  SYNOPSIS
+ *      size_t sslRecordSize(
+ *          SSL    *ssl,            // OpenSSL SSL structure
+ *          size_t num);            // number of data to write
+ *  DESCRIPTION
+ *      sslRecordSize() applies the dynamic record sizing of the context (see NOTES) to the next write of the
+ *      specified ssl connection: small records until record_boost bytes are written since the start of the
+ *      connection or since the last idle period longer than record_idle ms, full records otherwise. The bytes
+ *      written are accounted by sslRecordSent().
+ *  RETURN VALUE
+ *      sslRecordSize() shall return the number of bytes of the next SSL_write(): num with full records, at most
+ *      SSL_RECORD_SMALL bytes (a record) with small records.
+ */
+
+size_t sslRecordSize(
+    SSL    *ssl,                    // OpenSSL SSL structure
+    size_t num)                     // number of data to write
+{
+    // no record sizing in the context: OpenSSL default (full records)
+    SslCtxData  *ctxdata = sslCtxDataFind(SSL_get_SSL_CTX(ssl));
+    SslConnData *conn;
+    if (ctxdata == NULL || ctxdata->rec_boost <= 0 || (conn = sslConnData(ssl)) == NULL)
+        return num;
+
+    // an idle period (since the end of the last write) restarts the small records
+    if (conn->rec_last > 0 && ctxdata->rec_idle > 0 &&
+            sslClockNs() - conn->rec_last > (int64_t)ctxdata->rec_idle * 1000000) {
+        conn->rec_sent = 0;
+        conn->rec_last = 0;
     }
 
-    // return the number of sent bytes or error
-    return sent;
+    // small records for the first bytes (a record per write), then full records
+    if (conn->rec_sent < (size_t)ctxdata->rec_boost && num > SSL_RECORD_SMALL)
+        num = SSL_RECORD_SMALL;
+
+    return num;
+}
+
+
+/*!
+ *  NAME
+ *      sslRecordSent - account the bytes written
+ *  SYNOPSIS
+ *      void sslRecordSent(
+ *          SSL    *ssl,            // OpenSSL SSL structure
+ *          size_t sent);           // bytes written
+ *  DESCRIPTION
+ *      sslRecordSent() accounts the bytes written by a SSL_write() of the specified ssl connection for the dynamic
+ *      record sizing of the context (see sslRecordSize()) and the end of the write as the start of an idle period.
+ *  RETURN VALUE
+ *      None.
+ */
+
+void sslRecordSent(
+    SSL    *ssl,                    // OpenSSL SSL structure
+    size_t sent)                    // bytes written
+{
+    SslCtxData  *ctxdata = sslCtxDataFind(SSL_get_SSL_CTX(ssl));
+    SslConnData *conn;
+    if (ctxdata == NULL || ctxdata->rec_boost <= 0 || (conn = sslConnData(ssl)) == NULL)
+        return;
+
+    if (conn->rec_sent < (size_t)ctxdata->rec_boost)
+        conn->rec_sent += sent;
+
+    if (ctxdata->rec_idle > 0)
+        conn->rec_last = sslClockNs();
 }
@@ -0,0 +1,340 @@
+/*
+ * Copyright © 2019 Aldo Abate <aldo.abate99@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+
+
+/*!
+ *  FILE
+ *      sslwritev.c - sslWritev() and sslWriteAll() functions (scatter/gather and bulk writes) for MySSL library
+ *  PROJECT
+ *      MySSL library
+ *  FUNCTIONS
+ *      global:
+ *          ssize_t sslWritev(SSL *ssl, const struct iovec *iov, int iovcnt);
+ *          ssize_t sslWriteAll(SSL *ssl, const void *buf, size_t num);
+ *      local:
+ *          bool writevSeal(SSL *ssl, const void *buf, int num, bool sealing, int64_t deadline);
+ *          bool writevSend(SSL *ssl, int fd, BIO *mem, int64_t deadline);
+ *          void writevCork(int fd, int on);
+ *  DESCRIPTION
+ *      The MySSL library is a simple interface to OpenSSL library to permits user-friendly writing of Servers and
+ *      Clients using OpenSSL.
+ *  NOTES
+ *      - The free software library "OpenSSL" is distributed under a "dual licensed" system: under the OpenSSL License
+ *        and the SSLeay License. The OpenSSL License is Apache License 1.0 and SSLeay License bears some similarity to
+ *        a 4-clause BSD License. Both licenses apply.
+ *      - The library "OpenSSL" reference version is 1.0.2g
+ *      - The user buffers are packed in full records (SSL_RECORD_MAX bytes of plaintext, a staging copy only for the
+ *        pieces smaller than a record) and, after the handshake (OpenSSL 1.1.0 and above), the records are encrypted
+ *        in a memory BIO swapped in place of the socket BIO: the ciphertext of up to SSL_WRITE_BATCH bytes of
+ *        plaintext is sent with a single send() and a partial send is continued from the ciphertext already
+ *        produced, without encrypting again.
+ *      - When the records are written directly in the socket (before the end of the handshake, with OpenSSL 1.0.2 or
+ *        with the kernel TLS) a write of more than a record is corked (TCP_CORK): with TCP_NODELAY (see sslListen())
+ *        each record would be sent with its own partial segment.
+ *  AUTHOR
+ *      Aldo Abate
+ *  OPERATING SYSTEM
+ *      Linux (kernel 2.6 and above - glibc 2.3.2 and above)
+ *  COMPILER
+ *      GNU GCC (ver. 4.4 and above)
+ *  RELEASE
+ *      0.1.0 (August 2019)
+ */
+
+#include "myssl.h"
+#include "myssl-private.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+// local prototypes
+static bool writevSeal(SSL *ssl, const void *buf, int num, bool sealing, int64_t deadline);
+static bool writevSend(SSL *ssl, int fd, BIO *mem, int64_t deadline);
+static void writevCork(int fd, int on);
+
+
+////////////////////////////////////////////////////////////////////////////////
+// GLOBAL functions
+////////////////////////////////////////////////////////////////////////////////
+
+
+/*!
+ *  NAME
+ *      sslWritev - write the data of more buffers to a SSL/TLS connection
+ *  SYNOPSIS
+ *      ssize_t sslWritev(
+ *          SSL                *ssl,    // OpenSSL SSL structure
+ *          const struct iovec *iov,    // buffers of data to write
+ *          int                iovcnt); // number of buffers
+ *  DESCRIPTION
+ *      sslWritev() writes the data of the iovcnt buffers of iov (e.g.: header and body of a response) into the
+ *      specified ssl connection packed in full-size records (instead of a record for each buffer) and, after the
+ *      handshake, with a single send() for each SSL_WRITE_BATCH bytes. The timeout of the connection (see
+ *      sslSetTimeout()) is the max duration of the whole operation.
+ *  RETURN VALUE
+ *      Upon successful completion, sslWritev() shall return the number of bytes sent (the sum of the buffer lengths).
+ *      Otherwise, -1 shall be returned and the reason can be analyzed calling sslStatus(): after an error or a
+ *      timeout the data may be partially sent and the connection is not usable anymore (SSL_STATUS_FATAL), except
+ *      for SSL_STATUS_CLOSED.
+ */
+
+ssize_t sslWritev(
+    SSL                *ssl,        // OpenSSL SSL structure
+    const struct iovec *iov,        // buffers of data to write
+    int                iovcnt)      // number of buffers
+{
+    // staging buffer of a record
+    unsigned char *record;
+    if (iovcnt < 0 || (record = malloc(SSL_RECORD_MAX)) == NULL) {
+        sslStatusSet(ssl, SSL_STATUS_FATAL);
+        return -1;
+    }
+
+    int64_t deadline = sslDeadline(ssl, SSL_TIMEOUT_CONN);
+    ssize_t total    = 0;
+    bool    ok       = true;
+    BIO     *sock    = NULL, *mem = NULL;
+    int     fd       = SSL_get_wfd(ssl);
+
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+    // after the handshake: encrypt in a memory BIO (the socket BIO is restored at the end), except with the kernel
+    // TLS (the records are encrypted by the kernel in the socket BIO)
+    if (SSL_is_init_finished(ssl) && fd >= 0 && ! (sslKtls(ssl) & SSL_KTLS_TX) &&
+        (mem = BIO_new(BIO_s_mem())) != NULL) {
+        sock = SSL_get_wbio(ssl);
+        BIO_up_ref(sock);
+        SSL_set0_wbio(ssl, mem);
+    }
+#endif
+
+    // records written in the socket: cork the multi-record writes
+    size_t size = 0;
+    for (int i = 0; i < iovcnt; i++)
+        size += iov[i].iov_len;
+
+    bool cork = mem == NULL && fd >= 0 && size > SSL_RECORD_MAX;
+    if (cork)
+        writevCork(fd, 1);
+
+    // pack the buffers in full records
+    int rec_len = 0;
+    for (int i = 0; ok && i < iovcnt; i++) {
+        const unsigned char *base = iov[i].iov_base;
+        size_t              left  = iov[i].iov_len;
+        total += left;
+        while (ok && left > 0) {
+            size_t num;
+            if (rec_len == 0 && left >= SSL_RECORD_MAX) {
+                // full record from the user buffer: no staging copy
+                num = SSL_RECORD_MAX;
+                ok  = writevSeal(ssl, base, num, mem != NULL, deadline);
+            } else {
+                // piece of a record: copy it in the staging buffer
+                num = left < (size_t)(SSL_RECORD_MAX - rec_len) ? left : (size_t)(SSL_RECORD_MAX - rec_len);
+                memcpy(record + rec_len, base, num);
+                if ((rec_len += num) == SSL_RECORD_MAX) {
+                    ok      = writevSeal(ssl, record, rec_len, mem != NULL, deadline);
+                    rec_len = 0;
+                }
+            }
+
+            base += num;
+            left -= num;
+
+            // send a batch of records
+            if (ok && mem != NULL && BIO_pending(mem) >= SSL_WRITE_BATCH)
+                ok = writevSend(ssl, fd, mem, deadline);
+        }
+    }
+
+    // last record and last batch
+    if (ok && rec_len > 0)
+        ok = writevSeal(ssl, record, rec_len, mem != NULL, deadline);
+
+    if (ok && mem != NULL && BIO_pending(mem) > 0)
+        ok = writevSend(ssl, fd, mem, deadline);
+
+    if (cork)
+        writevCork(fd, 0);
+
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+    // restore the socket BIO (the memory BIO is freed)
+    if (sock != NULL)
+        SSL_set0_wbio(ssl, sock);
+#endif
+
+    free(record);
+    if (! ok)
+        return -1;
+
+    sslStatusSet(ssl, SSL_STATUS_OK);
+    return total;
+}
+
+
+/*!
+ *  NAME
+ *      sslWriteAll - write a large buffer to a SSL/TLS connection
+ *  SYNOPSIS
+ *      ssize_t sslWriteAll(
+ *          SSL        *ssl,        // OpenSSL SSL structure
+ *          const void *buf,        // buffer of data to write
+ *          size_t     num);        // number of data to write (also > INT_MAX)
+ *  DESCRIPTION
+ *      sslWriteAll() writes all the num bytes of buf into the specified ssl connection in full-size records and
+ *      batches of records (see sslWritev()), handling the partial sends of the socket without encrypting again.
+ *  RETURN VALUE
+ *      Upon successful completion, sslWriteAll() shall return num.
+ *      Otherwise, -1 shall be returned (see sslWritev()).
+ */
+
+ssize_t sslWriteAll(
+    SSL        *ssl,                // OpenSSL SSL structure
+    const void *buf,                // buffer of data to write
+    size_t     num)                 // number of data to write (also > INT_MAX)
+{
+    struct iovec iov;
+    iov.iov_base = (void *)buf;
+    iov.iov_len  = num;
+    return sslWritev(ssl, &iov, 1);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// LOCAL functions
+////////////////////////////////////////////////////////////////////////////////
+
+
+/*!
+ *  NAME
+ *      writevSeal - write a record
+ *  SYNOPSIS
+ *      bool writevSeal(
+ *          SSL        *ssl,        // OpenSSL SSL structure
+ *          const void *buf,        // record data
+ *          int        num,         // record data length (<= SSL_RECORD_MAX)
+ *          bool       sealing,     // the write BIO is the memory BIO (otherwise the socket BIO)
+ *          int64_t    deadline);   // deadline in ns (see sslDeadline())
+ *  DESCRIPTION
+ *      writevSeal() writes a record with SSL_write(): in the memory BIO (never blocked, the step is repeated only if
+ *      OpenSSL must read from the socket) or directly in the socket (before the end of the handshake or with
+ *      OpenSSL 1.0.2), with the record size of the dynamic record sizing (see sslRecordSize()).
+ *  RETURN VALUE
+ *      writevSeal() shall return true on success, false on error (status set).
+ */
+
+static bool writevSeal(
+    SSL        *ssl,                // OpenSSL SSL structure
+    const void *buf,                // record data
+    int        num,                 // record data length (<= SSL_RECORD_MAX)
+    bool       sealing,             // the write BIO is the memory BIO (otherwise the socket BIO)
+    int64_t    deadline)            // deadline in ns (see sslDeadline())
+{
+    // write loop: repeat the step waiting the required event (a write to the memory BIO can't block), a small record
+    // at a time with the dynamic record sizing (see sslRecordSize())
+    int sent, total = 0;
+    do {
+        int part = (int)sslRecordSize(ssl, num - total);
+        while ((sent = sslWriteStep(ssl, (const char *)buf + total, part)) < SSL_STEP_ERROR &&
+               (! sealing || sent != SSL_STEP_WANT_WRITE) && sslStepWait(ssl, sent, deadline))
+            ;
+
+        if (sent > 0)
+            sslRecordSent(ssl, sent);
+    } while (sent > 0 && (total += sent) < num);
+
+    if (sent > 0)
+        return true;
+
+    // a write error after records already sent breaks the connection (except a disconnection)
+    if (sslStatus(ssl) != SSL_STATUS_CLOSED)
+        sslStatusSet(ssl, SSL_STATUS_FATAL);
+
+    return false;
+}
+
+
+/*!
+ *  NAME
+ *      writevSend - send the encrypted records
+ *  SYNOPSIS
+ *      bool writevSend(
+ *          SSL     *ssl,           // OpenSSL SSL structure
+ *          int     fd,             // socket
+ *          BIO     *mem,           // memory BIO with the encrypted records
+ *          int64_t deadline);      // deadline in ns (see sslDeadline())
+ *  DESCRIPTION
+ *      writevSend() sends the records of the memory BIO with a single send() (more if the socket buffer is full,
+ *      continuing from the data not yet sent) and empties the BIO.
+ *  RETURN VALUE
+ *      writevSend() shall return true on success, false on error or timeout (status set).
+ */
+
+static bool writevSend(
+    SSL     *ssl,                   // OpenSSL SSL structure
+    int     fd,                     // socket
+    BIO     *mem,                   // memory BIO with the encrypted records
+    int64_t deadline)               // deadline in ns (see sslDeadline())
+{
+    char *data;
+    long len = BIO_get_mem_data(mem, &data), off = 0;
+    while (off < len) {
+        ssize_t sent;
+        if ((sent = send(fd, data + off, len - off, MSG_NOSIGNAL)) > 0) {
+            off += sent;
+            continue;
+        }
+
+        // socket buffer full: wait until the socket is writable
+        struct pollfd pfd = { fd, POLLOUT, 0 };
+        int           rc;
+        if (sent < 0 && errno == EINTR)
+            continue;
+
+        if (sent < 0 && errno == EAGAIN && (rc = sslPoll(&pfd, 1, deadline)) > 0)
+            continue;
+
+        // error, timeout or peer disconnected: the records already encrypted are lost
+        sslStatusSet(ssl, sent < 0 && (errno == EPIPE || errno == ECONNRESET) ? SSL_STATUS_CLOSED : SSL_STATUS_FATAL);
+        return false;
+    }
+
+    (void)BIO_reset(mem);
+    return true;
+}
+
+
+/*!
+ *  NAME
+ *      writevCork - cork or uncork a socket
+ *  SYNOPSIS
+ *      void writevCork(
+ *          int fd,                 // socket
+ *          int on);                // 1 = cork (hold the partial segments), 0 = uncork (send them)
+ *  DESCRIPTION
+ *      writevCork() sets TCP_CORK on the socket (ignored if the socket is not TCP, e.g. a Unix socket).
+ *  RETURN VALUE
+ *      None.
+ */
+
+static void writevCork(
+    int fd,                         // socket
+    int on)                         // 1 = cork (hold the partial segments), 0 = uncork (send them)
+{
+    (void)setsockopt(fd, IPPROTO_TCP, TCP_CORK, &on, sizeof(on));
+}
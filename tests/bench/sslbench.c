@@ -0,0 +1,4280 @@
+/*
+ * Copyright © 2019 Aldo Abate <aldo.abate99@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#include "myssl.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <limits.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/select.h>
+#include <sys/un.h>
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <openssl/err.h>
+#include <openssl/pem.h>
+#include <openssl/x509.h>
+
+// certificati di test (il benchmark si esegue nella directory tests/bench)
+#define BENCH_CERT      "../server/client.pem"
+#define BENCH_KEY       "../server/key.pem"
+#define BENCH_CACERT    "../client/ca.pem"
+
+// dati del server di loopback
+typedef struct {
+    int     sock;           // socket di ascolto
+    int     nconn;          // numero connessioni da servire
+    bool    early;          // legge gli early data (0-RTT) con sslAcceptEarly()
+    SSL_CTX *ctx;           // contesto del server
+} BenchServer;
+
+// contatori delle operazioni del BIO socket di una connessione (benchBioWatch())
+typedef struct {
+    bool          on;               // conteggio attivo
+    unsigned long reads;            // letture (una syscall ciascuna)
+    unsigned long writes;           // scritture (una syscall ciascuna)
+    long          rbytes;           // byte letti
+} BenchBio;
+
+// prototipi locali
+static double nowUs(void);
+static int    benchListen(int *port);
+static int    benchNoDelay(int sock);
+static int    benchConnect(int port);
+static SSL*   benchAccept(int lsock, SSL_CTX *ctx, bool handshake);
+static SSL*   benchSslNew(SSL_CTX *ctx, int sock, bool handshake);
+static bool   benchPair(int lsock, int port, SSL_CTX *cctx, SSL_CTX *sctx, SSL **cssl, SSL **sssl);
+static long   benchBioCount(BIO *bio, int oper, const char *argp, size_t len, int argi, long argl, int ret,
+                            size_t *processed);
+static void   benchBioWatch(SSL *ssl, BenchBio *count);
+static int    benchServerStart(BenchServer *srv, pthread_t *tid, const SslCtxOpts *opts, int nconn, int *port);
+static void*  benchServerThread(void *arg);
+static int    benchCtx(int iterations);
+static int    benchResume(int nconn);
+static int    benchEarly(int nconn);
+static int    benchTickets(int nconn);
+static pid_t  benchServerFork(int sock, const SslCtxOpts *opts, int nconn);
+static int    benchReload(int iterations);
+static void*  benchReloadThread(void *arg);
+static int    benchCertGen(int type, const char *cert, const char *key);
+static double benchHandshakeRun(const SslCtxOpts *srv_opts, const SslCtxOpts *cli_opts, int nconn);
+static int    benchHandshake(int nconn);
+static void*  benchAsyncServer(void *arg);
+static void*  benchAsyncClient(void *arg);
+static int    benchAsyncRun(int workers, int nconn);
+static int    benchAsync(int nconn);
+static int    benchDeadline(int iterations);
+static long   benchProcStatus(const char *field);
+static void   benchReactorEcho(SslConn *conn, int event, void *arg);
+static void   benchReactorClient(SslConn *conn, int event, void *arg);
+static void*  benchReactorServer(void *arg);
+static int    benchReactor(int nconn);
+static void   benchUringEcho(SslConn *conn, int event, void *arg);
+static void   benchUringClient(SslConn *conn, int event, void *arg);
+static int    benchUringRun(int backend, int nconn, int rounds, double *rate, double *syscalls);
+static int    benchUring(int nmsg);
+static void   benchEngineEcho(SslConn *conn, const void *buf, int num, void *arg);
+static void*  benchEngineLoad(void *arg);
+static int    benchEngineRun(int workers, SSL_CTX *ctx, double seconds, double *hs_rate, double *msg_rate);
+static int    benchEngine(int seconds);
+static void   benchSinkMsg(int write_p, int version, int content_type, const void *buf, size_t len, SSL *ssl,
+                           void *arg);
+static void*  benchSinkThread(void *arg);
+static int    benchWritev(int responses);
+static int    benchSendFile(int size_mb);
+static void*  benchEchoConn(void *arg);
+static void*  benchEchoServer(void *arg);
+static int    benchCmpDouble(const void *a, const void *b);
+static bool   benchForwardXchg(SSL *ssl, int sock, char *buf, int len);
+static int    benchForwardRun(int port, SSL_CTX *ctx, int size_mb, double *mbps, double *rtt_avg, double *rtt_p99);
+static int    benchForward(int size_mb);
+static void*  benchRecordsServer(void *arg);
+static void   benchRecordsMsg(int write_p, int version, int content_type, const void *buf, size_t len, SSL *ssl,
+                              void *arg);
+static int    benchRecordsRun(const SslCtxOpts *opts, int nconn, double *ttfb, double *ttfb_idle, double *ttlb,
+                              double *records, double *mbps);
+static int    benchRecords(int nconn);
+static bool   benchIdleStep(SSL *cssl, SSL *sssl, int (*cfunc)(SSL*), int (*sfunc)(SSL*));
+static int    benchIdleWrite(SSL *ssl);
+static int    benchIdleRead(SSL *ssl);
+static int    benchIdleRun(bool release, int nconn, double *kb_conn);
+static int    benchIdle(int nconn);
+static void*  benchAllocThread(void *arg);
+static int    benchAllocRun(const SslInitOpts *init, const char *name, int nconn);
+static int    benchAlloc(int nconn);
+static void*  benchBatchServer(void *arg);
+static int    benchBatchRun(SSL_CTX *sctx, SSL_CTX *cctx, bool batch, int nmsg, double *rate, double *syscalls);
+static int    benchBatch(int nmsg);
+static void   benchPoolEcho(SslConn *conn, const void *buf, int num, void *arg);
+static bool   benchPoolXchg(SSL *ssl, char *msg);
+static void*  benchPoolClient(void *arg);
+static int    benchPoolRun(int port, SSL_CTX *ctx, SslClientPool *pool, int nreq, double *rate);
+static int    benchPool(int nreq);
+static int    benchFdCount(void);
+static void*  benchCloseServer(void *arg);
+static int    benchCloseRun(SSL_CTX *sctx, SSL_CTX *cctx, bool stuck, int mode, int nconn, double *avg, double *max);
+static int    benchClose(int nconn);
+static bool   benchThreadsXchg(SSL *ssl, const char *msg, char *buf);
+static void*  benchThreadsClient(void *arg);
+static int    benchThreads(int nthreads);
+static bool   benchFramesExact(SSL *ssl, void *buf, int num);
+static void*  benchFramesServer(void *arg);
+static int    benchFramesRun(SSL_CTX *sctx, SSL_CTX *cctx, bool framed, int nmsg, double *rate, double *syscalls);
+static int    benchFrames(int nmsg);
+static bool   benchQueueUnsub(SslConn **subs, int nsubs, SslConn *conn);
+static void   benchQueueServer(SslConn *conn, int event, void *arg);
+static void*  benchQueueClient(void *arg);
+static int    benchQueueRun(SSL_CTX *sctx, SSL_CTX *cctx, const char *name, int nslow, int policy, int max_time,
+                            int nmsg);
+static int    benchQueue(int nmsg);
+static void*  benchSocketsServer(void *arg);
+static int    benchSocketsRun(SSL_CTX *sctx, SSL_CTX *cctx, const char *name, const SslSockOpts *sopts, int nconn);
+static int    benchSockets(int nconn);
+
+// opzioni dei contesti di test
+static const SslCtxOpts bench_opts = { BENCH_CERT, BENCH_KEY, BENCH_CACERT };
+
+int main(int argc, char *argv[])
+{
+    // test arguments
+    if (argc < 2) {
+        // args error
+        printf("%s: wrong arguments counts\n", argv[0]);
+        printf("usage: %s mode [args]\n", argv[0]);
+        printf("modes:\n");
+        printf("    ctx [iterations]            connection setup cost with/without the contexts registry\n");
+        printf("    resume [connections]        full/abbreviated handshakes and resumption hit rate\n");
+        printf("    early [connections]         time to first response with/without early data (0-RTT)\n");
+        printf("    tickets [connections]       resumption across two server processes sharing the ticket keys\n");
+        printf("    reload [iterations]         context borrow latency with/without concurrent reloads\n");
+        printf("    handshake [connections]     full handshakes/sec per certificate type and handshake profile\n");
+        printf("    async [connections]         event loop stalls with inline/offloaded private-key operations\n");
+        printf("    deadline [iterations]       timeouts, connection status and wake-up latency with fds > 1024\n");
+        printf("    reactor [connections]       handshakes/sec, memory and round trip of many connections in a reactor\n");
+        printf("    uring [messages]            messages/sec and syscalls/message of the epoll and io_uring backends\n");
+        printf("    engine [seconds]            handshakes/sec and messages/sec of the server engine per worker count\n");
+        printf("    writev [responses]          records, bytes on wire and throughput of sslWrite()/sslWritev()/sslWriteAll()\n");
+        printf("    sendfile [MB]               throughput of a file sent with read()/sslWrite() and sslSendFile() (kTLS)\n");
+        printf("    forward [MB]                throughput, latency and half-close of the forwarder to TCP/Unix backends\n");
+        printf("    records [connections]       time to first byte and bulk throughput with fixed/dynamic record sizes\n");
+        printf("    idle [connections]          memory per idle connection and buffer pool with/without buffers release\n");
+        printf("    alloc [connections]         handshakes/sec, allocations and memory per connection of the allocators\n");
+        printf("    batch [messages]            messages/sec and syscalls/message of pipelined reads with sslReadBatch()\n");
+        printf("    pool [requests]             requests/sec, handshakes and reuse rate with/without the client pool\n");
+        printf("    close [connections]         close latency per close mode with stuck and responsive peers\n");
+        printf("    threads [threads]           concurrent init, handshakes and verified I/O on many threads, teardown\n");
+        printf("    frames [messages]           messages/sec and syscalls/message of hand-rolled and sslFrame framing\n");
+        printf("    queue [messages]            fan-out latency and memory bounds of the write queues with slow consumers\n");
+        printf("    sockets [connections]       connect-to-first-byte latency without and with the socket tuning profile\n");
+        return EXIT_FAILURE;
+    }
+
+    // the server closes the connections without waiting the peer: ignore the SIGPIPE
+    signal(SIGPIPE, SIG_IGN);
+
+    // run the required benchmark
+    if (strcmp(argv[1], "ctx") == 0)
+        return benchCtx(argc > 2 ? atoi(argv[2]) : 1000);
+    else if (strcmp(argv[1], "resume") == 0)
+        return benchResume(argc > 2 ? atoi(argv[2]) : 200);
+    else if (strcmp(argv[1], "early") == 0)
+        return benchEarly(argc > 2 ? atoi(argv[2]) : 200);
+    else if (strcmp(argv[1], "tickets") == 0)
+        return benchTickets(argc > 2 ? atoi(argv[2]) : 20);
+    else if (strcmp(argv[1], "reload") == 0)
+        return benchReload(argc > 2 ? atoi(argv[2]) : 100000);
+    else if (strcmp(argv[1], "handshake") == 0)
+        return benchHandshake(argc > 2 ? atoi(argv[2]) : 200);
+    else if (strcmp(argv[1], "async") == 0)
+        return benchAsync(argc > 2 ? atoi(argv[2]) : 200);
+    else if (strcmp(argv[1], "deadline") == 0)
+        return benchDeadline(argc > 2 ? atoi(argv[2]) : 1000);
+    else if (strcmp(argv[1], "reactor") == 0)
+        return benchReactor(argc > 2 ? atoi(argv[2]) : 5000);
+    else if (strcmp(argv[1], "uring") == 0)
+        return benchUring(argc > 2 ? atoi(argv[2]) : 100000);
+    else if (strcmp(argv[1], "engine") == 0)
+        return benchEngine(argc > 2 ? atoi(argv[2]) : 2);
+    else if (strcmp(argv[1], "writev") == 0)
+        return benchWritev(argc > 2 ? atoi(argv[2]) : 500);
+    else if (strcmp(argv[1], "sendfile") == 0)
+        return benchSendFile(argc > 2 ? atoi(argv[2]) : 64);
+    else if (strcmp(argv[1], "forward") == 0)
+        return benchForward(argc > 2 ? atoi(argv[2]) : 64);
+    else if (strcmp(argv[1], "records") == 0)
+        return benchRecords(argc > 2 ? atoi(argv[2]) : 50);
+    else if (strcmp(argv[1], "idle") == 0)
+        return benchIdle(argc > 2 ? atoi(argv[2]) : 5000);
+    else if (strcmp(argv[1], "alloc") == 0)
+        return benchAlloc(argc > 2 ? atoi(argv[2]) : 2000);
+    else if (strcmp(argv[1], "batch") == 0)
+        return benchBatch(argc > 2 ? atoi(argv[2]) : 200000);
+    else if (strcmp(argv[1], "pool") == 0)
+        return benchPool(argc > 2 ? atoi(argv[2]) : 8000);
+    else if (strcmp(argv[1], "close") == 0)
+        return benchClose(argc > 2 ? atoi(argv[2]) : 50);
+    else if (strcmp(argv[1], "threads") == 0)
+        return benchThreads(argc > 2 ? atoi(argv[2]) : 32);
+    else if (strcmp(argv[1], "frames") == 0)
+        return benchFrames(argc > 2 ? atoi(argv[2]) : 200000);
+    else if (strcmp(argv[1], "queue") == 0)
+        return benchQueue(argc > 2 ? atoi(argv[2]) : 20000);
+    else if (strcmp(argv[1], "sockets") == 0)
+        return benchSockets(argc > 2 ? atoi(argv[2]) : 100);
+
+    // mode error
+    fprintf(stderr, "%s: unknown mode %s\n", argv[0], argv[1]);
+    return EXIT_FAILURE;
+}
+
+// nowUs - monotonic time in microseconds
+static double nowUs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+// benchListen - create a listening socket on a free loopback port
+static int benchListen(int *port)
+{
+    // create a socket
+    int sock;
+    if ((sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0)
+        return -1;
+
+    // assign a free loopback port and start listening
+    struct sockaddr_in server;
+    memset(&server, 0, sizeof(server));
+    server.sin_family      = AF_INET;
+    server.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t socksize = sizeof(server);
+    if (bind(sock, (struct sockaddr *)&server, sizeof(server)) < 0 || listen(sock, SOMAXCONN) < 0 ||
+            getsockname(sock, (struct sockaddr *)&server, &socksize) < 0) {
+        // bind()/listen() error
+        close(sock);
+        return -1;
+    }
+
+    // return the socket and the port
+    *port = ntohs(server.sin_port);
+    return sock;
+}
+
+// benchNoDelay - disable the Nagle algorithm (the request/response exchanges must not wait the delayed ACKs)
+static int benchNoDelay(int sock)
+{
+    int on = 1;
+    return setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+}
+
+// benchConnect - connect to a loopback port
+static int benchConnect(int port)
+{
+    // create a socket
+    int sock;
+    if ((sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0)
+        return -1;
+
+    // connect to the loopback server
+    struct sockaddr_in server;
+    memset(&server, 0, sizeof(server));
+    server.sin_family      = AF_INET;
+    server.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    server.sin_port        = htons(port);
+    if (connect(sock, (struct sockaddr *)&server, sizeof(server)) < 0) {
+        // connect() error
+        close(sock);
+        return -1;
+    }
+
+    // return the connected socket
+    benchNoDelay(sock);
+    return sock;
+}
+
+// benchAccept - accept a connection of a loopback server (TCP_NODELAY) and create its SSL structure, with the server
+// handshake if required (otherwise the caller executes it): NULL on error (the connection is closed)
+static SSL* benchAccept(int lsock, SSL_CTX *ctx, bool handshake)
+{
+    int sock;
+    if ((sock = accept(lsock, NULL, NULL)) < 0)
+        return NULL;
+
+    benchNoDelay(sock);
+    return benchSslNew(ctx, sock, handshake);
+}
+
+// benchSslNew - create the SSL structure of an accepted socket, with the server handshake if required: NULL on error
+// (the socket is closed)
+static SSL* benchSslNew(SSL_CTX *ctx, int sock, bool handshake)
+{
+    SSL *ssl = NULL;
+    if ((ssl = SSL_new(ctx)) == NULL || SSL_set_fd(ssl, sock) != 1 || (handshake && sslFunc(SSL_accept, ssl) != 1)) {
+        // handshake error
+        sslClose(ssl, sock, NULL, false);
+        return NULL;
+    }
+
+    return ssl;
+}
+
+// benchPair - loopback pair of non-blocking connections (client and server in the calling thread) with the
+// handshake: false on error (the connections are closed)
+static bool benchPair(int lsock, int port, SSL_CTX *cctx, SSL_CTX *sctx, SSL **cssl, SSL **sssl)
+{
+    int csock;
+    *cssl = *sssl = NULL;
+    if ((csock = benchConnect(port)) < 0)
+        return false;
+
+    if ((*sssl = benchAccept(lsock, sctx, false)) == NULL) {
+        close(csock);
+        return false;
+    }
+
+    fcntl(csock, F_SETFL, O_NONBLOCK);
+    fcntl(SSL_get_fd(*sssl), F_SETFL, O_NONBLOCK);
+    if ((*cssl = SSL_new(cctx)) == NULL || SSL_set_fd(*cssl, csock) != 1 ||
+            ! benchIdleStep(*cssl, *sssl, SSL_connect, SSL_accept)) {
+        sslClose(*cssl, csock, NULL, false);
+        sslClose(*sssl, SSL_get_fd(*sssl), NULL, false);
+        *cssl = *sssl = NULL;
+        return false;
+    }
+
+    return true;
+}
+
+// benchBioCount - BIO callback: count the reads (and the bytes read) and the writes of the socket BIO
+static long benchBioCount(BIO *bio, int oper, const char *argp, size_t len, int argi, long argl, int ret,
+                          size_t *processed)
+{
+    BenchBio *count = (BenchBio *)BIO_get_callback_arg(bio);
+    (void)argp, (void)len, (void)argi, (void)argl;
+    if (count->on && oper == (BIO_CB_READ | BIO_CB_RETURN)) {
+        count->reads++;
+        if (ret > 0)
+            count->rbytes += *processed;
+    } else if (count->on && oper == (BIO_CB_WRITE | BIO_CB_RETURN)) {
+        count->writes++;
+    }
+
+    return ret;
+}
+
+// benchBioWatch - count the operations of the socket BIO of a connection (while count->on)
+static void benchBioWatch(SSL *ssl, BenchBio *count)
+{
+    BIO_set_callback_arg(SSL_get_rbio(ssl), (char *)count);
+    BIO_set_callback_ex(SSL_get_rbio(ssl), benchBioCount);
+}
+
+// benchServerStart - start a loopback echo server thread serving nconn connections
+static int benchServerStart(BenchServer *srv, pthread_t *tid, const SslCtxOpts *opts, int nconn, int *port)
+{
+    // create the server context
+    int error;
+    if ((srv->ctx = sslCreateCtxEx(SSL_SERVER, opts, &error)) == NULL || error < 0) {
+        // context error
+        fprintf(stderr, "server: OpenSSL error creating the context SSL_CTX\n");
+        ERR_print_errors_fp(stderr);
+        sslReleaseCtx(srv->ctx);
+        return -1;
+    }
+
+    // create the listening socket and start the thread
+    srv->nconn = nconn;
+    srv->early = opts->max_early_data > 0;
+    if ((srv->sock = benchListen(port)) < 0 || pthread_create(tid, NULL, benchServerThread, srv) != 0) {
+        // socket/thread error
+        fprintf(stderr, "server: could not start the server (%s)\n", strerror(errno));
+        sslClose(NULL, srv->sock, srv->ctx, false);
+        return -1;
+    }
+
+    return 0;
+}
+
+// benchServerThread - loopback echo server: a connection at a time
+static void* benchServerThread(void *arg)
+{
+    BenchServer *srv = arg;
+
+    // serve the connections
+    for (int i = 0; i < srv->nconn; i++) {
+        // accept a connection and execute the handshake (reading the early data)
+        SSL  *ssl;
+        char buf[MYBUFSIZE];
+        int  early_len = 0;
+        if ((ssl = benchAccept(srv->sock, srv->ctx, ! srv->early)) == NULL)
+            continue;
+
+        if (srv->early && sslAcceptEarly(ssl, buf, sizeof(buf), &early_len) != 1) {
+            // handshake error: next connection
+            sslClose(ssl, SSL_get_fd(ssl), NULL, false);
+            continue;
+        }
+
+        // echo the early data and loop (until the client disconnects)
+        int rcvd;
+        if (early_len > 0 && sslWrite(ssl, buf, early_len) < 0) {
+            sslClose(ssl, SSL_get_fd(ssl), NULL, false);
+            continue;
+        }
+
+        while ((rcvd = sslRead(ssl, buf, sizeof(buf))) > 0) {
+            if (sslWrite(ssl, buf, rcvd) < 0)
+                break;
+        }
+
+        // shutdown also when the client is already disconnected (a session not shut down is removed from the cache)
+        sslClose(ssl, SSL_get_fd(ssl), NULL, true);
+    }
+
+    // close the listening socket and release the context
+    sslClose(NULL, srv->sock, srv->ctx, false);
+    return NULL;
+}
+
+// benchCtx - connection setup cost (context + SSL structure) building a fresh context per connection (old pattern)
+// and borrowing it from the contexts registry
+static int benchCtx(int iterations)
+{
+    // before: a fresh context per connection (read and parse the certificate files every time)
+    double start = nowUs();
+    for (int i = 0; i < iterations; i++) {
+        SSL_CTX *ctx = SSL_CTX_new(SSLv23_method());
+        if (ctx == NULL || SSL_CTX_use_certificate_file(ctx, BENCH_CERT, SSL_FILETYPE_PEM) != 1 ||
+                SSL_CTX_use_PrivateKey_file(ctx, BENCH_KEY, SSL_FILETYPE_PEM) != 1 || SSL_CTX_check_private_key(ctx) != 1) {
+            // context error
+            fprintf(stderr, "ctx: OpenSSL error creating the context SSL_CTX\n");
+            ERR_print_errors_fp(stderr);
+            SSL_CTX_free(ctx);
+            return EXIT_FAILURE;
+        }
+
+        SSL *ssl = SSL_new(ctx);
+        SSL_free(ssl);
+        SSL_CTX_free(ctx);
+    }
+
+    double fresh_us = (nowUs() - start) / iterations;
+
+    // after: borrow the context from the registry
+    start = nowUs();
+    for (int i = 0; i < iterations; i++) {
+        int error;
+        SSL_CTX *ctx;
+        if ((ctx = sslCreateCtxEx(SSL_SERVER, &bench_opts, &error)) == NULL || error < 0) {
+            // context error
+            fprintf(stderr, "ctx: OpenSSL error creating the context SSL_CTX\n");
+            ERR_print_errors_fp(stderr);
+            sslReleaseCtx(ctx);
+            return EXIT_FAILURE;
+        }
+
+        SSL *ssl = SSL_new(ctx);
+        SSL_free(ssl);
+        sslReleaseCtx(ctx);
+    }
+
+    double reg_us = (nowUs() - start) / iterations;
+
+    // show the results
+    printf("ctx: %d iterations\n", iterations);
+    printf("ctx: fresh context     %10.2f us/connection\n", fresh_us);
+    printf("ctx: registry context  %10.2f us/connection (x%.1f)\n", reg_us, fresh_us / reg_us);
+
+    sslFlushCtx();
+    return EXIT_SUCCESS;
+}
+
+// benchResume - full and abbreviated handshakes: the client reconnects nconn times to the same server
+static int benchResume(int nconn)
+{
+    // start the loopback server (the TLS 1.3 tickets and the server session cache are both enabled)
+    BenchServer srv;
+    pthread_t   tid;
+    int         port;
+    if (benchServerStart(&srv, &tid, &bench_opts, nconn, &port) < 0)
+        return EXIT_FAILURE;
+
+    // create the client context
+    int error;
+    SSL_CTX *ctx;
+    if ((ctx = sslCreateCtxEx(SSL_CLIENT, &bench_opts, &error)) == NULL || error < 0) {
+        // context error
+        fprintf(stderr, "resume: OpenSSL error creating the context SSL_CTX\n");
+        ERR_print_errors_fp(stderr);
+        sslReleaseCtx(ctx);
+        return EXIT_FAILURE;
+    }
+
+    // connection loop
+    double full_us = 0, resumed_us = 0;
+    int    nfull = 0, nresumed = 0;
+    for (int i = 0; i < nconn; i++) {
+        // connect and start the OpenSSL session resuming the stored session
+        int sock;
+        SSL *ssl = NULL;
+        double start = nowUs();
+        if ((sock = benchConnect(port)) < 0 || (ssl = SSL_new(ctx)) == NULL || SSL_set_fd(ssl, sock) == 0 ||
+                sslConnectSession(ssl, "127.0.0.1", port) != 1) {
+            // connection error
+            fprintf(stderr, "resume: connection %d failed\n", i);
+            ERR_print_errors_fp(stderr);
+            sslClose(ssl, sock, NULL, false);
+            shutdown(srv.sock, SHUT_RDWR);  // wake up the server
+            break;
+        }
+
+        // handshake time
+        double elapsed = nowUs() - start;
+        if (SSL_session_reused(ssl)) {
+            resumed_us += elapsed;
+            nresumed++;
+        }
+        else {
+            full_us += elapsed;
+            nfull++;
+        }
+
+        // a request/response exchange (the TLS 1.3 tickets are received here)
+        char buf[MYBUFSIZE];
+        if (sslWrite(ssl, "ping", 4) < 0 || sslRead(ssl, buf, sizeof(buf)) <= 0)
+            fprintf(stderr, "resume: exchange %d failed\n", i);
+
+        sslClose(ssl, sock, NULL, true);
+    }
+
+    pthread_join(tid, NULL);
+
+    // show the results
+    SslSessStats cli_stats, srv_stats;
+    sslSessionStats(ctx, &cli_stats);
+    sslSessionStats(srv.ctx, &srv_stats);
+    printf("resume: %d connections\n", nconn);
+    printf("resume: full handshake       %10.2f us (%d)\n", nfull ? full_us / nfull : 0.0, nfull);
+    printf("resume: resumed handshake    %10.2f us (%d)\n", nresumed ? resumed_us / nresumed : 0.0, nresumed);
+    printf("resume: client hit rate      %10.2f %% (%ld/%ld)\n", cli_stats.hit_rate, cli_stats.resumed,
+           cli_stats.handshakes);
+    printf("resume: server hit rate      %10.2f %% (%ld/%ld)\n", srv_stats.hit_rate, srv_stats.resumed,
+           srv_stats.handshakes);
+
+    sslReleaseCtx(ctx);
+    sslFlushSessions();
+    sslFlushCtx();
+    return EXIT_SUCCESS;
+}
+
+// benchEarly - time to first response of resumed connections with and without early data (0-RTT)
+static int benchEarly(int nconn)
+{
+    // start the loopback server accepting the early data
+    SslCtxOpts  opts = bench_opts;
+    BenchServer srv;
+    pthread_t   tid;
+    int         port;
+    opts.max_early_data = MYBUFSIZE;
+    if (benchServerStart(&srv, &tid, &opts, 2 * nconn + 1, &port) < 0)
+        return EXIT_FAILURE;
+
+    // create the client context
+    int error;
+    SSL_CTX *ctx;
+    if ((ctx = sslCreateCtxEx(SSL_CLIENT, &bench_opts, &error)) == NULL || error < 0) {
+        // context error
+        fprintf(stderr, "early: OpenSSL error creating the context SSL_CTX\n");
+        ERR_print_errors_fp(stderr);
+        sslReleaseCtx(ctx);
+        return EXIT_FAILURE;
+    }
+
+    // connection loop: the first connection gets the session, then resumed connections without and with early data
+    double elapsed[2] = { 0, 0 };
+    int    naccepted = 0;
+    for (int i = 0; i < 2 * nconn + 1; i++) {
+        bool use_early = i > nconn;
+        int  sock;
+        SSL  *ssl = NULL;
+        char buf[MYBUFSIZE];
+        double start = nowUs();
+        if ((sock = benchConnect(port)) < 0 || (ssl = SSL_new(ctx)) == NULL || SSL_set_fd(ssl, sock) == 0) {
+            // connection error
+            fprintf(stderr, "early: connection %d failed\n", i);
+            sslClose(ssl, sock, NULL, false);
+            shutdown(srv.sock, SHUT_RDWR);  // wake up the server
+            break;
+        }
+
+        // request (as early data or after the handshake) and response
+        int rc = use_early ? sslConnectEarly(ssl, "127.0.0.1", port, "ping", 4) :
+                             sslConnectSession(ssl, "127.0.0.1", port) == 1 ? sslWrite(ssl, "ping", 4) : -1;
+        if (rc < 0 || sslRead(ssl, buf, sizeof(buf)) <= 0) {
+            // exchange error
+            fprintf(stderr, "early: exchange %d failed\n", i);
+            ERR_print_errors_fp(stderr);
+            sslClose(ssl, sock, NULL, false);
+            shutdown(srv.sock, SHUT_RDWR);  // wake up the server
+            break;
+        }
+
+        // time to first response
+        if (i > 0)
+            elapsed[use_early] += nowUs() - start;
+
+        if (use_early && SSL_get_early_data_status(ssl) == SSL_EARLY_DATA_ACCEPTED)
+            naccepted++;
+
+        sslClose(ssl, sock, NULL, true);
+    }
+
+    pthread_join(tid, NULL);
+
+    // show the results
+    printf("early: %d connections\n", nconn);
+    printf("early: resumed, no early data    %10.2f us to first response\n", elapsed[0] / nconn);
+    printf("early: resumed, early data       %10.2f us to first response (%d/%d accepted)\n", elapsed[1] / nconn,
+           naccepted, nconn);
+
+    sslReleaseCtx(ctx);
+    sslFlushSessions();
+    sslFlushCtx();
+    return EXIT_SUCCESS;
+}
+
+// benchServerFork - start a loopback echo server process serving nconn connections
+static pid_t benchServerFork(int sock, const SslCtxOpts *opts, int nconn)
+{
+    // create the process
+    pid_t pid;
+    if ((pid = fork()) != 0)
+        return pid;
+
+    // child: create the server context and serve the connections
+    BenchServer srv;
+    int error;
+    if ((srv.ctx = sslCreateCtxEx(SSL_SERVER, opts, &error)) == NULL || error < 0) {
+        // context error
+        fprintf(stderr, "server: OpenSSL error creating the context SSL_CTX\n");
+        ERR_print_errors_fp(stderr);
+        _exit(EXIT_FAILURE);
+    }
+
+    srv.sock  = sock;
+    srv.nconn = nconn;
+    srv.early = false;
+    benchServerThread(&srv);
+    _exit(EXIT_SUCCESS);
+}
+
+// benchTickets - two server processes share the ticket keys file: the client alternates the connections between the
+// two processes resuming always the last session, and in the middle of the test the keys are rotated (fails if a
+// connection isn't resumed, the rotation fails or a server process fails)
+static int benchTickets(int nconn)
+{
+    // at least two connections per process and per key
+    if (nconn < 4) {
+        fprintf(stderr, "tickets: at least 4 connections\n");
+        return EXIT_FAILURE;
+    }
+
+    // ticket keys file shared by the two server processes
+    char path[FILENAME_MAX];
+    snprintf(path, sizeof(path), "/tmp/myssl-bench-tickets-%d", (int)getpid());
+    SslCtxOpts opts = bench_opts;
+    opts.ticket_keys = path;
+
+    // start the two server processes
+    int   port[2], sock[2];
+    pid_t pid[2];
+    for (int i = 0; i < 2; i++) {
+        if ((sock[i] = benchListen(&port[i])) < 0 ||
+                (pid[i] = benchServerFork(sock[i], &opts, (nconn + 1 - i) / 2)) < 0) {
+            // socket/process error
+            fprintf(stderr, "tickets: could not start the server %d (%s)\n", i, strerror(errno));
+            return EXIT_FAILURE;
+        }
+
+        close(sock[i]);
+    }
+
+    // create the client context
+    int error;
+    SSL_CTX *ctx;
+    if ((ctx = sslCreateCtxEx(SSL_CLIENT, &bench_opts, &error)) == NULL || error < 0) {
+        // context error
+        fprintf(stderr, "tickets: OpenSSL error creating the context SSL_CTX\n");
+        ERR_print_errors_fp(stderr);
+        sslReleaseCtx(ctx);
+        return EXIT_FAILURE;
+    }
+
+    // connection loop: the session key is the same for both processes (like two processes on the same port)
+    int  nresumed[2] = { 0, 0 };
+    int  ndone = 0;
+    bool rotated = false;
+    for (int i = 0; i < nconn; i++) {
+        // rotate the keys in the middle of the test (the servers pick up the new key without restarting)
+        if (i == nconn / 2) {
+            if (! (rotated = sslTicketKeysRotate(path, 0) > 0))
+                fprintf(stderr, "tickets: key rotation failed\n");
+
+            sleep(2);
+        }
+
+        int  sock_cli;
+        SSL  *ssl = NULL;
+        char buf[MYBUFSIZE];
+        if ((sock_cli = benchConnect(port[i % 2])) < 0 || (ssl = SSL_new(ctx)) == NULL ||
+                SSL_set_fd(ssl, sock_cli) == 0 || sslConnectSession(ssl, "127.0.0.1", port[0]) != 1 ||
+                sslWrite(ssl, "ping", 4) < 0 || sslRead(ssl, buf, sizeof(buf)) <= 0) {
+            // connection error
+            fprintf(stderr, "tickets: connection %d failed\n", i);
+            ERR_print_errors_fp(stderr);
+            sslClose(ssl, sock_cli, NULL, false);
+            break;
+        }
+
+        if (SSL_session_reused(ssl))
+            nresumed[i >= nconn / 2]++;
+
+        ndone++;
+        sslClose(ssl, sock_cli, NULL, true);
+    }
+
+    // wait the server processes and remove the keys file
+    int nfailed = 0;
+    for (int i = 0; i < 2; i++) {
+        int status;
+        if (ndone < nconn)
+            kill(pid[i], SIGTERM);
+
+        if (waitpid(pid[i], &status, 0) < 0 || ! WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS)
+            nfailed++;
+    }
+
+    char lock_path[FILENAME_MAX + 8];
+    snprintf(lock_path, sizeof(lock_path), "%s.lock", path);
+    unlink(path);
+    unlink(lock_path);
+
+    // show the results (all the connections but the first one must be resumed)
+    printf("tickets: %d connections alternated between 2 server processes\n", nconn);
+    printf("tickets: resumed before key rotation   %d/%d\n", nresumed[0], nconn / 2 - 1);
+    printf("tickets: resumed after key rotation    %d/%d\n", nresumed[1], nconn - nconn / 2);
+    printf("tickets: server processes failed     %d\n", nfailed);
+    bool ok = ndone == nconn && rotated && nfailed == 0 && nresumed[0] + nresumed[1] == nconn - 1;
+    printf("tickets: cross-process resumption %s\n", ok ? "OK" : "FAILED");
+
+    sslReleaseCtx(ctx);
+    sslFlushSessions();
+    sslFlushCtx();
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// benchReloadThread - reload (and flush with reload_flush) the server context until stopped
+static volatile bool reload_stop = false;
+static volatile bool reload_flush = false;
+static int           reload_count = 0;
+static void* benchReloadThread(void *arg)
+{
+    while (! reload_stop) {
+        if (sslReloadCtx(SSL_SERVER, &bench_opts) == 0)
+            reload_count++;
+
+        if (reload_flush)
+            sslFlushCtx();
+    }
+
+    return NULL;
+}
+
+// benchBorrowThread - borrow the server context until stopped (lookups concurrent with the reloads and flushes)
+#define RELOAD_BORROWERS    3
+static void* benchBorrowThread(void *arg)
+{
+    int *failed = arg;
+    while (! reload_stop) {
+        int     error;
+        SSL_CTX *ctx;
+        SSL     *ssl = NULL;
+        if ((ctx = sslCreateCtxEx(SSL_SERVER, &bench_opts, &error)) == NULL || error < 0 ||
+                (ssl = SSL_new(ctx)) == NULL)
+            (*failed)++;
+
+        SSL_free(ssl);
+        sslReleaseCtx(ctx);
+    }
+
+    return NULL;
+}
+
+// benchReload - latency of the context borrow (the accept path) without and with concurrent reloads
+static int benchReload(int iterations)
+{
+    // borrow loop: without reloads, with a thread reloading the context and with a thread reloading and flushing
+    // the registry while other threads borrow the context (the freed contexts and entries must not be in use)
+    int failed[RELOAD_BORROWERS] = { 0 }, nfailed = 0;
+    for (int with_reload = 0; with_reload < 3; with_reload++) {
+        pthread_t tid, btids[RELOAD_BORROWERS];
+        int       nborrowers = 0;
+        reload_stop  = false;
+        reload_flush = with_reload == 2;
+        reload_count = 0;
+        if (with_reload && pthread_create(&tid, NULL, benchReloadThread, NULL) != 0)
+            return EXIT_FAILURE;
+
+        while (reload_flush && nborrowers < RELOAD_BORROWERS &&
+               pthread_create(&btids[nborrowers], NULL, benchBorrowThread, &failed[nborrowers]) == 0)
+            nborrowers++;
+
+        double total_us = 0, max_us = 0;
+        int    nchanged = 0;
+        SSL_CTX *last = NULL;
+        for (int i = 0; i < iterations; i++) {
+            int error;
+            SSL_CTX *ctx;
+            double start = nowUs();
+            if ((ctx = sslCreateCtxEx(SSL_SERVER, &bench_opts, &error)) == NULL || error < 0) {
+                // context error
+                fprintf(stderr, "reload: OpenSSL error creating the context SSL_CTX\n");
+                ERR_print_errors_fp(stderr);
+                sslReleaseCtx(ctx);
+                return EXIT_FAILURE;
+            }
+
+            // the borrow (and a SSL structure creation) must not wait the reload
+            SSL *ssl = SSL_new(ctx);
+            double elapsed = i > 0 ? nowUs() - start : 0;     // the first call builds the context
+            total_us += elapsed;
+            max_us = elapsed > max_us ? elapsed : max_us;
+            nchanged += i > 0 && ctx != last;
+            last = ctx;
+            SSL_free(ssl);
+            sslReleaseCtx(ctx);
+        }
+
+        if (with_reload) {
+            reload_stop = true;
+            pthread_join(tid, NULL);
+        }
+
+        for (int t = 0; t < nborrowers; t++) {
+            pthread_join(btids[t], NULL);
+            nfailed += failed[t];
+        }
+
+        printf("reload: %s   avg %8.2f us   max %8.2f us   (%d reloads, %d new contexts picked up)\n",
+               with_reload == 0 ? "without reloads  " : with_reload == 1 ? "with reloads     " : "reloads + flushes",
+               total_us / (iterations - 1), max_us, reload_count, nchanged);
+        if (reload_flush && nborrowers < RELOAD_BORROWERS)
+            nfailed++;
+    }
+
+    printf("reload: concurrent borrows %s (%d failed)\n", nfailed ? "FAILED" : "OK", nfailed);
+    sslFlushCtx();
+    return nfailed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+// benchCertGen - generate a self-signed certificate and its private-key (EVP_PKEY_EC = P-256, EVP_PKEY_ED25519)
+static int benchCertGen(int type, const char *cert, const char *key)
+{
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+    // generate the key pair
+    EVP_PKEY     *pkey = NULL;
+    EVP_PKEY_CTX *pctx = EVP_PKEY_CTX_new_id(type, NULL);
+    if (pctx == NULL || EVP_PKEY_keygen_init(pctx) != 1 ||
+            (type == EVP_PKEY_EC && EVP_PKEY_CTX_set_ec_paramgen_curve_nid(pctx, NID_X9_62_prime256v1) != 1) ||
+            EVP_PKEY_keygen(pctx, &pkey) != 1) {
+        EVP_PKEY_CTX_free(pctx);
+        return -1;
+    }
+
+    EVP_PKEY_CTX_free(pctx);
+
+    // build and sign the certificate (Ed25519 doesn't use a separate digest)
+    X509 *x509 = X509_new();
+    int  rc    = -1;
+    if (x509 && X509_set_version(x509, 2) == 1 && ASN1_INTEGER_set(X509_get_serialNumber(x509), 1) == 1 &&
+            X509_gmtime_adj(X509_getm_notBefore(x509), -3600) && X509_gmtime_adj(X509_getm_notAfter(x509), 86400) &&
+            X509_NAME_add_entry_by_txt(X509_get_subject_name(x509), "CN", MBSTRING_ASC,
+                                       (const unsigned char *)"localhost", -1, -1, 0) == 1 &&
+            X509_set_issuer_name(x509, X509_get_subject_name(x509)) == 1 && X509_set_pubkey(x509, pkey) == 1 &&
+            X509_sign(x509, pkey, type == EVP_PKEY_EC ? EVP_sha256() : NULL) > 0) {
+        // write the certificate and the private-key
+        FILE *fp_cert = fopen(cert, "w"), *fp_key = fopen(key, "w");
+        if (fp_cert && fp_key && PEM_write_X509(fp_cert, x509) == 1 &&
+                PEM_write_PrivateKey(fp_key, pkey, NULL, NULL, 0, NULL, NULL) == 1)
+            rc = 0;
+
+        if (fp_cert)
+            fclose(fp_cert);
+
+        if (fp_key)
+            fclose(fp_key);
+    }
+
+    X509_free(x509);
+    EVP_PKEY_free(pkey);
+    return rc;
+#else
+    (void)type, (void)cert, (void)key;
+    return -1;
+#endif
+}
+
+// benchHandshakeRun - full handshakes per second between a server and a client context (no resumption)
+static double benchHandshakeRun(const SslCtxOpts *srv_opts, const SslCtxOpts *cli_opts, int nconn)
+{
+    // start the loopback server
+    BenchServer srv;
+    pthread_t   tid;
+    int         port;
+    if (benchServerStart(&srv, &tid, srv_opts, nconn, &port) < 0)
+        return -1;
+
+    // create the client context
+    int error;
+    SSL_CTX *ctx;
+    if ((ctx = sslCreateCtxEx(SSL_CLIENT, cli_opts, &error)) == NULL || error < 0) {
+        // context error
+        fprintf(stderr, "handshake: OpenSSL error creating the context SSL_CTX\n");
+        ERR_print_errors_fp(stderr);
+        sslReleaseCtx(ctx);
+        shutdown(srv.sock, SHUT_RDWR);  // wake up the server
+        pthread_join(tid, NULL);
+        return -1;
+    }
+
+    // connection loop: full handshakes only (no stored session is used)
+    double start = nowUs();
+    int    i;
+    for (i = 0; i < nconn; i++) {
+        int sock;
+        SSL *ssl = NULL;
+        if ((sock = benchConnect(port)) < 0 || (ssl = SSL_new(ctx)) == NULL || SSL_set_fd(ssl, sock) == 0 ||
+                sslFunc(SSL_connect, ssl) != 1) {
+            // connection error
+            fprintf(stderr, "handshake: connection %d failed\n", i);
+            ERR_print_errors_fp(stderr);
+            sslClose(ssl, sock, NULL, false);
+            shutdown(srv.sock, SHUT_RDWR);  // wake up the server
+            break;
+        }
+
+        sslClose(ssl, sock, NULL, true);
+    }
+
+    double elapsed = nowUs() - start;
+    pthread_join(tid, NULL);
+    sslReleaseCtx(ctx);
+    return i == nconn ? nconn * 1000000.0 / elapsed : -1;
+}
+
+// benchHandshake - full handshakes per second for each server certificate type (RSA, ECDSA P-256, Ed25519, RSA +
+// ECDSA) and handshake profile. The ECDSA and Ed25519 certificates are self-signed and generated in /tmp
+static int benchHandshake(int nconn)
+{
+    // an unknown profile must be refused
+    int        error;
+    SslCtxOpts opts = bench_opts;
+    opts.profile = "bogus";
+    SSL_CTX *ctx = sslCreateCtxEx(SSL_SERVER, &opts, &error);
+    sslReleaseCtx(ctx);
+    if (ctx && error == 0) {
+        fprintf(stderr, "handshake: unknown profile accepted\n");
+        return EXIT_FAILURE;
+    }
+
+    // generate the test certificates
+    char ec_cert[FILENAME_MAX], ec_key[FILENAME_MAX], ed_cert[FILENAME_MAX], ed_key[FILENAME_MAX];
+    snprintf(ec_cert, sizeof(ec_cert), "/tmp/mybench-%d-ecdsa.pem", (int)getpid());
+    snprintf(ec_key, sizeof(ec_key), "/tmp/mybench-%d-ecdsa.key", (int)getpid());
+    snprintf(ed_cert, sizeof(ed_cert), "/tmp/mybench-%d-ed25519.pem", (int)getpid());
+    snprintf(ed_key, sizeof(ed_key), "/tmp/mybench-%d-ed25519.key", (int)getpid());
+    if (benchCertGen(EVP_PKEY_EC, ec_cert, ec_key) < 0 || benchCertGen(EVP_PKEY_ED25519, ed_cert, ed_key) < 0) {
+        // certificates error
+        fprintf(stderr, "handshake: could not generate the test certificates\n");
+        ERR_print_errors_fp(stderr);
+        unlink(ec_cert), unlink(ec_key), unlink(ed_cert), unlink(ed_key);
+        return EXIT_FAILURE;
+    }
+
+    // certificate sets: server options and CA certificate of the client
+    struct {
+        const char *name;
+        SslCtxOpts srv;
+        const char *cacert;
+    } certs[] = {
+        { "RSA",          { BENCH_CERT, BENCH_KEY },                                  BENCH_CACERT },
+        { "ECDSA P-256",  { ec_cert, ec_key },                                        ec_cert },
+        { "Ed25519",      { ed_cert, ed_key },                                        ed_cert },
+        { "RSA + ECDSA",  { BENCH_CERT, BENCH_KEY, .cert2 = ec_cert, .key2 = ec_key }, ec_cert },
+    };
+
+    const char *profiles[] = { "default", "fast-handshake", "compat" };
+
+    // run the handshakes for each certificate set and profile (the client uses the same profile)
+    int rc = EXIT_SUCCESS;
+    printf("handshake: %d connections\n", nconn);
+    for (size_t i = 0; i < sizeof(certs) / sizeof(certs[0]) && rc == EXIT_SUCCESS; i++) {
+        for (size_t j = 0; j < sizeof(profiles) / sizeof(profiles[0]); j++) {
+            SslCtxOpts srv_opts = certs[i].srv, cli_opts = bench_opts;
+            srv_opts.profile    = profiles[j];
+            cli_opts.cacert     = certs[i].cacert;
+            cli_opts.profile    = profiles[j];
+            double rate;
+            if ((rate = benchHandshakeRun(&srv_opts, &cli_opts, nconn)) < 0) {
+                rc = EXIT_FAILURE;
+                break;
+            }
+
+            printf("handshake: %-12s %-15s %10.1f handshakes/sec\n", certs[i].name, profiles[j], rate);
+        }
+    }
+
+    // remove the test certificates
+    unlink(ec_cert), unlink(ec_key), unlink(ed_cert), unlink(ed_key);
+    sslFlushSessions();
+    sslFlushCtx();
+    return rc;
+}
+
+// data of the async benchmark: event loop server and clients
+#define ASYNC_CLIENTS   4           // number of client threads
+#define ASYNC_CONNS     64          // max number of connections of the event loop
+
+typedef struct {
+    int     sock;           // listening socket
+    int     port;           // listening port
+    int     nconn;          // connections to serve (and to open, for the clients)
+    SSL_CTX *ctx;           // server context
+    double  max_us;         // max time of a SSL_accept() call (event loop stall)
+    double  tot_us;         // total time of the SSL_accept() calls
+    int     ncalls;         // number of SSL_accept() calls
+    int     failed;         // failed connections
+} BenchAsync;
+
+// benchAsyncServer - single thread event loop server: non-blocking handshakes (resumed on SSL_ERROR_WANT_ASYNC when
+// the async fd is readable), then waits the client shutdown
+static void* benchAsyncServer(void *arg)
+{
+    BenchAsync *ba = arg;
+    SSL        *conns[ASYNC_CONNS] = { NULL };
+    short      events[ASYNC_CONNS];
+    bool       ready[ASYNC_CONNS];
+    int        served = 0, nopen = 0;
+
+    while (served < ba->nconn) {
+        // build the poll set: listening socket, then a socket or async fd per connection
+        struct pollfd pfds[ASYNC_CONNS + 1];
+        int           index[ASYNC_CONNS + 1];
+        int           npfds = 0;
+        if (nopen < ASYNC_CONNS) {
+            pfds[npfds].fd       = ba->sock;
+            pfds[npfds].events   = POLLIN;
+            index[npfds++]       = -1;
+        }
+
+        for (int i = 0; i < ASYNC_CONNS; i++) {
+            if (conns[i] == NULL)
+                continue;
+
+            OSSL_ASYNC_FD afd = -1;
+            size_t        nafd = 1;
+            if (events[i] == 0 && SSL_get_all_async_fds(conns[i], &afd, &nafd) == 1 && nafd == 1)
+                pfds[npfds].fd = afd, pfds[npfds].events = POLLIN;
+            else
+                pfds[npfds].fd = SSL_get_fd(conns[i]), pfds[npfds].events = events[i] ? events[i] : POLLIN;
+
+            index[npfds++] = i;
+        }
+
+        if (poll(pfds, npfds, 1000) <= 0)
+            break;
+
+        for (int i = 0; i < ASYNC_CONNS; i++)
+            ready[i] = false;
+
+        for (int i = 0; i < npfds; i++) {
+            if (pfds[i].revents == 0)
+                continue;
+
+            if (index[i] >= 0) {
+                ready[index[i]] = true;
+                continue;
+            }
+
+            // new connection (handshake in the event loop)
+            int slot;
+            for (slot = 0; conns[slot]; slot++)
+                ;
+
+            if ((conns[slot] = benchAccept(ba->sock, ba->ctx, false)) == NULL)
+                continue;
+
+            fcntl(SSL_get_fd(conns[slot]), F_SETFL, O_NONBLOCK);
+            SSL_set_accept_state(conns[slot]);
+            events[slot] = POLLIN;
+            ready[slot]  = true;
+            nopen++;
+        }
+
+        // step the ready connections
+        for (int i = 0; i < ASYNC_CONNS; i++) {
+            if (! ready[i])
+                continue;
+
+            SSL *ssl = conns[i];
+            int rc, err;
+            if (! SSL_is_init_finished(ssl)) {
+                // handshake step: time spent by the event loop inside OpenSSL
+                double start = nowUs();
+                rc = SSL_do_handshake(ssl);
+                double elapsed = nowUs() - start;
+                ba->tot_us += elapsed;
+                ba->ncalls++;
+                if (elapsed > ba->max_us)
+                    ba->max_us = elapsed;
+
+                if (rc == 1) {
+                    events[i] = POLLIN;
+                    continue;
+                }
+            }
+            else {
+                // wait the client shutdown
+                char buf[MYBUFSIZE];
+                rc = SSL_read(ssl, buf, sizeof(buf));
+            }
+
+            err = SSL_get_error(ssl, rc);
+            if (err == SSL_ERROR_WANT_READ)
+                events[i] = POLLIN;
+            else if (err == SSL_ERROR_WANT_WRITE)
+                events[i] = POLLOUT;
+            else if (err == SSL_ERROR_WANT_ASYNC)
+                events[i] = 0;
+            else {
+                // connection closed (or error)
+                if (! SSL_is_init_finished(ssl))
+                    ba->failed++;
+
+                sslClose(ssl, SSL_get_fd(ssl), NULL, false);
+                conns[i] = NULL;
+                nopen--;
+                served++;
+            }
+        }
+    }
+
+    // free the connections left open
+    for (int i = 0; i < ASYNC_CONNS; i++) {
+        if (conns[i])
+            sslClose(conns[i], SSL_get_fd(conns[i]), NULL, false);
+    }
+
+    return NULL;
+}
+
+// benchAsyncClient - blocking client: full handshakes (the connections are shared among the client threads)
+static void* benchAsyncClient(void *arg)
+{
+    BenchAsync *ba = arg;
+    int        error;
+    SSL_CTX    *ctx;
+    if ((ctx = sslCreateCtxEx(SSL_CLIENT, &bench_opts, &error)) == NULL || error < 0) {
+        sslReleaseCtx(ctx);
+        return NULL;
+    }
+
+    for (int i = 0; i < ba->nconn / ASYNC_CLIENTS; i++) {
+        int sock;
+        SSL *ssl = NULL;
+        if ((sock = benchConnect(ba->port)) < 0 || (ssl = SSL_new(ctx)) == NULL || SSL_set_fd(ssl, sock) == 0 ||
+                sslFunc(SSL_connect, ssl) != 1) {
+            sslClose(ssl, sock, NULL, false);
+            continue;
+        }
+
+        sslClose(ssl, sock, NULL, true);
+    }
+
+    sslReleaseCtx(ctx);
+    return NULL;
+}
+
+// benchAsyncRun - event loop server with the given crypto pool threads (0 = private-key operations inline)
+static int benchAsyncRun(int workers, int nconn)
+{
+    BenchAsync ba;
+    memset(&ba, 0, sizeof(ba));
+    ba.nconn = nconn - nconn % ASYNC_CLIENTS;
+
+    // create the server context and the listening socket
+    int        error;
+    SslCtxOpts opts = bench_opts;
+    opts.async_workers = workers;
+    if ((ba.ctx = sslCreateCtxEx(SSL_SERVER, &opts, &error)) == NULL || error < 0) {
+        // context error
+        fprintf(stderr, "async: OpenSSL error creating the context SSL_CTX\n");
+        ERR_print_errors_fp(stderr);
+        sslReleaseCtx(ba.ctx);
+        return -1;
+    }
+
+    if ((ba.sock = benchListen(&ba.port)) < 0) {
+        fprintf(stderr, "async: could not start the server (%s)\n", strerror(errno));
+        sslReleaseCtx(ba.ctx);
+        return -1;
+    }
+
+    // run the server and the clients
+    pthread_t srv_tid, cli_tid[ASYNC_CLIENTS];
+    double    start = nowUs();
+    pthread_create(&srv_tid, NULL, benchAsyncServer, &ba);
+    for (int i = 0; i < ASYNC_CLIENTS; i++)
+        pthread_create(&cli_tid[i], NULL, benchAsyncClient, &ba);
+
+    for (int i = 0; i < ASYNC_CLIENTS; i++)
+        pthread_join(cli_tid[i], NULL);
+
+    pthread_join(srv_tid, NULL);
+    double elapsed = nowUs() - start;
+
+    // show the results
+    printf("async: %-26s %8.1f handshakes/sec   stall avg %8.2f us   max %8.2f us   (%d failed)\n",
+           workers ? "offloaded private-keys" : "inline private-keys", ba.nconn * 1e6 / elapsed,
+           ba.ncalls ? ba.tot_us / ba.ncalls : 0.0, ba.max_us, ba.failed);
+
+    close(ba.sock);
+    sslReleaseCtx(ba.ctx);
+    return ba.failed ? -1 : 0;
+}
+
+// benchAsync - time the event loop thread spends inside the handshake steps (the other connections wait) with the
+// private-key operations inline and offloaded to the crypto thread pool
+static int benchAsync(int nconn)
+{
+    // the blocking functions (sslFunc()) resume the handshake too
+    SslCtxOpts srv_opts = bench_opts;
+    srv_opts.async_workers = 2;
+    if (benchHandshakeRun(&srv_opts, &bench_opts, 10) < 0) {
+        fprintf(stderr, "async: blocking handshake with offloaded private-key failed\n");
+        return EXIT_FAILURE;
+    }
+
+    // event loop server
+    printf("async: %d connections, %d client threads\n", nconn, ASYNC_CLIENTS);
+    int rc = benchAsyncRun(0, nconn) < 0 || benchAsyncRun(2, nconn) < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+    sslFlushSessions();
+    sslFlushCtx();
+    return rc;
+}
+
+// max duration accepted for a timeout of the deadline bench (the timeouts are 50..150 ms)
+#define DEADLINE_SLACK_MS   1000
+
+// benchDeadline - the blocking operations on a socket with fd > 1024 (select() can't be used): wake-up latency of a
+// request/response exchange, accuracy of the per-call and per-connection timeouts and status of the failures
+static int benchDeadline(int iterations)
+{
+    // allow the fds > 1024
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) < 0 || rl.rlim_max < 2048) {
+        fprintf(stderr, "deadline: the fds limit is too low\n");
+        return EXIT_FAILURE;
+    }
+
+    rl.rlim_cur = rl.rlim_max < 4096 ? rl.rlim_max : 4096;
+    setrlimit(RLIMIT_NOFILE, &rl);
+
+    // start the loopback server and create the client context
+    BenchServer srv;
+    pthread_t   tid;
+    int         port, error;
+    SSL_CTX     *ctx;
+    if (benchServerStart(&srv, &tid, &bench_opts, 1, &port) < 0)
+        return EXIT_FAILURE;
+
+    if ((ctx = sslCreateCtxEx(SSL_CLIENT, &bench_opts, &error)) == NULL || error < 0) {
+        // context error
+        fprintf(stderr, "deadline: OpenSSL error creating the context SSL_CTX\n");
+        ERR_print_errors_fp(stderr);
+        sslReleaseCtx(ctx);
+        shutdown(srv.sock, SHUT_RDWR);  // wake up the server
+        pthread_join(tid, NULL);
+        return EXIT_FAILURE;
+    }
+
+    // connect and move the socket to a fd > 1024
+    int  sock, high = -1, rc = EXIT_FAILURE;
+    SSL  *ssl = NULL;
+    char buf[MYBUFSIZE];
+    if ((sock = benchConnect(port)) >= 0) {
+        high = fcntl(sock, F_DUPFD, 1500);
+        close(sock);
+    }
+
+    if (high < FD_SETSIZE) {
+        fprintf(stderr, "deadline: fd %d is not above FD_SETSIZE (%d)\n", high, FD_SETSIZE);
+        goto end;
+    }
+
+    if ((ssl = SSL_new(ctx)) == NULL || SSL_set_fd(ssl, high) == 0 || sslFunc(SSL_connect, ssl) != 1) {
+        fprintf(stderr, "deadline: connection on fd %d failed\n", high);
+        ERR_print_errors_fp(stderr);
+        goto end;
+    }
+
+    // wake-up latency: request/response exchanges (two blocking waits per exchange)
+    double tot_us = 0, max_us = 0;
+    for (int i = 0; i < iterations; i++) {
+        double start = nowUs();
+        if (sslWrite(ssl, "ping", 4) != 4 || sslRead(ssl, buf, sizeof(buf)) != 4) {
+            fprintf(stderr, "deadline: exchange %d failed (status %d)\n", i, sslStatus(ssl));
+            goto end;
+        }
+
+        double elapsed = nowUs() - start;
+        tot_us += elapsed;
+        if (elapsed > max_us)
+            max_us = elapsed;
+    }
+
+    printf("deadline: fd %d, %d exchanges\n", high, iterations);
+    printf("deadline: round trip             avg %8.2f us   max %8.2f us\n", tot_us / iterations, max_us);
+
+    // per-call timeout: nothing to read
+    double start = nowUs();
+    int    result = sslReadEx(ssl, buf, sizeof(buf), 100);
+    double elapsed_ms = (nowUs() - start) / 1000;
+    printf("deadline: sslReadEx(100 ms)      %8.2f ms   status %s\n", elapsed_ms,
+           sslStatus(ssl) == SSL_STATUS_TIMEOUT ? "TIMEOUT" : "unexpected");
+    if (result > 0 || sslStatus(ssl) != SSL_STATUS_TIMEOUT || elapsed_ms < 100 || elapsed_ms > DEADLINE_SLACK_MS) {
+        fprintf(stderr, "deadline: sslReadEx(100 ms) failed\n");
+        goto end;
+    }
+
+    // per-connection timeout
+    sslSetTimeout(ssl, 50);
+    start      = nowUs();
+    result     = sslRead(ssl, buf, sizeof(buf));
+    elapsed_ms = (nowUs() - start) / 1000;
+    printf("deadline: sslRead(50 ms conn)    %8.2f ms   status %s\n", elapsed_ms,
+           sslStatus(ssl) == SSL_STATUS_TIMEOUT ? "TIMEOUT" : "unexpected");
+    if (result > 0 || sslStatus(ssl) != SSL_STATUS_TIMEOUT || elapsed_ms < 50 || elapsed_ms > DEADLINE_SLACK_MS) {
+        fprintf(stderr, "deadline: sslRead(50 ms conn) failed\n");
+        goto end;
+    }
+
+    // the connection is still usable after a timeout
+    if (sslWrite(ssl, "ping", 4) != 4 || sslRead(ssl, buf, sizeof(buf)) != 4 || sslStatus(ssl) != SSL_STATUS_OK) {
+        fprintf(stderr, "deadline: exchange after the timeouts failed (status %d)\n", sslStatus(ssl));
+        goto end;
+    }
+
+    // peer closed: a plain TCP server closes the connection during the handshake
+    int  lsock, lport, csock, asock;
+    bool closed_ok = false, silent_ok = false;
+    SSL  *cssl = NULL;
+    if ((lsock = benchListen(&lport)) >= 0 && (csock = benchConnect(lport)) >= 0) {
+        if ((asock = accept(lsock, NULL, NULL)) >= 0)
+            close(asock);
+
+        if ((cssl = SSL_new(ctx)) != NULL && SSL_set_fd(cssl, csock) == 1) {
+            result = sslFunc(SSL_connect, cssl);
+            printf("deadline: handshake, peer closed            status %s\n",
+                   sslStatus(cssl) == SSL_STATUS_CLOSED ? "CLOSED" : "unexpected");
+            closed_ok = result != 1 && sslStatus(cssl) == SSL_STATUS_CLOSED;
+        }
+
+        ERR_clear_error();
+        sslClose(cssl, csock, NULL, false);
+    }
+
+    // silent peer: without sslSetTimeout() the handshake ends at the timeout of the context (never infinite)
+    SslCtxOpts topts = bench_opts;
+    SSL_CTX    *tctx = NULL;
+    topts.io_timeout = 150;
+    cssl             = NULL;
+    if (lsock >= 0 && (csock = benchConnect(lport)) >= 0) {
+        if ((tctx = sslCreateCtxEx(SSL_CLIENT, &topts, &error)) != NULL && error == 0 &&
+            (cssl = SSL_new(tctx)) != NULL && SSL_set_fd(cssl, csock) == 1) {
+            start      = nowUs();
+            result     = sslFunc(SSL_connect, cssl);
+            elapsed_ms = (nowUs() - start) / 1000;
+            printf("deadline: handshake, silent peer %8.2f ms   status %s\n", elapsed_ms,
+                   sslStatus(cssl) == SSL_STATUS_TIMEOUT ? "TIMEOUT" : "unexpected");
+            silent_ok = result != 1 && sslStatus(cssl) == SSL_STATUS_TIMEOUT && elapsed_ms >= 150 &&
+                        elapsed_ms <= DEADLINE_SLACK_MS;
+        }
+
+        ERR_clear_error();
+        sslClose(cssl, csock, NULL, false);
+        sslReleaseCtx(tctx);
+    }
+
+    if (lsock >= 0)
+        close(lsock);
+
+    if (closed_ok && silent_ok)
+        rc = EXIT_SUCCESS;
+    else
+        fprintf(stderr, "deadline: %s failed\n", closed_ok ? "silent peer" : "peer closed");
+
+end:
+    // close the connection and wait the server
+    sslClose(ssl, high, NULL, ssl != NULL);
+    shutdown(srv.sock, SHUT_RDWR);  // wake up the server (in case of error)
+    pthread_join(tid, NULL);
+    sslReleaseCtx(ctx);
+    sslFlushSessions();
+    sslFlushCtx();
+    return rc;
+}
+
+// benchProcStatus - numeric field of the process status (e.g.: "VmRSS:" in KB, "Threads:")
+static long benchProcStatus(const char *field)
+{
+    FILE   *fp;
+    char   line[128];
+    long   value = 0;
+    size_t len = strlen(field);
+    if ((fp = fopen("/proc/self/status", "r")) == NULL)
+        return 0;
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        if (strncmp(line, field, len) == 0) {
+            value = atol(line + len);
+            break;
+        }
+    }
+
+    fclose(fp);
+    return value;
+}
+
+// dati del client del benchmark reactor
+typedef struct {
+    SslReactor *reactor;    // reactor dei client
+    int        nconn;       // numero connessioni
+    int        connected;   // handshake completati
+    int        resumed;     // handshake abbreviati
+    int        failed;      // handshake falliti
+    int        pongs;       // risposte ricevute
+    int        expected;    // risposte attese
+    double     last_us;     // istante dell'ultimo handshake completato
+} BenchReactor;
+
+static volatile bool reactor_stop = false;
+
+// benchReactorEcho - server callback: echo of the received data, close on disconnection
+static void benchReactorEcho(SslConn *conn, int event, void *arg)
+{
+    (void)arg;
+    if (event != SSL_EV_READ)
+        return;
+
+    // read until the socket is drained (edge-triggered) and send back the data
+    char buf[MYBUFSIZE];
+    int  rcvd;
+    while ((rcvd = sslReadStep(sslConnSsl(conn), buf, sizeof(buf))) > 0)
+        sslWriteStep(sslConnSsl(conn), buf, rcvd);
+
+    if (rcvd == SSL_STEP_CLOSED || rcvd == SSL_STEP_ERROR)
+        sslConnClose(conn, false);
+}
+
+// benchReactorClient - client callback: count the handshakes and the responses
+static void benchReactorClient(SslConn *conn, int event, void *arg)
+{
+    BenchReactor *bench = arg;
+    char         buf[MYBUFSIZE];
+    int          rcvd;
+    switch (event) {
+    case SSL_EV_CONNECTED:
+        bench->connected++;
+        bench->resumed += SSL_session_reused(sslConnSsl(conn));
+        bench->last_us  = nowUs();
+        break;
+
+    case SSL_EV_READ:
+        // the session tickets are consumed here too (post-handshake messages)
+        while ((rcvd = sslReadStep(sslConnSsl(conn), buf, sizeof(buf))) > 0)
+            bench->pongs++;
+
+        if (rcvd == SSL_STEP_CLOSED || rcvd == SSL_STEP_ERROR) {
+            bench->failed++;
+            sslConnClose(conn, false);
+        }
+
+        break;
+
+    case SSL_EV_CLOSED:
+        bench->failed++;
+        break;
+    }
+
+    // all the expected events received
+    if (bench->connected + bench->failed >= bench->nconn && bench->pongs >= bench->expected)
+        sslReactorStop(bench->reactor);
+}
+
+// benchReactorServer - server reactor thread (until reactor_stop)
+static void* benchReactorServer(void *arg)
+{
+    SslReactor *reactor = arg;
+    while (! reactor_stop && sslReactorRun(reactor, 100) == 0)
+        ;
+
+    return NULL;
+}
+
+// benchReactor - nconn loopback connections handled by two reactors (server thread and client): handshakes/sec
+// with session resumption, memory per connection and one round trip on all the connections
+static int benchReactor(int nconn)
+{
+    // allow two fds per connection (client and server are in the same process)
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+        if (nconn > (int)((rl.rlim_cur - 64) / 2))
+            nconn = (int)((rl.rlim_cur - 64) / 2);
+    }
+
+    // create the contexts, the reactors and the listening socket
+    SSL_CTX      *sctx, *cctx;
+    SslReactor   *server = NULL;
+    BenchReactor bench;
+    int          error, lsock, port, rc = EXIT_FAILURE;
+    pthread_t    tid;
+    memset(&bench, 0, sizeof(bench));
+    bench.nconn = nconn;
+    sctx = sslCreateCtxEx(SSL_SERVER, &bench_opts, &error);
+    cctx = sslCreateCtxEx(SSL_CLIENT, &bench_opts, &error);
+    if (sctx == NULL || cctx == NULL || (server = sslReactorNew()) == NULL ||
+            (bench.reactor = sslReactorNew()) == NULL || (lsock = benchListen(&port)) < 0 ||
+            sslReactorListen(server, lsock, sctx, benchReactorEcho, NULL) < 0 ||
+            pthread_create(&tid, NULL, benchReactorServer, server) != 0) {
+        fprintf(stderr, "reactor: setup failed\n");
+        ERR_print_errors_fp(stderr);
+        return EXIT_FAILURE;
+    }
+
+    // warm-up connection (blocking functions): get a session to resume
+    int         sock;
+    SSL         *ssl = NULL;
+    SSL_SESSION *sess = NULL;
+    SslConn     **conns = NULL;
+    char        buf[MYBUFSIZE];
+    if ((sock = benchConnect(port)) >= 0 && (ssl = SSL_new(cctx)) != NULL && SSL_set_fd(ssl, sock) == 1 &&
+            sslFunc(SSL_connect, ssl) == 1 && sslWrite(ssl, "ping", 4) == 4 && sslRead(ssl, buf, sizeof(buf)) == 4)
+        sess = SSL_get1_session(ssl);
+
+    sslClose(ssl, sock, NULL, ssl != NULL);
+    if (sess == NULL) {
+        fprintf(stderr, "reactor: warm-up connection failed\n");
+        goto end;
+    }
+
+    // connect all the clients (the handshakes run in the reactors)
+    long   rss_start = benchProcStatus("VmRSS:");
+    double start = nowUs();
+    if ((conns = calloc(nconn, sizeof(SslConn*))) == NULL)
+        goto end;
+
+    for (int i = 0; i < nconn; i++) {
+        if ((sock = benchConnect(port)) < 0 ||
+                (conns[i] = sslReactorAdd(bench.reactor, sock, cctx, SSL_CLIENT, benchReactorClient, &bench)) == NULL) {
+            fprintf(stderr, "reactor: connection %d failed\n", i);
+            if (sock >= 0)
+                close(sock);
+
+            goto end;
+        }
+
+        SSL_set_session(sslConnSsl(conns[i]), sess);
+    }
+
+    if (sslReactorRun(bench.reactor, 60000) < 0 || bench.connected != nconn) {
+        fprintf(stderr, "reactor: %d/%d handshakes completed\n", bench.connected, nconn);
+        goto end;
+    }
+
+    double hs_us  = bench.last_us - start;
+    long   rss_kb = benchProcStatus("VmRSS:") - rss_start;
+
+    // one round trip on all the connections
+    start          = nowUs();
+    bench.expected = nconn;
+    for (int i = 0; i < nconn; i++) {
+        if (sslWriteStep(sslConnSsl(conns[i]), "ping", 4) != 4) {
+            fprintf(stderr, "reactor: request %d failed\n", i);
+            goto end;
+        }
+    }
+
+    if (sslReactorRun(bench.reactor, 60000) < 0 || bench.pongs != nconn) {
+        fprintf(stderr, "reactor: %d/%d responses received\n", bench.pongs, nconn);
+        goto end;
+    }
+
+    double rt_us = nowUs() - start;
+
+    // show the results
+    printf("reactor: %d connections, %d resumed\n", nconn, bench.resumed);
+    printf("reactor: handshakes     %10.0f hs/s      (%.2f s)\n", nconn / (hs_us / 1e6), hs_us / 1e6);
+    printf("reactor: memory         %10.2f KB/connection (client + server side)\n", (double)rss_kb / nconn);
+    printf("reactor: round trip all %10.2f ms        (%.2f us/connection)\n", rt_us / 1000, rt_us / nconn);
+    rc = EXIT_SUCCESS;
+
+end:
+    // close the clients, then stop the server (it closes the connections of the disconnected clients)
+    sslReactorFree(bench.reactor);
+    reactor_stop = true;
+    pthread_join(tid, NULL);
+    sslReactorFree(server);
+    SSL_SESSION_free(sess);
+    free(conns);
+    sslReleaseCtx(sctx);
+    sslReleaseCtx(cctx);
+    sslFlushSessions();
+    sslFlushCtx();
+    return rc;
+}
+
+// connessioni del benchmark uring
+#define URING_CONNS     64          // connessioni contemporanee
+#define URING_MSGSIZE   64          // dimensione dei messaggi
+
+// dati di un lato (client o server) del benchmark uring
+typedef struct {
+    SslReactor    *reactor;         // reactor
+    int           nconn;            // numero connessioni (client)
+    int           connected;        // handshake completati
+    int           failed;           // connessioni fallite
+    int           done;             // connessioni che hanno completato i round trip (client)
+    bool          running;          // round trip in corso (client)
+    BenchBio      bio;              // chiamate del BIO socket (contate con il backend epoll: una syscall ciascuna)
+} BenchUring;
+
+// stato di una connessione client del benchmark uring (SSL_set_app_data())
+typedef struct {
+    int left;                       // round trip da eseguire
+    int rcvd;                       // byte ricevuti della risposta corrente
+} BenchUringConn;
+
+// benchUringEcho - server callback: echo of the received messages
+static void benchUringEcho(SslConn *conn, int event, void *arg)
+{
+    BenchUring *bench = arg;
+    SSL        *ssl   = sslConnSsl(conn);
+    if (event == SSL_EV_CONNECTED && bench->bio.on)
+        benchBioWatch(ssl, &bench->bio);
+
+    if (event != SSL_EV_READ)
+        return;
+
+    // read until the connection is drained (edge-triggered) and send back the data
+    char buf[MYBUFSIZE];
+    int  rcvd;
+    while ((rcvd = sslReadStep(ssl, buf, sizeof(buf))) > 0)
+        sslWriteStep(ssl, buf, rcvd);
+
+    if (rcvd == SSL_STEP_CLOSED || rcvd == SSL_STEP_ERROR)
+        sslConnClose(conn, false);
+}
+
+// benchUringClient - client callback: a request after each complete response until the round trips are done
+static void benchUringClient(SslConn *conn, int event, void *arg)
+{
+    BenchUring     *bench = arg;
+    SSL            *ssl   = sslConnSsl(conn);
+    BenchUringConn *state = SSL_get_app_data(ssl);
+    char           buf[MYBUFSIZE];
+    int            rcvd;
+    switch (event) {
+    case SSL_EV_CONNECTED:
+        bench->connected++;
+        if (bench->bio.on)
+            benchBioWatch(ssl, &bench->bio);
+
+        break;
+
+    case SSL_EV_READ:
+        while ((rcvd = sslReadStep(ssl, buf, sizeof(buf))) > 0) {
+            // complete response: next request
+            if ((state->rcvd += rcvd) < URING_MSGSIZE)
+                continue;
+
+            state->rcvd = 0;
+            if (--state->left > 0) {
+                memset(buf, 'x', URING_MSGSIZE);
+                sslWriteStep(ssl, buf, URING_MSGSIZE);
+            } else {
+                bench->done++;
+            }
+        }
+
+        if (rcvd == SSL_STEP_CLOSED || rcvd == SSL_STEP_ERROR) {
+            bench->failed++;
+            sslConnClose(conn, false);
+        }
+
+        break;
+
+    case SSL_EV_CLOSED:
+        bench->failed++;
+        break;
+    }
+
+    // all the connections connected (first phase) or all the round trips done (second phase)
+    if (bench->failed > 0 || (bench->connected == bench->nconn && (! bench->running || bench->done == bench->nconn)))
+        sslReactorStop(bench->reactor);
+}
+
+// benchUringRun - nconn connections between a server and a client reactor with the backend, rounds request/response
+// exchanges on each connection: messages/sec and syscalls/message (both sides, handshakes excluded)
+static int benchUringRun(int backend, int nconn, int rounds, double *rate, double *syscalls)
+{
+    // create the contexts, the reactors and the listening socket
+    BenchUring     server, client;
+    BenchUringConn *states;
+    SslConn        **conns = NULL;
+    SSL_CTX        *sctx, *cctx;
+    int            error, lsock, port, rc = -1;
+    pthread_t      tid;
+    bool           started = false;
+    memset(&server, 0, sizeof(server));
+    memset(&client, 0, sizeof(client));
+    client.nconn     = nconn;
+    server.bio.on = client.bio.on = backend == SSL_REACTOR_EPOLL;
+    reactor_stop     = false;
+    states = calloc(nconn, sizeof(BenchUringConn));
+    sctx   = sslCreateCtxEx(SSL_SERVER, &bench_opts, &error);
+    cctx   = sslCreateCtxEx(SSL_CLIENT, &bench_opts, &error);
+    if (states == NULL || sctx == NULL || cctx == NULL ||
+            (server.reactor = sslReactorNewEx(backend, nconn + 1)) == NULL ||
+            (client.reactor = sslReactorNewEx(backend, nconn)) == NULL || (lsock = benchListen(&port)) < 0 ||
+            sslReactorListen(server.reactor, lsock, sctx, benchUringEcho, &server) < 0 ||
+            pthread_create(&tid, NULL, benchReactorServer, server.reactor) != 0) {
+        fprintf(stderr, "uring: setup failed\n");
+        ERR_print_errors_fp(stderr);
+        goto end;
+    }
+
+    started = true;
+    if (sslReactorBackend(client.reactor) != backend) {
+        fprintf(stderr, "uring: io_uring not available (epoll backend in use)\n");
+        goto end;
+    }
+
+    // connect the clients
+    if ((conns = calloc(nconn, sizeof(SslConn*))) == NULL)
+        goto end;
+
+    for (int i = 0; i < nconn; i++) {
+        int sock;
+        if ((sock = benchConnect(port)) < 0 ||
+                (conns[i] = sslReactorAdd(client.reactor, sock, cctx, SSL_CLIENT, benchUringClient, &client)) == NULL) {
+            fprintf(stderr, "uring: connection %d failed\n", i);
+            if (sock >= 0)
+                close(sock);
+
+            goto end;
+        }
+
+        states[i].left = rounds;
+        SSL_set_app_data(sslConnSsl(conns[i]), &states[i]);
+    }
+
+    if (sslReactorRun(client.reactor, 60000) < 0 || client.connected != nconn) {
+        fprintf(stderr, "uring: %d/%d handshakes completed\n", client.connected, nconn);
+        goto end;
+    }
+
+    // let the server settle (session tickets) and take the syscalls count
+    usleep(100000);
+    unsigned long calls = sslReactorSyscalls(server.reactor) + sslReactorSyscalls(client.reactor) +
+                          server.bio.reads + server.bio.writes + client.bio.reads + client.bio.writes;
+
+    // exchanges: the first request on each connection, the next ones from the callback
+    client.running = true;
+    double start = nowUs();
+    char   msg[URING_MSGSIZE];
+    memset(msg, 'x', sizeof(msg));
+    for (int i = 0; i < nconn; i++)
+        sslWriteStep(sslConnSsl(conns[i]), msg, sizeof(msg));
+
+    if (sslReactorRun(client.reactor, 120000) < 0 || client.done != nconn) {
+        fprintf(stderr, "uring: %d/%d connections completed the exchanges\n", client.done, nconn);
+        goto end;
+    }
+
+    double elapsed = nowUs() - start;
+    usleep(100000);
+    calls = sslReactorSyscalls(server.reactor) + sslReactorSyscalls(client.reactor) + server.bio.reads +
+            server.bio.writes + client.bio.reads + client.bio.writes - calls;
+    *rate     = (double)nconn * rounds / (elapsed / 1e6);
+    *syscalls = (double)calls / ((double)nconn * rounds);
+    rc        = 0;
+
+end:
+    // close the clients, then stop the server
+    sslReactorFree(client.reactor);
+    reactor_stop = true;
+    if (started)
+        pthread_join(tid, NULL);
+
+    sslReactorFree(server.reactor);
+    free(conns);
+    free(states);
+    sslReleaseCtx(sctx);
+    sslReleaseCtx(cctx);
+    return rc;
+}
+
+// benchUring - request/response exchanges of small messages with the epoll backend (a syscall per record read or
+// written) and the io_uring backend (the operations of a events batch submitted together)
+static int benchUring(int nmsg)
+{
+    int    rounds = nmsg / URING_CONNS > 0 ? nmsg / URING_CONNS : 1;
+    double epoll_rate, epoll_calls, uring_rate, uring_calls;
+    if (benchUringRun(SSL_REACTOR_EPOLL, URING_CONNS, rounds, &epoll_rate, &epoll_calls) < 0 ||
+            benchUringRun(SSL_REACTOR_URING, URING_CONNS, rounds, &uring_rate, &uring_calls) < 0) {
+        sslFlushSessions();
+        sslFlushCtx();
+        return EXIT_FAILURE;
+    }
+
+    // show the results
+    printf("uring: %d connections, %d messages of %d bytes\n", URING_CONNS, URING_CONNS * rounds, URING_MSGSIZE);
+    printf("uring: epoll backend     %10.0f msg/s   %6.2f syscalls/msg\n", epoll_rate, epoll_calls);
+    printf("uring: io_uring backend  %10.0f msg/s   %6.2f syscalls/msg\n", uring_rate, uring_calls);
+    sslFlushSessions();
+    sslFlushCtx();
+    return EXIT_SUCCESS;
+}
+
+// generatore di carico del benchmark engine
+#define ENGINE_CLIENTS      8       // thread client
+#define ENGINE_EXCHANGES    10      // scambi richiesta/risposta per connessione
+#define ENGINE_MSGSIZE      64      // dimensione dei messaggi
+
+// dati di un thread client del benchmark engine
+typedef struct {
+    SSL_CTX *ctx;           // contesto client
+    int     port;           // porta del server engine
+    double  end_us;         // fine del test
+    long    handshakes;     // handshake completi
+    long    messages;       // scambi completati
+    long    failed;         // connessioni fallite
+} BenchLoad;
+
+// benchEngineEcho - server engine callback: echo of the received data
+static void benchEngineEcho(SslConn *conn, const void *buf, int num, void *arg)
+{
+    (void)arg;
+    if (num > 0)
+        sslWriteStep(sslConnSsl(conn), buf, num);
+}
+
+// benchEngineLoad - client thread: full handshakes and request/response exchanges until the end of the test
+static void* benchEngineLoad(void *arg)
+{
+    BenchLoad *load = arg;
+    char      msg[ENGINE_MSGSIZE], buf[MYBUFSIZE];
+    memset(msg, 'x', sizeof(msg));
+    while (nowUs() < load->end_us) {
+        // connect (full handshake: no session is reused)
+        int sock;
+        SSL *ssl = NULL;
+        if ((sock = benchConnect(load->port)) < 0 || (ssl = SSL_new(load->ctx)) == NULL ||
+                SSL_set_fd(ssl, sock) != 1 || sslFunc(SSL_connect, ssl) != 1) {
+            load->failed++;
+            ERR_clear_error();
+            sslClose(ssl, sock, NULL, false);
+            continue;
+        }
+
+        load->handshakes++;
+
+        // exchanges (the response can arrive in more records)
+        for (int i = 0; i < ENGINE_EXCHANGES; i++) {
+            int rcvd = 0, r = 0;
+            if (sslWrite(ssl, msg, sizeof(msg)) != sizeof(msg))
+                break;
+
+            while (rcvd < (int)sizeof(msg) && (r = sslRead(ssl, buf, sizeof(buf))) > 0)
+                rcvd += r;
+
+            if (r <= 0)
+                break;
+
+            load->messages++;
+        }
+
+        sslClose(ssl, sock, NULL, true);
+    }
+
+    return NULL;
+}
+
+// benchEngineRun - load test of a server engine with workers threads
+static int benchEngineRun(int workers, SSL_CTX *ctx, double seconds, double *hs_rate, double *msg_rate)
+{
+    // start the server engine
+    SslServerOpts sopts;
+    SslServer     *server;
+    memset(&sopts, 0, sizeof(sopts));
+    sopts.host    = "127.0.0.1";
+    sopts.workers = workers;
+    sopts.cb      = benchEngineEcho;
+    if ((server = sslServerStart(&sopts, &bench_opts)) == NULL) {
+        fprintf(stderr, "engine: server engine start failed (%s)\n", strerror(errno));
+        ERR_print_errors_fp(stderr);
+        return -1;
+    }
+
+    // run the client threads
+    BenchLoad load[ENGINE_CLIENTS];
+    pthread_t tids[ENGINE_CLIENTS];
+    double    start = nowUs();
+    int       nthreads = 0;
+    memset(load, 0, sizeof(load));
+    for (int i = 0; i < ENGINE_CLIENTS; i++) {
+        load[i].ctx    = ctx;
+        load[i].port   = sslServerPort(server);
+        load[i].end_us = start + seconds * 1e6;
+        if (pthread_create(&tids[i], NULL, benchEngineLoad, &load[i]) != 0)
+            break;
+
+        nthreads++;
+    }
+
+    long handshakes = 0, messages = 0, failed = 0;
+    for (int i = 0; i < nthreads; i++) {
+        pthread_join(tids[i], NULL);
+        handshakes += load[i].handshakes;
+        messages   += load[i].messages;
+        failed     += load[i].failed;
+    }
+
+    double elapsed = (nowUs() - start) / 1e6;
+    sslServerStop(server);
+    *hs_rate  = handshakes / elapsed;
+    *msg_rate = messages / elapsed;
+    return failed > 0 || handshakes == 0 ? -1 : 0;
+}
+
+// benchEngine - accepted handshakes/sec and messages/sec of the server engine with 1, 2, 4, ... workers (up to the
+// number of cores, at least 2): the rates should scale with the workers up to the cores
+static int benchEngine(int seconds)
+{
+    // create the client context
+    SSL_CTX *ctx;
+    int     error, ncpu = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if ((ctx = sslCreateCtxEx(SSL_CLIENT, &bench_opts, &error)) == NULL || error < 0) {
+        fprintf(stderr, "engine: OpenSSL error creating the context SSL_CTX\n");
+        ERR_print_errors_fp(stderr);
+        sslReleaseCtx(ctx);
+        return EXIT_FAILURE;
+    }
+
+    printf("engine: %d cores, %d client threads, %d exchanges of %d bytes per connection\n", ncpu, ENGINE_CLIENTS,
+           ENGINE_EXCHANGES, ENGINE_MSGSIZE);
+    int rc = EXIT_SUCCESS;
+    for (int workers = 1; workers <= (ncpu > 2 ? ncpu : 2); workers *= 2) {
+        double hs_rate, msg_rate;
+        if (benchEngineRun(workers, ctx, seconds > 0 ? seconds : 1, &hs_rate, &msg_rate) < 0) {
+            fprintf(stderr, "engine: load test with %d workers failed\n", workers);
+            rc = EXIT_FAILURE;
+            break;
+        }
+
+        printf("engine: %2d workers   %10.0f handshakes/s   %10.0f messages/s\n", workers, hs_rate, msg_rate);
+    }
+
+    sslReleaseCtx(ctx);
+    sslFlushSessions();
+    sslFlushCtx();
+    return rc;
+}
+
+// fasi del benchmark writev
+#define WRITEV_PHASES   4           // risposte con sslWrite()/sslWritev(), bulk con sslWrite()/sslWriteAll()
+#define WRITEV_HEADER   256         // header di una risposta
+#define WRITEV_PIECES   16          // pezzi di MYBUFSIZE del body di una risposta
+#define WRITEV_BULK     (16 << 20)  // dimensione del payload bulk
+
+// dati del server sink dei benchmark writev e sendfile (una connessione per fase)
+typedef struct {
+    int     sock;           // socket di ascolto
+    int     phases;         // numero di fasi (connessioni)
+    SSL_CTX *ctx;           // contesto del server
+    long    expected;       // byte applicativi attesi nella fase
+    BenchBio bio;           // byte ricevuti dal socket (conteggio attivo dopo l'handshake)
+    long    records;        // record TLS ricevuti (handshake escluso)
+} BenchSink;
+
+// benchSinkMsg - message callback: count the records received
+static void benchSinkMsg(int write_p, int version, int content_type, const void *buf, size_t len, SSL *ssl,
+                         void *arg)
+{
+    BenchSink *sink = arg;
+    (void)version, (void)buf, (void)len, (void)ssl;
+    if (! write_p && content_type == SSL3_RT_HEADER && sink->bio.on)
+        sink->records++;
+}
+
+// benchSinkThread - sink server: for each phase reads the expected bytes and sends an acknowledge
+static void* benchSinkThread(void *arg)
+{
+    BenchSink *sink = arg;
+    char      *buf  = malloc(SSL3_RT_MAX_PLAIN_LENGTH);
+    for (int phase = 0; buf != NULL && phase < sink->phases; phase++) {
+        // accept the connection and count the bytes and the records after the handshake
+        SSL *ssl;
+        if ((ssl = benchAccept(sink->sock, sink->ctx, false)) == NULL)
+            break;
+
+        memset(&sink->bio, 0, sizeof(sink->bio));
+        sink->records = 0;
+        benchBioWatch(ssl, &sink->bio);
+        SSL_set_msg_callback(ssl, benchSinkMsg);
+        SSL_set_msg_callback_arg(ssl, sink);
+        if (sslFunc(SSL_accept, ssl) != 1) {
+            sslClose(ssl, SSL_get_fd(ssl), NULL, false);
+            break;
+        }
+
+        // read the data of the phase and acknowledge it
+        sink->bio.on = true;
+        long rcvd = 0;
+        int  r    = 0;
+        sslSetTimeout(ssl, 10000);
+        while (rcvd < sink->expected && (r = sslRead(ssl, buf, SSL3_RT_MAX_PLAIN_LENGTH)) > 0)
+            rcvd += r;
+
+        sink->bio.on = false;
+        sslWrite(ssl, "k", 1);
+        sslClose(ssl, SSL_get_fd(ssl), NULL, true);
+    }
+
+    free(buf);
+    return NULL;
+}
+
+// benchWritev - a header + body response in MYBUFSIZE pieces written with a sslWrite() per piece and with a
+// sslWritev(), and a bulk payload written with sslWrite() in MYBUFSIZE pieces and with a sslWriteAll(): records and
+// bytes on wire per MB of payload and throughput
+static int benchWritev(int responses)
+{
+    // create the contexts and start the sink server
+    BenchSink sink;
+    SSL_CTX   *cctx;
+    pthread_t tid;
+    int       error, port, rc = EXIT_FAILURE;
+    memset(&sink, 0, sizeof(sink));
+    sink.phases = WRITEV_PHASES;
+    sink.ctx    = sslCreateCtxEx(SSL_SERVER, &bench_opts, &error);
+    cctx        = sslCreateCtxEx(SSL_CLIENT, &bench_opts, &error);
+    if (sink.ctx == NULL || cctx == NULL || (sink.sock = benchListen(&port)) < 0 ||
+            pthread_create(&tid, NULL, benchSinkThread, &sink) != 0) {
+        fprintf(stderr, "writev: setup failed\n");
+        ERR_print_errors_fp(stderr);
+        return EXIT_FAILURE;
+    }
+
+    // payloads: response pieces and bulk buffer
+    static char   header[WRITEV_HEADER], body[WRITEV_PIECES][MYBUFSIZE];
+    char          *bulk = calloc(1, WRITEV_BULK);
+    struct iovec  iov[WRITEV_PIECES + 1];
+    const char    *names[WRITEV_PHASES] = { "response sslWrite() x17", "response sslWritev()   ",
+                                            "bulk sslWrite() 1 KB   ", "bulk sslWriteAll()     " };
+    long          resp_len = WRITEV_HEADER + WRITEV_PIECES * MYBUFSIZE;
+    iov[0].iov_base = header;
+    iov[0].iov_len  = sizeof(header);
+    for (int i = 0; i < WRITEV_PIECES; i++) {
+        iov[i + 1].iov_base = body[i];
+        iov[i + 1].iov_len  = MYBUFSIZE;
+    }
+
+    printf("writev: %d responses of %ld bytes (header + %d x %d), bulk payload of %d MB\n", responses, resp_len,
+           WRITEV_PIECES, MYBUFSIZE, WRITEV_BULK >> 20);
+    for (int phase = 0; bulk != NULL && phase < WRITEV_PHASES; phase++) {
+        // connect (the sink counts from the end of the handshake)
+        int  sock;
+        SSL  *ssl = NULL;
+        bool ok   = true;
+        char ack;
+        sink.expected = phase < 2 ? resp_len * responses : WRITEV_BULK;
+        if ((sock = benchConnect(port)) < 0 || (ssl = SSL_new(cctx)) == NULL || SSL_set_fd(ssl, sock) != 1 ||
+                sslFunc(SSL_connect, ssl) != 1) {
+            fprintf(stderr, "writev: connection failed\n");
+            sslClose(ssl, sock, NULL, false);
+            goto end;
+        }
+
+        // write the payload and wait the acknowledge
+        double start = nowUs();
+        switch (phase) {
+        case 0:
+            for (int r = 0; ok && r < responses; r++) {
+                for (int i = 0; ok && i <= WRITEV_PIECES; i++)
+                    ok = sslWrite(ssl, iov[i].iov_base, iov[i].iov_len) == (int)iov[i].iov_len;
+            }
+
+            break;
+
+        case 1:
+            for (int r = 0; ok && r < responses; r++)
+                ok = sslWritev(ssl, iov, WRITEV_PIECES + 1) == resp_len;
+
+            break;
+
+        case 2:
+            for (long off = 0; ok && off < WRITEV_BULK; off += MYBUFSIZE)
+                ok = sslWrite(ssl, bulk + off, MYBUFSIZE) == MYBUFSIZE;
+
+            break;
+
+        case 3:
+            ok = sslWriteAll(ssl, bulk, WRITEV_BULK) == WRITEV_BULK;
+            break;
+        }
+
+        sslSetTimeout(ssl, 10000);
+        ok = ok && sslRead(ssl, &ack, 1) == 1;
+        double elapsed = nowUs() - start;
+        if (! ok)
+            fprintf(stderr, "writev: %s failed (status %d)\n", names[phase], sslStatus(ssl));
+
+        sslClose(ssl, sock, NULL, ok);
+        if (! ok)
+            goto end;
+
+        // show the results
+        double mb = sink.expected / 1048576.0;
+        printf("writev: %s  %8.1f records/MB  %6.2f%% overhead on wire  %8.1f MB/s\n", names[phase],
+               sink.records / mb, 100.0 * (sink.bio.rbytes - sink.expected) / sink.expected, mb / (elapsed / 1e6));
+    }
+
+    rc = EXIT_SUCCESS;
+
+end:
+    // stop the sink server
+    shutdown(sink.sock, SHUT_RDWR);
+    pthread_join(tid, NULL);
+    close(sink.sock);
+    free(bulk);
+    sslReleaseCtx(sink.ctx);
+    sslReleaseCtx(cctx);
+    sslFlushSessions();
+    sslFlushCtx();
+    return rc;
+}
+
+// fasi del benchmark sendfile
+#define SENDFILE_PHASES 3           // read()/sslWrite(), sslSendFile() senza kTLS, sslSendFile() con kTLS
+
+// benchSendFile - a file sent with read() and sslWrite() in MYBUFSIZE pieces, with sslSendFile() without kernel TLS
+// (pooled buffer and sslWriteAll()) and with sslSendFile() with kernel TLS (sendfile(), if the kernel supports it):
+// throughput and kTLS state of the connection (fails if the kernel TLS isn't available or not activated)
+static int benchSendFile(int size_mb)
+{
+    // create the contexts (the client is the sender) and start the sink server
+    BenchSink  sink;
+    SSL_CTX    *cctx, *kctx;
+    SslCtxOpts ktls_opts = bench_opts;
+    pthread_t  tid;
+    int        error, port, rc = EXIT_FAILURE;
+    long       size = (long)size_mb << 20;
+    memset(&sink, 0, sizeof(sink));
+    ktls_opts.ktls = true;
+    if (sslKtlsAvail() == 0) {
+        fprintf(stderr, "sendfile: kTLS requested but not available (OpenSSL without KTLS or kernel without the tls "
+                        "module)\n");
+        return EXIT_FAILURE;
+    }
+
+    sink.phases    = SENDFILE_PHASES;
+    sink.expected  = size;
+    sink.ctx       = sslCreateCtxEx(SSL_SERVER, &bench_opts, &error);
+    cctx           = sslCreateCtxEx(SSL_CLIENT, &bench_opts, &error);
+    kctx           = sslCreateCtxEx(SSL_CLIENT, &ktls_opts, &error);
+    if (size <= 0 || sink.ctx == NULL || cctx == NULL || kctx == NULL || (sink.sock = benchListen(&port)) < 0 ||
+            pthread_create(&tid, NULL, benchSinkThread, &sink) != 0) {
+        fprintf(stderr, "sendfile: setup failed\n");
+        ERR_print_errors_fp(stderr);
+        return EXIT_FAILURE;
+    }
+
+    // create the file (removed at once, it's closed at the end)
+    char path[] = "/tmp/sslbench-XXXXXX";
+    char buf[MYBUFSIZE];
+    int  fd     = mkstemp(path);
+    if (fd >= 0)
+        unlink(path);
+
+    memset(buf, 'x', sizeof(buf));
+    for (long off = 0; fd >= 0 && off < size; off += MYBUFSIZE) {
+        if (write(fd, buf, MYBUFSIZE) != MYBUFSIZE) {
+            close(fd);
+            fd = -1;
+        }
+    }
+
+    if (fd < 0)
+        fprintf(stderr, "sendfile: file creation failed\n");
+
+    const char *names[SENDFILE_PHASES] = { "read() + sslWrite() 1 KB", "sslSendFile()           ",
+                                           "sslSendFile() ktls      " };
+    printf("sendfile: file of %d MB\n", size_mb);
+    for (int phase = 0; fd >= 0 && phase < SENDFILE_PHASES; phase++) {
+        // connect (with the kernel TLS in the last phase)
+        int  sock;
+        SSL  *ssl = NULL;
+        bool ok   = true;
+        char ack;
+        if ((sock = benchConnect(port)) < 0 || (ssl = SSL_new(phase < 2 ? cctx : kctx)) == NULL ||
+                SSL_set_fd(ssl, sock) != 1 || sslFunc(SSL_connect, ssl) != 1) {
+            fprintf(stderr, "sendfile: connection failed\n");
+            sslClose(ssl, sock, NULL, false);
+            goto end;
+        }
+
+        // kTLS requested: the transmission offload must be active
+        int ktls = sslKtls(ssl);
+        if (phase == 2 && ! (ktls & SSL_KTLS_TX)) {
+            fprintf(stderr, "sendfile: kTLS requested but not active (%s %s)\n", SSL_get_version(ssl),
+                    SSL_get_cipher_name(ssl));
+            sslClose(ssl, sock, NULL, true);
+            goto end;
+        }
+
+        // send the file and wait the acknowledge
+        double start = nowUs();
+        if (phase == 0) {
+            ssize_t len;
+            for (off_t off = 0; ok && off < size; off += len)
+                ok = (len = pread(fd, buf, MYBUFSIZE, off)) > 0 && sslWrite(ssl, buf, len) == len;
+        } else {
+            ok = sslSendFile(ssl, fd, 0, size) == size;
+        }
+
+        sslSetTimeout(ssl, 10000);
+        ok = ok && sslRead(ssl, &ack, 1) == 1;
+        double elapsed = nowUs() - start;
+        if (! ok)
+            fprintf(stderr, "sendfile: %s failed (status %d)\n", names[phase], sslStatus(ssl));
+
+        sslClose(ssl, sock, NULL, ok);
+        if (! ok)
+            goto end;
+
+        // show the results
+        printf("sendfile: %s  %8.1f MB/s  ktls tx %-3s rx %-3s\n", names[phase], size_mb / (elapsed / 1e6),
+               (ktls & SSL_KTLS_TX) ? "on" : "off", (ktls & SSL_KTLS_RX) ? "on" : "off");
+    }
+
+    rc = fd >= 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+
+end:
+    // stop the sink server
+    shutdown(sink.sock, SHUT_RDWR);
+    pthread_join(tid, NULL);
+    close(sink.sock);
+    if (fd >= 0)
+        close(fd);
+
+    sslReleaseCtx(sink.ctx);
+    sslReleaseCtx(cctx);
+    sslReleaseCtx(kctx);
+    sslFlushSessions();
+    sslFlushCtx();
+    return rc;
+}
+
+// parametri del benchmark forward
+#define FORWARD_BLOCK   65536       // blocco inviato e riletto dall'echo (throughput)
+#define FORWARD_PING    64          // messaggio di una round trip (latenza)
+#define FORWARD_ROUNDS  2000        // round trip misurate
+
+// benchEchoConn - echo backend connection: echoes the data and, at the EOF of the client, half-closes the socket
+static void* benchEchoConn(void *arg)
+{
+    int     sock = (int)(intptr_t)arg;
+    char    *buf = malloc(FORWARD_BLOCK);
+    ssize_t rcvd = 0;
+    while (buf != NULL && (rcvd = read(sock, buf, FORWARD_BLOCK)) > 0) {
+        for (ssize_t off = 0, sent; off < rcvd; off += sent) {
+            if ((sent = write(sock, buf + off, rcvd - off)) <= 0) {
+                rcvd = -1;
+                break;
+            }
+        }
+
+        if (rcvd < 0)
+            break;
+    }
+
+    // EOF of the client: end of the echo (the socket is still readable by the client until the close)
+    if (rcvd == 0)
+        shutdown(sock, SHUT_WR);
+
+    free(buf);
+    close(sock);
+    return NULL;
+}
+
+// benchEchoServer - echo backend: a detached thread per connection, until the listening socket is shut down
+static void* benchEchoServer(void *arg)
+{
+    int sock = (int)(intptr_t)arg, conn;
+    while ((conn = accept(sock, NULL, NULL)) >= 0) {
+        pthread_attr_t attr;
+        pthread_t      tid;
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        if (pthread_create(&tid, &attr, benchEchoConn, (void *)(intptr_t)conn) != 0)
+            close(conn);
+
+        pthread_attr_destroy(&attr);
+    }
+
+    return NULL;
+}
+
+// benchCmpDouble - qsort() comparison of doubles
+static int benchCmpDouble(const void *a, const void *b)
+{
+    double da = *(const double *)a, db = *(const double *)b;
+    return da < db ? -1 : da > db;
+}
+
+// benchForwardXchg - send len bytes and read them back from the echo (TLS if ssl isn't NULL)
+static bool benchForwardXchg(SSL *ssl, int sock, char *buf, int len)
+{
+    int got = 0, r;
+    if ((ssl ? sslWrite(ssl, buf, len) : write(sock, buf, len)) != len)
+        return false;
+
+    while (got < len && (r = ssl ? sslRead(ssl, buf + got, len - got) : read(sock, buf + got, len - got)) > 0)
+        got += r;
+
+    return got == len;
+}
+
+// benchForwardRun - a connection to port (TLS if ctx isn't NULL): round trips of FORWARD_PING bytes, blocks of
+// FORWARD_BLOCK bytes sent and read back, and a half-close (the echo must be received up to the end of data)
+static int benchForwardRun(int port, SSL_CTX *ctx, int size_mb, double *mbps, double *rtt_avg, double *rtt_p99)
+{
+    int    sock;
+    SSL    *ssl  = NULL;
+    char   *buf  = malloc(FORWARD_BLOCK);
+    double *rtts = malloc(FORWARD_ROUNDS * sizeof(double));
+    bool   ok    = buf != NULL && rtts != NULL;
+    long   blocks = ((long)size_mb << 20) / FORWARD_BLOCK;
+    if ((sock = benchConnect(port)) < 0 || (ctx && ((ssl = SSL_new(ctx)) == NULL || SSL_set_fd(ssl, sock) != 1 ||
+            sslFunc(SSL_connect, ssl) != 1))) {
+        sslClose(ssl, sock, NULL, false);
+        free(buf);
+        free(rtts);
+        return -1;
+    }
+
+    // latency: round trips
+    memset(buf, 'f', FORWARD_BLOCK);
+    for (int i = 0; ok && i < FORWARD_ROUNDS; i++) {
+        double start = nowUs();
+        ok = benchForwardXchg(ssl, sock, buf, FORWARD_PING);
+        rtts[i] = nowUs() - start;
+    }
+
+    // throughput: blocks sent and read back
+    double start = nowUs();
+    for (long i = 0; ok && i < blocks; i++)
+        ok = benchForwardXchg(ssl, sock, buf, FORWARD_BLOCK);
+
+    double elapsed = nowUs() - start;
+
+    // half-close: the last echo must arrive after the end of data of the client, followed by the end of data
+    char tail[FORWARD_PING];
+    long got = 0, r = 0;
+    ok = ok && (ssl ? sslWrite(ssl, buf, FORWARD_PING) == FORWARD_PING : write(sock, buf, FORWARD_PING) == FORWARD_PING);
+    ok = ok && (ssl ? SSL_shutdown(ssl) >= 0 : shutdown(sock, SHUT_WR) == 0);
+    while (ok && (r = ssl ? sslRead(ssl, tail, sizeof(tail)) : read(sock, tail, sizeof(tail))) > 0)
+        got += r;
+
+    if (ok && (got != FORWARD_PING || r < 0 || (ssl && sslStatus(ssl) != SSL_STATUS_CLOSED))) {
+        fprintf(stderr, "forward: half-close failed (%ld bytes after the end of data)\n", got);
+        ok = false;
+    }
+
+    if (ok) {
+        double sum = 0;
+        qsort(rtts, FORWARD_ROUNDS, sizeof(double), benchCmpDouble);
+        for (int i = 0; i < FORWARD_ROUNDS; i++)
+            sum += rtts[i];
+
+        *mbps    = 2.0 * blocks * FORWARD_BLOCK / 1048576.0 / (elapsed / 1e6);
+        *rtt_avg = sum / FORWARD_ROUNDS;
+        *rtt_p99 = rtts[FORWARD_ROUNDS * 99 / 100];
+    }
+
+    sslClose(ssl, sock, NULL, false);
+    free(buf);
+    free(rtts);
+    return ok ? 0 : -1;
+}
+
+// benchForward - an echo backend reached directly in plaintext and through the forwarder (TCP and Unix backend):
+// throughput (both the directions), round trip latency and half-close propagation
+static int benchForward(int size_mb)
+{
+    // echo backend on TCP and on a Unix socket
+    struct sockaddr_un unix_addr;
+    char               tcp_backend[32];
+    pthread_t          tcp_tid, unix_tid;
+    int                tcp_sock, unix_sock, tcp_port, rc = EXIT_FAILURE;
+    memset(&unix_addr, 0, sizeof(unix_addr));
+    unix_addr.sun_family = AF_UNIX;
+    snprintf(unix_addr.sun_path, sizeof(unix_addr.sun_path), "/tmp/sslbench-%d.sock", (int)getpid());
+    unlink(unix_addr.sun_path);
+    if (size_mb <= 0 || (tcp_sock = benchListen(&tcp_port)) < 0 ||
+            (unix_sock = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 ||
+            bind(unix_sock, (struct sockaddr *)&unix_addr, sizeof(unix_addr)) < 0 || listen(unix_sock, SOMAXCONN) < 0 ||
+            pthread_create(&tcp_tid, NULL, benchEchoServer, (void *)(intptr_t)tcp_sock) != 0 ||
+            pthread_create(&unix_tid, NULL, benchEchoServer, (void *)(intptr_t)unix_sock) != 0) {
+        fprintf(stderr, "forward: backend setup failed\n");
+        return EXIT_FAILURE;
+    }
+
+    // forwarders to the two backends and client context
+    SslForwardOpts fopts;
+    SslForwarder   *tcp_fwd, *unix_fwd;
+    SSL_CTX        *cctx;
+    int            error;
+    snprintf(tcp_backend, sizeof(tcp_backend), "127.0.0.1:%d", tcp_port);
+    memset(&fopts, 0, sizeof(fopts));
+    fopts.host    = "127.0.0.1";
+    fopts.timeout = 10000;
+    fopts.backend = tcp_backend;
+    tcp_fwd       = sslForwarderStart(&fopts, &bench_opts);
+    fopts.backend = unix_addr.sun_path;
+    unix_fwd      = sslForwarderStart(&fopts, &bench_opts);
+    cctx          = sslCreateCtxEx(SSL_CLIENT, &bench_opts, &error);
+    if (tcp_fwd == NULL || unix_fwd == NULL || cctx == NULL) {
+        fprintf(stderr, "forward: forwarder setup failed\n");
+        ERR_print_errors_fp(stderr);
+        goto end;
+    }
+
+    // plaintext baseline, forwarder to TCP and to Unix backend
+    const char *names[3] = { "direct plaintext TCP    ", "forwarder -> TCP        ", "forwarder -> Unix socket" };
+    int        ports[3]  = { tcp_port, sslForwarderPort(tcp_fwd), sslForwarderPort(unix_fwd) };
+    printf("forward: %d MB each direction in %d KB blocks, %d round trips of %d bytes\n", size_mb,
+           FORWARD_BLOCK >> 10, FORWARD_ROUNDS, FORWARD_PING);
+    for (int phase = 0; phase < 3; phase++) {
+        double mbps, rtt_avg, rtt_p99;
+        if (benchForwardRun(ports[phase], phase > 0 ? cctx : NULL, size_mb, &mbps, &rtt_avg, &rtt_p99) < 0) {
+            fprintf(stderr, "forward: %s failed\n", names[phase]);
+            goto end;
+        }
+
+        printf("forward: %s  %8.1f MB/s  rtt avg %7.1f us  p99 %7.1f us  half-close ok\n", names[phase], mbps,
+               rtt_avg, rtt_p99);
+    }
+
+    rc = EXIT_SUCCESS;
+
+end:
+    // stop the forwarders and the backends
+    sslForwarderStop(tcp_fwd);
+    sslForwarderStop(unix_fwd);
+    shutdown(tcp_sock, SHUT_RDWR);
+    shutdown(unix_sock, SHUT_RDWR);
+    pthread_join(tcp_tid, NULL);
+    pthread_join(unix_tid, NULL);
+    close(tcp_sock);
+    close(unix_sock);
+    unlink(unix_addr.sun_path);
+    sslReleaseCtx(cctx);
+    sslFlushSessions();
+    sslFlushCtx();
+    return rc;
+}
+
+// parametri del benchmark records
+#define RECORDS_RESPONSE    65536       // risposta a una richiesta (time to first/last byte)
+#define RECORDS_BULK        (64 << 20)  // payload bulk (throughput)
+#define RECORDS_PIECE       262144      // scrittura del payload bulk
+#define RECORDS_IDLE        20          // inattività (ms) dopo la quale tornano i record piccoli
+
+// benchRecordsServer - response server: for each request ('r' = response, 'b' = bulk payload) writes the data with
+// sslWrite() (a single write for the response)
+static void* benchRecordsServer(void *arg)
+{
+    BenchServer *srv = arg;
+    char        *buf = calloc(1, RECORDS_PIECE);
+    for (int i = 0; buf != NULL && i < srv->nconn; i++) {
+        // accept a connection
+        SSL  *ssl;
+        char cmd;
+        if ((ssl = benchAccept(srv->sock, srv->ctx, true)) == NULL)
+            continue;
+
+        // serve the requests (until the client disconnects)
+        sslSetTimeout(ssl, 10000);
+        while (sslRead(ssl, &cmd, 1) == 1) {
+            bool ok = true;
+            if (cmd == 'r') {
+                ok = sslWrite(ssl, buf, RECORDS_RESPONSE) == RECORDS_RESPONSE;
+            } else {
+                for (long off = 0; ok && off < RECORDS_BULK; off += RECORDS_PIECE)
+                    ok = sslWrite(ssl, buf, RECORDS_PIECE) == RECORDS_PIECE;
+            }
+
+            if (! ok)
+                break;
+        }
+
+        sslClose(ssl, SSL_get_fd(ssl), NULL, false);
+    }
+
+    free(buf);
+    sslClose(NULL, srv->sock, srv->ctx, false);
+    return NULL;
+}
+
+// benchRecordsMsg - message callback: count the records received
+static void benchRecordsMsg(int write_p, int version, int content_type, const void *buf, size_t len, SSL *ssl,
+                            void *arg)
+{
+    (void)version, (void)buf, (void)len, (void)ssl;
+    if (! write_p && content_type == SSL3_RT_HEADER)
+        (*(long *)arg)++;
+}
+
+// benchRecordsRun - nconn connections with a response at the start and a response after an idle period (time to
+// first byte, time to last byte, records per response), then a connection with the bulk payload (throughput)
+static int benchRecordsRun(const SslCtxOpts *opts, int nconn, double *ttfb, double *ttfb_idle, double *ttlb,
+                           double *records, double *mbps)
+{
+    // start the server and create the client context
+    BenchServer srv;
+    SSL_CTX     *cctx;
+    pthread_t   tid;
+    int         error, port, rc = -1;
+    char        *buf = malloc(SSL3_RT_MAX_PLAIN_LENGTH);
+    memset(&srv, 0, sizeof(srv));
+    if ((srv.ctx = sslCreateCtxEx(SSL_SERVER, opts, &error)) == NULL || error < 0 ||
+            (cctx = sslCreateCtxEx(SSL_CLIENT, &bench_opts, &error)) == NULL) {
+        ERR_print_errors_fp(stderr);
+        sslReleaseCtx(srv.ctx);
+        free(buf);
+        return -1;
+    }
+
+    srv.nconn = nconn + 1;
+    if (buf == NULL || (srv.sock = benchListen(&port)) < 0 ||
+            pthread_create(&tid, NULL, benchRecordsServer, &srv) != 0) {
+        sslClose(NULL, srv.sock, srv.ctx, false);
+        sslReleaseCtx(cctx);
+        free(buf);
+        return -1;
+    }
+
+    *ttfb = *ttfb_idle = *ttlb = *records = 0;
+    for (int i = 0; i <= nconn; i++) {
+        // connect and count the records received after the handshake
+        int  sock;
+        SSL  *ssl = NULL;
+        long nrec = 0;
+        bool ok   = true, bulk = i == nconn;
+        if ((sock = benchConnect(port)) < 0 || (ssl = SSL_new(cctx)) == NULL || SSL_set_fd(ssl, sock) != 1 ||
+                sslFunc(SSL_connect, ssl) != 1) {
+            sslClose(ssl, sock, NULL, false);
+            goto end;
+        }
+
+        SSL_set_msg_callback(ssl, benchRecordsMsg);
+        SSL_set_msg_callback_arg(ssl, &nrec);
+        sslSetTimeout(ssl, 10000);
+
+        // two responses (the second one after an idle period) or the bulk payload
+        for (int req = 0; ok && req < (bulk ? 1 : 2); req++) {
+            long   size = bulk ? RECORDS_BULK : RECORDS_RESPONSE, got = 0;
+            int    rcvd = 0;
+            if (req > 0)
+                usleep(2 * RECORDS_IDLE * 1000);
+
+            nrec = 0;
+            double start = nowUs(), first_us = 0;
+            ok = sslWrite(ssl, bulk ? "b" : "r", 1) == 1;
+            while (ok && got < size && (rcvd = sslRead(ssl, buf, SSL3_RT_MAX_PLAIN_LENGTH)) > 0) {
+                if (got == 0)
+                    first_us = nowUs() - start;
+
+                got += rcvd;
+            }
+
+            double elapsed = nowUs() - start;
+            ok = ok && got == size;
+            if (ok && bulk) {
+                *mbps = RECORDS_BULK / 1048576.0 / (elapsed / 1e6);
+            } else if (ok && req == 0) {
+                *ttfb    += first_us / nconn;
+                *ttlb    += elapsed / nconn;
+                *records += (double)nrec / nconn;
+            } else if (ok) {
+                *ttfb_idle += first_us / nconn;
+            }
+        }
+
+        sslClose(ssl, sock, NULL, false);
+        if (! ok)
+            goto end;
+    }
+
+    rc = 0;
+
+end:
+    // stop the server (it exits after the last connection or at the shutdown of the listening socket)
+    shutdown(srv.sock, SHUT_RDWR);
+    pthread_join(tid, NULL);
+    sslReleaseCtx(cctx);
+    free(buf);
+    return rc;
+}
+
+// benchRecords - responses and bulk payload with full records (OpenSSL default), with the dynamic record sizing
+// (small records for the first 16 KB and after RECORDS_IDLE ms of idle) and with small records only: time to first
+// byte (also after an idle period), time to the last byte of the response and bulk throughput
+static int benchRecords(int nconn)
+{
+    SslCtxOpts opts[3];
+    const char *names[3] = { "full records     ", "dynamic 16 KB    ", "small records    " };
+    for (int i = 0; i < 3; i++)
+        opts[i] = bench_opts;
+
+    opts[1].record_boost = 16384;
+    opts[1].record_idle  = RECORDS_IDLE;
+    opts[2].record_boost = INT_MAX;
+    printf("records: %d connections, response of %d KB at the start and after %d ms idle, bulk payload of %d MB\n",
+           nconn, RECORDS_RESPONSE >> 10, 2 * RECORDS_IDLE, RECORDS_BULK >> 20);
+    for (int i = 0; i < 3; i++) {
+        double ttfb, ttfb_idle, ttlb, records, mbps;
+        if (nconn <= 0 || benchRecordsRun(&opts[i], nconn, &ttfb, &ttfb_idle, &ttlb, &records, &mbps) < 0) {
+            fprintf(stderr, "records: %s failed\n", names[i]);
+            return EXIT_FAILURE;
+        }
+
+        printf("records: %s  ttfb %6.1f us  ttfb after idle %6.1f us  response %7.1f us (%4.1f records)  "
+               "bulk %7.1f MB/s\n", names[i], ttfb, ttfb_idle, ttlb, records, mbps);
+    }
+
+    sslFlushSessions();
+    sslFlushCtx();
+    return EXIT_SUCCESS;
+}
+
+// messaggio scambiato da ogni connessione del benchmark idle prima dell'inattività (un record pieno: le pagine dei
+// buffer dei record sono tutte usate)
+#define IDLE_MESSAGE    16384
+
+// KB per connessione (client + server) che il rilascio dei buffer deve almeno liberare (un buffer di record per lato)
+#define IDLE_MIN_SAVED  32
+
+// benchIdleStep - run a function on the client and a function on the server of a loopback pair (non-blocking
+// sockets) alternating their steps until both are done (waiting the data when both are blocked)
+static bool benchIdleStep(SSL *cssl, SSL *sssl, int (*cfunc)(SSL*), int (*sfunc)(SSL*))
+{
+    int cres = 0, sres = 0;
+    for (int i = 0; i < 100 && (cres <= 0 || sres <= 0); i++) {
+        struct pollfd pfds[2] = { { SSL_get_fd(cssl), POLLIN, 0 }, { SSL_get_fd(sssl), POLLIN, 0 } };
+        if (i > 0)
+            poll(pfds, 2, 100);
+
+        if (cres <= 0 && ((cres = sslFuncStep(cfunc, cssl)) == SSL_STEP_ERROR || cres == SSL_STEP_CLOSED))
+            return false;
+
+        if (sres <= 0 && ((sres = sslFuncStep(sfunc, sssl)) == SSL_STEP_ERROR || sres == SSL_STEP_CLOSED))
+            return false;
+    }
+
+    return cres > 0 && sres > 0;
+}
+
+// benchIdleWrite - write the message of the benchmark idle (for benchIdleStep())
+static char idle_buf[IDLE_MESSAGE];
+static int benchIdleWrite(SSL *ssl)
+{
+    return SSL_write(ssl, idle_buf, IDLE_MESSAGE);
+}
+
+// benchIdleRead - read the message of the benchmark idle (for benchIdleStep())
+static int benchIdleRead(SSL *ssl)
+{
+    return SSL_read(ssl, idle_buf, IDLE_MESSAGE);
+}
+
+// benchIdleRun - nconn loopback connections (client and server in this process) with a handshake and a message in
+// both the directions, then idle: memory per connection (returned in kb_conn) and statistics of the buffer pool
+static int benchIdleRun(bool release, int nconn, double *kb_conn)
+{
+    // install the buffer pool (each run in its own process), then create the contexts and the listening socket
+    SslInitOpts init = { SSL_ALLOC_POOL, false };
+    SslCtxOpts  opts = bench_opts;
+    SSL_CTX     *sctx, *cctx;
+    SSL         **ssls;
+    int         error, lsock, port, done = 0;
+    sslInit(&init);
+    opts.release_buffers = release;
+    if ((sctx = sslCreateCtxEx(SSL_SERVER, &opts, &error)) == NULL || error < 0 ||
+            (cctx = sslCreateCtxEx(SSL_CLIENT, &opts, &error)) == NULL || error < 0 ||
+            (lsock = benchListen(&port)) < 0 || (ssls = calloc(2 * nconn, sizeof(SSL *))) == NULL) {
+        ERR_print_errors_fp(stderr);
+        return -1;
+    }
+
+    long rss = benchProcStatus("VmRSS:");
+    for (; done < nconn; done++) {
+        // connect a loopback pair and exchange the messages
+        SSL *cssl, *sssl;
+        bool paired = benchPair(lsock, port, cctx, sctx, &cssl, &sssl);
+        ssls[2 * done]     = cssl;
+        ssls[2 * done + 1] = sssl;
+        if (! paired || ! benchIdleStep(cssl, sssl, benchIdleWrite, benchIdleRead) ||
+                ! benchIdleStep(sssl, cssl, benchIdleWrite, benchIdleRead)) {
+            fprintf(stderr, "idle: connection %d failed\n", done);
+            ERR_print_errors_fp(stderr);
+            break;
+        }
+    }
+
+    // show the results
+    SslPoolStats stats;
+    sslPoolStats(&stats);
+    if (done == nconn) {
+        *kb_conn = (double)(benchProcStatus("VmRSS:") - rss) / nconn;
+        printf("idle: release buffers %-3s  %7.2f KB/connection (client + server side)\n", release ? "on" : "off",
+               *kb_conn);
+        printf("idle:                        pool %s, %ld KB in use (high-water %ld KB), %ld KB free, %.1f%% hits\n",
+               stats.active ? "active" : "not active", stats.in_use >> 10, stats.high_water >> 10,
+               stats.pooled >> 10, stats.hit_rate);
+    }
+
+    // close the connections
+    for (int i = 0; i < 2 * nconn; i++) {
+        if (ssls[i] != NULL)
+            sslClose(ssls[i], SSL_get_fd(ssls[i]), NULL, false);
+    }
+
+    free(ssls);
+    close(lsock);
+    sslReleaseCtx(sctx);
+    sslReleaseCtx(cctx);
+    return done == nconn ? 0 : -1;
+}
+
+// benchIdle - memory per idle connection with and without the release of the record buffers (each run in its own
+// process: the RSS doesn't include the memory of the other run, and the pool is installed at the first OpenSSL call),
+// fails if the release doesn't free at least IDLE_MIN_SAVED KB per connection
+static int benchIdle(int nconn)
+{
+    // allow two fds per connection (client and server are in the same process)
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+        if (nconn > (int)((rl.rlim_cur - 64) / 2))
+            nconn = (int)((rl.rlim_cur - 64) / 2);
+    }
+
+    printf("idle: %d idle connections after a handshake and a message of %d bytes in both the directions\n", nconn,
+           IDLE_MESSAGE);
+    double kb_conn[2] = { 0, 0 };
+    for (int release = 0; release < 2; release++) {
+        pid_t pid;
+        int   status, fds[2];
+        fflush(stdout);
+        if (pipe(fds) < 0) {
+            fprintf(stderr, "idle: pipe failed (%s)\n", strerror(errno));
+            return EXIT_FAILURE;
+        }
+
+        // the child returns the memory per connection through the pipe
+        if ((pid = fork()) == 0) {
+            int rc = benchIdleRun(release, nconn, &kb_conn[release]);
+            fflush(stdout);
+            if (rc == 0 && write(fds[1], &kb_conn[release], sizeof(double)) != sizeof(double))
+                rc = -1;
+
+            _exit(rc < 0 ? EXIT_FAILURE : EXIT_SUCCESS);
+        }
+
+        close(fds[1]);
+        if (pid < 0 || waitpid(pid, &status, 0) < 0 || ! WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS ||
+                read(fds[0], &kb_conn[release], sizeof(double)) != sizeof(double)) {
+            fprintf(stderr, "idle: run failed\n");
+            close(fds[0]);
+            return EXIT_FAILURE;
+        }
+
+        close(fds[0]);
+    }
+
+    // the release must free at least a record buffer per side
+    double saved = kb_conn[0] - kb_conn[1];
+    printf("idle: release buffers saves %.2f KB/connection (min %d KB)\n", saved, IDLE_MIN_SAVED);
+    if (saved < IDLE_MIN_SAVED) {
+        fprintf(stderr, "idle: release buffers saves less than %d KB/connection\n", IDLE_MIN_SAVED);
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+// benchmark alloc: thread di handshake e loro dati
+#define ALLOC_THREADS   4           // thread di handshake
+
+typedef struct {
+    SSL_CTX *sctx;          // contesto del server
+    SSL_CTX *cctx;          // contesto del client
+    int     nconn;          // connessioni da aprire (coppie client/server)
+    SSL     **ssls;         // connessioni aperte (2 * nconn, client e server)
+    int     done;           // connessioni aperte
+} BenchAlloc;
+
+// benchAllocThread - open the loopback connections of a thread (client and server in this thread), left open
+static void* benchAllocThread(void *arg)
+{
+    BenchAlloc *ba = arg;
+    int        lsock, port;
+    if ((lsock = benchListen(&port)) < 0)
+        return NULL;
+
+    for (; ba->done < ba->nconn; ba->done++) {
+        // connect a loopback pair and execute the handshake
+        if (! benchPair(lsock, port, ba->cctx, ba->sctx, &ba->ssls[2 * ba->done], &ba->ssls[2 * ba->done + 1])) {
+            fprintf(stderr, "alloc: connection %d failed\n", ba->done);
+            ERR_print_errors_fp(stderr);
+            break;
+        }
+    }
+
+    close(lsock);
+    return NULL;
+}
+
+// benchAllocRun - nconn loopback connections with a full handshake, opened by ALLOC_THREADS threads with the
+// allocator of OpenSSL set by sslInit(): handshakes/sec, allocations, memory per connection and peak memory
+static int benchAllocRun(const SslInitOpts *init, const char *name, int nconn)
+{
+    // initialize the library with the allocator (before the creation of the contexts)
+    if (sslInit(init) < 0) {
+        fprintf(stderr, "alloc: %s: allocator not installed\n", name);
+        return -1;
+    }
+
+    SslCtxOpts opts = bench_opts;
+    SSL_CTX    *sctx, *cctx;
+    int        error;
+    if ((sctx = sslCreateCtxEx(SSL_SERVER, &opts, &error)) == NULL || error < 0 ||
+            (cctx = sslCreateCtxEx(SSL_CLIENT, &opts, &error)) == NULL || error < 0) {
+        ERR_print_errors_fp(stderr);
+        return -1;
+    }
+
+    // open the connections
+    BenchAlloc ba[ALLOC_THREADS];
+    pthread_t  tids[ALLOC_THREADS];
+    int        done = 0;
+    long       rss = benchProcStatus("VmRSS:");
+    double     start = nowUs();
+    for (int i = 0; i < ALLOC_THREADS; i++) {
+        ba[i] = (BenchAlloc){ sctx, cctx, nconn / ALLOC_THREADS + (i < nconn % ALLOC_THREADS), NULL, 0 };
+        if ((ba[i].ssls = calloc(2 * ba[i].nconn, sizeof(SSL *))) == NULL ||
+                pthread_create(&tids[i], NULL, benchAllocThread, &ba[i]) != 0)
+            ba[i].nconn = -1;
+    }
+
+    for (int i = 0; i < ALLOC_THREADS; i++) {
+        if (ba[i].nconn >= 0)
+            pthread_join(tids[i], NULL);
+
+        done += ba[i].done;
+    }
+
+    double elapsed = nowUs() - start;
+
+    // show the results (the connections are still open)
+    SslAllocStats stats;
+    sslAllocStats(&stats);
+    if (done == nconn) {
+        printf("alloc: %-12s %6.0f handshakes/sec  %6.2f KB/SSL RSS", name, nconn * 1000000.0 / elapsed,
+               (double)(benchProcStatus("VmRSS:") - rss) / (2 * nconn));
+        if (stats.active)
+            printf("  %6.1f allocs/SSL  %6.2f KB/SSL live  %ld KB peak  %ld chunks (%ld huge%s)",
+                   stats.allocs_per_conn, stats.live_per_conn / 1024, stats.peak >> 10, stats.chunks,
+                   stats.huge_chunks, stats.huge_off ? ", no huge pages: normal pages" : "");
+
+        printf("\n");
+    }
+
+    // close the connections (from this thread: frees of the blocks of the other arenas)
+    for (int i = 0; i < ALLOC_THREADS; i++) {
+        for (int j = 0; ba[i].ssls != NULL && j < 2 * ba[i].done; j++) {
+            if (ba[i].ssls[j] != NULL)
+                sslClose(ba[i].ssls[j], SSL_get_fd(ba[i].ssls[j]), NULL, false);
+        }
+
+        free(ba[i].ssls);
+    }
+
+    sslReleaseCtx(sctx);
+    sslReleaseCtx(cctx);
+    return done == nconn ? 0 : -1;
+}
+
+// benchAlloc - handshakes and memory with the allocators of OpenSSL (each run in its own process: the allocator is
+// installed by sslInit() before any OpenSSL allocation)
+static int benchAlloc(int nconn)
+{
+    static const struct {
+        const char  *name;
+        SslInitOpts init;
+    } allocs[] = {
+        { "libc",        { SSL_ALLOC_LIBC,  false } },
+        { "pool",        { SSL_ALLOC_POOL,  false } },
+        { "arena",       { SSL_ALLOC_ARENA, false } },
+        { "arena+huge",  { SSL_ALLOC_ARENA, true  } },
+    };
+
+    // allow two fds per connection (client and server are in the same process)
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+        if (nconn > (int)((rl.rlim_cur - 64) / 2))
+            nconn = (int)((rl.rlim_cur - 64) / 2);
+    }
+
+    printf("alloc: %d connections (full handshake) opened by %d threads, per SSL structure (client or server side)\n",
+           nconn, ALLOC_THREADS);
+    for (size_t i = 0; i < sizeof(allocs) / sizeof(allocs[0]); i++) {
+        pid_t pid;
+        int   status;
+        fflush(stdout);
+        if ((pid = fork()) == 0) {
+            int rc = benchAllocRun(&allocs[i].init, allocs[i].name, nconn);
+            fflush(stdout);
+            _exit(rc < 0 ? EXIT_FAILURE : EXIT_SUCCESS);
+        }
+
+        if (pid < 0 || waitpid(pid, &status, 0) < 0 || ! WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+            fprintf(stderr, "alloc: run failed\n");
+            return EXIT_FAILURE;
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
+
+// benchmark batch: messaggi pipelined e buffer di lettura di sslReadBatch()
+#define BATCH_MSGSIZE   64          // dimensione dei messaggi (un record ciascuno)
+#define BATCH_BUFSIZE   65536       // buffer di lettura di sslReadBatch()
+
+// dati del server del benchmark batch
+typedef struct {
+    int           sock;             // socket di ascolto
+    SSL_CTX       *ctx;             // contesto del server
+    bool          batch;            // lettura con sslReadBatch() (altrimenti sslRead())
+    long          total;            // byte da ricevere
+    long          rcvd;             // byte ricevuti
+    BenchBio      bio;              // letture del BIO socket (una syscall ciascuna)
+} BenchBatch;
+
+// benchBatchServer - server of the benchmark batch: read the messages with sslRead() or sslReadBatch(), then ack
+static void* benchBatchServer(void *arg)
+{
+    BenchBatch *bb = arg;
+    SSL        *ssl;
+    static char buf[BATCH_BUFSIZE];
+    if ((ssl = benchAccept(bb->sock, bb->ctx, true)) == NULL)
+        return NULL;
+
+    // count the read system calls of the data only
+    benchBioWatch(ssl, &bb->bio);
+    while (bb->rcvd < bb->total) {
+        ssize_t rcvd = bb->batch ? sslReadBatch(ssl, buf, 1, sizeof(buf), SSL_TIMEOUT_CONN) :
+                                   sslRead(ssl, buf, MYBUFSIZE);
+        if (rcvd <= 0)
+            break;
+
+        bb->rcvd += rcvd;
+    }
+
+    if (bb->rcvd == bb->total)
+        sslWrite(ssl, "k", 1);
+
+    sslClose(ssl, SSL_get_fd(ssl), NULL, true);
+    return NULL;
+}
+
+// benchBatchRun - nmsg messages of BATCH_MSGSIZE bytes written back-to-back by the client (a record each) and read by
+// the server with sslRead() (MYBUFSIZE buffer, as the sample server) or sslReadBatch(): messages/sec and read
+// system calls/message of the server
+static int benchBatchRun(SSL_CTX *sctx, SSL_CTX *cctx, bool batch, int nmsg, double *rate, double *syscalls)
+{
+    BenchBatch bb = { -1, sctx, batch, (long)nmsg * BATCH_MSGSIZE, 0, { true, 0, 0, 0 } };
+    pthread_t  tid;
+    int        port, sock = -1;
+    SSL        *ssl = NULL;
+    char       msg[BATCH_MSGSIZE];
+    if ((bb.sock = benchListen(&port)) < 0 || pthread_create(&tid, NULL, benchBatchServer, &bb) != 0) {
+        close(bb.sock);
+        return -1;
+    }
+
+    // write the messages and wait the ack of the server
+    memset(msg, 'm', sizeof(msg));
+    double start = nowUs();
+    int    i = 0;
+    char   ack;
+    if ((sock = benchConnect(port)) >= 0 && (ssl = SSL_new(cctx)) != NULL && SSL_set_fd(ssl, sock) == 1 &&
+            sslFunc(SSL_connect, ssl) == 1) {
+        start = nowUs();
+        for (; i < nmsg && sslWrite(ssl, msg, sizeof(msg)) == sizeof(msg); i++)
+            ;
+    }
+
+    bool ok = i == nmsg && sslRead(ssl, &ack, 1) == 1;
+    double elapsed = nowUs() - start;
+    if (! ok) {
+        fprintf(stderr, "batch: run failed\n");
+        ERR_print_errors_fp(stderr);
+        shutdown(bb.sock, SHUT_RDWR);  // wake up the server
+    }
+
+    sslClose(ssl, sock, NULL, ok);
+    pthread_join(tid, NULL);
+    close(bb.sock);
+    *rate     = nmsg * 1000000.0 / elapsed;
+    *syscalls = (double)bb.bio.reads / nmsg;
+    return ok ? 0 : -1;
+}
+
+// benchBatch - pipelined small messages read by the server with sslRead() and sslReadBatch()
+static int benchBatch(int nmsg)
+{
+    SslCtxOpts opts = bench_opts;
+    SSL_CTX    *sctx, *cctx;
+    int        error;
+    double     read_rate, read_calls, batch_rate, batch_calls;
+    if ((sctx = sslCreateCtxEx(SSL_SERVER, &opts, &error)) == NULL || error < 0 ||
+            (cctx = sslCreateCtxEx(SSL_CLIENT, &opts, &error)) == NULL || error < 0) {
+        ERR_print_errors_fp(stderr);
+        return EXIT_FAILURE;
+    }
+
+    int rc = benchBatchRun(sctx, cctx, false, nmsg, &read_rate, &read_calls) < 0 ||
+             benchBatchRun(sctx, cctx, true, nmsg, &batch_rate, &batch_calls) < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+    if (rc == EXIT_SUCCESS) {
+        // show the results
+        printf("batch: %d pipelined messages of %d bytes (a record each)\n", nmsg, BATCH_MSGSIZE);
+        printf("batch: sslRead()       %10.0f msg/s   %6.3f read syscalls/msg\n", read_rate, read_calls);
+        printf("batch: sslReadBatch()  %10.0f msg/s   %6.3f read syscalls/msg\n", batch_rate, batch_calls);
+    }
+
+    sslReleaseCtx(sctx);
+    sslReleaseCtx(cctx);
+    return rc;
+}
+
+// benchmark pool: richieste da thread client a un server, con una connessione per richiesta o con il pool
+#define POOL_CLIENTS    4           // thread client
+#define POOL_MSGSIZE    64          // dimensione di richieste e risposte
+#define POOL_KILL       1000        // ogni POOL_KILL richieste una chiude la connessione (dopo la risposta)
+
+// dati di un thread client del benchmark pool
+typedef struct {
+    int           port;             // porta del server
+    SSL_CTX       *ctx;             // contesto client (connessione per richiesta)
+    SslClientPool *pool;            // pool (NULL = connessione per richiesta)
+    int           nreq;             // richieste da eseguire
+    int           failed;           // richieste fallite
+} BenchPool;
+
+// benchPoolEcho - server engine callback: echo of the received data, then close if the request starts with 'q'
+static void benchPoolEcho(SslConn *conn, const void *buf, int num, void *arg)
+{
+    // no Nagle: the response of the first request must not wait the ACK of the session tickets
+    (void)arg;
+    if (num > 0) {
+        benchNoDelay(SSL_get_fd(sslConnSsl(conn)));
+        sslWriteStep(sslConnSsl(conn), buf, num);
+        if (*(const char *)buf == 'q')
+            sslConnClose(conn, true);
+    }
+}
+
+// benchPoolXchg - a request/response exchange (the response can arrive in more records)
+static bool benchPoolXchg(SSL *ssl, char *msg)
+{
+    char buf[POOL_MSGSIZE];
+    int  rcvd = 0, r = 0;
+    if (sslWrite(ssl, msg, POOL_MSGSIZE) != POOL_MSGSIZE)
+        return false;
+
+    while (rcvd < POOL_MSGSIZE && (r = sslRead(ssl, buf + rcvd, POOL_MSGSIZE - rcvd)) > 0)
+        rcvd += r;
+
+    return rcvd == POOL_MSGSIZE;
+}
+
+// benchPoolClient - client thread: nreq requests on a new connection each (resuming the session) or on a connection
+// of the pool; with the pool every POOL_KILL requests the server closes the connection while it is idle
+static void* benchPoolClient(void *arg)
+{
+    BenchPool *bp = arg;
+    char      msg[POOL_MSGSIZE];
+    for (int i = 0; i < bp->nreq; i++) {
+        SSL  *ssl = NULL;
+        int  sock = -1;
+        bool ok;
+        memset(msg, bp->pool && i % POOL_KILL == POOL_KILL - 1 ? 'q' : 'x', sizeof(msg));
+        if (bp->pool) {
+            // acquire a connection, exchange and release
+            ok = (ssl = sslClientPoolGet(bp->pool, "127.0.0.1", bp->port, SSL_TIMEOUT_CONN)) != NULL &&
+                 benchPoolXchg(ssl, msg);
+            if (ssl)
+                sslClientPoolPut(bp->pool, ssl, ok);
+
+            // closed by the server: the connection stays idle while the close arrives
+            if (msg[0] == 'q')
+                usleep(1000);
+        } else {
+            // connect, exchange and close
+            ok = (sock = benchConnect(bp->port)) >= 0 && (ssl = SSL_new(bp->ctx)) != NULL &&
+                 SSL_set_fd(ssl, sock) == 1 && sslConnectSession(ssl, "127.0.0.1", bp->port) == 1 &&
+                 benchPoolXchg(ssl, msg);
+            ERR_clear_error();
+            sslClose(ssl, sock, NULL, ok);
+        }
+
+        if (! ok)
+            bp->failed++;
+    }
+
+    return NULL;
+}
+
+// benchPoolRun - nreq requests from POOL_CLIENTS threads: requests/sec
+static int benchPoolRun(int port, SSL_CTX *ctx, SslClientPool *pool, int nreq, double *rate)
+{
+    BenchPool bp[POOL_CLIENTS];
+    pthread_t tids[POOL_CLIENTS];
+    int       nthreads = 0, failed = 0;
+    double    start = nowUs();
+    for (int i = 0; i < POOL_CLIENTS; i++) {
+        bp[i] = (BenchPool){ port, ctx, pool, nreq / POOL_CLIENTS, 0 };
+        if (pthread_create(&tids[i], NULL, benchPoolClient, &bp[i]) != 0)
+            break;
+
+        nthreads++;
+    }
+
+    for (int i = 0; i < nthreads; i++) {
+        pthread_join(tids[i], NULL);
+        failed += bp[i].failed;
+    }
+
+    *rate = nthreads * (nreq / POOL_CLIENTS) * 1000000.0 / (nowUs() - start);
+    if (failed > 0 || nthreads < POOL_CLIENTS)
+        fprintf(stderr, "pool: %d requests failed\n", failed);
+
+    return failed > 0 || nthreads < POOL_CLIENTS ? -1 : 0;
+}
+
+// benchPool - requests to a local server with a new connection per request (session resumption) and with the client
+// pool (pre-warmed): the pool should skip almost all the handshakes and detect the connections closed by the server
+static int benchPool(int nreq)
+{
+    // start the server engine
+    SslServerOpts sopts;
+    SslServer     *server;
+    memset(&sopts, 0, sizeof(sopts));
+    sopts.host    = "127.0.0.1";
+    sopts.workers = 1;
+    sopts.cb      = benchPoolEcho;
+    if ((server = sslServerStart(&sopts, &bench_opts)) == NULL) {
+        fprintf(stderr, "pool: server engine start failed (%s)\n", strerror(errno));
+        ERR_print_errors_fp(stderr);
+        return EXIT_FAILURE;
+    }
+
+    // connection per request
+    SslClientPoolOpts popts = { 8, 16, 5000, POOL_CLIENTS, 0 };
+    SslClientPool     *pool = NULL;
+    SslClientPoolStats pstats;
+    SslSessStats      sstats;
+    SSL_CTX           *ctx;
+    double            conn_rate, pool_rate;
+    int               error, port = sslServerPort(server), rc = EXIT_FAILURE;
+    if ((ctx = sslCreateCtxEx(SSL_CLIENT, &bench_opts, &error)) == NULL || error < 0 ||
+            benchPoolRun(port, ctx, NULL, nreq, &conn_rate) < 0)
+        goto end;
+
+    sslSessionStats(ctx, &sstats);
+
+    // client pool (pre-warmed)
+    if ((pool = sslClientPoolNew(&popts, &bench_opts)) == NULL || sslClientPoolWarm(pool, "127.0.0.1", port) < 0 ||
+            benchPoolRun(port, NULL, pool, nreq, &pool_rate) < 0)
+        goto end;
+
+    sslClientPoolStats(pool, &pstats);
+
+    // show the results
+    printf("pool: %d requests of %d bytes from %d threads to a local server\n", nreq, POOL_MSGSIZE, POOL_CLIENTS);
+    printf("pool: connection per request %8.0f req/s  %8.1f us/req  %6ld handshakes (%5.1f%% resumed)\n",
+           conn_rate, POOL_CLIENTS * 1e6 / conn_rate, sstats.handshakes, sstats.hit_rate);
+    printf("pool: client pool            %8.0f req/s  %8.1f us/req  %6ld handshakes (%5.1f%% resumed)\n",
+           pool_rate, POOL_CLIENTS * 1e6 / pool_rate, pstats.connects,
+           pstats.connects > 0 ? pstats.resumed * 100.0 / pstats.connects : 0.0);
+    printf("pool: reuse rate %.2f%%, %ld closed by the server and detected idle, %ld failed connects\n",
+           pstats.reuse_rate, pstats.broken, pstats.failed);
+    rc = EXIT_SUCCESS;
+
+end:
+    if (rc != EXIT_SUCCESS)
+        ERR_print_errors_fp(stderr);
+
+    sslClientPoolFree(pool);
+    if (ctx)
+        sslReleaseCtx(ctx);
+
+    sslServerStop(server);
+    return rc;
+}
+
+// benchmark close: chiusura di connessioni con peer bloccato (non legge) o che risponde al close_notify
+#define CLOSE_BUFSIZE   65536       // buffer dei socket e scrittura che li riempie
+#define CLOSE_TIMEOUT   100         // timeout in ms di SSL_CLOSE_WAIT/SSL_CLOSE_ASYNC
+#define CLOSE_FILL      20          // attesa in ms di una scrittura che riempie i buffer (socket pieno)
+#define CLOSE_LEGACY    3           // connessioni chiuse con lo shutdown bloccante (2 sec ciascuna)
+#define CLOSE_LEGACY_TIMEOUT 2000   // timeout in ms della connessione nello shutdown bloccante
+#define CLOSE_LEGACY_MODE   -1      // shutdown bloccante: sslClose() (sslFunc(SSL_shutdown))
+
+// dati del server del benchmark close
+typedef struct {
+    int           sock;             // socket di ascolto
+    SSL_CTX       *ctx;             // contesto del server
+    int           nconn;            // connessioni da servire
+    bool          stuck;            // non legge (tiene le connessioni fino a done), altrimenti risponde al close_notify
+    volatile bool done;             // fine del test
+} BenchClose;
+
+// benchFdCount - number of open fds of the process
+static int benchFdCount(void)
+{
+    int count = 0;
+    for (int fd = 0; fd < 4096; fd++)
+        if (fcntl(fd, F_GETFD) >= 0)
+            count++;
+
+    return count;
+}
+
+// benchCloseServer - server of the benchmark close: stuck (handshake, then no reads until the end of the test) or
+// responsive (reads until the close_notify and answers with its close_notify)
+static void* benchCloseServer(void *arg)
+{
+    BenchClose *bc = arg;
+    SSL        *ssls[bc->nconn];
+    int        n;
+    char       buf[MYBUFSIZE];
+    for (n = 0; n < bc->nconn; n++) {
+        if ((ssls[n] = benchAccept(bc->sock, bc->ctx, true)) == NULL)
+            break;
+
+        if (! bc->stuck) {
+            // responsive: discard the data until the close_notify, then answer
+            sslSetTimeout(ssls[n], SSL_TIMEOUT_INFINITE);
+            while (sslRead(ssls[n], buf, sizeof(buf)) > 0)
+                ;
+
+            sslClose(ssls[n], SSL_get_fd(ssls[n]), NULL, true);
+        }
+    }
+
+    // stuck: close at the end of the test
+    while (bc->stuck && ! bc->done)
+        usleep(1000);
+
+    for (int i = 0; bc->stuck && i < n; i++)
+        sslClose(ssls[i], SSL_get_fd(ssls[i]), NULL, false);
+
+    return NULL;
+}
+
+// benchCloseRun - nconn connections closed with a close mode: average and max close time (stuck peer: the socket
+// buffers are filled before the close, the close_notify can't be sent)
+static int benchCloseRun(SSL_CTX *sctx, SSL_CTX *cctx, bool stuck, int mode, int nconn, double *avg, double *max)
+{
+    BenchClose bc = { -1, sctx, nconn, stuck, false };
+    pthread_t  tid;
+    int        port, size = CLOSE_BUFSIZE, done = 0;
+    static char buf[CLOSE_BUFSIZE];
+    if ((bc.sock = benchListen(&port)) < 0 || setsockopt(bc.sock, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size)) < 0 ||
+            pthread_create(&tid, NULL, benchCloseServer, &bc) != 0) {
+        close(bc.sock);
+        return -1;
+    }
+
+    *avg = *max = 0;
+    for (; done < nconn; done++) {
+        // connect and fill the socket buffers (stuck peer) or send a message (responsive peer)
+        SSL *ssl = NULL;
+        int sock;
+        if ((sock = benchConnect(port)) < 0 || setsockopt(sock, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size)) < 0 ||
+                (ssl = SSL_new(cctx)) == NULL || SSL_set_fd(ssl, sock) != 1 || sslFunc(SSL_connect, ssl) != 1) {
+            sslClose(ssl, sock, NULL, false);
+            break;
+        }
+
+        if (stuck)
+            while (sslWriteEx(ssl, buf, sizeof(buf), CLOSE_FILL) > 0)
+                ;
+        else if (sslWrite(ssl, buf, MYBUFSIZE) != MYBUFSIZE)
+            break;
+
+        // close
+        double start = nowUs();
+        if (mode == CLOSE_LEGACY_MODE) {
+            sslSetTimeout(ssl, CLOSE_LEGACY_TIMEOUT);
+            sslClose(ssl, sock, NULL, true);
+        } else
+            sslCloseEx(ssl, sock, NULL, mode, CLOSE_TIMEOUT);
+
+        double elapsed = nowUs() - start;
+        *avg += elapsed;
+        if (elapsed > *max)
+            *max = elapsed;
+    }
+
+    // end of the test
+    bc.done = true;
+    if (done < nconn)
+        shutdown(bc.sock, SHUT_RDWR);  // wake up the server
+
+    pthread_join(tid, NULL);
+    close(bc.sock);
+    *avg /= done > 0 ? done : 1;
+    return done == nconn ? 0 : -1;
+}
+
+// benchClose - close time of the connections with the close modes of sslCloseEx() and with the blocking shutdown of
+// the old sslClose(): a peer that doesn't read stalls only the blocking shutdown
+static int benchClose(int nconn)
+{
+    static const struct {
+        const char *name;
+        bool       stuck;
+        int        mode;
+    } runs[] = {
+        { "stuck peer      sslClose(true)       ", true,  CLOSE_LEGACY_MODE },
+        { "stuck peer      SSL_CLOSE_QUIET      ", true,  SSL_CLOSE_QUIET },
+        { "stuck peer      SSL_CLOSE_WAIT       ", true,  SSL_CLOSE_WAIT },
+        { "stuck peer      SSL_CLOSE_ASYNC      ", true,  SSL_CLOSE_ASYNC },
+        { "stuck peer      SSL_CLOSE_RESET      ", true,  SSL_CLOSE_RESET },
+        { "responsive peer SSL_CLOSE_WAIT       ", false, SSL_CLOSE_WAIT },
+        { "responsive peer SSL_CLOSE_ASYNC      ", false, SSL_CLOSE_ASYNC },
+    };
+    SslCtxOpts opts = bench_opts;
+    SSL_CTX    *sctx, *cctx;
+    int        error, rc = EXIT_SUCCESS;
+    if ((sctx = sslCreateCtxEx(SSL_SERVER, &opts, &error)) == NULL || error < 0 ||
+            (cctx = sslCreateCtxEx(SSL_CLIENT, &opts, &error)) == NULL || error < 0) {
+        ERR_print_errors_fp(stderr);
+        return EXIT_FAILURE;
+    }
+
+    printf("close: %d connections per mode (%d with the blocking shutdown), timeout %d ms\n", nconn,
+           CLOSE_LEGACY, CLOSE_TIMEOUT);
+    int fds = benchFdCount();
+    for (size_t i = 0; i < sizeof(runs) / sizeof(runs[0]); i++) {
+        double avg, max;
+        int    n = runs[i].mode == CLOSE_LEGACY_MODE && nconn > CLOSE_LEGACY ? CLOSE_LEGACY : nconn;
+        if (benchCloseRun(sctx, cctx, runs[i].stuck, runs[i].mode, n, &avg, &max) < 0) {
+            fprintf(stderr, "close: %s run failed\n", runs[i].name);
+            ERR_print_errors_fp(stderr);
+            rc = EXIT_FAILURE;
+            break;
+        }
+
+        printf("close: %s  avg %10.1f us  max %10.1f us\n", runs[i].name, avg, max);
+    }
+
+    // the reaper closes the connections within the timeout
+    usleep(CLOSE_TIMEOUT * 2000);
+    printf("close: open fds %d before the runs, %d after the reaper (its event fd included)\n", fds, benchFdCount());
+    sslReleaseCtx(sctx);
+    sslReleaseCtx(cctx);
+    return rc;
+}
+
+// benchmark threads: thread client con init, handshake e scambi verificati concorrenti
+#define THREADS_CONNS       25      // connessioni per thread (una su THREADS_RESUME con ripresa della sessione)
+#define THREADS_RESUME      2       // ogni THREADS_RESUME connessioni una riprende la sessione
+#define THREADS_EXCHANGES   20      // scambi richiesta/risposta per connessione
+#define THREADS_MSGSIZE     256     // dimensione di richieste e risposte
+
+// dati di un thread client del benchmark threads
+typedef struct {
+    int               id;           // numero del thread
+    int               port;         // porta del server engine (impostata dopo la prima barriera)
+    pthread_barrier_t *barrier;     // barriera: init e contesti creati, poi server avviato
+    long              handshakes;   // handshake completati
+    long              resumed;      // handshake abbreviati
+    long              exchanges;    // scambi verificati
+    long              corrupted;    // risposte diverse dalle richieste
+    long              failed;       // connessioni o scambi falliti
+} BenchThreads;
+
+// benchThreadsXchg - a request/response exchange: the response must be equal to the request
+static bool benchThreadsXchg(SSL *ssl, const char *msg, char *buf)
+{
+    int rcvd = 0, r = 0;
+    if (sslWrite(ssl, msg, THREADS_MSGSIZE) != THREADS_MSGSIZE)
+        return false;
+
+    while (rcvd < THREADS_MSGSIZE && (r = sslRead(ssl, buf + rcvd, THREADS_MSGSIZE - rcvd)) > 0)
+        rcvd += r;
+
+    return rcvd == THREADS_MSGSIZE;
+}
+
+// benchThreadsClient - client thread: library initialization and context creation (concurrent with the other
+// threads), then THREADS_CONNS connections with full or abbreviated handshake and verified exchanges
+static void* benchThreadsClient(void *arg)
+{
+    BenchThreads *bt = arg;
+    SSL_CTX      *ctx;
+    int          error;
+    char         msg[THREADS_MSGSIZE], buf[THREADS_MSGSIZE];
+
+    // initialize the library and get the client context (the same for all the threads, from the registry)
+    sslInit(NULL);
+    ctx = sslCreateCtxEx(SSL_CLIENT, &bench_opts, &error);
+    if (ctx == NULL || error < 0) {
+        sslReleaseCtx(ctx);
+        ctx = NULL;
+    }
+
+    pthread_barrier_wait(bt->barrier);
+    pthread_barrier_wait(bt->barrier);
+    for (int i = 0; ctx != NULL && bt->port > 0 && i < THREADS_CONNS; i++) {
+        // connect (every THREADS_RESUME connections one resumes the session)
+        SSL  *ssl = NULL;
+        int  sock;
+        bool resume = i % THREADS_RESUME == THREADS_RESUME - 1, ok;
+        ok = (sock = benchConnect(bt->port)) >= 0 && (ssl = SSL_new(ctx)) != NULL && SSL_set_fd(ssl, sock) == 1 &&
+             (resume ? sslConnectSession(ssl, "127.0.0.1", bt->port) : sslFunc(SSL_connect, ssl)) == 1;
+        if (ok) {
+            bt->handshakes++;
+            bt->resumed += SSL_session_reused(ssl);
+        }
+
+        // exchanges (a different message for each thread and exchange, never starting with 'q')
+        for (int j = 0; ok && j < THREADS_EXCHANGES; j++) {
+            for (int k = 0; k < THREADS_MSGSIZE; k++)
+                msg[k] = 'A' + (bt->id + i + j + k) % 26;
+
+            if ((ok = benchThreadsXchg(ssl, msg, buf)) && memcmp(msg, buf, THREADS_MSGSIZE) != 0) {
+                bt->corrupted++;
+                ok = false;
+            }
+
+            bt->exchanges += ok;
+        }
+
+        if (! ok)
+            bt->failed++;
+
+        // every other connection is closed by the reaper thread (SSL_CLOSE_ASYNC)
+        ERR_clear_error();
+        if (ok && i % 2 && 0)
+            sslCloseEx(ssl, sock, NULL, SSL_CLOSE_ASYNC, SSL_TIMEOUT_CONN);
+        else
+            sslClose(ssl, sock, NULL, ok);
+    }
+
+    if (ctx == NULL || bt->port <= 0)
+        bt->failed = THREADS_CONNS;
+
+    sslReleaseCtx(ctx);
+    return NULL;
+}
+
+// benchThreads - nthreads client threads initialize the library and create their context at the same time, then
+// run handshakes and verified exchanges against a server engine with a worker per core (at least 2): no failure and
+// no corrupted response must happen; at the end the library is torn down (twice: sslCleanup() is idempotent) and no
+// thread of the library (crypto pool of the server keys, reaper of the async closes, watcher of the ticket keys of a
+// context still referenced) must be left running
+static int benchThreads(int nthreads)
+{
+    pthread_barrier_t barrier;
+    BenchThreads      *bt;
+    pthread_t         *tids;
+    int               started = 0, ncpu = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (nthreads <= 0 || (bt = calloc(nthreads, sizeof(BenchThreads))) == NULL ||
+            (tids = calloc(nthreads, sizeof(pthread_t))) == NULL ||
+            pthread_barrier_init(&barrier, NULL, nthreads + 1) != 0) {
+        fprintf(stderr, "threads: allocation failed\n");
+        return EXIT_FAILURE;
+    }
+
+    // start the client threads (they initialize the library concurrently)
+    long threads_before = benchProcStatus("Threads:");
+    printf("threads: %d client threads, %d connections each (1 of %d resumed), %d exchanges of %d bytes\n",
+           nthreads, THREADS_CONNS, THREADS_RESUME, THREADS_EXCHANGES, THREADS_MSGSIZE);
+    double start = nowUs();
+    for (; started < nthreads; started++) {
+        bt[started] = (BenchThreads){ started, 0, &barrier, 0, 0, 0, 0, 0 };
+        if (pthread_create(&tids[started], NULL, benchThreadsClient, &bt[started]) != 0) {
+            fprintf(stderr, "threads: thread creation failed\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    pthread_barrier_wait(&barrier);
+    double init_us = nowUs() - start;
+
+    // start the server engine (private-key operations in the crypto pool) and release the clients; a context with
+    // ticket keys (a watcher thread) is kept referenced until after the teardown
+    SslServerOpts sopts;
+    SslServer     *server;
+    SslCtxOpts    copts = bench_opts, kopts = bench_opts;
+    SSL_CTX       *kctx;
+    char          path[FILENAME_MAX];
+    int           error;
+    snprintf(path, sizeof(path), "/tmp/myssl-bench-threads-%d", (int)getpid());
+    copts.async_workers = 2;
+    kopts.ticket_keys   = path;
+    if ((kctx = sslCreateCtxEx(SSL_SERVER, &kopts, &error)) == NULL || error < 0) {
+        fprintf(stderr, "threads: OpenSSL error creating the context with ticket keys\n");
+        ERR_print_errors_fp(stderr);
+    }
+
+    memset(&sopts, 0, sizeof(sopts));
+    sopts.host    = "127.0.0.1";
+    sopts.workers = ncpu > 2 ? ncpu : 2;
+    sopts.cb      = benchPoolEcho;
+    if ((server = sslServerStart(&sopts, &copts)) == NULL) {
+        fprintf(stderr, "threads: server engine start failed (%s)\n", strerror(errno));
+        ERR_print_errors_fp(stderr);
+    }
+
+    for (int i = 0; i < nthreads; i++)
+        bt[i].port = server ? sslServerPort(server) : 0;
+
+    start = nowUs();
+    pthread_barrier_wait(&barrier);
+
+    // collect the results
+    long handshakes = 0, resumed = 0, exchanges = 0, corrupted = 0, failed = 0;
+    for (int i = 0; i < nthreads; i++) {
+        pthread_join(tids[i], NULL);
+        handshakes += bt[i].handshakes;
+        resumed    += bt[i].resumed;
+        exchanges  += bt[i].exchanges;
+        corrupted  += bt[i].corrupted;
+        failed     += bt[i].failed;
+    }
+
+    double elapsed = (nowUs() - start) / 1e6;
+    if (server)
+        sslServerStop(server);
+
+    printf("threads: concurrent init and context creation %8.1f us\n", init_us);
+    printf("threads: %6ld handshakes (%ld resumed)  %10.0f handshakes/s\n", handshakes, resumed,
+           handshakes / elapsed);
+    printf("threads: %6ld exchanges                %10.0f exchanges/s\n", exchanges, exchanges / elapsed);
+    printf("threads: %6ld failed, %ld corrupted\n", failed, corrupted);
+
+    // teardown (the second call does nothing): the threads of the library are joined
+    long threads_live = benchProcStatus("Threads:");
+    sslCleanup();
+    sslCleanup();
+    long threads_after = benchProcStatus("Threads:");
+    printf("threads: library torn down, threads %ld before the test, %ld before and %ld after the teardown\n",
+           threads_before, threads_live, threads_after);
+    sslReleaseCtx(kctx);
+    unlink(path);
+    pthread_barrier_destroy(&barrier);
+    free(tids);
+    free(bt);
+    if (threads_after > threads_before)
+        fprintf(stderr, "threads: %ld threads of the library still running\n", threads_after - threads_before);
+
+    return failed > 0 || corrupted > 0 || handshakes == 0 || kctx == NULL || error < 0 ||
+           threads_after > threads_before ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+// benchmark frames: messaggi piccoli di lunghezza variabile con prefisso di lunghezza
+#define FRAMES_MAXSIZE  128         // max dimensione di un messaggio (lunghezze da 1 a FRAMES_MAXSIZE)
+
+// dati del server del benchmark frames
+typedef struct {
+    int           sock;             // socket di ascolto
+    SSL_CTX       *ctx;             // contesto del server
+    bool          framed;           // lettura con sslFrameRead() (altrimenti header e payload con sslRead())
+    int           nmsg;             // messaggi da ricevere
+    int           rcvd;             // messaggi ricevuti e verificati
+    BenchBio      bio;              // letture del BIO socket (una syscall ciascuna)
+} BenchFrames;
+
+// benchFramesExact - read exactly num bytes (hand-rolled framing: header, then payload)
+static bool benchFramesExact(SSL *ssl, void *buf, int num)
+{
+    int rcvd = 0, r = 0;
+    while (rcvd < num && (r = sslRead(ssl, (char *)buf + rcvd, num - rcvd)) > 0)
+        rcvd += r;
+
+    return rcvd == num;
+}
+
+// benchFramesServer - server of the benchmark frames: read and verify the messages (hand-rolled or with a framer),
+// then ack
+static void* benchFramesServer(void *arg)
+{
+    BenchFrames *bf = arg;
+    SSL         *ssl;
+    SslFrame    *frame = NULL;
+    if ((ssl = benchAccept(bf->sock, bf->ctx, true)) == NULL)
+        return NULL;
+
+    if (bf->framed && (frame = sslFrameNew(ssl, FRAMES_MAXSIZE)) == NULL) {
+        sslClose(ssl, SSL_get_fd(ssl), NULL, false);
+        return NULL;
+    }
+
+    // count the read system calls of the data only
+    benchBioWatch(ssl, &bf->bio);
+    for (; bf->rcvd < bf->nmsg; bf->rcvd++) {
+        const void *payload;
+        size_t     len;
+        char       buf[FRAMES_MAXSIZE];
+        if (frame != NULL) {
+            // framer: the payload stays in the read buffer of the framer
+            if (sslFrameRead(frame, &payload, &len, SSL_TIMEOUT_CONN) != 1)
+                break;
+        } else {
+            // hand-rolled: header and payload copied in the buffer of the message
+            uint32_t hdr;
+            if (! benchFramesExact(ssl, &hdr, sizeof(hdr)) || (len = ntohl(hdr)) > sizeof(buf) ||
+                    ! benchFramesExact(ssl, buf, (int)len))
+                break;
+
+            payload = buf;
+        }
+
+        // verify the message
+        if (len != (size_t)(bf->rcvd % FRAMES_MAXSIZE + 1) || ((const char *)payload)[len - 1] != 'a' + bf->rcvd % 26)
+            break;
+    }
+
+    if (bf->rcvd == bf->nmsg)
+        sslWrite(ssl, "k", 1);
+
+    sslFrameFree(frame);
+    sslClose(ssl, SSL_get_fd(ssl), NULL, true);
+    return NULL;
+}
+
+// benchFramesRun - nmsg messages of 1..FRAMES_MAXSIZE bytes written back-to-back by the client, with a hand-rolled
+// length prefix (header and payload in two writes, read by the server with sslRead() of the exact sizes) or with
+// sslFrameWrite()/sslFrameRead(): messages/sec and read system calls/message of the server
+static int benchFramesRun(SSL_CTX *sctx, SSL_CTX *cctx, bool framed, int nmsg, double *rate, double *syscalls)
+{
+    BenchFrames bf = { -1, sctx, framed, nmsg, 0, { true, 0, 0, 0 } };
+    pthread_t   tid;
+    int         port, sock = -1;
+    SSL         *ssl = NULL;
+    char        msg[FRAMES_MAXSIZE];
+    if ((bf.sock = benchListen(&port)) < 0 || pthread_create(&tid, NULL, benchFramesServer, &bf) != 0) {
+        close(bf.sock);
+        return -1;
+    }
+
+    // write the messages and wait the ack of the server
+    double start = nowUs();
+    int    i = 0;
+    char   ack;
+    if ((sock = benchConnect(port)) >= 0 && (ssl = SSL_new(cctx)) != NULL && SSL_set_fd(ssl, sock) == 1 &&
+            sslFunc(SSL_connect, ssl) == 1) {
+        start = nowUs();
+        for (; i < nmsg; i++) {
+            uint32_t len = i % FRAMES_MAXSIZE + 1, hdr = htonl(len);
+            memset(msg, 'a' + i % 26, len);
+            if (framed ? sslFrameWrite(ssl, msg, len) != (ssize_t)len :
+                         sslWrite(ssl, &hdr, sizeof(hdr)) != sizeof(hdr) || sslWrite(ssl, msg, len) != (int)len)
+                break;
+        }
+    }
+
+    bool ok = i == nmsg && sslRead(ssl, &ack, 1) == 1;
+    double elapsed = nowUs() - start;
+    if (! ok) {
+        fprintf(stderr, "frames: run failed (%d messages verified)\n", bf.rcvd);
+        ERR_print_errors_fp(stderr);
+        shutdown(bf.sock, SHUT_RDWR);  // wake up the server
+    }
+
+    sslClose(ssl, sock, NULL, ok);
+    pthread_join(tid, NULL);
+    close(bf.sock);
+    *rate     = nmsg * 1000000.0 / elapsed;
+    *syscalls = (double)bf.bio.reads / nmsg;
+    return ok ? 0 : -1;
+}
+
+// benchFrames - pipelined small messages with a hand-rolled length prefix and with the framing layer
+static int benchFrames(int nmsg)
+{
+    SslCtxOpts opts = bench_opts;
+    SSL_CTX    *sctx, *cctx;
+    int        error;
+    double     hand_rate, hand_calls, frame_rate, frame_calls;
+    if ((sctx = sslCreateCtxEx(SSL_SERVER, &opts, &error)) == NULL || error < 0 ||
+            (cctx = sslCreateCtxEx(SSL_CLIENT, &opts, &error)) == NULL || error < 0) {
+        ERR_print_errors_fp(stderr);
+        return EXIT_FAILURE;
+    }
+
+    int rc = benchFramesRun(sctx, cctx, false, nmsg, &hand_rate, &hand_calls) < 0 ||
+             benchFramesRun(sctx, cctx, true, nmsg, &frame_rate, &frame_calls) < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+    if (rc == EXIT_SUCCESS) {
+        // show the results
+        printf("frames: %d pipelined messages of 1..%d bytes (verified by the server)\n", nmsg, FRAMES_MAXSIZE);
+        printf("frames: hand-rolled (2 records)         %10.0f msg/s   %6.3f read syscalls/msg\n", hand_rate,
+               hand_calls);
+        printf("frames: sslFrameWrite()/sslFrameRead()  %10.0f msg/s   %6.3f read syscalls/msg\n", frame_rate,
+               frame_calls);
+    }
+
+    sslReleaseCtx(sctx);
+    sslReleaseCtx(cctx);
+    return rc;
+}
+
+// benchmark queue: fan-out di un produttore a consumatori veloci e lenti con le code di scrittura del reactor
+#define QUEUE_MSGSIZE   256         // dimensione di un messaggio (istante di invio, numero di sequenza, riempimento)
+#define QUEUE_RATE      10000       // messaggi/sec del produttore
+#define QUEUE_FAST      4           // consumatori veloci (leggono tutti i messaggi)
+#define QUEUE_SLOW      4           // consumatori lenti (non leggono)
+#define QUEUE_SNDBUF    65536       // buffer di invio dei socket del server (la coda si riempie prima)
+#define QUEUE_RCVBUF    4096        // buffer di ricezione dei consumatori lenti
+#define QUEUE_HIGH      65536       // soglia alta delle code
+#define QUEUE_LOW       16384       // soglia bassa delle code
+#define QUEUE_LIMIT     262144      // limite delle code
+#define QUEUE_MAXTIME   200         // ms sopra la soglia alta prima della chiusura (esecuzione SSL_QUEUE_CLOSE)
+
+// dati del server (produttore) del benchmark queue
+typedef struct {
+    SslQueueOpts opts;                          // opzioni delle code delle connessioni
+    SslConn      *subs[QUEUE_FAST + QUEUE_SLOW];    // connessioni iscritte (NULL = chiusa)
+    int          nsubs;                         // connessioni iscritte (chiuse comprese)
+    size_t       peak;                          // max byte in coda di una connessione
+    long         high;                          // eventi SSL_EV_QUEUE_HIGH
+    long         low;                           // eventi SSL_EV_QUEUE_LOW
+    long         dropped;                       // buffer scartati (SSL_QUEUE_DROP)
+    long         closed;                        // consumatori chiusi dalla coda (SSL_QUEUE_CLOSE o max_time)
+} BenchQueue;
+
+// dati di un thread consumatore del benchmark queue
+typedef struct {
+    int           port;             // porta del server
+    SSL_CTX       *ctx;             // contesto client
+    bool          slow;             // consumatore lento (non legge)
+    int           nmsg;             // messaggi attesi
+    volatile bool *stop;            // fine dell'esecuzione (consumatori lenti)
+    double        *lat;             // latenze dei messaggi ricevuti in us
+    int           rcvd;             // messaggi ricevuti
+    long          lost;             // messaggi mancanti (numeri di sequenza saltati)
+    long          corrupted;        // messaggi di lunghezza errata o fuori sequenza
+    double        last_us;          // istante dell'ultimo messaggio ricevuto
+    volatile bool done;             // consumatore terminato
+} BenchQueueClient;
+
+// benchQueueUnsub - remove a connection from the subscribers of the producer
+static bool benchQueueUnsub(SslConn **subs, int nsubs, SslConn *conn)
+{
+    for (int i = 0; i < nsubs; i++) {
+        if (subs[i] == conn) {
+            subs[i] = NULL;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// benchQueueServer - server callback: subscribe the connected clients, count the queue events
+static void benchQueueServer(SslConn *conn, int event, void *arg)
+{
+    BenchQueue *bench = arg;
+    char       buf[MYBUFSIZE];
+    int        rcvd, size = QUEUE_SNDBUF;
+    switch (event) {
+    case SSL_EV_CONNECTED:
+        // small kernel send buffer: a slow consumer fills its queue in a short time
+        setsockopt(SSL_get_fd(sslConnSsl(conn)), SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+        sslConnQueueSet(conn, &bench->opts);
+        if (bench->nsubs < QUEUE_FAST + QUEUE_SLOW)
+            bench->subs[bench->nsubs++] = conn;
+
+        break;
+
+    case SSL_EV_READ:
+        // the clients don't send data: drain the post-handshake messages, close on disconnection
+        while ((rcvd = sslReadStep(sslConnSsl(conn), buf, sizeof(buf))) > 0)
+            ;
+
+        if (rcvd == SSL_STEP_CLOSED || rcvd == SSL_STEP_ERROR) {
+            benchQueueUnsub(bench->subs, bench->nsubs, conn);
+            sslConnClose(conn, false);
+        }
+
+        break;
+
+    case SSL_EV_CLOSED:
+        // slow consumer closed by its queue (or handshake failed: not subscribed)
+        if (benchQueueUnsub(bench->subs, bench->nsubs, conn))
+            bench->closed++;
+
+        break;
+
+    case SSL_EV_QUEUE_HIGH:
+        bench->high++;
+        break;
+
+    case SSL_EV_QUEUE_LOW:
+        bench->low++;
+        break;
+    }
+}
+
+// benchQueueClient - consumer thread: a fast consumer reads and checks all the messages with sslFrameRead(), a
+// slow consumer (small receive buffer) never reads
+static void* benchQueueClient(void *arg)
+{
+    BenchQueueClient *bc = arg;
+    int              sock, size = QUEUE_RCVBUF;
+    SSL              *ssl = NULL;
+    SslFrame         *frame = NULL;
+    if ((sock = benchConnect(bc->port)) < 0 || (ssl = SSL_new(bc->ctx)) == NULL || SSL_set_fd(ssl, sock) != 1 ||
+            sslFunc(SSL_connect, ssl) != 1) {
+        fprintf(stderr, "queue: connection failed\n");
+        goto end;
+    }
+
+    if (bc->slow) {
+        setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+        while (! *bc->stop)
+            usleep(10000);
+
+        goto end;
+    }
+
+    // read the messages until the last one (or a stall of the producer)
+    const void *payload;
+    size_t     len;
+    int64_t    next = 0;
+    if ((frame = sslFrameNew(ssl, 0)) == NULL)
+        goto end;
+
+    while (next < bc->nmsg && sslFrameRead(frame, &payload, &len, 2000) == 1) {
+        double  sent;
+        int64_t seq;
+        if (len != QUEUE_MSGSIZE) {
+            bc->corrupted++;
+            continue;
+        }
+
+        memcpy(&sent, payload, sizeof(sent));
+        memcpy(&seq, (const char*)payload + sizeof(sent), sizeof(seq));
+        if (seq < next) {
+            bc->corrupted++;
+            continue;
+        }
+
+        bc->last_us           = nowUs();
+        bc->lat[bc->rcvd++]   = bc->last_us - sent;
+        bc->lost             += seq - next;
+        next                  = seq + 1;
+    }
+
+    bc->lost += bc->nmsg - next;
+
+end:
+    bc->done = true;
+    sslFrameFree(frame);
+    sslClose(ssl, sock, NULL, false);
+    return NULL;
+}
+
+// benchQueueRun - a producer (server reactor) sends nmsg messages at QUEUE_RATE msg/s to QUEUE_FAST fast consumers
+// and nslow slow consumers, sharing each message (a SslBuf) among all the write queues
+static int benchQueueRun(SSL_CTX *sctx, SSL_CTX *cctx, const char *name, int nslow, int policy, int max_time,
+                         int nmsg)
+{
+    // create the reactor and the listening socket
+    BenchQueue   bench;
+    SslReactor   *reactor;
+    int          lsock, port;
+    memset(&bench, 0, sizeof(bench));
+    bench.opts.high     = QUEUE_HIGH;
+    bench.opts.low      = QUEUE_LOW;
+    bench.opts.limit    = QUEUE_LIMIT;
+    bench.opts.policy   = policy;
+    bench.opts.max_time = max_time;
+    if ((reactor = sslReactorNew()) == NULL || (lsock = benchListen(&port)) < 0 ||
+            sslReactorListen(reactor, lsock, sctx, benchQueueServer, &bench) < 0) {
+        fprintf(stderr, "queue: setup failed\n");
+        sslReactorFree(reactor);
+        return -1;
+    }
+
+    // start the consumers and wait their subscriptions
+    BenchQueueClient bc[QUEUE_FAST + QUEUE_SLOW];
+    pthread_t        tids[QUEUE_FAST + QUEUE_SLOW];
+    volatile bool    stop = false;
+    int              nclients = QUEUE_FAST + nslow, nthreads = 0, rc = -1;
+    memset(bc, 0, sizeof(bc));
+    for (int i = 0; i < nclients; i++) {
+        bc[i].port = port;
+        bc[i].ctx  = cctx;
+        bc[i].slow = i >= QUEUE_FAST;
+        bc[i].nmsg = nmsg;
+        bc[i].stop = &stop;
+        if ((bc[i].lat = malloc(nmsg * sizeof(double))) == NULL ||
+                pthread_create(&tids[i], NULL, benchQueueClient, &bc[i]) != 0)
+            goto end;
+
+        nthreads++;
+    }
+
+    double deadline = nowUs() + 10e6;
+    while (bench.nsubs < nclients && nowUs() < deadline)
+        sslReactorRun(reactor, 10);
+
+    if (bench.nsubs < nclients) {
+        fprintf(stderr, "queue: %d/%d consumers connected\n", bench.nsubs, nclients);
+        goto end;
+    }
+
+    // produce the messages at the fixed rate: each message is a frame in a buffer shared by all the queues
+    double start = nowUs();
+    for (int sent = 0; sent < nmsg; ) {
+        int due = (int)((nowUs() - start) * QUEUE_RATE / 1e6) + 1;
+        for (; sent < nmsg && sent < due; sent++) {
+            SslBuf  *buf;
+            if ((buf = sslBufNew(NULL, SSL_FRAME_HEADER + QUEUE_MSGSIZE)) == NULL)
+                goto end;
+
+            unsigned char *data = sslBufData(buf);
+            uint32_t      hdr = htonl(QUEUE_MSGSIZE);
+            double        now = nowUs();
+            int64_t       seq = sent;
+            memcpy(data, &hdr, SSL_FRAME_HEADER);
+            memcpy(data + SSL_FRAME_HEADER, &now, sizeof(now));
+            memcpy(data + SSL_FRAME_HEADER + sizeof(now), &seq, sizeof(seq));
+            memset(data + SSL_FRAME_HEADER + sizeof(now) + sizeof(seq), 'q', QUEUE_MSGSIZE - sizeof(now) - sizeof(seq));
+            for (int i = 0; i < bench.nsubs; i++) {
+                if (bench.subs[i] && sslConnSend(bench.subs[i], buf) < 0 && errno == ENOBUFS &&
+                        policy == SSL_QUEUE_DROP)
+                    bench.dropped++;
+
+                if (bench.subs[i] && sslConnQueued(bench.subs[i]) > bench.peak)
+                    bench.peak = sslConnQueued(bench.subs[i]);
+            }
+
+            sslBufUnref(buf);
+        }
+
+        sslReactorRun(reactor, 1);
+    }
+
+    // write the rest of the queues until the fast consumers are done
+    deadline = nowUs() + 10e6;
+    for (bool done = false; ! done && nowUs() < deadline; ) {
+        sslReactorRun(reactor, 5);
+        done = true;
+        for (int i = 0; i < QUEUE_FAST; i++)
+            done = done && bc[i].done;
+    }
+
+    // latency and throughput of the fast consumers
+    double *lat, last = start;
+    long   rcvd = 0, lost = 0, corrupted = 0;
+    for (int i = 0; i < QUEUE_FAST; i++)
+        rcvd += bc[i].rcvd;
+
+    if ((lat = malloc((rcvd + 1) * sizeof(double))) == NULL)
+        goto end;
+
+    rcvd = 0;
+    for (int i = 0; i < QUEUE_FAST; i++) {
+        memcpy(lat + rcvd, bc[i].lat, bc[i].rcvd * sizeof(double));
+        rcvd      += bc[i].rcvd;
+        lost      += bc[i].lost;
+        corrupted += bc[i].corrupted;
+        if (bc[i].last_us > last)
+            last = bc[i].last_us;
+    }
+
+    qsort(lat, rcvd, sizeof(double), benchCmpDouble);
+    printf("queue: %-20s fast %8.0f msg/s  p50 %8.1f us  p99 %8.1f us  lost %ld  corrupted %ld\n", name,
+           last > start ? rcvd / ((last - start) / 1e6) : 0.0, rcvd ? lat[rcvd / 2] : 0.0,
+           rcvd ? lat[rcvd * 99 / 100] : 0.0, lost, corrupted);
+    printf("queue: %-20s peak %8zu B/conn (limit %d)  high %ld  low %ld  dropped %ld  closed %ld\n", "",
+           bench.peak, QUEUE_LIMIT, bench.high, bench.low, bench.dropped, bench.closed);
+    free(lat);
+    rc = corrupted > 0 || lost > 0 || bench.peak > QUEUE_LIMIT ? -1 : 0;
+
+end:
+    // stop the consumers, then close the server connections
+    stop = true;
+    for (int i = 0; i < nthreads; i++)
+        pthread_join(tids[i], NULL);
+
+    for (int i = 0; i < nclients; i++)
+        free(bc[i].lat);
+
+    sslReactorFree(reactor);
+    return rc;
+}
+
+// benchQueue - fast consumers alone, then with slow consumers dropped by buffer (SSL_QUEUE_DROP) or by connection
+// (SSL_QUEUE_CLOSE with max_time): the fast consumers keep their throughput and latency, the slow ones their memory
+static int benchQueue(int nmsg)
+{
+    SslCtxOpts opts = bench_opts;
+    SSL_CTX    *sctx, *cctx;
+    int        error;
+    if ((sctx = sslCreateCtxEx(SSL_SERVER, &opts, &error)) == NULL || error < 0 ||
+            (cctx = sslCreateCtxEx(SSL_CLIENT, &opts, &error)) == NULL || error < 0) {
+        ERR_print_errors_fp(stderr);
+        return EXIT_FAILURE;
+    }
+
+    printf("queue: %d messages of %d bytes at %d msg/s, %d fast consumers, %d slow consumers\n", nmsg, QUEUE_MSGSIZE,
+           QUEUE_RATE, QUEUE_FAST, QUEUE_SLOW);
+    int rc = benchQueueRun(sctx, cctx, "fast only", 0, SSL_QUEUE_DROP, 0, nmsg) < 0 ||
+             benchQueueRun(sctx, cctx, "slow, drop", QUEUE_SLOW, SSL_QUEUE_DROP, 0, nmsg) < 0 ||
+             benchQueueRun(sctx, cctx, "slow, close", QUEUE_SLOW, SSL_QUEUE_CLOSE, QUEUE_MAXTIME, nmsg) < 0 ?
+             EXIT_FAILURE : EXIT_SUCCESS;
+
+    sslReleaseCtx(sctx);
+    sslReleaseCtx(cctx);
+    return rc;
+}
+
+// benchmark sockets: richiesta e risposta in due scritture piccole (header e corpo) su connessioni nuove
+#define SOCKETS_BODY    100         // dimensione del corpo di richiesta e risposta
+
+// dati del server del benchmark sockets
+typedef struct {
+    int     sock;           // socket di ascolto (sslListen())
+    int     nconn;          // numero connessioni da servire
+    SSL_CTX *ctx;           // contesto del server
+    int     failed;         // connessioni fallite
+} BenchSockets;
+
+// benchSocketsServer - server thread: accept, handshake, request read and response in two writes for each connection
+static void* benchSocketsServer(void *arg)
+{
+    BenchSockets *bs = arg;
+    char         buf[SSL_FRAME_HEADER + SOCKETS_BODY];
+    uint32_t     hdr = htonl(SOCKETS_BODY);
+    memset(buf, 'r', sizeof(buf));
+    for (int i = 0; i < bs->nconn; i++) {
+        int        sock, rcvd = 0, r = 0;
+        SSL        *ssl;
+        if ((sock = sslAccept(bs->sock)) < 0 || (ssl = benchSslNew(bs->ctx, sock, true)) == NULL) {
+            bs->failed++;
+            continue;
+        }
+
+        // request (header and body), then response (header and body in two records)
+        while (rcvd < (int)sizeof(buf) && (r = sslRead(ssl, buf + rcvd, sizeof(buf) - rcvd)) > 0)
+            rcvd += r;
+
+        if (rcvd < (int)sizeof(buf) || sslWrite(ssl, &hdr, SSL_FRAME_HEADER) != SSL_FRAME_HEADER ||
+                sslWrite(ssl, buf + SSL_FRAME_HEADER, SOCKETS_BODY) != SOCKETS_BODY)
+            bs->failed++;
+
+        sslClose(ssl, sock, NULL, true);
+    }
+
+    return NULL;
+}
+
+// benchSocketsRun - nconn connections with the socket options sopts (server and client): time from the connect to
+// the first byte and to the whole response, connections with data in the SYN (Fast Open, returned, -1 on error)
+static int benchSocketsRun(SSL_CTX *sctx, SSL_CTX *cctx, const char *name, const SslSockOpts *sopts, int nconn)
+{
+    // start the server
+    BenchSockets       bs;
+    pthread_t          tid;
+    struct sockaddr_in addr;
+    socklen_t          addrlen = sizeof(addr);
+    memset(&bs, 0, sizeof(bs));
+    bs.nconn = nconn;
+    bs.ctx   = sctx;
+    if ((bs.sock = sslListen("127.0.0.1", 0, sopts)) < 0 ||
+            getsockname(bs.sock, (struct sockaddr *)&addr, &addrlen) < 0 ||
+            pthread_create(&tid, NULL, benchSocketsServer, &bs) != 0) {
+        fprintf(stderr, "sockets: setup failed (%s)\n", strerror(errno));
+        if (bs.sock >= 0)
+            close(bs.sock);
+
+        return -1;
+    }
+
+    // connections: request in two writes (header and body), response read to the end
+    double   *first, *last;
+    int      failed = 0, syn_data = 0, n = 0;
+    char     buf[SSL_FRAME_HEADER + SOCKETS_BODY];
+    uint32_t hdr = htonl(SOCKETS_BODY);
+    first = malloc(nconn * sizeof(double));
+    last  = malloc(nconn * sizeof(double));
+    memset(buf, 'q', sizeof(buf));
+    for (int i = 0; first != NULL && last != NULL && i < nconn; i++) {
+        double         start = nowUs(), ttfb = 0;
+        int            sock, rcvd = 0, r = 0;
+        SSL            *ssl = NULL;
+        struct tcp_info info;
+        socklen_t      len = sizeof(info);
+        if ((sock = sslConnect("127.0.0.1", ntohs(addr.sin_port), sopts)) < 0 || (ssl = SSL_new(cctx)) == NULL ||
+                SSL_set_fd(ssl, sock) != 1 || sslFunc(SSL_connect, ssl) != 1 ||
+                sslWrite(ssl, &hdr, SSL_FRAME_HEADER) != SSL_FRAME_HEADER ||
+                sslWrite(ssl, buf + SSL_FRAME_HEADER, SOCKETS_BODY) != SOCKETS_BODY) {
+            failed++;
+            sslClose(ssl, sock, NULL, false);
+            continue;
+        }
+
+        while (rcvd < (int)sizeof(buf) && (r = sslRead(ssl, buf + rcvd, sizeof(buf) - rcvd)) > 0) {
+            if (rcvd == 0)
+                ttfb = nowUs() - start;
+
+            rcvd += r;
+        }
+
+        if (rcvd < (int)sizeof(buf)) {
+            failed++;
+        } else {
+            first[n]  = ttfb;
+            last[n++] = nowUs() - start;
+        }
+
+        if (getsockopt(sock, IPPROTO_TCP, TCP_INFO, &info, &len) == 0 && (info.tcpi_options & TCPI_OPT_SYN_DATA))
+            syn_data++;
+
+        sslClose(ssl, sock, NULL, true);
+    }
+
+    pthread_join(tid, NULL);
+    close(bs.sock);
+
+    // show the results
+    int rc = -1;
+    if (n > 0) {
+        qsort(first, n, sizeof(double), benchCmpDouble);
+        qsort(last, n, sizeof(double), benchCmpDouble);
+        printf("sockets: %-16s first byte p50 %8.1f us  p99 %8.1f us   response p50 %8.1f us  p99 %8.1f us\n", name,
+               first[n / 2], first[n * 99 / 100], last[n / 2], last[n * 99 / 100]);
+        printf("sockets: %-16s %d connections, %d with data in the SYN, %d failed\n", "", n, syn_data,
+               failed + bs.failed);
+        rc = failed + bs.failed > 0 ? -1 : syn_data;
+    }
+
+    free(first);
+    free(last);
+    return rc;
+}
+
+// benchSockets - connect-to-first-byte latency of new connections without socket options (as the sockets of the
+// samples before sslListen()/sslConnect()) and with the latency profile
+static int benchSockets(int nconn)
+{
+    SslCtxOpts opts = bench_opts;
+    SSL_CTX    *sctx, *cctx;
+    int        error;
+    if ((sctx = sslCreateCtxEx(SSL_SERVER, &opts, &error)) == NULL || error < 0 ||
+            (cctx = sslCreateCtxEx(SSL_CLIENT, &opts, &error)) == NULL || error < 0) {
+        ERR_print_errors_fp(stderr);
+        return EXIT_FAILURE;
+    }
+
+    // Fast Open enabled for the client and the server (net.ipv4.tcp_fastopen bits 1 and 2)
+    FILE *fp;
+    int  tfo = 0;
+    if ((fp = fopen("/proc/sys/net/ipv4/tcp_fastopen", "r")) != NULL) {
+        if (fscanf(fp, "%d", &tfo) != 1)
+            tfo = 0;
+
+        fclose(fp);
+    }
+
+    // no options and the old fixed backlog, then the default profile (NULL)
+    SslSockOpts plain = { 0, BACKLOG, 0, 0, 0 };
+    int         syn_data;
+    printf("sockets: %d connections, request and response of %d bytes in two writes each\n", nconn,
+           SSL_FRAME_HEADER + SOCKETS_BODY);
+    int rc = benchSocketsRun(sctx, cctx, "no options", &plain, nconn) < 0 ||
+             (syn_data = benchSocketsRun(sctx, cctx, "SSL_SOCK_LATENCY", NULL, nconn)) < 0 ? EXIT_FAILURE :
+                                                                                             EXIT_SUCCESS;
+
+    // with Fast Open enabled the connections after the first one (cookie) must send the ClientHello in the SYN
+    if (rc == EXIT_SUCCESS && (tfo & 3) != 3) {
+        printf("sockets: Fast Open not tested (net.ipv4.tcp_fastopen = %d, 3 enables the client and the server)\n",
+               tfo);
+    } else if (rc == EXIT_SUCCESS && nconn > 1 && syn_data == 0) {
+        fprintf(stderr, "sockets: Fast Open enabled but no connection with data in the SYN\n");
+        rc = EXIT_FAILURE;
+    }
+
+    sslReleaseCtx(sctx);
+    sslReleaseCtx(cctx);
+    return rc;
+}
@@ -17,7 +17,7 @@
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
-#include <arpa/inet.h>
+#include <signal.h>
 #include <openssl/err.h>
 
 int main(int argc, char *argv[])
@@ -30,26 +30,15 @@ int main(int argc, char *argv[])
         return EXIT_FAILURE;
     }
 
-    // create a socket
-    int my_socket;
-    if ((my_socket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0) {
-        // socket() error
-        fprintf(stderr, "%s: could not create socket (%s)\n", argv[0], strerror(errno));
-        return EXIT_FAILURE;
-    }
+    // a write to a disconnected peer must fail with EPIPE, not kill the program: ignore the SIGPIPE
+    signal(SIGPIPE, SIG_IGN);
 
-    // prepare the structure sockaddr_in for the remote server
-    struct sockaddr_in server;                      // (remote) server socket info
-    memset(&server, 0, sizeof(server));
-    server.sin_family = AF_INET;                    // set address family
-    server.sin_addr.s_addr = inet_addr(argv[1]);    // set server address
-    server.sin_port = htons(atoi(argv[2]));         // set port number of the server
-
-    // connect to the remote server
-    if (connect(my_socket, (struct sockaddr *)&server, sizeof(server)) < 0) {
-        // connect() error
+    // connect to the remote server with a socket tuned for the latency (TCP_NODELAY, Fast Open if enabled by
+    // net.ipv4.tcp_fastopen)
+    int my_socket;
+    if ((my_socket = sslConnect(argv[1], atoi(argv[2]), NULL)) < 0) {
+        // sslConnect() error
         fprintf(stderr, "%s: connect failed (%s)\n", argv[0], strerror(errno));
-        close(my_socket);
         return EXIT_FAILURE;
     }
 
@@ -86,43 +75,57 @@ int main(int argc, char *argv[])
     // start an OpenSSL connection using SSL_connect()
     int rc;
     if ((rc = sslFunc(SSL_connect, ssl)) != 1) {
-        // sslConnect() error
+        // SSL_connect() error
         fprintf(stderr, "%s: OpenSSL error on SSL_connect (%d)\n", argv[0], SSL_get_error(ssl, rc));
         ERR_print_errors_fp(stderr);
         sslClose(ssl, my_socket, ctx, false);
         return EXIT_FAILURE;
     }
 
-    // communication loop with the remote server
+    // communication loop with the remote server (a frame for each message)
+    SslFrame *frame;
+    if ((frame = sslFrameNew(ssl, 2 * MYBUFSIZE)) == NULL) {
+        // sslFrameNew() error
+        fprintf(stderr, "%s: could not create the framer\n", argv[0]);
+        sslClose(ssl, my_socket, ctx, true);
+        return EXIT_FAILURE;
+    }
+
     for (;;) {
-        // build a message for the remote server
+        // build a message for the remote server (stop at the end of the input)
         char my_msg[MYBUFSIZE];
         printf("write a message to the remote Server: ");
-        scanf("%s", my_msg);
+        if (scanf("%1023s", my_msg) != 1)
+            break;
 
         // send message to the remote server
-        if ((rc = sslWrite(ssl, my_msg, strlen(my_msg))) < 0) {
-            // sslWrite() error
-            fprintf(stderr, "%s: send failed (%d)\n", argv[0], SSL_get_error(ssl, rc));
+        if (sslFrameWrite(ssl, my_msg, strlen(my_msg)) < 0) {
+            // sslFrameWrite() error
+            fprintf(stderr, "%s: send failed (%d)\n", argv[0], sslStatus(ssl));
             ERR_print_errors_fp(stderr);
+            sslFrameFree(frame);
             sslClose(ssl, my_socket, ctx, true);
             return EXIT_FAILURE;
         }
 
         // receive an answer from the remote server
-        memset(my_msg, 0, MYBUFSIZE);
-        if ((rc = sslRead(ssl, my_msg, MYBUFSIZE)) < 0) {
-            // sslRead() error
-            fprintf(stderr, "%s: recv failed (%d)\n", argv[0], SSL_get_error(ssl, rc));
+        const void *reply;
+        size_t reply_len;
+        if ((rc = sslFrameRead(frame, &reply, &reply_len, SSL_TIMEOUT_INFINITE)) <= 0) {
+            // sslFrameRead() error
+            fprintf(stderr, "%s: recv failed (%d)\n", argv[0], sslStatus(ssl));
             ERR_print_errors_fp(stderr);
+            sslFrameFree(frame);
             sslClose(ssl, my_socket, ctx, true);
             return EXIT_FAILURE;
         }
 
         // show the answer
-        printf("server reply: %s\n", my_msg);
+        printf("server reply: %.*s\n", (int)reply_len, (const char *)reply);
     }
 
+    sslFrameFree(frame);
+
     // exit with Ok
     sslClose(ssl, my_socket, ctx, true);
     return EXIT_SUCCESS;
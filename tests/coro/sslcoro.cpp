@@ -0,0 +1,394 @@
+/*
+ * Copyright © 2019 Aldo Abate <aldo.abate99@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#include "myssl.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
+#include <atomic>
+#include <vector>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <arpa/inet.h>
+#include <openssl/err.h>
+
+// file dei certificati (cwd: tests/coro)
+#define CORO_CERT       "../server/client.pem"
+#define CORO_KEY        "../server/key.pem"
+#define CORO_CACERT     "../client/ca.pem"
+
+// messaggi dei client e stack dei thread del server bloccante
+#define CORO_MSGSIZE    64
+#define CORO_STACK      262144
+
+// dati del benchmark (client)
+struct CoroBench {
+    int                                  nconn;         // connessioni
+    int                                  nmsg;          // round trip per connessione
+    int                                  connected;     // handshake completati
+    int                                  done;          // connessioni terminate (round trip completati o errore)
+    int                                  failed;        // connessioni fallite
+    double                               start;         // inizio dei round trip (in us)
+    double                               elapsed;       // durata dei round trip (in us)
+    long                                 rss;           // memoria residente con tutte le connessioni aperte (in KB)
+    double                               cpu_self;      // tempo CPU del processo all'inizio dei round trip (in us)
+    double                               cpu_client;    // tempo CPU del thread dei client all'inizio dei round trip
+    std::vector<std::coroutine_handle<>> gate;          // client connessi in attesa dell'inizio dei round trip
+    myssl::Loop                          *loop;         // loop dei client
+};
+
+// dati del server bloccante (un thread per connessione, come il server di esempio)
+struct CoroBlocking {
+    int     sock;           // socket di ascolto
+    int     nconn;          // connessioni da accettare
+    SSL_CTX *ctx;           // contesto del server
+};
+
+// attesa dell'inizio dei round trip (tutti i client connessi)
+struct CoroGate {
+    CoroBench *bench;
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> h) { bench->gate.push_back(h); }
+    void await_resume() const noexcept {}
+};
+
+// prototipi locali
+static double       nowUs(void);
+static long         coroRssKb(void);
+static double       coroCpuUs(int who);
+static int          coroListen(int *port);
+static void         coroGateOpen(CoroBench *bench);
+static myssl::Task  coroEcho(myssl::Connection conn);
+static myssl::Task  coroServe(myssl::Listener *listener);
+static void*        coroServerThread(void *arg);
+static void*        coroBlockingConn(void *arg);
+static void*        coroBlockingThread(void *arg);
+static myssl::Task  coroClient(CoroBench *bench, const myssl::Context *ctx, int port);
+static int          coroRun(bool blocking, int nconn, int nmsg);
+
+// dati del server a coroutine (thread del server)
+static std::atomic<bool> server_stop(false);
+static SSL_CTX           *server_ctx = NULL;
+static int               server_sock = -1;
+
+static const SslCtxOpts coro_opts = { CORO_CERT, CORO_KEY, CORO_CACERT };
+
+int main(int argc, char *argv[])
+{
+    // test arguments
+    int nconn = argc > 1 ? atoi(argv[1]) : 1000;
+    int nmsg  = argc > 2 ? atoi(argv[2]) : 100;
+    if (argc > 3 || nconn <= 0 || nmsg <= 0) {
+        printf("usage: %s [connections] [round trips] [i.e.: %s 1000 100]\n", argv[0], argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    // allow the fds of client and server (same process)
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+        if (nconn > (int)((rl.rlim_cur - 64) / 2))
+            nconn = (int)((rl.rlim_cur - 64) / 2);
+    }
+
+    // the servers close the connections without waiting the peer: ignore the SIGPIPE
+    signal(SIGPIPE, SIG_IGN);
+    printf("coro: %d connections, %d round trips of %d bytes each, clients in a coroutines loop\n", nconn, nmsg,
+           CORO_MSGSIZE);
+
+    // each server in its own process (the RSS doesn't include the memory freed by the other run)
+    for (int blocking = 0; blocking < 2; blocking++) {
+        pid_t pid;
+        int   status;
+        fflush(stdout);
+        if ((pid = fork()) == 0) {
+            int rc = coroRun(blocking, nconn, nmsg);
+            fflush(stdout);
+            _exit(rc < 0 ? EXIT_FAILURE : EXIT_SUCCESS);
+        }
+
+        if (pid < 0 || waitpid(pid, &status, 0) < 0 || ! WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+            fprintf(stderr, "coro: run failed\n");
+            return EXIT_FAILURE;
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
+
+// nowUs - monotonic time in microseconds
+static double nowUs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000.0 + ts.tv_nsec / 1000.0;
+}
+
+// coroRssKb - resident memory of the process in KB
+static long coroRssKb(void)
+{
+    FILE *fp;
+    char line[128];
+    long rss = 0;
+    if ((fp = fopen("/proc/self/status", "r")) == NULL)
+        return 0;
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        if (strncmp(line, "VmRSS:", 6) == 0) {
+            rss = atol(line + 6);
+            break;
+        }
+    }
+
+    fclose(fp);
+    return rss;
+}
+
+// coroCpuUs - CPU time (user + system) of the process (RUSAGE_SELF) or of the calling thread (RUSAGE_THREAD) in us
+static double coroCpuUs(int who)
+{
+    struct rusage ru;
+    if (getrusage(who, &ru) < 0)
+        return 0;
+
+    return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000.0 + ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+}
+
+// coroListen - listening socket on a free loopback port
+static int coroListen(int *port)
+{
+    int sock;
+    if ((sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0)
+        return -1;
+
+    struct sockaddr_in server;
+    memset(&server, 0, sizeof(server));
+    server.sin_family      = AF_INET;
+    server.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t socksize = sizeof(server);
+    if (bind(sock, (struct sockaddr *)&server, sizeof(server)) < 0 || listen(sock, SOMAXCONN) < 0 ||
+            getsockname(sock, (struct sockaddr *)&server, &socksize) < 0) {
+        close(sock);
+        return -1;
+    }
+
+    *port = ntohs(server.sin_port);
+    return sock;
+}
+
+// coroGateOpen - all the clients connected (or failed): start the round trips
+static void coroGateOpen(CoroBench *bench)
+{
+    std::vector<std::coroutine_handle<>> gate;
+    gate.swap(bench->gate);
+    bench->start = nowUs();
+    bench->rss        = coroRssKb();
+    bench->cpu_self   = coroCpuUs(RUSAGE_SELF);
+    bench->cpu_client = coroCpuUs(RUSAGE_THREAD);
+    for (std::coroutine_handle<> h : gate)
+        h.resume();
+}
+
+// coroEcho - coroutine of a server connection: echo until the client disconnects
+static myssl::Task coroEcho(myssl::Connection conn)
+{
+    char buf[MYBUFSIZE];
+    for (;;) {
+        ssize_t rcvd = co_await conn.read(buf, sizeof(buf));
+        if (rcvd <= 0)
+            break;
+
+        if (co_await conn.write(buf, rcvd) < 0)
+            break;
+    }
+}
+
+// coroServe - coroutine of the listening socket: a coroutine for each accepted connection
+static myssl::Task coroServe(myssl::Listener *listener)
+{
+    for (;;) {
+        myssl::Connection conn = co_await listener->accept();
+        if (conn)
+            coroEcho(std::move(conn));
+    }
+}
+
+// coroServerThread - coroutines echo server: a loop in a thread
+static void* coroServerThread(void *arg)
+{
+    myssl::Loop     loop;
+    myssl::Listener *listener;
+    myssl::Context  ctx(SSL_SERVER, &coro_opts);
+    if (! loop || ! ctx || (listener = loop.listen(server_sock, ctx)) == NULL) {
+        fprintf(stderr, "coro: could not start the coroutines server\n");
+        ERR_print_errors_fp(stderr);
+        close(server_sock);
+        return NULL;
+    }
+
+    coroServe(listener);
+    while (! server_stop)
+        loop.run(100);
+
+    return NULL;
+}
+
+// coroBlockingConn - thread of a blocking server connection (the loop of the sample server, without timeout: the
+// first message arrives when all the clients are connected)
+static void* coroBlockingConn(void *arg)
+{
+    int  sock = (int)(intptr_t)arg;
+    SSL  *ssl;
+    char buf[MYBUFSIZE];
+    int  rcvd;
+    if ((ssl = SSL_new(server_ctx)) == NULL || SSL_set_fd(ssl, sock) == 0 ||
+            sslSetTimeout(ssl, SSL_TIMEOUT_INFINITE) < 0 || sslFunc(SSL_accept, ssl) != 1) {
+        sslClose(ssl, sock, NULL, false);
+        return NULL;
+    }
+
+    while ((rcvd = sslRead(ssl, buf, sizeof(buf))) > 0 && sslWrite(ssl, buf, rcvd) > 0)
+        ;
+
+    sslClose(ssl, sock, NULL, false);
+    return NULL;
+}
+
+// coroBlockingThread - blocking echo server: a thread for each accepted connection
+static void* coroBlockingThread(void *arg)
+{
+    CoroBlocking   *srv = (CoroBlocking *)arg;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_attr_setstacksize(&attr, CORO_STACK);
+    for (int i = 0; i < srv->nconn; i++) {
+        int       sock;
+        pthread_t tid;
+        if ((sock = accept(srv->sock, NULL, NULL)) < 0)
+            break;
+
+        if (pthread_create(&tid, &attr, coroBlockingConn, (void *)(intptr_t)sock) != 0)
+            close(sock);
+    }
+
+    pthread_attr_destroy(&attr);
+    close(srv->sock);
+    return NULL;
+}
+
+// coroClient - coroutine of a client connection: connect, wait all the clients, then nmsg round trips
+static myssl::Task coroClient(CoroBench *bench, const myssl::Context *ctx, int port)
+{
+    char              msg[CORO_MSGSIZE], buf[CORO_MSGSIZE];
+    myssl::Connection conn = co_await myssl::Connection::connect(*bench->loop, *ctx, "127.0.0.1", port);
+    bool              ok = (bool)conn;
+    if (ok)
+        bench->connected++;
+    else
+        bench->failed++;
+
+    if (bench->connected + bench->failed < bench->nconn)
+        co_await CoroGate{ bench };
+    else
+        coroGateOpen(bench);
+
+    memset(msg, 'c', sizeof(msg));
+    for (int i = 0; ok && i < bench->nmsg; i++) {
+        int got = 0;
+        ok = co_await conn.write(msg, sizeof(msg)) == sizeof(msg);
+        while (ok && got < CORO_MSGSIZE) {
+            ssize_t rcvd = co_await conn.read(buf + got, sizeof(buf) - got);
+            ok   = rcvd > 0;
+            got += rcvd;
+        }
+    }
+
+    if (! ok && conn)
+        bench->failed++;
+
+    conn.close();
+    if (++bench->done == bench->nconn) {
+        // CPU time of the server during the round trips: process less the clients thread
+        bench->elapsed    = nowUs() - bench->start;
+        bench->cpu_self   = coroCpuUs(RUSAGE_SELF) - bench->cpu_self;
+        bench->cpu_client = coroCpuUs(RUSAGE_THREAD) - bench->cpu_client;
+        bench->loop->stop();
+    }
+}
+
+// coroRun - nconn client coroutines against the coroutines server or the blocking server
+static int coroRun(bool blocking, int nconn, int nmsg)
+{
+    // start the server
+    int          port;
+    pthread_t    tid;
+    CoroBlocking srv;
+    int          error;
+    long         rss = coroRssKb();
+    server_stop = false;
+    if ((server_sock = coroListen(&port)) < 0)
+        return -1;
+
+    if (blocking) {
+        srv = { server_sock, nconn, NULL };
+        if ((srv.ctx = server_ctx = sslCreateCtxEx(SSL_SERVER, &coro_opts, &error)) == NULL || error < 0 ||
+                pthread_create(&tid, NULL, coroBlockingThread, &srv) != 0) {
+            ERR_print_errors_fp(stderr);
+            close(server_sock);
+            return -1;
+        }
+    } else if (pthread_create(&tid, NULL, coroServerThread, NULL) != 0) {
+        close(server_sock);
+        return -1;
+    }
+
+    // run the clients
+    CoroBench bench = {};
+    {
+        myssl::Loop    loop;
+        myssl::Context ctx(SSL_CLIENT, &coro_opts);
+        bench.nconn = nconn;
+        bench.nmsg  = nmsg;
+        bench.loop  = &loop;
+        if (loop && ctx) {
+            double start = nowUs();
+            for (int i = 0; i < nconn; i++)
+                coroClient(&bench, &ctx, port);
+
+            loop.run(60000);
+            double trips = (double)bench.connected * nmsg;
+            printf("coro: %-22s %5.0f handshakes/sec %7.0f round trips/sec %6.2f us server CPU/round trip "
+                   "%7.2f KB/connection RSS\n", blocking ? "blocking (thread/conn)" : "coroutines (1 thread)",
+                   bench.connected * 1000000.0 / (bench.start - start), trips * 1000000.0 / bench.elapsed,
+                   (bench.cpu_self - bench.cpu_client) / trips, (double)(bench.rss - rss) / nconn);
+        }
+    }
+
+    // stop the server (the blocking threads end with the disconnection of the clients)
+    server_stop = true;
+    pthread_join(tid, NULL);
+    sslReleaseCtx(server_ctx);
+    server_ctx = NULL;
+    if (bench.failed > 0 || bench.done < nconn) {
+        fprintf(stderr, "coro: %d connections failed, %d not terminated\n", bench.failed, nconn - bench.done);
+        return -1;
+    }
+
+    return 0;
+}
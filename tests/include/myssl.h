@@ -0,0 +1,361 @@
+/*
+ * Copyright © 2019 Aldo Abate <aldo.abate99@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#ifndef MYSSL_H
+#define MYSSL_H
+
+/*!
+ *  FILE
+ *      myssl.h -  MySSL library public header file
+ *  PROJECT
+ *      MySSL library
+ *  DESCRIPTION
+ *      The MySSL library is a simple interface to OpenSSL library to permits user-friendly writing of Servers and
+ *      Clients using OpenSSL.
+ *  NOTES
+ *      - The free software library "OpenSSL" is distributed under a "dual licensed" system: under the OpenSSL License
+ *        and the SSLeay License. The OpenSSL License is Apache License 1.0 and SSLeay License bears some similarity to
+ *        a 4-clause BSD License. Both licenses apply.
+ *      - The library "OpenSSL" reference version is 1.0.2g
+ *  AUTHOR
+ *      Aldo Abate
+ *  OPERATING SYSTEM
+ *      Linux (kernel 2.6 and above - glibc 2.3.2 and above)
+ *  COMPILER
+ *      GNU GCC (ver. 4.4 and above)
+ *  RELEASE
+ *      0.1.0 (August 2019)
+ */
+
+#include <openssl/ssl.h>
+#include <stdbool.h>
+#include <sys/uio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// tipi per sslCreateCtx()
+#define SSL_SERVER  0
+#define SSL_CLIENT  1
+
+// opzioni per sslCreateCtxEx(): i campi a NULL assumono i valori di default (file certificati di myssl-private.h)
+typedef struct {
+    const char *cert;       // file certificato (PEM) del server
+    const char *key;        // file chiave privata (PEM) del server
+    const char *cacert;     // file certificato CA (PEM) del client
+    long       sess_cache_size; // numero max di sessioni nella cache del server (0 = default OpenSSL)
+    long       sess_timeout;    // timeout delle sessioni in secondi (0 = default OpenSSL)
+    bool       no_tickets;      // disabilita i session ticket (il server usa solo la cache delle sessioni)
+    unsigned   max_early_data;  // max byte di early data (0-RTT) accettati dal server (0 = 0-RTT disabilitato)
+    long       early_data_window;   // finestra anti-replay del server in secondi (0 = SSL_EARLY_WINDOW)
+    const char *ticket_keys;    // file chiavi dei ticket condiviso tra processi (e.g.: in /dev/shm, NULL = chiavi interne)
+    long       ticket_rotate;   // intervallo di rotazione delle chiavi dei ticket in secondi (0 = nessuna rotazione)
+    int        ticket_keep;     // numero di chiavi precedenti accettate per i ticket (0 = SSL_TICKET_KEEP, max 15)
+    const char *profile;        // profilo di handshake: "default", "fast-handshake", "compat" (NULL = "default")
+    const char *cert2;          // secondo certificato (PEM) del server, e.g.: ECDSA insieme a RSA (NULL = nessuno)
+    const char *key2;           // file chiave privata (PEM) del secondo certificato
+    int        async_workers;   // thread del pool crittografico per le chiavi private del server (0 = firma inline)
+    bool       ktls;            // kernel TLS: cifratura dei record nel kernel dopo l'handshake (errore se non
+                                // disponibile, vedi sslKtlsAvail(); il cifrario negoziato deve essere supportato)
+    int        record_boost;    // byte iniziali di una connessione scritti in record piccoli (0 = record pieni)
+    int        record_idle;     // inattività in ms dopo la quale si torna ai record piccoli (0 = mai)
+    bool       release_buffers; // libera i buffer dei record delle connessioni inattive (ripresi dal pool)
+    int        io_timeout;      // timeout delle operazioni delle connessioni in ms (0 = SSL_TIMEOUT_DEFAULT,
+                                // SSL_TIMEOUT_INFINITE = nessun timeout)
+} SslCtxOpts;
+
+// statistiche di resumption per sslSessionStats()
+typedef struct {
+    long   handshakes;      // handshake completati
+    long   resumed;         // handshake abbreviati (sessione riutilizzata)
+    double hit_rate;        // percentuale di sessioni riutilizzate
+} SslSessStats;
+
+// statistiche del pool dei buffer di OpenSSL per sslPoolStats()
+typedef struct {
+    bool   active;          // pool attivo (funzioni di allocazione di OpenSSL sostituite)
+    long   requests;        // allocazioni delle dimensioni del pool
+    long   hits;            // allocazioni servite dal pool (senza malloc())
+    double hit_rate;        // percentuale di allocazioni servite dal pool
+    long   in_use;          // byte in uso dei blocchi del pool
+    long   high_water;      // max byte in uso dei blocchi del pool (high-water mark)
+    long   pooled;          // byte dei blocchi liberi tenuti nel pool
+} SslPoolStats;
+
+// allocatore di OpenSSL scelto con sslInit()
+#define SSL_ALLOC_LIBC      0       // malloc() della libc (default, allocatore di default di OpenSSL)
+#define SSL_ALLOC_POOL      1       // pool dei buffer dei record (vedi sslPoolStats())
+#define SSL_ALLOC_ARENA     2       // arene per thread con classi di dimensione (vedi sslAllocStats())
+
+// opzioni di inizializzazione della libreria per sslInit()
+typedef struct {
+    int        allocator;       // allocatore di OpenSSL: SSL_ALLOC_LIBC, SSL_ALLOC_POOL, SSL_ALLOC_ARENA
+    bool       huge_pages;      // SSL_ALLOC_ARENA: memoria delle arene su huge pages riservate (se disponibili)
+} SslInitOpts;
+
+// statistiche dell'allocatore ad arene per sslAllocStats()
+typedef struct {
+    bool   active;          // allocatore ad arene attivo (funzioni di allocazione di OpenSSL sostituite)
+    long   arenas;          // arene create (una per thread)
+    long   allocs;          // allocazioni di OpenSSL
+    long   frees;           // deallocazioni di OpenSSL
+    long   live;            // byte allocati in uso
+    long   peak;            // max byte allocati in uso (precisione di 64 KB per thread)
+    long   chunks;          // blocchi di memoria delle arene (2 MB)
+    long   huge_chunks;     // blocchi di memoria delle arene su huge pages riservate
+    bool   huge_off;        // huge pages richieste ma esaurite o non riservate: blocchi su pagine normali
+    long   conns;           // connessioni (strutture SSL) create
+    long   conns_live;      // connessioni (strutture SSL) attive
+    double allocs_per_conn; // allocazioni per connessione (handshake compreso)
+    double live_per_conn;   // byte in uso per connessione attiva
+} SslAllocStats;
+
+// timeout delle operazioni bloccanti (in ms) per sslSetTimeout() e le funzioni Ex (e.g.: sslReadEx())
+#define SSL_TIMEOUT_INFINITE    -1  // nessun timeout
+#define SSL_TIMEOUT_CONN        -2  // timeout della connessione (sslSetTimeout(), default SslCtxOpts.io_timeout)
+#define SSL_TIMEOUT_DEFAULT     30000   // timeout di default delle connessioni (SslCtxOpts.io_timeout = 0)
+
+// N.B.: la prima operazione bloccante di una connessione (sslRead(), sslWrite(), sslFunc(), ...) imposta O_NONBLOCK
+// sul socket del chiamante, che resta non bloccante fino alla chiusura (sslClose() chiude anche il socket): un
+// socket usato anche fuori dalla libreria deve gestire EAGAIN (o reimpostare i flag con fcntl())
+
+// stato dell'ultima operazione bloccante di una connessione (sslStatus())
+#define SSL_STATUS_OK       0       // operazione completata
+#define SSL_STATUS_TIMEOUT  1       // timeout scaduto (la connessione è ancora utilizzabile)
+#define SSL_STATUS_CLOSED   2       // connessione chiusa dal peer
+#define SSL_STATUS_FATAL    3       // errore fatale (di protocollo o di sistema)
+
+// risultati delle funzioni non bloccanti (sslFuncStep(), sslReadStep(), sslWriteStep())
+#define SSL_STEP_CLOSED         0   // connessione chiusa dal peer
+#define SSL_STEP_ERROR          -1  // errore fatale
+#define SSL_STEP_WANT_READ      -2  // ripetere quando il socket è leggibile
+#define SSL_STEP_WANT_WRITE     -3  // ripetere quando il socket è scrivibile
+#define SSL_STEP_WANT_ASYNC     -4  // ripetere quando l'operazione asincrona è completata (SSL_get_all_async_fds())
+
+// eventi delle connessioni del reactor (callback SslConnCb)
+#define SSL_EV_CONNECTED    1       // handshake completato (seguito da un SSL_EV_READ)
+#define SSL_EV_READ         2       // dati da leggere: leggere con sslReadStep() fino a SSL_STEP_WANT_READ
+#define SSL_EV_WRITE        3       // socket di nuovo scrivibile (dopo un SSL_STEP_WANT_WRITE)
+#define SSL_EV_CLOSED       4       // handshake fallito o consumatore lento scartato (SSL_QUEUE_CLOSE): la
+                                    // connessione è chiusa dopo la callback
+#define SSL_EV_QUEUE_HIGH   5       // coda di scrittura sopra la soglia alta (il produttore può fermarsi)
+#define SSL_EV_QUEUE_LOW    6       // coda di scrittura scesa sotto la soglia bassa (il produttore può riprendere)
+
+// backend di I/O del reactor (sslReactorNewEx())
+#define SSL_REACTOR_EPOLL   0       // epoll edge-triggered e BIO socket di OpenSSL (una syscall per ogni record)
+#define SSL_REACTOR_URING   1       // io_uring: ricezioni/trasmissioni di un batch di eventi in una syscall
+
+// reactor epoll e sue connessioni (tipi opachi) e callback degli eventi delle connessioni
+typedef struct SslReactor SslReactor;
+typedef struct SslConn    SslConn;
+typedef void (*SslConnCb)(SslConn *conn, int event, void *arg);
+
+// buffer condiviso a conteggio di riferimenti per le code di scrittura (sslBufNew()), tipo opaco
+typedef struct SslBuf SslBuf;
+
+// politica della coda di scrittura oltre il limite (sslConnQueueSet())
+#define SSL_QUEUE_DROP      0       // il buffer nuovo è scartato (la connessione resta aperta)
+#define SSL_QUEUE_CLOSE     1       // la connessione è chiusa (callback SSL_EV_CLOSED)
+
+// opzioni della coda di scrittura di una connessione del reactor (i campi a 0 assumono i valori di default)
+typedef struct {
+    size_t      high;           // byte in coda per l'evento SSL_EV_QUEUE_HIGH (0 = default)
+    size_t      low;            // byte in coda per l'evento SSL_EV_QUEUE_LOW dopo SSL_EV_QUEUE_HIGH (0 = default)
+    size_t      limit;          // max byte in coda, oltre si applica la politica (0 = default)
+    int         policy;         // politica oltre il limite: SSL_QUEUE_DROP/SSL_QUEUE_CLOSE
+    int         max_time;       // ms sopra la soglia alta dopo i quali la connessione è chiusa (0 = nessun limite)
+} SslQueueOpts;
+
+// server engine multi-thread (sslServerStart()) e callback dei dati ricevuti (num = 0: connessione chiusa)
+typedef struct SslServer SslServer;
+typedef void (*SslServerCb)(SslConn *conn, const void *buf, int num, void *arg);
+
+// opzioni del server engine
+typedef struct {
+    const char  *host;          // indirizzo IPv4 di ascolto (NULL = tutte le interfacce)
+    int         port;           // porta di ascolto (0 = porta libera, vedi sslServerPort())
+    int         workers;        // thread worker, ognuno con socket SO_REUSEPORT e reactor (0 = numero di core)
+    int         backend;        // backend di I/O dei reactor: SSL_REACTOR_EPOLL/SSL_REACTOR_URING
+    int         max_conn;       // backend io_uring: max connessioni per worker (0 = default)
+    SslServerCb cb;             // callback dei dati ricevuti (chiamata nel thread del worker)
+    void        *arg;           // argomento della callback
+} SslServerOpts;
+
+// offload kernel TLS attivo su una connessione (sslKtls()) o disponibile (sslKtlsAvail())
+#define SSL_KTLS_TX         1       // trasmissione: record cifrati dal kernel (sslSendFile() usa sendfile())
+#define SSL_KTLS_RX         2       // ricezione: record decifrati dal kernel
+
+// forwarder TLS -> backend in chiaro (sslForwarderStart()), tipo opaco
+typedef struct SslForwarder SslForwarder;
+
+// opzioni del forwarder
+typedef struct {
+    const char  *host;          // indirizzo IPv4 di ascolto (NULL = tutte le interfacce)
+    int         port;           // porta di ascolto (0 = porta libera, vedi sslForwarderPort())
+    const char  *backend;       // backend in chiaro: "host:porta" TCP IPv4 o path di un socket Unix (inizia con '/')
+    int         max_conn;       // max connessioni contemporanee (0 = default)
+    int         timeout;        // timeout di inattività di una connessione in ms (0 = nessuno)
+} SslForwardOpts;
+
+// pool di connessioni client verso destinazioni host:porta (sslClientPoolNew()), tipo opaco
+typedef struct SslClientPool SslClientPool;
+
+// opzioni del pool di connessioni client (i campi a 0 assumono i valori di default)
+typedef struct {
+    int         max_idle;       // max connessioni inattive per destinazione (0 = default)
+    int         max_total;      // max connessioni (in uso + inattive) per destinazione, oltre si attende (0 = default)
+    int         idle_timeout;   // inattività in ms dopo la quale una connessione inattiva è chiusa (0 = nessuna)
+    int         prewarm;        // connessioni inattive tenute pronte per destinazione (0 = nessuna)
+    int         timeout;        // timeout di connect + handshake delle connessioni di pre-warm in ms (0 = default)
+} SslClientPoolOpts;
+
+// statistiche del pool di connessioni client per sslClientPoolStats()
+typedef struct {
+    long   gets;            // connessioni richieste (sslClientPoolGet())
+    long   reused;          // richieste servite con una connessione inattiva (senza handshake)
+    long   connects;        // connessioni nuove (connect + handshake)
+    long   resumed;         // connessioni nuove con handshake abbreviato (sessione riutilizzata)
+    long   failed;          // connessioni nuove fallite
+    long   waits;           // richieste in attesa di un rilascio (max_total connessioni raggiunto)
+    long   expired;         // connessioni inattive chiuse per idle_timeout
+    long   broken;          // connessioni inattive scartate dal controllo (chiuse dal peer)
+    int    idle;            // connessioni inattive
+    int    busy;            // connessioni in uso (o in connessione)
+    double reuse_rate;      // percentuale di richieste servite senza handshake
+} SslClientPoolStats;
+
+// framer dei messaggi con prefisso di lunghezza di una connessione (sslFrameNew()), tipo opaco
+typedef struct SslFrame SslFrame;
+
+// header di un frame: lunghezza del payload (32 bit, network byte order)
+#define SSL_FRAME_HEADER    4
+
+// ottimizzazioni dei socket TCP di sslListen()/sslConnect() (SslSockOpts.flags)
+#define SSL_SOCK_NODELAY    0x01    // TCP_NODELAY: flight dell'handshake e record piccoli senza ritardo di Nagle
+#define SSL_SOCK_FASTOPEN   0x02    // TCP Fast Open (server e client): il ClientHello viaggia nel SYN
+                                    // (richiede net.ipv4.tcp_fastopen = 3 e il cookie di una connessione precedente)
+#define SSL_SOCK_DEFER      0x04    // TCP_DEFER_ACCEPT: connessione accettata all'arrivo del ClientHello
+#define SSL_SOCK_LATENCY    (SSL_SOCK_NODELAY | SSL_SOCK_FASTOPEN | SSL_SOCK_DEFER)    // profilo di default
+
+// opzioni dei socket di sslListen()/sslConnect() (i campi a 0 assumono i valori di default)
+typedef struct {
+    int         flags;          // ottimizzazioni SSL_SOCK_* (0 = nessuna)
+    int         backlog;        // coda delle connessioni di listen() (0 = SOMAXCONN)
+    int         sndbuf;         // SO_SNDBUF in byte (0 = dimensionamento automatico del kernel)
+    int         rcvbuf;         // SO_RCVBUF in byte (0 = dimensionamento automatico del kernel)
+    int         timeout;        // timeout della connect in ms (0 = nessuno)
+} SslSockOpts;
+
+// modi di chiusura di una connessione per sslCloseEx()
+#define SSL_CLOSE_NONE      0       // nessun close_notify (il peer riceve solo il FIN)
+#define SSL_CLOSE_QUIET     1       // invia il close_notify senza attendere quello del peer
+#define SSL_CLOSE_WAIT      2       // shutdown bidirezionale: attende il close_notify del peer fino al timeout
+#define SSL_CLOSE_ASYNC     3       // come SSL_CLOSE_WAIT, ma l'attesa è del thread reaper (ritorno immediato)
+#define SSL_CLOSE_RESET     4       // nessun close_notify e RST invece del FIN (e.g.: peer abusivi)
+#define SSL_CLOSE_TIMEOUT   1000    // timeout di default in ms di SSL_CLOSE_WAIT/SSL_CLOSE_ASYNC con SSL_TIMEOUT_CONN
+                                    // (se la connessione non ha un timeout impostato con sslSetTimeout())
+
+// altre define
+#define BACKLOG     10      // numero connessioni per coda listen() (obsoleto: vedi SslSockOpts.backlog di
+                            // sslListen(), di default SOMAXCONN)
+#define MYBUFSIZE   1024    // size buffer per send/recv
+
+// prototipi globali
+int      sslInit(const SslInitOpts *opts);
+void     sslCleanup(void);
+SSL_CTX* sslCreateCtx(int type, int *error);
+SSL_CTX* sslCreateCtxEx(int type, const SslCtxOpts *opts, int *error);
+void     sslReleaseCtx(SSL_CTX *ctx);
+void     sslFlushCtx(void);
+int      sslConnectSession(SSL *ssl, const char *host, int port);
+void     sslSessionStats(SSL_CTX *ctx, SslSessStats *stats);
+void     sslPoolStats(SslPoolStats *stats);
+void     sslAllocStats(SslAllocStats *stats);
+void     sslFlushSessions(void);
+int      sslConnectEarly(SSL *ssl, const char *host, int port, const void *buf, int num);
+int      sslAcceptEarly(SSL *ssl, void *buf, int num, int *early_len);
+int      sslTicketKeysRotate(const char *path, int keep);
+int      sslReloadCtx(int type, const SslCtxOpts *opts);
+int      sslWatchCtx(int type, const SslCtxOpts *opts);
+int      sslUnwatchCtx(int type, const SslCtxOpts *opts);
+int      sslSetTimeout(SSL *ssl, int timeout);
+int      sslStatus(SSL *ssl);
+int      sslWrite(SSL *ssl, const void *buf, int num);
+int      sslWriteEx(SSL *ssl, const void *buf, int num, int timeout);
+ssize_t  sslWritev(SSL *ssl, const struct iovec *iov, int iovcnt);
+ssize_t  sslWriteAll(SSL *ssl, const void *buf, size_t num);
+int      sslKtls(SSL *ssl);
+int      sslKtlsAvail(void);
+ssize_t  sslSendFile(SSL *ssl, int fd, off_t offset, size_t size);
+int      sslRead(SSL *ssl, void *buf, int num);
+int      sslReadEx(SSL *ssl, void *buf, int num, int timeout);
+ssize_t  sslReadBatch(SSL *ssl, void *buf, size_t min, size_t max, int timeout);
+int      sslFunc(int (*pfunc)(SSL*), SSL *ssl);
+int      sslFuncEx(int (*pfunc)(SSL*), SSL *ssl, int timeout);
+int      sslFuncStep(int (*pfunc)(SSL*), SSL *ssl);
+int      sslReadStep(SSL *ssl, void *buf, int num);
+int      sslWriteStep(SSL *ssl, const void *buf, int num);
+SslReactor* sslReactorNew(void);
+SslReactor* sslReactorNewEx(int backend, int max_conn);
+void     sslReactorFree(SslReactor *reactor);
+int      sslReactorListen(SslReactor *reactor, int sock, SSL_CTX *ctx, SslConnCb cb, void *arg);
+SslConn* sslReactorAdd(SslReactor *reactor, int sock, SSL_CTX *ctx, int type, SslConnCb cb, void *arg);
+int      sslReactorRun(SslReactor *reactor, int timeout);
+void     sslReactorStop(SslReactor *reactor);
+int      sslReactorCount(SslReactor *reactor);
+int      sslReactorBackend(SslReactor *reactor);
+unsigned long sslReactorSyscalls(SslReactor *reactor);
+SSL*     sslConnSsl(SslConn *conn);
+void     sslConnSetCb(SslConn *conn, SslConnCb cb, void *arg);
+void     sslConnClose(SslConn *conn, bool do_shutdown);
+void     sslConnQueueSet(SslConn *conn, const SslQueueOpts *opts);
+int      sslConnSend(SslConn *conn, SslBuf *buf);
+size_t   sslConnQueued(SslConn *conn);
+SslBuf*  sslBufNew(const void *data, size_t len);
+SslBuf*  sslBufRef(SslBuf *buf);
+void     sslBufUnref(SslBuf *buf);
+void*    sslBufData(SslBuf *buf);
+size_t   sslBufLen(SslBuf *buf);
+SslServer* sslServerStart(const SslServerOpts *sopts, const SslCtxOpts *opts);
+int      sslServerPort(SslServer *server);
+void     sslServerStop(SslServer *server);
+int      sslForward(SSL *ssl, int backend, int timeout);
+SslForwarder* sslForwarderStart(const SslForwardOpts *fopts, const SslCtxOpts *opts);
+int      sslForwarderPort(SslForwarder *forwarder);
+void     sslForwarderStop(SslForwarder *forwarder);
+SslClientPool* sslClientPoolNew(const SslClientPoolOpts *popts, const SslCtxOpts *opts);
+int      sslClientPoolWarm(SslClientPool *pool, const char *host, int port);
+SSL*     sslClientPoolGet(SslClientPool *pool, const char *host, int port, int timeout);
+void     sslClientPoolPut(SslClientPool *pool, SSL *ssl, bool reusable);
+void     sslClientPoolStats(SslClientPool *pool, SslClientPoolStats *stats);
+void     sslClientPoolFree(SslClientPool *pool);
+SslFrame* sslFrameNew(SSL *ssl, size_t max_frame);
+void     sslFrameFree(SslFrame *frame);
+int      sslFrameRead(SslFrame *frame, const void **payload, size_t *len, int timeout);
+int      sslFrameStep(SslFrame *frame, const void **payload, size_t *len);
+ssize_t  sslFrameWrite(SSL *ssl, const void *buf, size_t num);
+ssize_t  sslFrameWritev(SSL *ssl, const struct iovec *iov, int iovcnt);
+int      sslFrameWriteStep(SslFrame *frame, const void *buf, size_t num);
+int      sslListen(const char *host, int port, const SslSockOpts *sopts);
+int      sslAccept(int lsock);
+int      sslConnect(const char *host, int port, const SslSockOpts *sopts);
+void     sslClose(SSL *ssl, int sock, SSL_CTX *ctx, bool do_shutdown);
+void     sslCloseEx(SSL *ssl, int sock, SSL_CTX *ctx, int mode, int timeout);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MYSSL_H */
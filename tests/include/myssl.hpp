@@ -0,0 +1,615 @@
+/*
+ * Copyright © 2019 Aldo Abate <aldo.abate99@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+ * warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+#ifndef MYSSL_HPP
+#define MYSSL_HPP
+
+/*!
+ *  FILE
+ *      myssl.hpp -  MySSL library C++20 coroutines header file
+ *  PROJECT
+ *      MySSL library
+ *  CLASSES
+ *      myssl::Task         coroutine started by the caller and detached (its frame is freed at the end)
+ *      myssl::Loop         event loop (a reactor, see sslReactorNewEx()) that resumes the suspended coroutines
+ *      myssl::Context      OpenSSL context (RAII, see sslCreateCtxEx())
+ *      myssl::Listener     listening socket of a loop: co_await accept()
+ *      myssl::Connection   connection of a loop (RAII): co_await connect(), read(), write(), shutdown()
+ *  DESCRIPTION
+ *      The MySSL library is a simple interface to OpenSSL library to permits user-friendly writing of Servers and
+ *      Clients using OpenSSL. This header is the C++20 interface over the reactor: a connection is handled by a
+ *      coroutine with sequential code, and a loop (one per thread) runs many thousands of coroutines, e.g.:
+ *
+ *          myssl::Task echo(myssl::Connection conn)
+ *          {
+ *              char buf[MYBUFSIZE];
+ *              for (;;) {
+ *                  ssize_t rcvd = co_await conn.read(buf, sizeof(buf));
+ *                  if (rcvd <= 0)
+ *                      break;
+ *
+ *                  if (co_await conn.write(buf, rcvd) < 0)
+ *                      break;
+ *              }
+ *          }
+ *
+ *          myssl::Task serve(myssl::Listener *listener)
+ *          {
+ *              for (;;) {
+ *                  myssl::Connection conn = co_await listener->accept();
+ *                  if (conn)
+ *                      echo(std::move(conn));
+ *              }
+ *          }
+ *
+ *  NOTES
+ *      - The free software library "OpenSSL" is distributed under a "dual licensed" system: under the OpenSSL License
+ *        and the SSLeay License. The OpenSSL License is Apache License 1.0 and SSLeay License bears some similarity to
+ *        a 4-clause BSD License. Both licenses apply.
+ *      - The library "OpenSSL" reference version is 1.0.2g
+ *      - The frames of the coroutines are allocated from a pool of the thread (size classes of FRAME_CLASS bytes),
+ *        the awaitables live in the frames: the steady-state read/write path doesn't allocate memory. Only accept()
+ *        and connect() allocate the state of the new connection.
+ *      - An operation is first executed at once (no suspension if it completes), otherwise the coroutine is
+ *        suspended and the loop repeats the operation at the events of the connection, resuming the coroutine when
+ *        it's completed. A connection can have only one operation in progress (no concurrent read and write).
+ *      - The results are the ones of the blocking functions (no exceptions): read() as sslRead() (0 = closed by the
+ *        peer, -1 = error), write() as sslWrite(), shutdown() 0/-1, connect()/accept() an empty Connection on error.
+ *      - GCC 12 miscompiles a co_await in the right operand of && or ||: await in a statement of its own, as in the
+ *        example.
+ *      - The Connection objects must be destroyed before their Loop: the destruction of the Loop destroys the
+ *        coroutines suspended in its connections (and then their Connection objects).
+ *  AUTHOR
+ *      Aldo Abate
+ *  OPERATING SYSTEM
+ *      Linux (kernel 2.6 and above - glibc 2.3.2 and above)
+ *  COMPILER
+ *      GNU G++ (ver. 11 and above, -std=c++20)
+ *  RELEASE
+ *      0.1.0 (August 2019)
+ */
+
+#include "myssl.h"
+#include <cerrno>
+#include <coroutine>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+#include <unistd.h>
+#include <fcntl.h>
+#include <arpa/inet.h>
+
+namespace myssl {
+
+class Loop;
+class Connection;
+
+namespace detail {
+
+// pool dei frame delle coroutine: classi di FRAME_CLASS byte fino a FRAME_MAX, max FRAME_KEEP frame liberi per classe
+constexpr std::size_t FRAME_CLASS = 64;
+constexpr std::size_t FRAME_MAX   = 4096;
+constexpr std::size_t FRAME_KEEP  = 4096;
+
+// operazioni in corso di una connessione
+enum { OP_NONE, OP_CONNECT, OP_READ, OP_WRITE, OP_SHUTDOWN };
+
+// pool dei frame di un thread
+class FramePool {
+public:
+    ~FramePool()
+    {
+        for (FrameFree *&head : free_)
+            while (FrameFree *frame = head) {
+                head = frame->next;
+                ::operator delete(frame);
+            }
+    }
+
+    static FramePool& local() noexcept
+    {
+        static thread_local FramePool pool;
+        return pool;
+    }
+
+    void* get(std::size_t size)
+    {
+        if (size == 0 || size > FRAME_MAX)
+            return ::operator new(size);
+
+        std::size_t cls = (size - 1) / FRAME_CLASS;
+        if (FrameFree *frame = free_[cls]) {
+            free_[cls] = frame->next;
+            count_[cls]--;
+            return frame;
+        }
+
+        return ::operator new((cls + 1) * FRAME_CLASS);
+    }
+
+    void put(void *ptr, std::size_t size) noexcept
+    {
+        std::size_t cls = size > 0 ? (size - 1) / FRAME_CLASS : 0;
+        if (size == 0 || size > FRAME_MAX || count_[cls] >= FRAME_KEEP) {
+            ::operator delete(ptr);
+            return;
+        }
+
+        FrameFree *frame = static_cast<FrameFree *>(ptr);
+        frame->next = free_[cls];
+        free_[cls]  = frame;
+        count_[cls]++;
+    }
+
+private:
+    struct FrameFree {
+        FrameFree *next;
+    };
+
+    FrameFree   *free_[FRAME_MAX / FRAME_CLASS] = {};     // frame liberi per classe
+    std::size_t count_[FRAME_MAX / FRAME_CLASS] = {};     // numero di frame liberi per classe
+};
+
+// stato di una connessione (argomento della callback del reactor)
+struct ConnState {
+    ConnState(Loop *loop, SslConn *conn) noexcept;
+    ~ConnState();
+
+    Loop                    *loop;              // loop della connessione
+    SslConn                 *conn;              // connessione del reactor (NULL = chiusa)
+    std::coroutine_handle<> waiter;             // coroutine sospesa nell'operazione in corso
+    int                     op = OP_NONE;       // operazione in corso
+    int                     want = 0;           // evento atteso dall'operazione in corso (SSL_STEP_WANT_*)
+    void                    *buf = nullptr;     // buffer dell'operazione in corso
+    int                     num = 0;            // byte dell'operazione in corso
+    ssize_t                 result = -1;        // risultato dell'ultima operazione
+    bool                    connected = false;  // handshake completato
+    ConnState               *prev = nullptr;    // connessione precedente del loop
+    ConnState               *next = nullptr;    // connessione successiva del loop
+};
+
+// stato di un socket di ascolto
+struct ListenState {
+    Loop                    *loop;              // loop del socket
+    std::deque<ConnState *> ready;              // connessioni accettate (handshake completato) da restituire
+    std::coroutine_handle<> waiter;             // coroutine sospesa in accept()
+};
+
+void connCb(SslConn *conn, int event, void *arg);
+void listenCb(SslConn *conn, int event, void *arg);
+
+// awaitable di read(), write(), shutdown()
+class IoAwait {
+public:
+    IoAwait(ConnState *st, int op, void *buf, int num) noexcept : st_(st), op_(op), buf_(buf), num_(num) {}
+    bool await_ready() noexcept;
+    void await_suspend(std::coroutine_handle<> h) noexcept { st_->waiter = h; }
+    ssize_t await_resume() const noexcept { return st_ && st_->conn ? st_->result : -1; }
+
+private:
+    ConnState *st_;
+    int       op_;
+    void      *buf_;
+    int       num_;
+};
+
+// awaitable di connect()
+class ConnectAwait {
+public:
+    ConnectAwait(Loop &loop, SSL_CTX *ctx, const char *host, int port) noexcept :
+        loop_(loop), ctx_(ctx), host_(host), port_(port) {}
+    bool await_ready() noexcept;
+    void await_suspend(std::coroutine_handle<> h) noexcept { st_->waiter = h; }
+    Connection await_resume() noexcept;
+
+private:
+    Loop       &loop_;
+    SSL_CTX    *ctx_;
+    const char *host_;
+    int        port_;
+    ConnState  *st_ = nullptr;
+};
+
+// awaitable di accept()
+class AcceptAwait {
+public:
+    explicit AcceptAwait(ListenState *ls) noexcept : ls_(ls) {}
+    bool await_ready() const noexcept { return ! ls_->ready.empty(); }
+    void await_suspend(std::coroutine_handle<> h) noexcept { ls_->waiter = h; }
+    Connection await_resume() noexcept;
+
+private:
+    ListenState *ls_;
+};
+
+bool connStep(ConnState *st) noexcept;
+void resume(std::coroutine_handle<> &waiter) noexcept;
+
+} // namespace detail
+
+// coroutine avviata subito e staccata dal chiamante (il frame è liberato alla fine)
+class Task {
+public:
+    struct promise_type {
+        Task get_return_object() noexcept { return Task(); }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept { std::terminate(); }
+
+        static void* operator new(std::size_t size) { return detail::FramePool::local().get(size); }
+        static void operator delete(void *ptr, std::size_t size) noexcept { detail::FramePool::local().put(ptr, size); }
+    };
+};
+
+// contesto OpenSSL (RAII)
+class Context {
+public:
+    Context() noexcept = default;
+    explicit Context(int type, const SslCtxOpts *opts = nullptr) noexcept
+    {
+        int error;
+        ctx_ = opts ? sslCreateCtxEx(type, opts, &error) : sslCreateCtx(type, &error);
+        if (ctx_ && error < 0) {
+            sslReleaseCtx(ctx_);
+            ctx_ = nullptr;
+        }
+    }
+
+    Context(Context &&other) noexcept : ctx_(std::exchange(other.ctx_, nullptr)) {}
+    Context& operator=(Context &&other) noexcept
+    {
+        if (this != &other) {
+            sslReleaseCtx(ctx_);
+            ctx_ = std::exchange(other.ctx_, nullptr);
+        }
+
+        return *this;
+    }
+
+    Context(const Context &) = delete;
+    Context& operator=(const Context &) = delete;
+    ~Context() { sslReleaseCtx(ctx_); }
+
+    explicit operator bool() const noexcept { return ctx_ != nullptr; }
+    SSL_CTX* get() const noexcept { return ctx_; }
+
+private:
+    SSL_CTX *ctx_ = nullptr;
+};
+
+// socket di ascolto di un loop (di proprietà del loop, vedi Loop::listen())
+class Listener {
+public:
+    detail::AcceptAwait accept() noexcept { return detail::AcceptAwait(&ls_); }
+
+private:
+    friend class Loop;
+    explicit Listener(Loop *loop) noexcept : ls_{ loop, {}, {} } {}
+
+    detail::ListenState ls_;
+};
+
+// event loop: un reactor, usato solo dal thread che lo esegue
+class Loop {
+public:
+    explicit Loop(int backend = SSL_REACTOR_EPOLL, int max_conn = 0) noexcept :
+        reactor_(sslReactorNewEx(backend, max_conn)) {}
+    Loop(const Loop &) = delete;
+    Loop& operator=(const Loop &) = delete;
+    ~Loop()
+    {
+        // destroy the suspended coroutines (their connections are closed by the Connection destructors)
+        for (auto &listener : listeners_) {
+            if (listener->ls_.waiter)
+                std::exchange(listener->ls_.waiter, nullptr).destroy();
+
+            for (detail::ConnState *st : listener->ls_.ready) {
+                sslConnClose(st->conn, false);
+                delete st;
+            }
+
+            listener->ls_.ready.clear();
+        }
+
+        for (detail::ConnState *st = conns_; st != nullptr; ) {
+            if (! st->waiter) {
+                st = st->next;
+                continue;
+            }
+
+            // a connection in connect() has no Connection object yet
+            bool connecting = st->op == detail::OP_CONNECT;
+            std::exchange(st->waiter, nullptr).destroy();
+            if (connecting)
+                delete st;
+
+            st = conns_;
+        }
+
+        if (reactor_)
+            sslReactorFree(reactor_);
+    }
+
+    explicit operator bool() const noexcept { return reactor_ != nullptr; }
+    SslReactor* get() const noexcept { return reactor_; }
+    int run(int timeout = SSL_TIMEOUT_INFINITE) noexcept { return sslReactorRun(reactor_, timeout); }
+    void stop() noexcept { sslReactorStop(reactor_); }
+    int count() const noexcept { return sslReactorCount(reactor_); }
+
+    // listening socket (closed by the loop): the connections are accepted and handshaked by the loop
+    Listener* listen(int sock, const Context &ctx)
+    {
+        std::unique_ptr<Listener> listener(new Listener(this));
+        if (sslReactorListen(reactor_, sock, ctx.get(), detail::listenCb, &listener->ls_) < 0)
+            return nullptr;
+
+        listeners_.push_back(std::move(listener));
+        return listeners_.back().get();
+    }
+
+private:
+    friend struct detail::ConnState;
+
+    SslReactor                             *reactor_;               // reactor
+    detail::ConnState                      *conns_ = nullptr;       // connessioni del loop
+    std::vector<std::unique_ptr<Listener>> listeners_;              // socket di ascolto
+};
+
+// connessione di un loop (RAII: chiusa dal distruttore)
+class Connection {
+public:
+    Connection() noexcept = default;
+    Connection(Connection &&other) noexcept : st_(std::exchange(other.st_, nullptr)) {}
+    Connection& operator=(Connection &&other) noexcept
+    {
+        if (this != &other) {
+            close();
+            st_ = std::exchange(other.st_, nullptr);
+        }
+
+        return *this;
+    }
+
+    Connection(const Connection &) = delete;
+    Connection& operator=(const Connection &) = delete;
+    ~Connection() { close(); }
+
+    explicit operator bool() const noexcept { return st_ != nullptr && st_->conn != nullptr; }
+    SSL* ssl() const noexcept { return *this ? sslConnSsl(st_->conn) : nullptr; }
+
+    // connect a TCP socket to host (IPv4 address) and port and execute the handshake
+    static detail::ConnectAwait connect(Loop &loop, const Context &ctx, const char *host, int port) noexcept
+    {
+        return detail::ConnectAwait(loop, ctx.get(), host, port);
+    }
+
+    // operations: read up to num bytes, write num bytes, send the close_notify
+    detail::IoAwait read(void *buf, int num) noexcept { return detail::IoAwait(st_, detail::OP_READ, buf, num); }
+    detail::IoAwait write(const void *buf, int num) noexcept
+    {
+        return detail::IoAwait(st_, detail::OP_WRITE, const_cast<void *>(buf), num);
+    }
+
+    detail::IoAwait shutdown() noexcept { return detail::IoAwait(st_, detail::OP_SHUTDOWN, nullptr, 0); }
+
+    // close the connection (without waiting the send of the close_notify)
+    void close(bool do_shutdown = false) noexcept
+    {
+        if (st_) {
+            if (st_->conn)
+                sslConnClose(st_->conn, do_shutdown);
+
+            delete st_;
+            st_ = nullptr;
+        }
+    }
+
+private:
+    friend class detail::ConnectAwait;
+    friend class detail::AcceptAwait;
+    explicit Connection(detail::ConnState *st) noexcept : st_(st) {}
+
+    detail::ConnState *st_ = nullptr;
+};
+
+namespace detail {
+
+inline ConnState::ConnState(Loop *loop_, SslConn *conn_) noexcept : loop(loop_), conn(conn_)
+{
+    if ((next = loop->conns_) != nullptr)
+        next->prev = this;
+
+    loop->conns_ = this;
+}
+
+inline ConnState::~ConnState()
+{
+    if (prev)
+        prev->next = next;
+    else
+        loop->conns_ = next;
+
+    if (next)
+        next->prev = prev;
+}
+
+// resume the suspended coroutine (the state may be freed by the coroutine)
+inline void resume(std::coroutine_handle<> &waiter) noexcept
+{
+    std::exchange(waiter, nullptr).resume();
+}
+
+// execute the operation in progress: true if completed (result set)
+inline bool connStep(ConnState *st) noexcept
+{
+    SSL *ssl = sslConnSsl(st->conn);
+    int step;
+    switch (st->op) {
+    case OP_READ:
+        step = sslReadStep(ssl, st->buf, st->num);
+        break;
+
+    case OP_WRITE:
+        step = sslWriteStep(ssl, st->buf, st->num);
+        break;
+
+    case OP_SHUTDOWN:
+        // close_notify sent (the one of the peer is not waited)
+        if ((step = sslFuncStep(SSL_shutdown, ssl)) >= SSL_STEP_CLOSED)
+            step = 0;
+
+        break;
+
+    default:
+        return false;
+    }
+
+    if (step == SSL_STEP_WANT_READ || step == SSL_STEP_WANT_WRITE || step == SSL_STEP_WANT_ASYNC) {
+        st->want = step;
+        return false;
+    }
+
+    st->result = step < SSL_STEP_CLOSED ? -1 : step;
+    st->op     = OP_NONE;
+    return true;
+}
+
+// events of a connection: repeat the operation in progress, resume the coroutine when completed
+inline void connCb(SslConn *conn, int event, void *arg)
+{
+    ConnState *st = static_cast<ConnState *>(arg);
+    switch (event) {
+    case SSL_EV_CONNECTED:
+        st->connected = true;
+        if (st->op == OP_CONNECT) {
+            st->op = OP_NONE;
+            resume(st->waiter);
+        }
+
+        break;
+
+    case SSL_EV_CLOSED:
+        // handshake failed: the reactor closes the connection
+        st->conn = nullptr;
+        if (st->op == OP_CONNECT) {
+            st->op = OP_NONE;
+            resume(st->waiter);
+        }
+
+        break;
+
+    default:
+        // only the awaited event (a write edge doesn't make a read progress)
+        if (st->waiter && (st->want == SSL_STEP_WANT_ASYNC ||
+                           (event == SSL_EV_READ) == (st->want == SSL_STEP_WANT_READ)) && connStep(st))
+            resume(st->waiter);
+
+        break;
+    }
+}
+
+// events of the connections accepted by a listening socket: a connection is returned by accept() when connected
+inline void listenCb(SslConn *conn, int event, void *arg)
+{
+    ListenState *ls = static_cast<ListenState *>(arg);
+    if (event != SSL_EV_CONNECTED)
+        return;
+
+    ConnState *st = new (std::nothrow) ConnState(ls->loop, conn);
+    if (st == nullptr) {
+        sslConnClose(conn, false);
+        return;
+    }
+
+    // read-ahead: a record with a single read system call
+    st->connected = true;
+    SSL_set_read_ahead(sslConnSsl(conn), 1);
+    sslConnSetCb(conn, connCb, st);
+    ls->ready.push_back(st);
+    if (ls->waiter)
+        resume(ls->waiter);
+}
+
+inline bool IoAwait::await_ready() noexcept
+{
+    if (st_ == nullptr || st_->conn == nullptr)
+        return true;
+
+    // execute the operation at once (suspend only if it must wait an event)
+    st_->op  = op_;
+    st_->buf = buf_;
+    st_->num = num_;
+    return connStep(st_);
+}
+
+inline bool ConnectAwait::await_ready() noexcept
+{
+    // start the TCP connection (non-blocking)
+    struct sockaddr_in addr = {};
+    int                sock;
+    addr.sin_family = AF_INET;
+    addr.sin_port   = htons(port_);
+    if (inet_pton(AF_INET, host_, &addr.sin_addr) != 1 || (sock = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+        return true;
+
+    if (fcntl(sock, F_SETFL, O_NONBLOCK) < 0 ||
+            (::connect(sock, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) < 0 && errno != EINPROGRESS)) {
+        ::close(sock);
+        return true;
+    }
+
+    // the reactor executes the handshake when the socket is connected
+    if ((st_ = new (std::nothrow) ConnState(&loop_, nullptr)) == nullptr ||
+            (st_->conn = sslReactorAdd(loop_.get(), sock, ctx_, SSL_CLIENT, connCb, st_)) == nullptr) {
+        delete st_;
+        st_ = nullptr;
+        ::close(sock);
+        return true;
+    }
+
+    SSL_set_read_ahead(sslConnSsl(st_->conn), 1);
+    st_->op = OP_CONNECT;
+    return false;
+}
+
+inline Connection ConnectAwait::await_resume() noexcept
+{
+    if (st_ != nullptr && ! st_->connected) {
+        // handshake failed
+        if (st_->conn)
+            sslConnClose(st_->conn, false);
+
+        delete st_;
+        st_ = nullptr;
+    }
+
+    return Connection(st_);
+}
+
+inline Connection AcceptAwait::await_resume() noexcept
+{
+    ConnState *st = ls_->ready.front();
+    ls_->ready.pop_front();
+    return Connection(st);
+}
+
+} // namespace detail
+
+} // namespace myssl
+
+#endif /* MYSSL_HPP */
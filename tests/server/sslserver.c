@@ -17,7 +17,7 @@
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
-#include <arpa/inet.h>
+#include <signal.h>
 #include <openssl/err.h>
 
 int main(int argc, char *argv[])
@@ -30,44 +30,23 @@ int main(int argc, char *argv[])
         return EXIT_FAILURE;
     }
 
-    // create a socket
-    int my_socket;
-    if ((my_socket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0) {
-        // socket() error
-        fprintf(stderr, "%s: could not create socket (%s)\n", argv[0], strerror(errno));
-        return EXIT_FAILURE;
-    }
+    // a write to a disconnected peer must fail with EPIPE, not kill the program: ignore the SIGPIPE
+    signal(SIGPIPE, SIG_IGN);
 
-    // prepare the structure sockaddr_in for this server
-    struct sockaddr_in server;              // (local) server socket info
-    memset(&server, 0, sizeof(server));
-    server.sin_family = AF_INET;            // set address family
-    server.sin_addr.s_addr = INADDR_ANY;    // set server address for any interface
-    server.sin_port = htons(atoi(argv[1])); // set server port number
-
-    // assign an address to the created socket
-    if (bind(my_socket, (struct sockaddr *)&server, sizeof(server)) < 0) {
-        // bind() error
-        fprintf(stderr, "%s: bind failed (%s)", argv[0], strerror(errno));
-        close(my_socket);
-        return EXIT_FAILURE;
-    }
-
-    // start listening with a queue of max BACKLOG connections
-    if (listen(my_socket, BACKLOG) < 0) {
-        // listen() error
+    // create a listening socket tuned for the latency (TCP_NODELAY, Fast Open if enabled by net.ipv4.tcp_fastopen,
+    // TCP_DEFER_ACCEPT)
+    int my_socket;
+    if ((my_socket = sslListen(NULL, atoi(argv[1]), NULL)) < 0) {
+        // sslListen() error
         fprintf(stderr, "%s: listen failed (%s)\n", argv[0], strerror(errno));
-        close(my_socket);
         return EXIT_FAILURE;
     }
 
     // accept connection from an incoming client
     printf("waiting for incoming connections...\n");
-    socklen_t socksize = sizeof(struct sockaddr_in);
-    struct sockaddr_in client;          // (remote) client socket info
     int client_sock;
-    if ((client_sock = accept(my_socket, (struct sockaddr *)&client, &socksize)) < 0) {
-        // accept() error
+    if ((client_sock = sslAccept(my_socket)) < 0) {
+        // sslAccept() error
         fprintf(stderr, "%s: accept failed (%s)\n", argv[0], strerror(errno));
         close(my_socket);
         return EXIT_FAILURE;
@@ -109,37 +88,46 @@ int main(int argc, char *argv[])
     // accept an OpenSSL connection with SSL_accept()
     int rc;
     if ((rc = sslFunc(SSL_accept, ssl)) != 1) {
-        // sslAccept() error
-        fprintf(stderr, "%s: OpenSSL error on sslAccept (%d)\n", argv[0], SSL_get_error(ssl, rc));
+        // SSL_accept() error
+        fprintf(stderr, "%s: OpenSSL error on SSL_accept (%d)\n", argv[0], SSL_get_error(ssl, rc));
         ERR_print_errors_fp(stderr);
         sslClose(ssl, client_sock, ctx, false);
         return EXIT_FAILURE;
     }
 
-    // receiving message loop from the client
-    char client_msg[MYBUFSIZE];
+    // receiving message loop from the client (a frame for each message)
+    SslFrame *frame;
+    if ((frame = sslFrameNew(ssl, MYBUFSIZE)) == NULL) {
+        // sslFrameNew() error
+        fprintf(stderr, "%s: could not create the framer\n", argv[0]);
+        sslClose(ssl, client_sock, ctx, true);
+        return EXIT_FAILURE;
+    }
+
+    const void *client_msg;
+    size_t msg_len;
     int recv_size;
-    while ((recv_size = sslRead(ssl, client_msg, MYBUFSIZE)) > 0 ) {
-        // send answer to client
-        printf("received message from sock %d: %s\n", client_sock, client_msg);
-        char server_msg[MYBUFSIZE + 18];
-        snprintf(server_msg, sizeof(server_msg), "you wrote to me: %s", client_msg);
-        if (sslWrite(ssl, server_msg, strlen(server_msg)) < 0) {
-            // sslWrite() error
-            fprintf(stderr, "%s: send failed (%d)\n", argv[0], SSL_get_error(ssl, recv_size));
+    while ((recv_size = sslFrameRead(frame, &client_msg, &msg_len, SSL_TIMEOUT_INFINITE)) > 0) {
+        // send answer to client (the message is sent from the read buffer, without copies)
+        printf("received message from sock %d: %.*s\n", client_sock, (int)msg_len, (const char *)client_msg);
+        static const char prefix[] = "you wrote to me: ";
+        struct iovec server_msg[2] = { { (void *)prefix, sizeof(prefix) - 1 }, { (void *)client_msg, msg_len } };
+        if (sslFrameWritev(ssl, server_msg, 2) < 0) {
+            // sslFrameWritev() error
+            fprintf(stderr, "%s: send failed (%d)\n", argv[0], sslStatus(ssl));
             ERR_print_errors_fp(stderr);
+            sslFrameFree(frame);
             sslClose(ssl, client_sock, ctx, true);
             return EXIT_FAILURE;
         }
-
-        // clear buffer
-        memset(client_msg, 0, MYBUFSIZE);
     }
 
+    sslFrameFree(frame);
+
     // loop terminated: test why
     if (recv_size < 0) {
-        // sslRead() error
-        fprintf(stderr, "%s: recv failed (%d)\n", argv[0], SSL_get_error(ssl, recv_size));
+        // sslFrameRead() error
+        fprintf(stderr, "%s: recv failed (%d)\n", argv[0], sslStatus(ssl));
         ERR_print_errors_fp(stderr);
         sslClose(ssl, client_sock, ctx, true);
         return EXIT_FAILURE;